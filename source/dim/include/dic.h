@@ -57,6 +57,8 @@ _DIM_PROTOE( int dic_get_server,       (char *name ) );
 _DIM_PROTOE( int dic_get_conn_id,      () );
 _DIM_PROTOE( void dic_stop,      () );
 _DIM_PROTOE( int dic_get_server_pid,       (int *pid ) );
+_DIM_PROTOE( void dic_hold_dns_requests,	() );
+_DIM_PROTOE( void dic_flush_dns_requests,	() );
 
 #ifdef __cplusplus
 #undef __CXX_CONST
@@ -361,6 +361,7 @@ public :
 	int wakeUp;
 	int itsWaiting;
 	int itsConnected;
+	int itsLinkLost;
 	void *itsNolinkBuf;
 	int itsNolinkSize;
 	DimRpcInfo *itsHandler;
@@ -400,6 +401,7 @@ public :
 	virtual ~DimRpcInfo();
 	int getId() {return itsId;};
 	void keepWaiting() {itsWaiting = 2;};
+	int isLinkLost() {return itsLinkLost;};
 	char *getName()  { return itsName; } ;
 	void *getData();
 	int getInt() { return *(int *)getData(); } ;
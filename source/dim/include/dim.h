@@ -204,6 +204,9 @@ typedef enum { NOSWAP, SWAPS, SWAPL, SWAPD} SWAP_TYPE;
 #define	TEST_TIME_VMS		30		/* Interval to test conn.    */
 #define	TEST_WRITE_TAG		25		/* DTQ tag for test writes   */
 #define	WRITE_TMOUT			5		/* Interval to wait while writing.    */
+#define	WRITE_QUEUE_LIMIT	(32*1024*1024)	/* Max bytes queued per connection */
+#define	RCV_RING_SIZE		16384		/* Receive buffer per connection */
+#define	MAX_IO_THREADS		16		/* Max number of IO threads  */
 
 #define	OPN_MAGIC		0xc0dec0de	/* Magic value 1st packet    */
 #define	HDR_MAGIC		0xfeadfead	/* Magic value in header     */
@@ -302,6 +305,15 @@ typedef struct{
 	SERVICE_REQ service;
 } DIC_DNS_PACKET;
 
+#define DIC_DNS_HEADER		8
+
+/* Several requests can be sent in one packet (up to MAX_SERVICE_UNIT), the
+   name server then answers them in one packet of DNS_DIC_PACKETs. Clients
+   request DIC_DNS_PROBE_NAME with service id 0 on each new connection: a name
+   server taking several requests per packet answers with a task name, older
+   ones answer that the service does not exist */
+#define DIC_DNS_PROBE_NAME	"DIS_DNS/MULTI_REQUEST"
+
 /* Packet sent by the name_server to the client */
 typedef struct {
 	int size;
@@ -370,11 +382,13 @@ typedef struct {
 typedef struct timer_entry{
 	struct timer_entry *next;
 	struct timer_entry *prev;
-	struct timer_entry *next_done;
+	struct timer_entry *next_tag;
 	int time;
-	int time_left;
+	int queue_id;
+	int heap_index;
 	void (*user_routine)();
 	dim_long tag;
+	longlong expires;
 } TIMR_ENT;
 
 typedef struct {
@@ -412,6 +426,20 @@ typedef struct {
 	int write_timedout;
 	TIMR_ENT *timr_ent;
 	time_t last_used;
+	struct tcpip_wentry *write_head;
+	struct tcpip_wentry *write_tail;
+	int write_bytes;
+	int write_entries;
+	int write_peak;
+	int write_limit;
+	int write_policy;
+	int write_drops;
+	char *rcv_ring;
+	int rcv_start;
+	int rcv_end;
+	int reactor;
+	int write_gen;
+	int write_failed;
 } NET_CONNECTION;
  
 extern DllExp DIM_NOSHARE NET_CONNECTION *Net_conns;
@@ -442,12 +470,27 @@ typedef struct {
 	TIMR_ENT *timr_ent;
 	int already;
 	char long_task_name[MAX_NAME];
+	int listed;
+	int provisional;
 } DNS_CONNECTION;
 
 extern DllExp DIM_NOSHARE DNS_CONNECTION *Dns_conns;
 
 extern DllExp DIM_NOSHARE int Curr_N_Conns;
 
+/* Open addressing name table, see hash.c */
+typedef struct {
+	unsigned int hash;
+	void *item;
+} NAME_SLOT;
+
+typedef struct {
+	NAME_SLOT *slots;
+	int size;
+	int n_items;
+	int name_offset;
+} NAME_TABLE;
+
 /* Client definitions needed by dim_jni.c (from H.Essel GSI) */
 typedef enum {
 	NOT_PENDING, WAITING_DNS_UP, WAITING_DNS_ANSWER, WAITING_SERVER_UP,
@@ -475,10 +518,12 @@ typedef struct dic_serv {
 	int conn_id;
 	PENDING_STATES pending;
 	int tmout_done;
+	void *cb_owner;
 	int stamped;
 	int time_stamp[2];
 	int quality;
     int tid;
+	NAME_TABLE *name_table;
 } DIC_SERVICE;
 
 /* PROTOTYPES */
@@ -491,9 +536,12 @@ extern "C" {
 
 /* DNA */
 _DIM_PROTOE( int dna_start_read,    (int conn_id, int size) );
+_DIM_PROTOE( int dna_unlock_callback, (void *data, void **handle) );
+_DIM_PROTOE( void dna_lock_callback, (void *handle) );
 _DIM_PROTOE( void dna_test_write,   (int conn_id) );
 _DIM_PROTOE( int dna_write,         (int conn_id, __CXX_CONST void *buffer, int size) );
 _DIM_PROTOE( int dna_write_nowait,  (int conn_id, __CXX_CONST void *buffer, int size) );
+_DIM_PROTOE( int dna_write_nowait_tag, (int conn_id, __CXX_CONST void *buffer, int size, int tag) );
 _DIM_PROTOE( int dna_open_server,   (__CXX_CONST char *task, void (*read_ast)(), int *protocol,
 				int *port, void (*error_ast)()) );
 _DIM_PROTOE( int dna_get_node_task, (int conn_id, char *node, char *task) );
@@ -504,6 +552,28 @@ _DIM_PROTOE( void dna_report_error, (int conn_id, int code, char *routine_name)
 
 
 /* TCPIP */
+#define TCPIP_MAX_IOVEC		8
+
+typedef struct {
+	char *buffer;
+	int size;
+} TCPIP_IOVEC;
+
+/* A write error seen under the write lock of a connection, it is reported
+   (with the user error handler) once the lock is released */
+typedef struct {
+	int what;
+	int error;
+} TCPIP_WRITE_ERROR;
+
+/* Data written to several connections without being copied: the write
+   queues hold a reference on it, release is called when the last
+   reference is dropped */
+typedef struct tcpip_shared {
+	int refs;
+	void (*release)(struct tcpip_shared *sharedp);
+} TCPIP_SHARED;
+
 _DIM_PROTOE( int tcpip_open_client,     (int conn_id, char *node, char *task,
                                     int port) );
 _DIM_PROTOE( int tcpip_open_server,     (int conn_id, char *task, int *port) );
@@ -512,11 +582,33 @@ _DIM_PROTOE( int tcpip_start_read,      (int conn_id, char *buffer, int size,
                                     void (*ast_routine)()) );
 _DIM_PROTOE( int tcpip_start_listen,    (int conn_id, void (*ast_routine)()) );
 _DIM_PROTOE( int tcpip_write,           (int conn_id, char *buffer, int size) );
+_DIM_PROTOE( int tcpip_write_nowait,    (int conn_id, char *buffer, int size) );
+_DIM_PROTOE( int tcpip_writev_nowait,   (int conn_id, TCPIP_IOVEC *iov, int n_iov) );
+_DIM_PROTOE( int tcpip_writev_queued,   (int conn_id, TCPIP_IOVEC *iov, int n_iov, int tag) );
+_DIM_PROTOE( int tcpip_writev_gen,      (int conn_id, int gen, TCPIP_IOVEC *iov, int n_iov,
+                                    int tag, TCPIP_WRITE_ERROR *errp) );
+_DIM_PROTOE( int tcpip_writev_shared,   (int conn_id, int gen, TCPIP_IOVEC *iov, int n_iov,
+                                    int tag, TCPIP_SHARED *sharedp, TCPIP_WRITE_ERROR *errp) );
+_DIM_PROTOE( void tcpip_shared_hold,    (TCPIP_SHARED *sharedp) );
+_DIM_PROTOE( void tcpip_shared_release, (TCPIP_SHARED *sharedp) );
+_DIM_PROTOE( void tcpip_report_write_error, (int conn_id, TCPIP_WRITE_ERROR *errp) );
+_DIM_PROTOE( int tcpip_unlocked_writes, (void) );
 _DIM_PROTOE( void tcpip_get_node_task,  (int conn_id, char *node, char *task) );
 _DIM_PROTOE( int tcpip_close,           (int conn_id) );
+_DIM_PROTOE( void tcpip_lock_reactors,  (void) );
+_DIM_PROTOE( void tcpip_unlock_reactors, (void) );
+_DIM_PROTOE( void tcpip_lock_writes,    (void) );
+_DIM_PROTOE( void tcpip_unlock_writes,  (void) );
+_DIM_PROTOE( void tcpip_reactor_task,   (int r) );
 _DIM_PROTOE( int tcpip_failure,         (int code) );
 _DIM_PROTOE( void tcpip_report_error,   (int code) );
 
+_DIM_PROTOE( int dna_write_nowait_gen, (int conn_id, int gen, void *header, int header_size,
+				void *buffer, int size, int tag, TCPIP_WRITE_ERROR *errp) );
+_DIM_PROTOE( int dna_write_nowait_shared, (int conn_id, int gen, void *header, int header_size,
+				void *buffer, int size, TCPIP_SHARED *sharedp, void *data, int data_size,
+				int tag, TCPIP_WRITE_ERROR *errp) );
+
 
 /* DTQ */
 _DIM_PROTOE( int dtq_create,          (void) );
@@ -544,7 +636,9 @@ _DIM_PROTOE( int conn_get,         (void) );
 _DIM_PROTOE( void conn_free,       (int conn_id) );
 _DIM_PROTOE( void *arr_increase,   (void *conn_ptr, int conn_size, int n_conns) );
 _DIM_PROTOE( void id_arr_create,   () );
-_DIM_PROTOE( void *id_arr_increase,(void *id_ptr, int id_size, int n_ids) );
+_DIM_PROTOE( int dim_lock_depth,   (void) );
+_DIM_PROTOE( void dim_wait_callbacks, (void) );
+_DIM_PROTOE( void dim_callback_done, (void) );
 
 _DIM_PROTOE( void dll_init,         ( DLL *head ) );
 _DIM_PROTOE( void dll_insert_queue, ( DLL *head, DLL *item ) );
@@ -554,6 +648,11 @@ _DIM_PROTOE( DLL *dll_get_next,     ( DLL *head, DLL *item ) );
 _DIM_PROTOE( DLL *dll_get_prev,     ( DLL *head, DLL *item ) );
 _DIM_PROTOE( int dll_empty,         ( DLL *head ) );
 _DIM_PROTOE( void dll_remove,       ( DLL *item ) );
+_DIM_PROTOE( void dll_insert_queue_unlocked, ( DLL *head, DLL *item ) );
+_DIM_PROTOE( void dll_insert_after_unlocked, ( DLL *after, DLL *item ) );
+_DIM_PROTOE( DLL *dll_get_next_unlocked,     ( DLL *head, DLL *item ) );
+_DIM_PROTOE( int dll_empty_unlocked,         ( DLL *head ) );
+_DIM_PROTOE( void dll_remove_unlocked,       ( DLL *item ) );
 
 _DIM_PROTOE( void sll_init,               ( SLL *head ) );
 _DIM_PROTOE( int sll_insert_queue,        ( SLL *head, SLL *item ) );
@@ -566,11 +665,19 @@ _DIM_PROTOE( SLL *sll_search_next_remove, ( SLL *item, int offset, char *data, i
 _DIM_PROTOE( SLL *sll_get_head, 		  ( SLL *head ) );
 
 _DIM_PROTOE( int HashFunction,         ( char *name, int max ) );
+_DIM_PROTOE( unsigned int name_hash,   ( char *name ) );
+_DIM_PROTOE( void name_table_init,     ( NAME_TABLE *table, int name_offset ) );
+_DIM_PROTOE( void name_table_free,     ( NAME_TABLE *table ) );
+_DIM_PROTOE( void name_table_insert,   ( NAME_TABLE *table, void *item ) );
+_DIM_PROTOE( int name_table_remove,    ( NAME_TABLE *table, void *item ) );
+_DIM_PROTOE( void *name_table_find,    ( NAME_TABLE *table, char *name ) );
+_DIM_PROTOE( void *name_table_next,    ( NAME_TABLE *table, int *index ) );
 
 _DIM_PROTOE( int copy_swap_buffer_out, (int format, FORMAT_STR *format_data, 
 					void *buff_out, void *buff_in, int size) );
 _DIM_PROTOE( int copy_swap_buffer_in, (FORMAT_STR *format_data, void *buff_out, 
 					void *buff_in, int size) );
+_DIM_PROTOE( int copy_swap_raw_format, (FORMAT_STR *format_data) );
 _DIM_PROTOE( int get_node_name, (char *node_name) );
 
 _DIM_PROTOE( int get_dns_port_number, () );
@@ -8,7 +8,7 @@
 class DimCore
 {
 public:
-	static int inCallback;
+	static DIM_THREAD_LOCAL int inCallback;
 };
 
 class DllExp DimErrorHandler{
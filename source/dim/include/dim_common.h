@@ -181,6 +181,43 @@ _DIM_PROTOE( void dim_signal_cond,	() );
 #define ENABLE_AST      sigmask(DEC_LEVEL);
 #endif
 
+/* Per thread storage, for the state of the callback a thread delivers
+   (several IO threads deliver callbacks at the same time) */
+#ifndef DIM_THREAD_LOCAL
+#if defined(WIN32)
+#define DIM_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__) && !defined(NOTHREADS)
+#define DIM_THREAD_LOCAL __thread
+#else
+#define DIM_THREAD_LOCAL
+#endif
+#endif
+
+/* Outbound queue of a connection, used when the peer does not read fast enough */
+#define DIM_WQ_DROP_OLDEST	0	/* on overflow drop queued updates of the same service */
+#define DIM_WQ_DISCONNECT	1	/* on overflow disconnect the peer */
+
+typedef struct {
+	int bytes;			/* bytes currently queued */
+	int entries;		/* messages currently queued */
+	int peak_bytes;		/* maximum bytes ever queued */
+	int limit;			/* maximum bytes allowed in the queue */
+	int policy;			/* overflow policy */
+	int drops;			/* messages dropped on overflow */
+} DIM_WRITE_QUEUE_INFO;
+
+/* Text feed of the name server directory. Each update starts with a line
+   "S<seq>" for a snapshot of the whole directory (sent on subscription) or
+   "D<seq>" for the changes following update <seq>-1, then one line per change:
+	+<task>@<node>|<pid>			server registered, or back from error
+	!<task>@<node>					server in error
+	?<task>@<node>					server known from a DNS snapshot, not connected again yet
+	-<task>@<node>					server gone, with all its services
+	><task>@<node>|<name>|<format>|<type>	service registered, type "" or "CMD"
+	<<task>@<node>|<name>			service unregistered
+   A client seeing a sequence gap has missed changes and must subscribe again */
+#define DNS_DIRECTORY_CHANGES	"DIS_DNS/DIRECTORY_CHANGES"
+
 #ifdef __cplusplus
 extern "C" {
 #define __CXX_CONST const
@@ -209,8 +246,17 @@ _DIM_PROTOE( void dim_print_msg,		(__CXX_CONST char *msg, int severity) );
 _DIM_PROTOE( void dim_print_date_time,		() );
 _DIM_PROTOE( void dim_set_write_timeout,		(int secs) );
 _DIM_PROTOE( int dim_get_write_timeout,		() );
+_DIM_PROTOE( void dim_set_write_queue_limit,	(int bytes) );
+_DIM_PROTOE( int dim_get_write_queue_limit,	() );
+_DIM_PROTOE( void dim_set_write_queue_policy,	(int policy) );
+_DIM_PROTOE( int dim_get_write_queue_policy,	() );
+_DIM_PROTOE( int dim_set_conn_write_queue,	(int conn_id, int bytes, int policy) );
+_DIM_PROTOE( int dim_get_conn_write_queue_info,	(int conn_id, DIM_WRITE_QUEUE_INFO *info) );
 _DIM_PROTOE( void dim_usleep,	(unsigned int t) );
 _DIM_PROTOE( int dim_wait,		(void) );
+_DIM_PROTOE( int dim_in_dim_thread,	(void) );
+_DIM_PROTOE( void dim_wait_flag,	(int *flag) );
+_DIM_PROTOE( void dim_signal_flag,	(int *flag) );
 _DIM_PROTOE( int dim_get_priority,		(int dim_thread, int prio) );
 _DIM_PROTOE( int dim_set_priority,		(int dim_thread, int *prio) );
 _DIM_PROTOE( int dim_set_scheduler_class,		(int sched_class) );
@@ -233,12 +279,16 @@ _DIM_PROTOE( int dim_set_write_buffer_size,		(int bytes) );
 _DIM_PROTOE( int dim_get_write_buffer_size,		() );
 _DIM_PROTOE( int dim_set_read_buffer_size,		(int bytes) );
 _DIM_PROTOE( int dim_get_read_buffer_size,		() );
+_DIM_PROTOE( int dim_set_io_threads,		(int n) );
+_DIM_PROTOE( int dim_get_io_threads,		() );
 _DIM_PROTOE( void dis_set_debug_on,		() );
 _DIM_PROTOE( void dis_set_debug_off,	() );
 _DIM_PROTOE( void dim_set_keepalive_timeout,		(int secs) );
 _DIM_PROTOE( int dim_get_keepalive_timeout,		() );
 _DIM_PROTOE( void dim_set_listen_backlog,		(int size) );
 _DIM_PROTOE( int dim_get_listen_backlog,		() );
+_DIM_PROTOE( void *dim_retain_data,		(void *data) );
+_DIM_PROTOE( void dim_release_data,		(void *handle) );
 
 #ifdef WIN32
 #define getpid _getpid
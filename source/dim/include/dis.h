@@ -56,6 +56,11 @@ _DIM_PROTOE( int dis_set_timestamp,     (unsigned service_id,
 					int secs, int millisecs) );
 _DIM_PROTOE( int dis_selective_update_service,   (unsigned service_id, 
 					int *client_id_list) );
+_DIM_PROTOE( int dis_update_service_loan,   (unsigned service_id, 
+					int *client_id_list, void *buffer, int size,
+					void (*release)(void *), void *arg) );
+_DIM_PROTOE( int dis_update_service_copy,   (unsigned service_id, 
+					int *client_id_list, void *buffer, int size) );
 _DIM_PROTOE( void dis_disable_padding,      		() );
 _DIM_PROTOE( int dis_get_timeout,      		(unsigned service_id, int client_id) );
 _DIM_PROTOE( char *dis_get_error_services,	() );
@@ -70,6 +75,8 @@ _DIM_PROTOE( unsigned dis_add_cmnd_dns,		(dim_long dns_id, __CXX_CONST char *ser
 _DIM_PROTOE( int dis_get_n_clients,	(unsigned service_id) );
 _DIM_PROTOE( int dis_get_timestamp,     (unsigned service_id, 
 					int *secs, int *millisecs) );
+_DIM_PROTOE( void dis_hold_dns_updates,	() );
+_DIM_PROTOE( void dis_flush_dns_updates,	() );
 #ifdef __cplusplus
 #undef __CXX_CONST
 }
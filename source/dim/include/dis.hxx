@@ -201,6 +201,12 @@ public :
 	int selectiveUpdateService( char *string, int *cids );
 	
 	int selectiveUpdateService( void *structure, int size, int *cids );
+	// Update with data loaned until release(arg) is called, to all clients if cids is 0
+	int loanUpdateService( void *structure, int size, int *cids,
+		void (*release)(void *), void *arg );
+	// Update with a copy of the data, to all clients if cids is 0. Does not
+	// call serviceHandler() and does not change the data of the service
+	int copyUpdateService( void *structure, int size, int *cids = 0 );
 	
 	void setQuality(int quality);
 	void setTimestamp(int secs, int millisecs);
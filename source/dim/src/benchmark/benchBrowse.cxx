@@ -0,0 +1,88 @@
+#include <iostream>
+using namespace std;
+#include <dis.hxx>
+#include <dic.hxx>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+/*
+ * Measures wildcard browsing (DimBrowser::getServices) on a DNS knowing
+ * many services. The services are published by this process as
+ * BENCH/Folder_<f>/Histogram_<h>, the patterns select one folder, one
+ * histogram name in all folders or the whole directory.
+ *
+ * Usage: benchBrowse [services] [folders] [browses]
+ */
+
+static double now()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, 0);
+	return tv.tv_sec*1e6 + tv.tv_usec;
+}
+
+static void browse(const char *pattern, int nBrowses)
+{
+	DimBrowser br;
+	char *name, *format;
+	int i, n = 0;
+	double t0, t1;
+
+	t0 = now();
+	for(i = 0; i < nBrowses; i++)
+	{
+		br.getServices(pattern);
+		n = 0;
+		while(br.getNextService(name, format))
+			n++;
+	}
+	t1 = now();
+	cout << pattern << "\t" << n << " services\t" << (t1 - t0)/1000/nBrowses << " ms/browse" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+	int nServices = 100000, nFolders = 100, nBrowses = 20;
+	int i, value = 0;
+	char name[128];
+	DimService **services;
+
+	if(argc > 1)
+		sscanf(argv[1], "%d", &nServices);
+	if(argc > 2)
+		sscanf(argv[2], "%d", &nFolders);
+	if(argc > 3)
+		sscanf(argv[3], "%d", &nBrowses);
+
+	services = new DimService *[nServices];
+	for(i = 0; i < nServices; i++)
+	{
+		sprintf(name, "BENCH/Folder_%d/Histogram_%d", i % nFolders, i / nFolders);
+		services[i] = new DimService(name, value);
+	}
+	DimServer::start("BENCH_BROWSE");
+	/* Wait for the DNS to know them all */
+	sprintf(name, "BENCH/Folder_%d/Histogram_%d", (nServices - 1) % nFolders,
+		(nServices - 1) / nFolders);
+	while(1)
+	{
+		DimBrowser br;
+
+		if(br.getServices(name))
+			break;
+		usleep(100000);
+	}
+	cout << nServices << " services in " << nFolders << " folders" << endl;
+
+	browse("BENCH/Folder_7/*", nBrowses);
+	browse("BENCH/Folder_7*", nBrowses);
+	browse("*/Histogram_7", nBrowses);
+	browse("BENCH/Folder_7/Histogram_7", nBrowses);
+	browse("*/VERSION_NUMBER", nBrowses);
+	browse("*", nBrowses / 10 + 1);
+	return 1;
+}
@@ -0,0 +1,173 @@
+#include <iostream>
+using namespace std;
+#include <dis.hxx>
+#include <dic.hxx>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+/*
+ * Measures what a directory browser receives from the DNS while many
+ * servers start and stop (as during a run transition), following:
+ * - DIS_DNS/SERVER_INFO, the whole service list of the server at each change
+ *   (as DID and webDid do),
+ * - DIS_DNS/SERVER_LIST, only the server names,
+ * - DIS_DNS/DIRECTORY_CHANGES, the added and removed servers and services.
+ * The servers are child processes publishing DIRB_<s>/Service_<n>. A second
+ * browser then subscribes, with all the servers running.
+ *
+ * Usage: benchDirectory [servers] [services]
+ */
+
+static double now()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, 0);
+	return tv.tv_sec*1e6 + tv.tv_usec;
+}
+
+static double lastUpdate = 0;
+
+class Counter : public DimInfo
+{
+public:
+	int nUpdates;
+	double nBytes;
+	int nServers;
+
+	Counter(const char *name) : DimInfo(name, (void *)0, 0),
+		nUpdates(0), nBytes(0), nServers(0) {}
+	void reset() { nUpdates = 0; nBytes = 0; }
+	void infoHandler()
+	{
+		char *data = (char *)getData(), *line;
+
+		nUpdates++;
+		nBytes += getSize();
+		lastUpdate = now();
+		if(strcmp(getName(), "DIS_DNS/DIRECTORY_CHANGES") || !data)
+			return;
+		/* Count the benchmark servers running */
+		if(data[0] == 'S')
+			nServers = 0;
+		for(line = data; line; line = strchr(line, '\n'))
+		{
+			if(*line == '\n')
+				line++;
+			if(!strncmp(line, "+DIRB_", 6))
+				nServers++;
+			else if(!strncmp(line, "-DIRB_", 6))
+				nServers--;
+		}
+	}
+};
+
+static void serve(const char *name, int nServices)
+{
+	char sname[128];
+	int i, value = 0;
+
+	for(i = 0; i < nServices; i++)
+	{
+		sprintf(sname, "%s/Service_%d", name, i);
+		new DimService(sname, value);
+	}
+	DimServer::start(name);
+	while(1)
+		pause();
+}
+
+static void waitQuiet(Counter *feed, int nServers)
+{
+	while((feed->nServers != nServers) || (now() - lastUpdate < 500000))
+		usleep(10000);
+}
+
+static void report(const char *phase, Counter **counters, double t0)
+{
+	int i;
+
+	cout << phase << "\t(" << (lastUpdate - t0)/1000 << " ms)" << endl;
+	for(i = 0; i < 3; i++)
+	{
+		cout << "\t" << counters[i]->getName() << "\t" << counters[i]->nUpdates
+			<< " updates\t" << counters[i]->nBytes/1024 << " kB" << endl;
+		counters[i]->reset();
+	}
+}
+
+static Counter **subscribe()
+{
+	Counter **counters = new Counter *[3];
+
+	counters[0] = new Counter("DIS_DNS/SERVER_INFO");
+	counters[1] = new Counter("DIS_DNS/SERVER_LIST");
+	counters[2] = new Counter("DIS_DNS/DIRECTORY_CHANGES");
+	return counters;
+}
+
+int main(int argc, char *argv[])
+{
+	int nServers = 100, nServices = 20;
+	int i;
+	pid_t *pids;
+	char name[64], count[16];
+	Counter **counters, **newCounters;
+	double t0;
+
+	if((argc > 3) && !strcmp(argv[1], "serve"))
+	{
+		serve(argv[2], atoi(argv[3]));
+		return 0;
+	}
+	if(argc > 1)
+		sscanf(argv[1], "%d", &nServers);
+	if(argc > 2)
+		sscanf(argv[2], "%d", &nServices);
+
+	counters = subscribe();
+	sleep(1);
+	waitQuiet(counters[2], 0);
+	for(i = 0; i < 3; i++)
+		counters[i]->reset();
+	cout << nServers << " servers of " << nServices << " services" << endl;
+
+	pids = new pid_t[nServers];
+	sprintf(count, "%d", nServices);
+	t0 = now();
+	for(i = 0; i < nServers; i++)
+	{
+		sprintf(name, "DIRB_%d", i);
+		if(!(pids[i] = fork()))
+		{
+			execl(argv[0], argv[0], "serve", name, count, (char *)0);
+			_exit(1);
+		}
+	}
+	waitQuiet(counters[2], nServers);
+	report("start", counters, t0);
+
+	t0 = now();
+	newCounters = subscribe();
+	waitQuiet(newCounters[2], nServers);
+	report("subscribe, first browser", counters, t0);
+	report("subscribe, second browser", newCounters, t0);
+
+	t0 = now();
+	for(i = 0; i < nServers; i++)
+	{
+		kill(pids[i], SIGKILL);
+		waitpid(pids[i], 0, 0);
+	}
+	waitQuiet(counters[2], 0);
+	report("stop", counters, t0);
+	for(i = 0; i < 3; i++)
+		delete newCounters[i];
+	delete[] pids;
+	return 1;
+}
@@ -0,0 +1,204 @@
+#include <iostream>
+using namespace std;
+#include <dis.hxx>
+#include <dic.hxx>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+/*
+ * Measures the service lookups answered by the DNS while other processes
+ * load it with registrations and browses:
+ * - a server publishes DNSL/Folder_<f>/Service_<n>,
+ * - registrars keep adding and removing services DNSL_REG_<r>/Service_<n>,
+ * - browsers keep browsing the services of a folder, DNSL/Folder_<f>/
+ *   followed by a '*'.
+ * The lookups are ONCE_ONLY requests of all the DNSL services at once, sent
+ * in rounds, first with the DNS idle then under load. Run it against a DNS
+ * started with DIM_DNS_READ_THREADS=0 (everything in the DNS thread) and
+ * with the default reader threads.
+ *
+ * Usage: benchDnsLoad [services] [registrars] [browsers] [seconds]
+ */
+
+static double now()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, 0);
+	return tv.tv_sec*1e6 + tv.tv_usec;
+}
+
+static void serve(int nServices)
+{
+	char name[128];
+	int i, value = 0;
+
+	for(i = 0; i < nServices; i++)
+	{
+		sprintf(name, "DNSL/Folder_%d/Service_%d", i % 100, i);
+		new DimService(name, value);
+	}
+	DimServer::start("DNSL");
+	while(1)
+		pause();
+}
+
+static void registrar(const char *serverName, double seconds)
+{
+	DimService *services[50];
+	char name[128];
+	int i, value = 0, nCycles = 0, nNames = 0;
+	double t0;
+
+	DimServer::start(serverName);
+	t0 = now();
+	while(now() - t0 < seconds*1e6)
+	{
+		for(i = 0; i < 50; i++)
+		{
+			sprintf(name, "%s/Service_%d", serverName, nNames++);
+			services[i] = new DimService(name, value);
+		}
+		usleep(10000);
+		for(i = 0; i < 50; i++)
+			delete services[i];
+		nCycles++;
+	}
+	cout << serverName << "\t" << nCycles*100/seconds << " registrations/s" << endl;
+}
+
+static void browser(const char *id, double seconds)
+{
+	DimBrowser br;
+	char *name, *format, pattern[64];
+	int nBrowses = 0;
+	double t0;
+
+	t0 = now();
+	while(now() - t0 < seconds*1e6)
+	{
+		sprintf(pattern, "DNSL/Folder_%d/*", nBrowses % 100);
+		br.getServices(pattern);
+		while(br.getNextService(name, format))
+			;
+		nBrowses++;
+	}
+	cout << "browser " << id << "\t" << nBrowses/seconds << " browses/s" << endl;
+}
+
+static volatile int received = 0;
+
+static void lookedUp(void *tag, void *buffer, int *size)
+{
+	if(tag || buffer || size)
+		__sync_fetch_and_add(&received, 1);
+}
+
+static void lookup(const char *phase, int nServices, double seconds)
+{
+	char name[128];
+	int i, nRounds = 0;
+	double t0, t1, round, worst = 0;
+
+	t0 = now();
+	while(now() - t0 < seconds*1e6)
+	{
+		received = 0;
+		round = now();
+		for(i = 0; i < nServices; i++)
+		{
+			sprintf(name, "DNSL/Folder_%d/Service_%d", i % 100, i);
+			dic_info_service(name, ONCE_ONLY, 0, 0, 0, lookedUp, 0, 0, 0);
+		}
+		while(received < nServices)
+			usleep(100);
+		round = now() - round;
+		if(round > worst)
+			worst = round;
+		nRounds++;
+	}
+	t1 = now();
+	cout << phase << "\t" << (double)nRounds*nServices/((t1 - t0)/1e6) << " lookups/s\t"
+		<< (t1 - t0)/1000/nRounds << " ms/round (worst " << worst/1000 << ")" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+	int nServices = 2000, nRegistrars = 4, nBrowsers = 4, seconds = 10;
+	int i, nChildren;
+	pid_t server, *pids;
+	char name[64], arg[16];
+
+	if((argc > 2) && !strcmp(argv[1], "serve"))
+	{
+		serve(atoi(argv[2]));
+		return 0;
+	}
+	if((argc > 3) && !strcmp(argv[1], "register"))
+	{
+		registrar(argv[2], atof(argv[3]));
+		return 0;
+	}
+	if((argc > 3) && !strcmp(argv[1], "browse"))
+	{
+		browser(argv[2], atof(argv[3]));
+		return 0;
+	}
+	if(argc > 1)
+		sscanf(argv[1], "%d", &nServices);
+	if(argc > 2)
+		sscanf(argv[2], "%d", &nRegistrars);
+	if(argc > 3)
+		sscanf(argv[3], "%d", &nBrowsers);
+	if(argc > 4)
+		sscanf(argv[4], "%d", &seconds);
+
+	sprintf(arg, "%d", nServices);
+	if(!(server = fork()))
+	{
+		execl(argv[0], argv[0], "serve", arg, (char *)0);
+		_exit(1);
+	}
+	/* Wait for the DNS to know them all */
+	sprintf(name, "DNSL/Folder_%d/Service_%d", (nServices - 1) % 100, nServices - 1);
+	while(1)
+	{
+		DimBrowser br;
+
+		if(br.getServices(name))
+			break;
+		usleep(100000);
+	}
+	cout << nServices << " services, " << nRegistrars << " registrars, "
+		<< nBrowsers << " browsers" << endl;
+	lookup("idle", nServices, seconds/2.0);
+
+	nChildren = nRegistrars + nBrowsers;
+	pids = new pid_t[nChildren];
+	sprintf(arg, "%d", seconds);
+	for(i = 0; i < nChildren; i++)
+	{
+		if(i < nRegistrars)
+			sprintf(name, "DNSL_REG_%d", i);
+		else
+			sprintf(name, "%d", i - nRegistrars);
+		if(!(pids[i] = fork()))
+		{
+			execl(argv[0], argv[0], (i < nRegistrars) ? "register" : "browse", name, arg, (char *)0);
+			_exit(1);
+		}
+	}
+	sleep(1);
+	lookup("loaded", nServices, seconds - 2);
+	for(i = 0; i < nChildren; i++)
+		waitpid(pids[i], 0, 0);
+	kill(server, SIGKILL);
+	waitpid(server, 0, 0);
+	delete[] pids;
+	return 1;
+}
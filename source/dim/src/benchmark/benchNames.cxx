@@ -0,0 +1,137 @@
+#include <iostream>
+using namespace std;
+#include <dim.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/time.h>
+
+/*
+ * Compares service name lookups in the name tables (open addressing, see
+ * hash.c) with the chained hash tables used before (DLL buckets indexed by
+ * HashFunction, 25000 of them as in the DNS). Names look like the ones of
+ * a DQM system: <server>/<folder>/<histogram>.
+ *
+ * Usage: benchNames [names] [lookups]
+ */
+
+#define CHAINED_ENTRIES 25000
+
+typedef struct item {
+	struct item *next;
+	struct item *prev;
+	char name[MAX_NAME];
+} ITEM;
+
+static double now()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, 0);
+	return tv.tv_sec*1e6 + tv.tv_usec;
+}
+
+static void report(const char *what, int n, double t0, double t1)
+{
+	cout << what << "\t" << (t1 - t0)*1000/n << " ns/op" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+	int nNames = 1000000, nLookups = 2000000;
+	int i, found, index;
+	ITEM *items, **chained, *itemp;
+	NAME_TABLE table;
+	char name[MAX_NAME];
+	double t0, t1;
+
+	if(argc > 1)
+		sscanf(argv[1], "%d", &nNames);
+	if(argc > 2)
+		sscanf(argv[2], "%d", &nLookups);
+
+	items = new ITEM[nNames];
+	for(i = 0; i < nNames; i++)
+		sprintf(items[i].name, "DQM_SERVER_%03d/Folder_%02d/Histogram_%d",
+			i % 200, (i / 200) % 50, i);
+	cout << nNames << " names, " << nLookups << " lookups" << endl;
+
+	chained = new ITEM *[CHAINED_ENTRIES];
+	for(i = 0; i < CHAINED_ENTRIES; i++)
+	{
+		chained[i] = new ITEM;
+		dll_init((DLL *)chained[i]);
+	}
+	t0 = now();
+	for(i = 0; i < nNames; i++)
+		dll_insert_queue((DLL *)chained[HashFunction(items[i].name, CHAINED_ENTRIES)],
+			(DLL *)&items[i]);
+	t1 = now();
+	report("chained insert", nNames, t0, t1);
+	found = 0;
+	t0 = now();
+	for(i = 0; i < nLookups; i++)
+	{
+		itemp = &items[((unsigned)i * 7919u) % (unsigned)nNames];
+		if(dll_search((DLL *)chained[HashFunction(itemp->name, CHAINED_ENTRIES)],
+			itemp->name, (int)strlen(itemp->name) + 1))
+			found++;
+	}
+	t1 = now();
+	report("chained hit", nLookups, t0, t1);
+	t0 = now();
+	for(i = 0; i < nLookups / 10; i++)
+	{
+		sprintf(name, "DQM_SERVER_%03d/Missing_%d", i % 200, i);
+		if(dll_search((DLL *)chained[HashFunction(name, CHAINED_ENTRIES)],
+			name, (int)strlen(name) + 1))
+			found++;
+	}
+	t1 = now();
+	report("chained miss", nLookups / 10, t0, t1);
+	if(found != nLookups)
+		cout << "chained found " << found << endl;
+
+	name_table_init(&table, (int)offsetof(ITEM, name));
+	t0 = now();
+	for(i = 0; i < nNames; i++)
+		name_table_insert(&table, &items[i]);
+	t1 = now();
+	report("table insert", nNames, t0, t1);
+	found = 0;
+	t0 = now();
+	for(i = 0; i < nLookups; i++)
+	{
+		itemp = &items[((unsigned)i * 7919u) % (unsigned)nNames];
+		if(name_table_find(&table, itemp->name) == itemp)
+			found++;
+	}
+	t1 = now();
+	report("table hit", nLookups, t0, t1);
+	t0 = now();
+	for(i = 0; i < nLookups / 10; i++)
+	{
+		sprintf(name, "DQM_SERVER_%03d/Missing_%d", i % 200, i);
+		if(name_table_find(&table, name))
+			found++;
+	}
+	t1 = now();
+	report("table miss", nLookups / 10, t0, t1);
+	t0 = now();
+	for(i = 0; i < nNames; i += 2)
+		name_table_remove(&table, &items[i]);
+	t1 = now();
+	report("table remove", nNames / 2, t0, t1);
+	for(i = 1; i < nNames; i += 2)
+	{
+		if(name_table_find(&table, items[i].name) != &items[i])
+			found--;
+	}
+	index = -1;
+	for(i = 0; name_table_next(&table, &index); i++)
+		;
+	if((found != nLookups) || (i != nNames / 2))
+		cout << "table found " << found << ", " << i << " left" << endl;
+	return 1;
+}
@@ -0,0 +1,132 @@
+#include <iostream>
+using namespace std;
+#include <dis.hxx>
+#include <dic.hxx>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+/*
+ * Measures how service updates scale with the number of publishing
+ * threads: each thread updates its own service, which has several
+ * subscribers, as fast as it can. The updates and the received messages
+ * per second are printed for 1, 2, 4... threads.
+ *
+ * Usage: benchPublish [max threads] [message size] [subscribers per service]
+ *                     [seconds per step]
+ */
+
+static volatile int Stop = 0;
+static volatile long Received = 0;
+
+class Publisher
+{
+public :
+	DimService *service;
+	char *data;
+	long updates;
+	pthread_t thread;
+
+	Publisher(char *name, int size)
+	{
+		data = new char[size];
+		memset(data, 0, size);
+		updates = 0;
+		service = new DimService(name, (char *)"C", data, size);
+	}
+};
+
+class Subscriber : public DimInfo
+{
+	void infoHandler()
+	{
+		Received++;
+	}
+public :
+	Subscriber(char *name) : DimInfo(name, (char *)"") {}
+};
+
+static void *publish(void *arg)
+{
+	Publisher *pub = (Publisher *)arg;
+
+	while(!Stop)
+	{
+		pub->data[0]++;
+		pub->service->updateService();
+		pub->updates++;
+	}
+	return 0;
+}
+
+static double now()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, 0);
+	return tv.tv_sec*1e6 + tv.tv_usec;
+}
+
+int main(int argc, char *argv[])
+{
+	int maxThreads = 8, size = 64, nSubscribers = 4, seconds = 2;
+	int i, n, nThreads;
+	char serverName[64], name[128];
+	Publisher **pubs;
+	long updates, received;
+	double t0, t1;
+
+	if(argc > 1)
+		sscanf(argv[1], "%d", &maxThreads);
+	if(argc > 2)
+		sscanf(argv[2], "%d", &size);
+	if(argc > 3)
+		sscanf(argv[3], "%d", &nSubscribers);
+	if(argc > 4)
+		sscanf(argv[4], "%d", &seconds);
+
+	sprintf(serverName, "BENCH_PUBLISH_%d", getpid());
+	pubs = new Publisher *[maxThreads];
+	for(i = 0; i < maxThreads; i++)
+	{
+		sprintf(name, "%s/SERVICE_%d", serverName, i);
+		pubs[i] = new Publisher(name, size);
+	}
+	DimServer::start(serverName);
+	sleep(1);
+	for(i = 0; i < maxThreads; i++)
+	{
+		sprintf(name, "%s/SERVICE_%d", serverName, i);
+		for(n = 0; n < nSubscribers; n++)
+			new Subscriber(name);
+	}
+	sleep(2);
+
+	cout << "Threads\tUpdates/s\tReceived/s" << endl;
+	for(nThreads = 1; nThreads <= maxThreads; nThreads *= 2)
+	{
+		Stop = 0;
+		Received = 0;
+		for(i = 0; i < nThreads; i++)
+			pubs[i]->updates = 0;
+		t0 = now();
+		for(i = 0; i < nThreads; i++)
+			pthread_create(&pubs[i]->thread, 0, publish, pubs[i]);
+		sleep(seconds);
+		Stop = 1;
+		received = Received;
+		for(i = 0; i < nThreads; i++)
+			pthread_join(pubs[i]->thread, 0);
+		t1 = now();
+		updates = 0;
+		for(i = 0; i < nThreads; i++)
+			updates += pubs[i]->updates;
+		cout << nThreads << "\t" << (long)(updates/((t1 - t0)/1e6)) << "\t\t"
+			<< (long)(received/((t1 - t0)/1e6)) << endl;
+		sleep(1);
+	}
+	return 1;
+}
@@ -0,0 +1,107 @@
+#include <iostream>
+using namespace std;
+#include <dis.hxx>
+#include <dic.hxx>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+/*
+ * Measures the registration of many services by a running server, until
+ * the DNS knows them all, and their removal:
+ * - one by one, each name checked on the DNS first (as the dqm4hep Server
+ *   did for each service),
+ * - at once, all the names checked with one browse and the DNS updates
+ *   held back while the services are created or deleted.
+ *
+ * Usage: benchRegister [services]
+ */
+
+static double now()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, 0);
+	return tv.tv_sec*1e6 + tv.tv_usec;
+}
+
+static int count(const char *pattern)
+{
+	DimBrowser br;
+	char *name, *format;
+	int n = 0;
+
+	br.getServices(pattern);
+	while(br.getNextService(name, format))
+		n++;
+	return n;
+}
+
+static void waitFor(const char *pattern, int n)
+{
+	while(count(pattern) != n)
+		usleep(1000);
+}
+
+static int value = 0;
+
+static void run(const char *prefix, int nServices, int bulk)
+{
+	DimService **services = new DimService *[nServices];
+	char name[128], pattern[128];
+	int i;
+	double t0, t1;
+
+	sprintf(pattern, "%s/*", prefix);
+	t0 = now();
+	if(bulk)
+	{
+		count(pattern);
+		dis_hold_dns_updates();
+	}
+	for(i = 0; i < nServices; i++)
+	{
+		sprintf(name, "%s/Folder_%d/Histogram_%d", prefix, i % 100, i);
+		if(!bulk)
+			count(name);
+		services[i] = new DimService(name, value);
+	}
+	if(bulk)
+		dis_flush_dns_updates();
+	waitFor(pattern, nServices);
+	t1 = now();
+	cout << (bulk ? "bulk" : "single") << "\tregister\t" << nServices << " services\t"
+		<< (t1 - t0)/1000 << " ms" << endl;
+
+	t0 = now();
+	if(bulk)
+		dis_hold_dns_updates();
+	for(i = 0; i < nServices; i++)
+		delete services[i];
+	if(bulk)
+		dis_flush_dns_updates();
+	waitFor(pattern, 0);
+	t1 = now();
+	cout << (bulk ? "bulk" : "single") << "\tremove\t\t" << nServices << " services\t"
+		<< (t1 - t0)/1000 << " ms" << endl;
+	delete[] services;
+}
+
+int main(int argc, char *argv[])
+{
+	int nServices = 10000;
+
+	if(argc > 1)
+		sscanf(argv[1], "%d", &nServices);
+
+	DimServer::start("BENCH_REGISTER");
+	/* The server keeps one service, it would stop serving without any */
+	DimService keep("BENCH_REGISTER/KEEP", value);
+	waitFor("BENCH_REGISTER/KEEP", 1);
+
+	run("BULK", nServices, 1);
+	run("SINGLE", nServices, 0);
+	return 1;
+}
@@ -0,0 +1,154 @@
+#include <iostream>
+using namespace std;
+#include <dis.hxx>
+#include <dic.hxx>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+/*
+ * Measures synchronous requests issued concurrently by many threads: each
+ * thread does blocking RPCs (DimRpcInfo::getData) or blocking commands
+ * (DimClient::sendCommand) in a loop. The requests per second and the
+ * CPU time used per request are printed for 1, 2, 4... threads. An RPC
+ * answer goes to all the RPC clients of a process, each thread uses its
+ * own RPC service.
+ *
+ * Usage: benchRequest [max threads] [requests per thread]
+ */
+
+static char ServerName[64];
+static char CmndName[128];
+static int NRequests = 20;
+
+typedef struct {
+	int index;
+	int bad;
+} Worker;
+
+class Echo : public DimRpc
+{
+	void rpcHandler()
+	{
+		int value = getInt();
+
+		setData(value);
+	}
+public :
+	Echo(char *name) : DimRpc(name, (char *)"I", (char *)"I") {}
+};
+
+class Sink : public DimCommand
+{
+	void commandHandler() {}
+public :
+	Sink(char *name) : DimCommand(name, (char *)"I") {}
+};
+
+static void *doRpcs(void *arg)
+{
+	Worker *worker = (Worker *)arg;
+	char name[128];
+	int i;
+
+	sprintf(name, "%s/ECHO_%d", ServerName, worker->index);
+	DimRpcInfo rpc(name, -1);
+	for(i = 0; i < NRequests; i++)
+	{
+		rpc.setData(i);
+		if(rpc.getInt() != i)
+			worker->bad++;
+	}
+	return 0;
+}
+
+static void *doCommands(void *arg)
+{
+	Worker *worker = (Worker *)arg;
+	int i;
+
+	for(i = 0; i < NRequests; i++)
+	{
+		if(!DimClient::sendCommand(CmndName, i))
+			worker->bad++;
+	}
+	return 0;
+}
+
+static double now()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, 0);
+	return tv.tv_sec*1e6 + tv.tv_usec;
+}
+
+static double cpuTime()
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)*1e6 +
+		usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static void run(const char *what, void *(*routine)(void *), int nThreads)
+{
+	pthread_t *threads = new pthread_t[nThreads];
+	Worker *workers = new Worker[nThreads];
+	int i, nBad = 0;
+	double t0, t1, c0, c1;
+
+	t0 = now();
+	c0 = cpuTime();
+	for(i = 0; i < nThreads; i++)
+	{
+		workers[i].index = i;
+		workers[i].bad = 0;
+		pthread_create(&threads[i], 0, routine, &workers[i]);
+	}
+	for(i = 0; i < nThreads; i++)
+	{
+		pthread_join(threads[i], 0);
+		nBad += workers[i].bad;
+	}
+	t1 = now();
+	c1 = cpuTime();
+	cout << what << "\t" << nThreads << "\t" << (long)(nThreads*NRequests/((t1 - t0)/1e6))
+		<< "\t\t" << (c1 - c0)/(nThreads*NRequests) << "\t\t" << nBad << endl;
+	delete[] threads;
+	delete[] workers;
+}
+
+int main(int argc, char *argv[])
+{
+	int maxThreads = 64, nThreads, i;
+	char name[128];
+
+	if(argc > 1)
+		sscanf(argv[1], "%d", &maxThreads);
+	if(argc > 2)
+		sscanf(argv[2], "%d", &NRequests);
+
+	sprintf(ServerName, "BENCH_REQUEST_%d", getpid());
+	for(i = 0; i < maxThreads; i++)
+	{
+		sprintf(name, "%s/ECHO_%d", ServerName, i);
+		new Echo(name);
+	}
+	sprintf(CmndName, "%s/SINK", ServerName);
+	Sink sink(CmndName);
+	DimServer::start(ServerName);
+	sleep(1);
+
+	cout << "Request\tThreads\tRequests/s\tCPU us/request\tFailed" << endl;
+	for(nThreads = 1; nThreads <= maxThreads; nThreads *= 2)
+		run("rpc", doRpcs, nThreads);
+	for(nThreads = 1; nThreads <= maxThreads; nThreads *= 2)
+		run("command", doCommands, nThreads);
+	return 1;
+}
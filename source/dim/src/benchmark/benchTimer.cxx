@@ -0,0 +1,101 @@
+#include <iostream>
+using namespace std;
+#include <dim.hxx>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+/*
+ * Measures the DIM timer queue under load: the cost of starting and
+ * stopping many timers, how late they fire and the CPU used while they
+ * are pending.
+ *
+ * Usage: benchTimer [timers] [idle seconds]
+ */
+
+static double now()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, 0);
+	return tv.tv_sec*1e6 + tv.tv_usec;
+}
+
+static double cpuTime()
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)*1e6 +
+		usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static volatile int Fired = 0;
+static double Late = 0, MaxLate = 0;
+
+class Timer : public DimTimer
+{
+	void timerHandler()
+	{
+		double late = (now() - expected)/1000;
+
+		Late += late;
+		if(late > MaxLate)
+			MaxLate = late;
+		Fired++;
+	}
+public :
+	double expected;
+
+	void go(int secs)
+	{
+		expected = now() + secs*1e6;
+		start(secs);
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	int nTimers = 10000, seconds = 5;
+	int i;
+	Timer *timers;
+	double t0, t1, c0, c1;
+
+	if(argc > 1)
+		sscanf(argv[1], "%d", &nTimers);
+	if(argc > 2)
+		sscanf(argv[2], "%d", &seconds);
+
+	timers = new Timer[nTimers];
+	srand(1);
+
+	t0 = now();
+	for(i = 0; i < nTimers; i++)
+		timers[i].go(10 + rand() % 50);
+	t1 = now();
+	cout << "start\t" << nTimers << " timers\t" << (t1 - t0)*1000/nTimers << " ns/timer" << endl;
+
+	c0 = cpuTime();
+	sleep(seconds);
+	c1 = cpuTime();
+	cout << "idle\t" << seconds << " s\t\t" << (c1 - c0)/1000/seconds << " ms CPU/s" << endl;
+
+	t0 = now();
+	for(i = 0; i < nTimers; i++)
+		timers[i].stop();
+	t1 = now();
+	cout << "stop\t" << nTimers << " timers\t" << (t1 - t0)*1000/nTimers << " ns/timer" << endl;
+
+	c0 = cpuTime();
+	for(i = 0; i < nTimers; i++)
+		timers[i].go(1 + i % 3);
+	while(Fired < nTimers)
+		usleep(10000);
+	c1 = cpuTime();
+	cout << "fire\t" << nTimers << " timers\t" << (c1 - c0)/nTimers << " us CPU/timer\t"
+		<< Late/nTimers << " ms late (mean)\t" << MaxLate << " ms late (max)" << endl;
+	return 1;
+}
@@ -0,0 +1,144 @@
+#include <iostream>
+using namespace std;
+#include <dis.hxx>
+#include <dic.hxx>
+#include <dim.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/*
+ * Measures the cost of an IO thread wakeup as the number of connections
+ * grows: idle TCP connections are opened on the server and the round trip
+ * time of a command/service ping-pong is measured for each step.
+ *
+ * Usage: benchWakeup [max idle connections] [round trips per step]
+ */
+
+static volatile int Trips = 0;
+static int MaxTrips = 0;
+static char *PingName;
+
+class Ping : public DimCommand
+{
+	DimService *pong;
+	int count;
+
+	void commandHandler()
+	{
+		count = getInt();
+		pong->updateService();
+	}
+public :
+	Ping(char *name, char *pongName) : DimCommand(name, "I")
+	{
+		count = 0;
+		pong = new DimService(pongName, count);
+	}
+};
+
+class Pong : public DimInfo
+{
+	void infoHandler()
+	{
+		int count = getInt();
+
+		if(count < 0)
+			return;
+		Trips++;
+		if(Trips < MaxTrips)
+			DimClient::sendCommandNB(PingName, Trips);
+	}
+public :
+	Pong(char *name) : DimInfo(name, -1) {}
+};
+
+static int getListenPort()
+{
+	int i, port = 0;
+
+	dim_lock();
+	for(i = 1; i < Curr_N_Conns; i++)
+	{
+		if(Dna_conns[i].busy && (Net_conns[i].reading == 0) && Net_conns[i].port)
+			port = Net_conns[i].port;
+	}
+	dim_unlock();
+	return port;
+}
+
+static double now()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, 0);
+	return tv.tv_sec*1e6 + tv.tv_usec;
+}
+
+int main(int argc, char *argv[])
+{
+	int port, maxIdle = 4000, nTrips = 2000, nIdle = 0, step, sock;
+	char serverName[64], pingName[128], pongName[128];
+	struct rlimit lim;
+	struct sockaddr_in addr;
+	double t0, t1;
+
+	if(argc > 1)
+		sscanf(argv[1], "%d", &maxIdle);
+	if(argc > 2)
+		sscanf(argv[2], "%d", &nTrips);
+	getrlimit(RLIMIT_NOFILE, &lim);
+	lim.rlim_cur = lim.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &lim);
+
+	sprintf(serverName, "BENCH_WAKEUP_%d", getpid());
+	sprintf(pingName, "%s/PING", serverName);
+	sprintf(pongName, "%s/PONG", serverName);
+	PingName = pingName;
+	Ping ping(pingName, pongName);
+	DimServer::start(serverName);
+	sleep(1);
+	port = getListenPort();
+	if(!port)
+	{
+		cout << "Could not find the server port" << endl;
+		return 0;
+	}
+	Pong pong(pongName);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+	cout << "Idle connections\tRound trip (us)" << endl;
+	for(step = 0; ; step = step ? step*2 : 250)
+	{
+		if(step > maxIdle)
+			break;
+		for(; nIdle < step; nIdle++)
+		{
+			if( ((sock = socket(AF_INET, SOCK_STREAM, 0)) == -1) ||
+				(connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1) )
+			{
+				cout << "Could only open " << nIdle << " connections" << endl;
+				return 0;
+			}
+		}
+		sleep(1);
+		Trips = 0;
+		MaxTrips = nTrips;
+		t0 = now();
+		DimClient::sendCommandNB(pingName, 0);
+		while(Trips < nTrips)
+			usleep(1000);
+		t1 = now();
+		cout << nIdle << "\t\t\t" << (t1 - t0)/nTrips << endl;
+	}
+	return 1;
+}
@@ -33,18 +33,49 @@ DllExp DIM_NOSHARE NET_CONNECTION *Net_conns = 0;
 DllExp DIM_NOSHARE int Curr_N_Conns = 0;
 #endif
 
+/* An id is a handle: the index of its slot in the low ID_INDEX_BITS bits,
+   and above them the generation of the slot, which changes every time the
+   slot is freed, so a stale id does not find the new owner. Bits 28 and 31
+   of service ids are flags in the protocol, ids stay below them */
+#define ID_INDEX_BITS	20
+#define ID_GEN_BITS		8
+#define ID_INDEX_MASK	((1 << ID_INDEX_BITS) - 1)
+#define ID_GEN_MASK		((1 << ID_GEN_BITS) - 1)
+#define ID_CHUNK_BITS	10
+#define ID_CHUNK		(1 << ID_CHUNK_BITS)
+#define ID_CHUNKS		(1 << (ID_INDEX_BITS - ID_CHUNK_BITS))
+
 typedef struct id_item
 {
 	void *ptr;
 	SRC_TYPES type;
+	int gen;
+	int next_free;
 }ID_ITEM;
 
-static ID_ITEM *Id_arr;
-/*
-static void **Id_arr;
-*/
+/* Slots are allocated in chunks which never move. Freed slots are queued
+   at the tail of the free list, to be reused as late as possible */
+static ID_ITEM *Id_chunks[ID_CHUNKS];
 static int Curr_N_Ids = 0;
-static int Curr_id = 1;
+static int Free_id_head = 0;
+static int Free_id_tail = 0;
+
+#define ID_ITEMP(index)	(&Id_chunks[(index) >> ID_CHUNK_BITS][(index) & (ID_CHUNK - 1)])
+
+/* Free connection slots, conn_get() takes the last one */
+static int *Free_conns = 0;
+static int N_free_conns = 0;
+
+/* The ID table has its own lock, ids are looked up for every message.
+   It is a leaf lock: nothing else is taken while holding it */
+#if defined(__unix__) && !defined(NOTHREADS) && !defined(VxWorks)
+static pthread_mutex_t Id_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define ID_LOCK		DISABLE_SIG pthread_mutex_lock(&Id_mutex);
+#define ID_UNLOCK	pthread_mutex_unlock(&Id_mutex); ENABLE_SIG
+#else
+#define ID_LOCK		DISABLE_AST
+#define ID_UNLOCK	ENABLE_AST
+#endif
 
 void conn_arr_create(SRC_TYPES type)
 {
@@ -78,22 +109,35 @@ void conn_arr_create(SRC_TYPES type)
 
 int conn_get()
 {
-	register DNA_CONNECTION *dna_connp;
 	int i, n_conns, conn_id;
 
 	DISABLE_AST
-	for( i = 1, dna_connp = &Dna_conns[1]; i < Curr_N_Conns; i++, dna_connp++ )
+	if(!Free_conns)
 	{
-		if( !dna_connp->busy )
+		Free_conns = (int *)malloc((size_t)Curr_N_Conns * sizeof(int));
+		for( i = Curr_N_Conns - 1; i > 0; i-- )
 		{
-			dna_connp->busy = TRUE;
-			ENABLE_AST
-			return(i);
+			if( !Dna_conns[i].busy )
+				Free_conns[N_free_conns++] = i;
 		}
 	}
+	if( N_free_conns )
+	{
+		conn_id = Free_conns[--N_free_conns];
+		Dna_conns[conn_id].busy = TRUE;
+		ENABLE_AST
+		return(conn_id);
+	}
 	n_conns = Curr_N_Conns + CONN_BLOCK;
+	Free_conns = (int *)realloc(Free_conns, (size_t)n_conns * sizeof(int));
+	for( i = n_conns - 1; i > Curr_N_Conns; i-- )
+		Free_conns[N_free_conns++] = i;
 	Dna_conns = arr_increase( Dna_conns, sizeof(DNA_CONNECTION), n_conns );
+	tcpip_lock_writes();
+	tcpip_lock_reactors();
 	Net_conns = arr_increase( Net_conns, sizeof(NET_CONNECTION), n_conns );
+	tcpip_unlock_reactors();
+	tcpip_unlock_writes();
 	switch(My_type)
 	{
 	case SRC_DIC :
@@ -118,7 +162,12 @@ int conn_get()
 void conn_free(int conn_id)
 {
 	DISABLE_AST
-	Dna_conns[conn_id].busy = FALSE;
+	if( Dna_conns[conn_id].busy )
+	{
+		Dna_conns[conn_id].busy = FALSE;
+		if( Free_conns )
+			Free_conns[N_free_conns++] = conn_id;
+	}
 	ENABLE_AST
 }
 
@@ -135,85 +184,90 @@ void *arr_increase(void *conn_ptr, int conn_size, int n_conns)
 void id_arr_create()
 {
 
-	Curr_N_Ids = ID_BLOCK;
-	Id_arr = (void *) calloc( (size_t)Curr_N_Ids, sizeof(ID_ITEM));
-}
-
-
-void *id_arr_increase(void *id_ptr, int id_size, int n_ids)
-{
-	register char *new_ptr;
-
-	new_ptr = realloc( id_ptr, (size_t)(id_size * n_ids) );
-	memset( new_ptr + id_size * Curr_N_Ids, 0, (size_t)(id_size * ID_BLOCK) );
-	return(new_ptr);
+	Id_chunks[0] = (ID_ITEM *) calloc( (size_t)ID_CHUNK, sizeof(ID_ITEM));
+	Curr_N_Ids = 1;
 }
 
 int id_get(void *ptr, SRC_TYPES type)
 {
-	register int i, id;
+	register int index;
 	register ID_ITEM *idp;
 
-	DISABLE_AST
+	ID_LOCK
 	if(!Curr_N_Ids)
 	{
 		id_arr_create();
 	}
-	for( i = Curr_id, idp = &Id_arr[Curr_id]; i < Curr_N_Ids; i++, idp++ )
+	if(Free_id_head)
+	{
+		index = Free_id_head;
+		idp = ID_ITEMP(index);
+		Free_id_head = idp->next_free;
+		if(!Free_id_head)
+			Free_id_tail = 0;
+	}
+	else
 	{
-		if( !idp->type )
+		if(Curr_N_Ids > ID_INDEX_MASK)
 		{
-			idp->ptr = ptr;
-			idp->type = type;
-			Curr_id = i;
-			ENABLE_AST
-			return(i);
+			ID_UNLOCK
+			return(0);
 		}
+		index = Curr_N_Ids++;
+		if(!Id_chunks[index >> ID_CHUNK_BITS])
+			Id_chunks[index >> ID_CHUNK_BITS] = (ID_ITEM *) calloc( (size_t)ID_CHUNK, sizeof(ID_ITEM));
+		idp = ID_ITEMP(index);
 	}
-	Id_arr = id_arr_increase( Id_arr, sizeof(ID_ITEM), Curr_N_Ids + ID_BLOCK );
-	id = Curr_N_Ids;
-	idp = &Id_arr[id];
 	idp->ptr = ptr;
 	idp->type = type;
-	Curr_N_Ids += ID_BLOCK;
-	Curr_id = id;
-	ENABLE_AST
-	return(id);
+	idp->next_free = 0;
+	ID_UNLOCK
+	return((idp->gen << ID_INDEX_BITS) | index);
 }
 
-void *id_get_ptr(int id, SRC_TYPES type)
+static ID_ITEM *id_lookup(int id, SRC_TYPES type)
 {
+	int index;
 	ID_ITEM *idp;
-	void *ptr;
-	DISABLE_AST
 
-	if((id >= Curr_N_Ids) || (id <= 0))
-	{
-		ENABLE_AST
+	index = id & ID_INDEX_MASK;
+	if((id <= 0) || (index >= Curr_N_Ids))
 		return(0);
-	}
-	idp = &Id_arr[id];
-	if(idp->type == type)
-	{
+	idp = ID_ITEMP(index);
+	if((idp->type != type) || (idp->gen != (id >> ID_INDEX_BITS)))
+		return(0);
+	return(idp);
+}
+
+void *id_get_ptr(int id, SRC_TYPES type)
+{
+	ID_ITEM *idp;
+	void *ptr = 0;
+	ID_LOCK
+
+	if( (idp = id_lookup(id, type)) )
 		ptr = idp->ptr;
-		ENABLE_AST
-		return(ptr);
-	}
-	ENABLE_AST
-	return(0);
+	ID_UNLOCK
+	return(ptr);
 }
 
 void id_free(int id, SRC_TYPES type)
 {
 	ID_ITEM *idp;
-	DISABLE_AST
+	int index;
+	ID_LOCK
 
-	idp = &Id_arr[id];
-	if(idp->type == type)
+	if( (idp = id_lookup(id, type)) )
 	{
+		index = id & ID_INDEX_MASK;
 		idp->type = 0;
 		idp->ptr = 0;
+		idp->gen = (idp->gen + 1) & ID_GEN_MASK;
+		if(Free_id_tail)
+			ID_ITEMP(Free_id_tail)->next_free = index;
+		else
+			Free_id_head = index;
+		Free_id_tail = index;
 	}
-	Curr_id = 1;
-	ENABLE_AST
+	ID_UNLOCK
 }
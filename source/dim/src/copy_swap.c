@@ -396,6 +396,17 @@ int copy_swap_buffer_in(FORMAT_STR *format_data, void *buff_out, void *buff_in,
 	return(curr_out);
 }
 
+int copy_swap_raw_format(FORMAT_STR *format_data)
+{
+	/* Whether buffers of this format are copied in and out as they are,
+	 * no format or a single variable length list of chars
+	 */
+	if(!format_data->par_bytes)
+		return(1);
+	return((format_data->par_bytes == SIZEOF_CHAR) && !format_data->par_num &&
+		!format_data[1].par_bytes);
+}
+
 
 
 
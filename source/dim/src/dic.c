@@ -15,6 +15,7 @@
 #	include <assert.h>
 #endif
 
+#include <stddef.h>
 #define DIMLIB
 #include <dim.h>
 #include <dic.h>
@@ -40,18 +41,29 @@ typedef struct bad_conn {
 
 static DIC_SERVICE *Service_pend_head = 0;
 static DIC_SERVICE *Cmnd_head = 0;
-static DIC_SERVICE *Current_server = 0;
+/* The pending services and the commands are also found by name */
+static NAME_TABLE Pend_table = { 0, 0, 0, (int)offsetof(DIC_SERVICE, serv_name) };
+static NAME_TABLE Cmnd_table = { 0, 0, 0, (int)offsetof(DIC_SERVICE, serv_name) };
+/* The service whose user routine the calling thread runs */
+static DIM_THREAD_LOCAL DIC_SERVICE *Current_server = 0;
 static DIC_BAD_CONNECTION *Bad_connection_head = 0;
 static int Dic_timer_q = 0;
 static int Dns_dic_conn_id = 0;
 static TIMR_ENT *Dns_dic_timr = NULL;
+/* The name server answer to the probe sent on Dns_probe_conn_id: whether it
+   takes several requests per packet, -1 while waiting for it */
+static int Dns_probe_conn_id = 0;
+static int Dns_multi_requests = -1;
+static DIC_DNS_PACKET *Dns_requests = 0;
+static int N_dns_requests = 0;
+static int Dns_request_hold = 0;
 static int Tmout_max = 0;
 static int Tmout_min = 0;
 static int Threads_off = 0;
 
 static void (*Error_user_routine)() = 0;
 static int Error_conn_id = 0;
-static int Curr_conn_id = 0;
+static DIM_THREAD_LOCAL int Curr_conn_id = 0;
 
 #ifdef DEBUG
 static int Debug_on = 1;
@@ -76,14 +88,19 @@ _DIM_PROTO( void modify_service, (DIC_SERVICE *servp, int timeout,
 _DIM_PROTO( DIC_SERVICE *locate_command, (char *serv_name) );
 _DIM_PROTO( DIC_SERVICE *locate_pending, (char *serv_name) );
 _DIM_PROTO( DIC_BAD_CONNECTION *locate_bad, (char *node, char *task, int port) );
+_DIM_PROTO( static void service_link, (DIC_SERVICE *headp, DIC_SERVICE *servp) );
+_DIM_PROTO( static void service_unlink, (DIC_SERVICE *servp) );
 _DIM_PROTO( void service_tmout,      (int serv_id) );
 _DIM_PROTO( static void request_dns_info,      (int retry) );
 _DIM_PROTO( static int handle_dns_info,      (DNS_DIC_PACKET *) );
+_DIM_PROTO( static void handle_dns_probe,      (DNS_DIC_PACKET *) );
+_DIM_PROTO( static int queue_dns_request,      (DIC_SERVICE *servp) );
+_DIM_PROTO( static int send_dns_requests,      (void) );
 _DIM_PROTO( void close_dns_conn,     (void) );
 _DIM_PROTO( static void release_conn, (int conn_id) );
 _DIM_PROTO( static void get_format_data, (int format, FORMAT_STR *format_data, 
 					char *def) );
-_DIM_PROTO( static void execute_service,      (DIS_PACKET *packet, 
+_DIM_PROTO( static DIC_SERVICE *execute_service,      (DIS_PACKET *packet, 
 					DIC_SERVICE *servp, int size) );
 
 void print_packet(DIS_PACKET *packet)
@@ -293,7 +310,9 @@ static void recv_rout( int conn_id, DIS_PACKET *packet, int size, int status )
 					}
 				}
 			}			
-			if( dll_empty((DLL *)dic_connp->service_head) ) {
+			/* Releasing the last command may have released the connection */
+			if( dic_connp->service_head &&
+				dll_empty((DLL *)dic_connp->service_head) ) {
 				if( (servp = (DIC_SERVICE *) Cmnd_head) ) {
 					while( (servp = (DIC_SERVICE *) dll_get_next(
 							(DLL *) Cmnd_head,
@@ -327,9 +346,9 @@ static void recv_rout( int conn_id, DIS_PACKET *packet, int size, int status )
 					}
 				}
 				Curr_conn_id = conn_id;
-				execute_service(packet, servp, size);
+				servp = execute_service(packet, servp, size);
 				Curr_conn_id = 0;
-				if( once_only )
+				if( servp && once_only )
 				{
 					auxp = locate_command(servp->serv_name);
 					if((auxp) && (auxp != servp))
@@ -373,16 +392,53 @@ static void recv_rout( int conn_id, DIS_PACKET *packet, int size, int status )
 	}
 }
 
-static void execute_service(DIS_PACKET *packet, DIC_SERVICE *servp, int size)
+static DIC_SERVICE *wait_service_idle( int serv_id )
 {
+	/* Waits for a user routine of the service running without the DIM lock
+	 * in another thread, returns the service or 0 if it was released
+	 * meanwhile. Callers holding the lock more than once can't wait.
+	 */
+	DIC_SERVICE *servp;
+
+	while( (servp = (DIC_SERVICE *)id_get_ptr(serv_id, SRC_DIC)) &&
+	       (servp->serv_id == serv_id) )
+	{
+		if( !servp->cb_owner || (servp->cb_owner == (void *)&Current_server) ||
+		    (dim_lock_depth() != 1) )
+			return(servp);
+		dim_wait_callbacks();
+	}
+	return(0);
+}
+
+static DIC_SERVICE *execute_service(DIS_PACKET *packet, DIC_SERVICE *servp, int size)
+{
+	/* With several IO threads the user routine runs without the DIM lock,
+	 * one at a time per service. Returns the service, or 0 if it was
+	 * released meanwhile.
+	 */
 	int format;
 	FORMAT_STR format_data_cp[MAX_NAME/4], *formatp;
-	static int *buffer;
-	static int buffer_size = 0;
-	int add_size;
-	int *pkt_buffer, header_size;
-
-	Current_server = servp;
+	static DIM_THREAD_LOCAL int *buffer;
+	static DIM_THREAD_LOCAL int buffer_size = 0;
+	int add_size, serv_id, in_buffer = 0;
+	int *pkt_buffer, header_size, *data = 0;
+	void *wait_handle = 0, *handle;
+	void (*user_routine)();
+	dim_long tag;
+
+	if(servp->cb_owner)
+	{
+		/* Data of a service moving to another connection, the packet is
+		   kept while waiting */
+		serv_id = servp->serv_id;
+		wait_handle = dim_retain_data(packet);
+		if(!(servp = wait_service_idle(serv_id)))
+		{
+			dim_release_data(wait_handle);
+			return(0);
+		}
+	}
 	format = servp->format;
 	memcpy(format_data_cp, servp->format_data, sizeof(format_data_cp));
 	if((format & 0xF) == ((MY_FORMAT) & 0xF)) 
@@ -430,12 +486,20 @@ static void execute_service(DIS_PACKET *packet, DIC_SERVICE *servp, int size)
 		add_size = copy_swap_buffer_in(format_data_cp, 
 						 servp->serv_address, 
 						 pkt_buffer, size);
-		if( servp->user_routine )
-			(servp->user_routine)(&servp->tag, servp->serv_address, &add_size );
+		data = servp->serv_address;
 	} 
 	else 
 	{
-		if( servp->user_routine )
+		if( servp->user_routine && copy_swap_raw_format(format_data_cp) )
+		{
+			/* Raw data is passed up in the receive buffer of the connection,
+			 * it can be kept past the callback with dim_retain_data()
+			 */
+			add_size = size;
+			data = pkt_buffer;
+			in_buffer = 1;
+		}
+		else if( servp->user_routine )
 		{
 			add_size = size + (size/2);
 			if(!buffer_size)
@@ -455,18 +519,47 @@ static void execute_service(DIS_PACKET *packet, DIC_SERVICE *servp, int size)
 			add_size = copy_swap_buffer_in(format_data_cp, 
 						 buffer, 
 						 pkt_buffer, size);
-			(servp->user_routine)( &servp->tag, buffer, &add_size );
+			data = buffer;
 		}
 	}
-	Current_server = 0;
+	if( servp->user_routine )
+	{
+		Current_server = servp;
+		serv_id = servp->serv_id;
+		user_routine = servp->user_routine;
+		tag = servp->tag;
+		servp->cb_owner = (void *)&Current_server;
+		if(dna_unlock_callback(in_buffer ? data : 0, &handle))
+		{
+			(user_routine)( &tag, data, &add_size );
+			dna_lock_callback(handle);
+			if( (servp = (DIC_SERVICE *)id_get_ptr(serv_id, SRC_DIC)) &&
+			    ((servp->serv_id != serv_id) ||
+			     (servp->cb_owner != (void *)&Current_server)) )
+				servp = 0;
+			if(servp)
+				servp->cb_owner = 0;
+			dim_callback_done();
+		}
+		else
+		{
+			servp->cb_owner = 0;
+			(servp->user_routine)( &servp->tag, data, &add_size );
+		}
+		Current_server = 0;
+	}
+	if(wait_handle)
+		dim_release_data(wait_handle);
+	return(servp);
 }
 
 static void recv_dns_dic_rout( int conn_id, DNS_DIC_PACKET *packet, int size, int status )
 {
 	register DIC_SERVICE *servp, *auxp;
+	DNS_DIC_PACKET *entryp;
+	int i;
 	void dim_panic(char *);
 
-	if(size){}
 	switch( status )
 	{
 	case STA_DISC:       /* connection broken */
@@ -493,6 +586,8 @@ static void recv_dns_dic_rout( int conn_id, DNS_DIC_PACKET *packet, int size, in
 		}
 		dna_close( Dns_dic_conn_id );
 		Dns_dic_conn_id = 0;
+		Dns_probe_conn_id = 0;
+		N_dns_requests = 0;
 		request_dns_info(0);
 		break;
 	case STA_CONN:        /* connection received */
@@ -505,9 +600,18 @@ static void recv_dns_dic_rout( int conn_id, DNS_DIC_PACKET *packet, int size, in
 		}
 		break;
 	case STA_DATA:       /* normal packet */
-		if( vtohl(packet->size) == DNS_DIC_HEADER )
+		/* One answer per request of the packet sent */
+		for(i = 0; i + DNS_DIC_HEADER <= size; i += DNS_DIC_HEADER)
 		{
-			handle_dns_info( packet );
+			entryp = (DNS_DIC_PACKET *)((char *)packet + i);
+			if( vtohl(entryp->size) != DNS_DIC_HEADER )
+				break;
+			if( !entryp->service_id )
+				handle_dns_probe( entryp );
+			else
+				handle_dns_info( entryp );
+			if( Dns_dic_conn_id != conn_id )
+				break;
 		}
 		break;
 	default:	dim_panic( "recv_dns_dic_rout(): Bad switch" );
@@ -529,6 +633,9 @@ printf("In service tmout\n");
 		return;
 	if(servp->tmout_done)
 		return;
+	/* Data is being delivered by another thread, the timeout is stale */
+	if(servp->cb_owner && (servp->cb_owner != (void *)&Current_server))
+		return;
 /*
 dim_print_date_time();
 printf("In service tmout %s\n", servp->serv_name);
@@ -764,7 +871,10 @@ int request_command(char *serv_name, void *serv_address, int serv_size,
 	}
 	if( (servp = locate_command(serv_name)) ) 
 	{
-		if(!(testp = locate_pending(serv_name)))
+		/* A command still waiting for its completion keeps its routine and
+		   tag, a concurrent one goes through a new service */
+		if((!(testp = locate_pending(serv_name))) &&
+			(servp->pending != WAITING_CMND_ANSWER))
 		{
 			if( (conn_id = servp->conn_id) ) 
 			{
@@ -846,7 +956,7 @@ DIC_SERVICE *insert_service( int type, int timeout, char *name, int *address, in
 		dll_init( (DLL *) Service_pend_head );
 		Service_pend_head->serv_id = 0;
 	}
-	dll_insert_queue( (DLL *) Service_pend_head, (DLL *)newp );
+	service_link( Service_pend_head, newp );
 	newp->timer_ent = NULL;
 	if(type != MONIT_FIRST)
 	{
@@ -868,6 +978,7 @@ DIC_SERVICE *insert_service( int type, int timeout, char *name, int *address, in
 	}
 	newp->pending = pending;
 	newp->tmout_done = 0;
+	newp->cb_owner = 0;
 	newp->stamped = stamped;
 	newp->time_stamp[0] = 0;
 	newp->time_stamp[1] = 0;
@@ -1043,17 +1154,13 @@ void dic_release_service( unsigned service_id )
 	    ENABLE_AST
 		return;
 	}
-	servp = (DIC_SERVICE *)id_get_ptr(service_id, SRC_DIC);
+	/* The user routine may be running in another thread */
+	servp = wait_service_idle((int)service_id);
 	if( servp == 0 )
 	{
 	    ENABLE_AST
 		return;
 	}
-	if(servp->serv_id != (int)service_id)
-	{
-	    ENABLE_AST
-		return;
-	}
 	pending = servp->pending;
 	switch( pending )
 	{
@@ -1108,7 +1215,7 @@ int release_service( DIC_SERVICE *servicep )
 	servicep->serv_id = 0;
 	conn_id = servicep->conn_id;
 	dic_connp = &Dic_conns[conn_id] ;
-	dll_remove( (DLL *) servicep );
+	service_unlink( servicep );
 	if( servicep->timer_ent )
 	{
 		dtq_rem_entry( Dic_timer_q, servicep->timer_ent );
@@ -1192,35 +1299,62 @@ int locate_service( DIC_SERVICE *servp )
 	if( Dns_dic_conn_id > 0)
 	{
 	    DISABLE_AST;
-		request_dns_info(servp->prev->serv_id);
+		/* Held requests are sent together by dic_flush_dns_requests() */
+		if(!Dns_request_hold)
+			request_dns_info(servp->prev->serv_id);
 		ENABLE_AST;
 	}
 
 	return(Dns_dic_conn_id);
 }
 
-DIC_SERVICE *locate_command( char *serv_name )
+/* Hold back the DNS requests of the new services, until
+   dic_flush_dns_requests() sends them in full packets. Calls can be nested */
+void dic_hold_dns_requests()
 {
-	register DIC_SERVICE *servp;
+	DISABLE_AST
+	Dns_request_hold++;
+	ENABLE_AST
+}
 
-	if(!Cmnd_head)
-		return((DIC_SERVICE *)0);
-	if( (servp = (DIC_SERVICE *) dll_search( (DLL *) Cmnd_head, serv_name,
-					    (int)strlen(serv_name)+1)) )
-		return(servp);
-	return((DIC_SERVICE *)0);
+void dic_flush_dns_requests()
+{
+	DISABLE_AST
+	if(Dns_request_hold && !--Dns_request_hold)
+		request_dns_info(0);
+	ENABLE_AST
+}
+
+DIC_SERVICE *locate_command( char *serv_name )
+{
+	return((DIC_SERVICE *)name_table_find(&Cmnd_table, serv_name));
 }
 
 DIC_SERVICE *locate_pending( char *serv_name )
 {
-	register DIC_SERVICE *servp;
+	return((DIC_SERVICE *)name_table_find(&Pend_table, serv_name));
+}
 
-	if(!Service_pend_head)
-		return((DIC_SERVICE *)0);
-	if( (servp = (DIC_SERVICE *) dll_search( (DLL *) Service_pend_head, serv_name,
-					    (int)strlen(serv_name)+1)) )
-		return(servp);
-	return((DIC_SERVICE *)0);
+static void service_link( DIC_SERVICE *headp, DIC_SERVICE *servp )
+{
+	dll_insert_queue( (DLL *) headp, (DLL *) servp );
+	servp->name_table = 0;
+	if(headp == Service_pend_head)
+		servp->name_table = &Pend_table;
+	else if(headp == Cmnd_head)
+		servp->name_table = &Cmnd_table;
+	if(servp->name_table)
+		name_table_insert(servp->name_table, servp);
+}
+
+static void service_unlink( DIC_SERVICE *servp )
+{
+	dll_remove( (DLL *) servp );
+	if(servp->name_table)
+	{
+		name_table_remove(servp->name_table, servp);
+		servp->name_table = 0;
+	}
 }
 
 DIC_BAD_CONNECTION *locate_bad(char *node, char *task, int port)
@@ -1261,6 +1395,19 @@ static void request_dns_info(int id)
 	}
 	if( Dns_dic_conn_id > 0)
 	{
+		/* Learn first whether the name server takes several requests per
+		   packet, the requests are sent when it answers */
+		if(Dns_probe_conn_id != Dns_dic_conn_id)
+		{
+			request_dns_single_info(0);
+			ENABLE_AST
+			return;
+		}
+		if(Dns_multi_requests < 0)
+		{
+			ENABLE_AST
+			return;
+		}
 		servp = Service_pend_head;
 		if(id > 0)
 		{
@@ -1278,7 +1425,7 @@ static void request_dns_info(int id)
 		{
 			if( servp->pending == WAITING_DNS_UP)
 			{
-				if(!request_dns_single_info( servp ))
+				if(!queue_dns_request( servp ))
 				{
 					ENABLE_AST
 					return;
@@ -1287,11 +1434,13 @@ static void request_dns_info(int id)
 			}
 			if(n_pend == 1000)
 			{
+				send_dns_requests();
 				dtq_start_timer( 0, request_dns_info, servp->serv_id);
 				ENABLE_AST
 				return;
 			}
 		}
+		send_dns_requests();
 	}
 	else
 	{
@@ -1311,13 +1460,28 @@ static void request_dns_info(int id)
 }
 
 
+/* Without service, sends the probe */
 int request_dns_single_info( DIC_SERVICE *servp )
 {
 	static DIC_DNS_PACKET Dic_dns_packet;
 	static SERVICE_REQ *serv_reqp;
 	int ret = 1;
 
-	if( Dns_dic_conn_id > 0)
+	if( (Dns_dic_conn_id > 0) && !servp )
+	{
+		Dns_probe_conn_id = Dns_dic_conn_id;
+		Dns_multi_requests = -1;
+		N_dns_requests = 0;
+		Dic_dns_packet.src_type = htovl(SRC_DIC);
+		serv_reqp = &Dic_dns_packet.service;
+		strcpy( serv_reqp->service_name, DIC_DNS_PROBE_NAME );
+		serv_reqp->service_id = 0;
+		Dic_dns_packet.size = htovl(sizeof(DIC_DNS_PACKET));
+		if(!dna_write( Dns_dic_conn_id, &Dic_dns_packet,
+				      sizeof(DIC_DNS_PACKET) ) )
+			ret = 0;
+	}
+	else if( Dns_dic_conn_id > 0)
 	{
 	        if(Debug_on)
 			{
@@ -1343,6 +1507,54 @@ int request_dns_single_info( DIC_SERVICE *servp )
 }
 
 
+static int queue_dns_request( DIC_SERVICE *servp )
+{
+	SERVICE_REQ *serv_reqp;
+
+	if(Dns_multi_requests <= 0)
+		return(request_dns_single_info(servp));
+	if(!Dns_requests)
+		Dns_requests = (DIC_DNS_PACKET *)malloc(DIC_DNS_HEADER +
+			MAX_SERVICE_UNIT * sizeof(SERVICE_REQ));
+	if(Debug_on)
+	{
+		dim_print_date_time();
+		printf("Requesting DNS Info for %s, id %d\n",
+			servp->serv_name, servp->serv_id);
+	}
+	serv_reqp = &(&Dns_requests->service)[N_dns_requests++];
+	strcpy( serv_reqp->service_name, servp->serv_name );
+	serv_reqp->service_id = htovl(servp->serv_id);
+	servp->pending = WAITING_DNS_ANSWER;
+	if(N_dns_requests == MAX_SERVICE_UNIT)
+		return(send_dns_requests());
+	return(1);
+}
+
+static int send_dns_requests()
+{
+	int size;
+
+	if(!N_dns_requests)
+		return(1);
+	size = DIC_DNS_HEADER + N_dns_requests * (int)sizeof(SERVICE_REQ);
+	N_dns_requests = 0;
+	Dns_requests->size = htovl(size);
+	Dns_requests->src_type = htovl(SRC_DIC);
+	return(dna_write( Dns_dic_conn_id, Dns_requests, size ));
+}
+
+static void handle_dns_probe( DNS_DIC_PACKET *packet )
+{
+	if(packet->node_name[0] == (char)0xFF)
+	{
+		error_handler(0, DIM_FATAL, DIMDNSREFUS, "DIM_DNS refuses connection");
+		return;
+	}
+	Dns_multi_requests = (packet->task_name[0] != '\0');
+	request_dns_info(0);
+}
+
 static int handle_dns_info( DNS_DIC_PACKET *packet )
 {
 	int conn_id, service_id;
@@ -1617,9 +1829,8 @@ printf("move_to_ok %s\n",servp->serv_name);
 */
 		servp->pending = NOT_PENDING;
 		servp->tmout_done = 0;
-		dll_remove( (DLL *) servp );
-		dll_insert_queue( (DLL *) Dic_conns[conn_id].service_head,
-			  (DLL *) servp );
+		service_unlink( servp );
+		service_link( (DIC_SERVICE *) Dic_conns[conn_id].service_head, servp );
 		ENABLE_AST
 	}
 }
@@ -1631,8 +1842,8 @@ void move_to_bad_service( DIC_SERVICE *servp, DIC_BAD_CONNECTION *bad_connp)
 printf("move_to_bad %s\n",servp->serv_name);
 */
 	servp->pending = WAITING_DNS_UP;
-	dll_remove( (DLL *) servp );
-	dll_insert_queue( (DLL *) bad_connp->conn.service_head, (DLL *) servp );
+	service_unlink( servp );
+	service_link( (DIC_SERVICE *) bad_connp->conn.service_head, servp );
 	ENABLE_AST
 }
 
@@ -1647,8 +1858,8 @@ printf("move_to_cmnd %s\n",servp->serv_name);
 */
 	servp->pending = NOT_PENDING;
 	servp->tmout_done = 0;
-	dll_remove( (DLL *) servp );
-	dll_insert_queue( (DLL *) Cmnd_head, (DLL *) servp );
+	service_unlink( servp );
+	service_link( Cmnd_head, servp );
 	ENABLE_AST
 }
 
@@ -1660,8 +1871,8 @@ printf("move_to_notok %s\n",servp->serv_name);
 */
 	servp->pending = WAITING_DNS_UP;
 	servp->conn_id = 0;
-	dll_remove( (DLL *) servp );
-	dll_insert_queue( (DLL *) Service_pend_head, (DLL *) servp );
+	service_unlink( servp );
+	service_link( Service_pend_head, servp );
 	ENABLE_AST
 }
 
@@ -1929,23 +2140,34 @@ void do_cmnd_callback(CMNDCB_ITEM *itemp)
 {
 
 	DIC_SERVICE *servp;
-	int ret, serv_id;
+	int ret, serv_id, conn_id = 0;
+	void (*user_routine)() = 0;
+	dim_long tag = 0;
 /*
 	itemp = (CMNDCB_ITEM *)id_get_ptr(id, SRC_DIC);
 */
+/* Called without the DIM lock: the user routine may wake a thread which
+   sends the next command, so the service is done with before calling it */
 	serv_id = itemp->serv_id;
 	ret = itemp->ret_code;
+	{
+	DISABLE_AST
 	servp = (DIC_SERVICE *)id_get_ptr(serv_id, SRC_DIC);
-	if(servp)
+	if(servp && (servp->serv_id == serv_id))
 	{
-		if(servp->serv_id == serv_id)
-		{
-			Curr_conn_id = servp->conn_id;
-			(servp->user_routine)( &servp->tag, &ret );
-			servp->pending = NOT_PENDING;
-			end_command(servp, ret);
-			Curr_conn_id = 0;
-		}
+		user_routine = servp->user_routine;
+		tag = servp->tag;
+		conn_id = servp->conn_id;
+		servp->pending = NOT_PENDING;
+		end_command(servp, ret);
+	}
+	ENABLE_AST
+	}
+	if(user_routine)
+	{
+		Curr_conn_id = conn_id;
+		(user_routine)( &tag, &ret );
+		Curr_conn_id = 0;
 	}
 /*
 	id_free(id, SRC_DIC);
@@ -2106,6 +2328,7 @@ void dic_destroy(int tid)
 	      {
 		dna_close( Dns_dic_conn_id );
 		Dns_dic_conn_id = 0;
+		Dns_probe_conn_id = 0;
 	      }
 	  }
 }
@@ -2177,6 +2400,7 @@ void dic_close_dns()
 		}
 		dna_close( Dns_dic_conn_id );
 		Dns_dic_conn_id = 0;
+		Dns_probe_conn_id = 0;
 	}
 }
 /*
@@ -375,6 +375,7 @@ static void data_user_routine(void *tagp, void *bufp, int *size)
 	}
 	t->itsSize = *size;
 	t->wakeUp = 1;
+	dim_signal_flag(&t->wakeUp);
 #ifdef __VMS
 	sys$wake(0,0);
 #endif
@@ -450,14 +451,12 @@ DimCurrentInfo::~DimCurrentInfo()
 
 void *DimCurrentInfo::getData()
 {
-	while(!wakeUp)
-	{
 #ifdef __VMS
+	while(!wakeUp)
 		sys$hiber();
 #else
-		dim_wait();
+	dim_wait_flag(&wakeUp);
 #endif
-	}
 	return this->itsData;
 }
 
@@ -472,6 +471,7 @@ static void cmnd_done(void *tagp, int *result)
 	t = *(DimCmnd **)tagp;
 	t->result = *result;
 	t->wakeUp = 1;
+	dim_signal_flag(&t->wakeUp);
 #ifdef __VMS
 	sys$wake(0,0);
 #endif
@@ -496,14 +496,12 @@ int DimCmnd::send(char *name, void *data, int datasize)
 		dic_cmnd_callback(name, data, datasize,
 //			cmnd_done, id);
 			cmnd_done, (dim_long)this);
-		while(!wakeUp)
-		{
 #ifdef __VMS
+		while(!wakeUp)
 			sys$hiber();
 #else
-			dim_wait();
+		dim_wait_flag(&wakeUp);
 #endif
-		}
 //		id_free(id, SRC_DIC);
 		return(result);
 	}
@@ -527,6 +525,7 @@ static void rpc_user_routine(void *tagp, void *bufp, int *sizep)
 //	t = (DimRpcInfo *)id_get_ptr(id, SRC_DIC);
 	t = *(DimRpcInfo **)tagp;
 	quality = dic_get_quality(0);
+	t->itsLinkLost = (quality == -1);
 	if(quality == -1)
 	{
 		buf = (char *)t->itsNolinkBuf;
@@ -585,6 +584,8 @@ static void rpc_user_routine(void *tagp, void *bufp, int *sizep)
 		if(t->itsWaiting != 2)
 			t->itsWaiting = 0;
 	}
+	dim_signal_flag(&t->itsConnected);
+	dim_signal_flag(&t->wakeUp);
 #ifdef __VMS
 	sys$wake(0,0);
 #endif
@@ -650,6 +651,7 @@ void DimRpcInfo::timerHandler()
 		if(itsWaiting != 2)
 			itsWaiting = 0;
 	}
+	dim_signal_flag(&wakeUp);
 #ifdef __VMS
 	sys$wake(0,0);
 #endif
@@ -687,6 +689,7 @@ void DimRpcInfo::subscribe(char *name, void *data, int size,
 //	itsTagId = 0;
 	itsInit = 0;
 	itsWaiting = 0;
+	itsLinkLost = 0;
 	itsName = new char[(int)strlen(name)+1];
 	strcpy(itsName,name);
 	itsHandler = this;
@@ -757,8 +760,7 @@ void DimRpcInfo::doIt(void *data, int size)
 	{
 		itsDataOut = data;
 	}
-	while(!itsConnected)
-		dim_wait();
+	dim_wait_flag(&itsConnected);
 	itsWaiting = 1;
 	if(itsTimeout)
 		start(itsTimeout);
@@ -785,14 +787,12 @@ void DimRpcInfo::doIt(void *data, int size)
 
 void *DimRpcInfo::getData()
 {
-	while(!wakeUp)
-	{
 #ifdef __VMS
+	while(!wakeUp)
 		sys$hiber();
 #else
-		dim_wait();
+	dim_wait_flag(&wakeUp);
 #endif
-	}
 /*
 	if(DimClient::getNoDataCopy() == 1)
 	{
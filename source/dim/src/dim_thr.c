@@ -16,6 +16,8 @@
 #endif
 
 pthread_t IO_thread = 0;
+pthread_t IO_reactor_threads[MAX_IO_THREADS];
+int N_IO_reactor_threads = 0;
 pthread_t ALRM_thread = 0;
 pthread_t INIT_thread = 0;
 pthread_t MAIN_thread = 0;
@@ -36,10 +38,24 @@ int WAIT_count = 0;
 */
 int DIM_THR_init_done = 0;
 
+void *dim_io_reactor_thread(void *tag)
+{
+	/* Additional IO threads, each one serves its share of the connections
+	 */
+	int r = (int)(dim_long)tag;
+
+	while(1)
+	{
+		tcpip_reactor_task(r);
+		dim_signal_cond();
+	}
+}
+
 void *dim_tcpip_thread(void *tag)
 {
 	extern int dim_tcpip_init();
 	extern void tcpip_task();
+	int i;
 	/*	
 	int prio;
 		
@@ -50,6 +66,12 @@ void *dim_tcpip_thread(void *tag)
 	IO_thread = pthread_self();
 
 	dim_tcpip_init(1);
+	for(i = 1; i < dim_get_io_threads(); i++)
+	{
+		pthread_create(&IO_reactor_threads[i], NULL, dim_io_reactor_thread,
+			(void *)(dim_long)i);
+		N_IO_reactor_threads = i;
+	}
 	if(INIT_thread)
 	{
 #ifndef darwin
@@ -186,6 +208,7 @@ void dim_init()
 void dim_stop()
 {
 	void dim_tcpip_stop(), dim_dtq_stop();
+	int i;
 /*
 	int i;
 	int n = 0;
@@ -200,10 +223,15 @@ void dim_stop()
 */
 	if(IO_thread)
 		pthread_cancel(IO_thread);
+	for(i = 1; i <= N_IO_reactor_threads; i++)
+		pthread_cancel(IO_reactor_threads[i]);
 	if(ALRM_thread)
 		pthread_cancel(ALRM_thread);
 	if(IO_thread) 
 		pthread_join(IO_thread,0);
+	for(i = 1; i <= N_IO_reactor_threads; i++)
+		pthread_join(IO_reactor_threads[i],0);
+	N_IO_reactor_threads = 0;
 	if(ALRM_thread) 
 		pthread_join(ALRM_thread,0);
 #ifndef darwin 		
@@ -406,13 +434,27 @@ void dim_stop_threads()
 	dim_stop();
 }
 
-int dim_wait(void)
+int dim_in_dim_thread()
 {
 	pthread_t id;
-	
-	id = pthread_self();
+	int i;
 
+	/* The DIM threads deliver all the callbacks, they can't wait for
+	   a message */
+	id = pthread_self();
 	if((id == ALRM_thread) || (id == IO_thread))
+		return(1);
+	for(i = 1; i <= N_IO_reactor_threads; i++)
+	{
+		if(id == IO_reactor_threads[i])
+			return(1);
+	}
+	return(0);
+}
+
+int dim_wait(void)
+{
+	if(dim_in_dim_thread())
 	  {
 		return(-1);
 	  }
@@ -438,6 +480,24 @@ sigset_t oset;
 }
 */
 
+/* Lock ordering, a thread holding one of these locks only takes the ones
+   further down the list:
+	- the DIM lock (DISABLE_AST): client lists, DNS connections, the upper
+	  layer connection tables, and the removal of services, requests and
+	  timer entries
+	- the write lock of a connection (tcpip.c): socket output and write queue
+	- the reactor locks (tcpip.c): receive rings
+   The service table lock (dis.c) is only followed by the ID table lock
+   (conn_handler.c). The other locks are leaves, nothing is taken while
+   holding them:
+	- the ID table lock
+	- the lock of each service (dis.c): its request list
+	- the fan-out set lock (dis.c)
+	- the timer lock (dtq.c): timer heap and queues
+	- the callback lock (user routines running without the DIM lock)
+   The service pins and the request lists are changed holding the DIM lock
+   as well, service updates read them without it. Net_conns is only
+   reallocated holding the DIM, write and reactor locks. */
 pthread_t Dim_thr_locker = 0;
 int Dim_thr_counter = 0;
 #ifdef LYNXOS
@@ -454,15 +514,32 @@ int Global_cond_waiters = 0;
 
 void dim_lock()
 {
+#ifdef __linux__
+	struct timespec deadline;
+#endif
 	/*printf("Locking %d ", pthread_self());*/
     if(Dim_thr_locker != pthread_self())
     {
-/*
 #ifdef __linux__
-		pthread_testcancel();
-#endif
-*/
+		/* dim_stop() cancels and joins the DIM threads holding the lock,
+		   a thread waiting for it has to notice the cancellation */
+		if(pthread_mutex_trylock(&Global_DIM_mutex))
+		{
+			do
+			{
+				pthread_testcancel();
+				clock_gettime(CLOCK_REALTIME, &deadline);
+				deadline.tv_nsec += 10000000;
+				if(deadline.tv_nsec >= 1000000000)
+				{
+					deadline.tv_sec++;
+					deadline.tv_nsec -= 1000000000;
+				}
+			} while(pthread_mutex_timedlock(&Global_DIM_mutex, &deadline));
+		}
+#else
 		pthread_mutex_lock(&Global_DIM_mutex);
+#endif
 		Dim_thr_locker=pthread_self();
 		/*printf(": Locked ");*/
 	}
@@ -483,6 +560,57 @@ void dim_unlock()
 	/*     printf("\n");*/
 }
 
+int dim_lock_depth()
+{
+	/* Number of times the calling thread holds the DIM lock, code holding
+	   it only once may release it around slow operations */
+	if(Dim_thr_locker != pthread_self())
+		return(0);
+	return(Dim_thr_counter);
+}
+
+/* With several IO threads the user routines of services run without the
+   DIM lock (dna_unlock_callback), a thread removing such a service or
+   delivering to it from another connection waits for the routine to return */
+static pthread_mutex_t Callback_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t Callback_cond = PTHREAD_COND_INITIALIZER;
+static unsigned int Callback_epoch = 0;
+
+static void callback_mutex_unlock(void *arg)
+{
+	if(arg){}
+	pthread_mutex_unlock(&Callback_mutex);
+}
+
+void dim_wait_callbacks()
+{
+	/* Called holding the DIM lock once, after finding the service busy in
+	   another thread. Releases the lock until one of the unlocked routines
+	   returns, the caller then looks its service up again */
+	unsigned int epoch;
+
+	pthread_mutex_lock(&Callback_mutex);
+	epoch = Callback_epoch;
+	pthread_mutex_unlock(&Callback_mutex);
+	dim_unlock();
+	pthread_mutex_lock(&Callback_mutex);
+	pthread_cleanup_push(callback_mutex_unlock, 0);
+	while(epoch == Callback_epoch)
+		pthread_cond_wait(&Callback_cond, &Callback_mutex);
+	pthread_cleanup_pop(1);
+	dim_lock();
+}
+
+void dim_callback_done()
+{
+	/* Called holding the DIM lock, once an unlocked routine has returned
+	   and its service is no longer marked busy */
+	pthread_mutex_lock(&Callback_mutex);
+	Callback_epoch++;
+	pthread_cond_broadcast(&Callback_cond);
+	pthread_mutex_unlock(&Callback_mutex);
+}
+
 void dim_wait_cond()
 {
   pthread_mutex_lock(&Global_cond_mutex);
@@ -512,6 +640,108 @@ void dim_signal_cond()
   pthread_mutex_unlock(&Global_cond_mutex);
 }
 
+/* Threads waiting for a flag set by a callback (synchronous commands, RPCs
+   and current values) wait on their own condition, a completion only
+   wakes its own waiter. Waiters are hashed by flag address */
+#define FLAG_BUCKETS 64
+
+typedef struct flag_waiter {
+	struct flag_waiter *next;
+	int *flag;
+	pthread_cond_t cond;
+} FLAG_WAITER;
+
+typedef struct {
+	pthread_mutex_t mutex;
+	FLAG_WAITER *head;
+} FLAG_BUCKET;
+
+static FLAG_BUCKET Flag_buckets[FLAG_BUCKETS];
+static pthread_once_t Flag_buckets_once = PTHREAD_ONCE_INIT;
+
+static void flag_buckets_init()
+{
+	int i;
+
+	for(i = 0; i < FLAG_BUCKETS; i++)
+	{
+		pthread_mutex_init(&Flag_buckets[i].mutex, NULL);
+		Flag_buckets[i].head = 0;
+	}
+}
+
+static FLAG_BUCKET *flag_bucket(int *flag)
+{
+	pthread_once(&Flag_buckets_once, flag_buckets_init);
+	return(&Flag_buckets[((unsigned long)flag / sizeof(int)) % FLAG_BUCKETS]);
+}
+
+static void flag_waiter_remove(void *arg)
+{
+	FLAG_WAITER *waiterp = (FLAG_WAITER *)arg, **pp;
+	FLAG_BUCKET *bucketp = flag_bucket(waiterp->flag);
+
+	for(pp = &bucketp->head; *pp; pp = &(*pp)->next)
+	{
+		if(*pp == waiterp)
+		{
+			*pp = waiterp->next;
+			break;
+		}
+	}
+	pthread_cond_destroy(&waiterp->cond);
+	pthread_mutex_unlock(&bucketp->mutex);
+}
+
+void dim_wait_flag(int *flag)
+{
+	/* Wait until *flag is set and dim_signal_flag(flag) is called.
+	 * The DIM threads can not block, they wait as dim_wait().
+	 */
+	FLAG_WAITER waiter;
+	FLAG_BUCKET *bucketp;
+
+	if(dim_in_dim_thread())
+	{
+		while(!*flag)
+			dim_wait();
+		return;
+	}
+	bucketp = flag_bucket(flag);
+	pthread_mutex_lock(&bucketp->mutex);
+	if(*flag)
+	{
+		pthread_mutex_unlock(&bucketp->mutex);
+		return;
+	}
+	waiter.flag = flag;
+	pthread_cond_init(&waiter.cond, NULL);
+	waiter.next = bucketp->head;
+	bucketp->head = &waiter;
+	pthread_cleanup_push(flag_waiter_remove, &waiter);
+	while(!*flag)
+		pthread_cond_wait(&waiter.cond, &bucketp->mutex);
+	pthread_cleanup_pop(1);
+}
+
+void dim_signal_flag(int *flag)
+{
+	/* Called after setting *flag, wakes the threads waiting for it.
+	 * flag is not accessed, its owner may already be gone.
+	 */
+	FLAG_WAITER *waiterp;
+	FLAG_BUCKET *bucketp;
+
+	bucketp = flag_bucket(flag);
+	pthread_mutex_lock(&bucketp->mutex);
+	for(waiterp = bucketp->head; waiterp; waiterp = waiterp->next)
+	{
+		if(waiterp->flag == flag)
+			pthread_cond_signal(&waiterp->cond);
+	}
+	pthread_mutex_unlock(&bucketp->mutex);
+}
+
 #else
 
 void dim_init()
@@ -551,6 +781,35 @@ int dim_stop_thread(dim_long t_id)
 	printf("dim_stop_thread: not available\n");
 	return 0;
 }
+
+int dim_lock_depth()
+{
+	return(0);
+}
+
+void dim_wait_callbacks()
+{
+}
+
+void dim_callback_done()
+{
+}
+
+int dim_in_dim_thread()
+{
+	return(0);
+}
+
+void dim_wait_flag(int *flag)
+{
+	while(!*flag)
+		dim_wait();
+}
+
+void dim_signal_flag(int *flag)
+{
+	if(flag){}
+}
 #endif
 
 #else
@@ -883,6 +1142,37 @@ void dim_unlock()
 	ReleaseMutex(Global_DIM_mutex);
 }
 
+int dim_lock_depth()
+{
+	/* The mutex does not tell its recursion count */
+	return(0);
+}
+
+void dim_wait_callbacks()
+{
+}
+
+void dim_callback_done()
+{
+}
+
+int dim_in_dim_thread()
+{
+	return(GetCurrentThreadId() == IO_thread);
+}
+
+void dim_wait_flag(int *flag)
+{
+	/* Waiters are woken by wake_up() */
+	while(!*flag)
+		dim_wait();
+}
+
+void dim_signal_flag(int *flag)
+{
+	if(flag){}
+}
+
 void dim_pause()
 {
 HANDLE handles[2];
@@ -10,7 +10,7 @@
 #include <dim_core.hxx>
 #include <dim.hxx>
 
-int DimCore::inCallback = 0;
+DIM_THREAD_LOCAL int DimCore::inCallback = 0;
 int DimUtil::itsBufferSize = 0;
 char *DimUtil::itsBuffer = (char *)0;
 
@@ -19,6 +19,7 @@
 #define DEBUG
 */
 #include <time.h>
+#include <stddef.h>
 #ifdef VAX
 #include <timeb.h>
 #else
@@ -33,6 +34,12 @@
 #define MORE 1
 #define NONE 2
 
+/* With threads the service table and each service have locks of their
+   own, services are updated without the DIM lock (see update_service) */
+#if defined(__unix__) && !defined(NOTHREADS) && !defined(VxWorks)
+#define DIS_LOCKS
+#endif
+
 typedef struct dis_dns_ent {
 	struct dis_dns_ent *next;
 	struct dis_dns_ent *prev;
@@ -47,6 +54,12 @@ typedef struct dis_dns_ent {
 	unsigned int dis_service_id;
 	unsigned int dis_client_id;
 	int updating_service_list;
+	SERVICE_REG *unreg_services;
+	int n_unreg_services;
+	int held_updates;
+	char *removed_list;
+	int removed_size;
+	int removed_length;
 } DIS_DNS_CONN;
 
 typedef struct req_ent {
@@ -62,6 +75,7 @@ typedef struct req_ent {
 	int first_time;
 	int delay_delete;
 	int to_delete;
+	int conn_gen;
 	TIMR_ENT *timr_ent;
 	struct reqp_ent *reqpp;
 } REQUEST;
@@ -87,6 +101,12 @@ typedef struct serv {
 	DIS_DNS_CONN *dnsp;
 	int delay_delete;
 	int to_delete;
+	int new_entry;
+	void *cb_owner;
+	int refs;
+#ifdef DIS_LOCKS
+	pthread_mutex_t lock;
+#endif
 } SERVICE;
 
 typedef struct reqp_ent {
@@ -103,6 +123,30 @@ typedef struct cli_ent {
 	DIS_DNS_CONN *dnsp;
 } CLIENT;
 
+/* The service table lock pins the services updated without the DIM lock
+   (refs), removing a pinned service is left to its last updater. The lock
+   of a service guards its request list and the fields its updates encode.
+   The table and the lists are changed holding the DIM lock and these
+   locks, they are read holding either. Both are leaves, like the fan-out
+   set lock */
+#ifdef DIS_LOCKS
+static pthread_mutex_t Service_table_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t Fanout_lock = PTHREAD_MUTEX_INITIALIZER;
+#define SERVICE_TABLE_LOCK		pthread_mutex_lock(&Service_table_lock);
+#define SERVICE_TABLE_UNLOCK	pthread_mutex_unlock(&Service_table_lock);
+#define SERVICE_LOCK(servp)		pthread_mutex_lock(&(servp)->lock);
+#define SERVICE_UNLOCK(servp)	pthread_mutex_unlock(&(servp)->lock);
+#define FANOUT_LOCK				pthread_mutex_lock(&Fanout_lock);
+#define FANOUT_UNLOCK			pthread_mutex_unlock(&Fanout_lock);
+#else
+#define SERVICE_TABLE_LOCK
+#define SERVICE_TABLE_UNLOCK
+#define SERVICE_LOCK(servp)
+#define SERVICE_UNLOCK(servp)
+#define FANOUT_LOCK
+#define FANOUT_UNLOCK
+#endif
+
 static CLIENT *Client_head = (CLIENT *)0;	
 
 static DIS_DNS_CONN *DNS_head = (DIS_DNS_CONN *)0;	
@@ -120,7 +164,9 @@ static int Dns_dis_conn_id = 0;
 static int Protocol;
 static int Port_number;
 static int Dis_conn_id = 0;
-static int Curr_conn_id = 0;
+static DIM_THREAD_LOCAL int Curr_conn_id = 0;
+/* The command whose user routine the calling thread runs */
+static DIM_THREAD_LOCAL SERVICE *Current_command = 0;
 static int Serving = 0;
 static void (*Client_exit_user_routine)() = 0;
 static void (*Exit_user_routine)() = 0;
@@ -148,6 +194,7 @@ static int Updating_service_list = 0;
 */
 static int Last_client;
 static int Last_n_clients;
+static int Dns_hold = 0;
 
 
 #ifdef DEBUG
@@ -159,7 +206,7 @@ static int Debug_on = 0;
 _DIM_PROTO( static void dis_insert_request, (int conn_id, DIC_PACKET *dic_packet,
 				  int size, int status ) );
 _DIM_PROTO( int execute_service,	(int req_id) );
-_DIM_PROTO( void execute_command,	(SERVICE *servp, DIC_PACKET *packet) );
+_DIM_PROTO( int execute_command,	(SERVICE *servp, DIC_PACKET *packet) );
 _DIM_PROTO( void register_dns_services,  (int flag) );
 _DIM_PROTO( void register_services,  (DIS_DNS_CONN *dnsp, int flag, int dns_flag) );
 _DIM_PROTO( void std_cmnd_handler,   (dim_long *tag, int *cmnd_buff, int *size) );
@@ -177,6 +224,10 @@ _DIM_PROTO( SERVICE *dis_hash_service_get_next, (int *start, SERVICE *prev, int
 _DIM_PROTO( static unsigned do_dis_add_service_dns, (char *name, char *type, void *address, int size, 
 								   void (*user_routine)(), dim_long tag, dim_long dnsid ) );
 _DIM_PROTO( static DIS_DNS_CONN *create_dns, (dim_long dnsid) );
+_DIM_PROTO( static void send_unregistrations, (DIS_DNS_CONN *dnsp) );
+_DIM_PROTO( void do_update_service_list, (DIS_DNS_CONN *dnsp) );
+_DIM_PROTO( static void update_service_list, (DIS_DNS_CONN *dnsp) );
+_DIM_PROTO( void append_service, (char *service_info_buffer, SERVICE *servp) );
 
 void dis_set_debug_on()
 {
@@ -196,6 +247,75 @@ void dis_no_threads()
 static DIS_STAMPED_PACKET *Dis_packet = 0;
 static int Dis_packet_size = 0;
 
+/* Service updates encode the data once per client format and fan the
+   same packet out to all the subscribers, only the service id differs */
+#define MAX_FANOUT_PACKETS 4
+
+typedef struct {
+	int format;
+	int stamped;
+	int *buffp;
+	int size;
+	int write_size;
+	int packet_size;
+	DIS_STAMPED_PACKET *packet;
+} FANOUT_PACKET;
+
+/* The data of an update loaned by the user, the write queues of slow
+   subscribers reference it until it is sent, the user routine is called
+   when it is no longer used. Without a routine the data is copied into
+   the packets, see dis_update_service_copy */
+typedef struct {
+	TCPIP_SHARED shared;
+	int *buffp;
+	int size;
+	void (*release)(void *);
+	void *arg;
+} DIS_LOAN;
+
+_DIM_PROTO( static int update_service_locked, (unsigned service_id, int *client_ids,
+				  DIS_LOAN *loanp) );
+
+/* A write prepared under the DIM lock or the service lock and sent after
+   releasing it, the size and service id go in front of the shared packet.
+   A packet that could not be shared is owned by its write */
+typedef struct {
+	int req_id;
+	int conn_id;
+	int gen;
+	int tag;
+	int header[DIS_HEADER/4];
+	DIS_STAMPED_PACKET *packet;
+	int own;
+	int write_size;
+	DIS_LOAN *loanp;
+	int ret;
+	TCPIP_WRITE_ERROR err;
+} FANOUT_WRITE;
+
+/* The fan-out buffers of one update in progress, concurrent and nested
+   updates take different sets */
+#define MAX_FANOUT_SETS 8
+
+typedef struct {
+	int busy;
+	FANOUT_PACKET packets[MAX_FANOUT_PACKETS];
+	int n_writes;
+	int max_writes;
+	FANOUT_WRITE *writes;
+} FANOUT_SET;
+
+/* With a loan the packets hold only the headers, the data follows
+   from the loaned buffer */
+typedef struct {
+	int n_packets;
+	FANOUT_PACKET *packets;
+	FANOUT_SET *defer;
+	DIS_LOAN *loanp;
+} FANOUT;
+
+static FANOUT_SET Dis_fanout_sets[MAX_FANOUT_SETS];
+
 int dis_set_buffer_size(int size)
 {
 	if(Dis_packet_size)
@@ -305,6 +425,11 @@ static unsigned do_dis_add_service_dns( char *name, char *type, void *address, i
 	new_serv->tid = 0;
 	new_serv->delay_delete = 0;
 	new_serv->to_delete = 0;
+	new_serv->cb_owner = 0;
+	new_serv->refs = 0;
+#ifdef DIS_LOCKS
+	pthread_mutex_init(&new_serv->lock, NULL);
+#endif
 	dnsp = dis_find_dns(dnsid);
 	if(!dnsp)
 		dnsp = create_dns(dnsid);
@@ -470,6 +595,11 @@ static unsigned do_dis_add_cmnd_dns( char *name, char *type, void (*user_routine
 	new_serv->user_secs = 0;
 	new_serv->delay_delete = 0;
 	new_serv->to_delete = 0;
+	new_serv->cb_owner = 0;
+	new_serv->refs = 0;
+#ifdef DIS_LOCKS
+	pthread_mutex_init(&new_serv->lock, NULL);
+#endif
 	service_id = id_get((void *)new_serv, SRC_DIS);
 	new_serv->id = service_id;
 	dnsp = dis_find_dns(dnsid);
@@ -845,6 +975,11 @@ dim_print_date_time();
 	
 	}
 
+	/* The held unregistrations go first, a new DNS connection has no use for them */
+	if(flag == ALL)
+		dnsp->n_unreg_services = 0;
+	else
+		send_unregistrations(dnsp);
 	dis_dns_p->port = htovl(Port_number);
 	serv_regp = dis_dns_p->services;
 	n_services = 0;
@@ -974,14 +1109,15 @@ dim_print_date_time();
 	}
 }
 
-void unregister_service(DIS_DNS_CONN *dnsp, SERVICE *servp)
+static void send_unregistrations(DIS_DNS_CONN *dnsp)
 {
 	register DIS_DNS_PACKET *dis_dns_p = &(dnsp->dis_dns_packet);
 	register int n_services;
-	register SERVICE_REG *serv_regp;
 	extern int get_node_addr();
 
-	if(dnsp->dns_dis_conn_id > 0)
+	n_services = dnsp->n_unreg_services;
+	dnsp->n_unreg_services = 0;
+	if(n_services && (dnsp->dns_dis_conn_id > 0))
 	{
 		if(!dis_dns_p->src_type)
 		{
@@ -998,13 +1134,8 @@ void unregister_service(DIS_DNS_CONN *dnsp, SERVICE *servp)
 			dis_dns_p->src_type = htovl(SRC_DIS);
 			dis_dns_p->format = htovl(MY_FORMAT);
 		}
-		serv_regp = dis_dns_p->services;
-		strcpy( serv_regp->service_name, servp->name );
-		strcpy( serv_regp->service_def, servp->def );
-		serv_regp->service_id = (int)htovl( (unsigned)servp->id | 0x80000000);
-		serv_regp++;
-		n_services = 1;
-		servp->registered = 0;
+		memcpy( dis_dns_p->services, dnsp->unreg_services,
+			(size_t)n_services * sizeof(SERVICE_REG) );
 		dis_dns_p->n_services = htovl(n_services);
 		dis_dns_p->size = htovl(DIS_DNS_HEADER +
 				n_services * (int)sizeof(SERVICE_REG));
@@ -1021,16 +1152,101 @@ dim_print_date_time();
 		{
 			release_conn(dnsp->dns_dis_conn_id, 0, 1);
 		}
-		if(dnsp->dis_service_id)
-			dis_update_service(dnsp->dis_service_id);
 	}
 }
 
-void do_update_service_list(DIS_DNS_CONN *dnsp)
+void unregister_service(DIS_DNS_CONN *dnsp, SERVICE *servp)
+{
+	register SERVICE_REG *serv_regp;
+
+	if(dnsp->dns_dis_conn_id > 0)
+	{
+		if(!dnsp->unreg_services)
+			dnsp->unreg_services = (SERVICE_REG *)
+				malloc(MAX_SERVICE_UNIT * sizeof(SERVICE_REG));
+		serv_regp = &dnsp->unreg_services[dnsp->n_unreg_services++];
+		strcpy( serv_regp->service_name, servp->name );
+		strcpy( serv_regp->service_def, servp->def );
+		serv_regp->service_id = (int)htovl( (unsigned)servp->id | 0x80000000);
+		servp->registered = 0;
+		/* While the DNS updates are held, sent when the packet is full. The
+		   service is gone at the next SERVICE_LIST update, which takes it
+		   from the removed list */
+		if(Dns_hold)
+		{
+			dnsp->held_updates = 1;
+			if(dnsp->n_unreg_services == MAX_SERVICE_UNIT)
+				send_unregistrations(dnsp);
+			if(dnsp->dis_service_id)
+			{
+				if(dnsp->removed_length + MAX_NAME*3 + 8 > dnsp->removed_size)
+				{
+					dnsp->removed_size = dnsp->removed_size ? dnsp->removed_size*2 : MAX_NAME*64;
+					dnsp->removed_list = realloc(dnsp->removed_list, (size_t)dnsp->removed_size);
+				}
+				strcpy(&dnsp->removed_list[dnsp->removed_length], "-");
+				append_service(&dnsp->removed_list[dnsp->removed_length], servp);
+				if(dnsp->removed_list[dnsp->removed_length+1])
+					dnsp->removed_length += (int)strlen(&dnsp->removed_list[dnsp->removed_length]);
+				else
+					dnsp->removed_list[dnsp->removed_length] = '\0';
+			}
+			return;
+		}
+		send_unregistrations(dnsp);
+		update_service_list(dnsp);
+	}
+}
+
+/* Hold back the registrations and unregistrations sent to the DNS, until
+   dis_flush_dns_updates() sends them in full packets. Calls can be nested */
+void dis_hold_dns_updates()
+{
+	DISABLE_AST
+	Dns_hold++;
+	ENABLE_AST
+}
+
+void dis_flush_dns_updates()
+{
+	DIS_DNS_CONN *dnsp;
+
+	DISABLE_AST
+	if(Dns_hold && !--Dns_hold && DNS_head)
+	{
+		dnsp = DNS_head;
+		while( (dnsp = (DIS_DNS_CONN *) dll_get_next( (DLL *) DNS_head, (DLL *) dnsp)) )
+		{
+			if(!dnsp->held_updates)
+				continue;
+			dnsp->held_updates = 0;
+			if(dnsp->dns_dis_conn_id <= 0)
+				continue;
+			if(dnsp->serving)
+				register_services(dnsp, MORE, 0);
+			else
+				send_unregistrations(dnsp);
+			if(dnsp->dis_service_id && !dnsp->updating_service_list)
+			{
+				dtq_start_timer(1, do_update_service_list, dnsp);
+				dnsp->updating_service_list = 1;
+			}
+		}
+	}
+	ENABLE_AST
+}
+
+static void update_service_list(DIS_DNS_CONN *dnsp)
 {
-	dnsp->updating_service_list = 0;
 	if(dnsp->dis_service_id)
 		dis_update_service(dnsp->dis_service_id);
+	dnsp->removed_length = 0;
+}
+
+void do_update_service_list(DIS_DNS_CONN *dnsp)
+{
+	dnsp->updating_service_list = 0;
+	update_service_list(dnsp);
 }
 
 /* start serving client requests
@@ -1058,6 +1274,12 @@ static DIS_DNS_CONN *create_dns(dim_long dnsid)
 	dnsp->dis_dns_packet.src_type = 0;
 	dnsp->dis_dns_packet.node_name[0] = 0;
 	dnsp->updating_service_list = 0;
+	dnsp->unreg_services = 0;
+	dnsp->n_unreg_services = 0;
+	dnsp->held_updates = 0;
+	dnsp->removed_list = 0;
+	dnsp->removed_size = 0;
+	dnsp->removed_length = 0;
 	dnsp->dnsid = dnsid;
 	dll_insert_queue( (DLL *) DNS_head, (DLL *) dnsp );
 	return dnsp;
@@ -1222,6 +1444,10 @@ dim_print_date_time();
 				error_handler(0, DIM_FATAL, DIMDNSUNDEF, "DIM_DNS_NODE undefined", -1);
 		}
 	}
+	else if(Dns_hold)
+	{
+		dnsp->held_updates = 1;
+	}
 	else
 	{
 		register_services(dnsp, MORE, 0);
@@ -1254,7 +1480,7 @@ static void dis_insert_request(int conn_id, DIC_PACKET *dic_packet, int size, in
 	register REQUEST *newp, *reqp;
 	CLIENT *clip, *create_client();
 	REQUEST_PTR *reqpp;
-	int type, new_client = 0, found = 0;
+	int type, new_client = 0, found = 0, ret;
 	int find_release_request();
 	DIS_DNS_CONN *dnsp;
 
@@ -1329,22 +1555,30 @@ printf("Received Request for %s, from %d  %s@%s\n",
 		newp->first_time = 1;
 		newp->delay_delete = 0;
 		newp->to_delete = 0;
+		newp->conn_gen = Net_conns[conn_id].write_gen;
 		newp->timr_ent = 0;
 		newp->req_id = id_get((void *)newp, SRC_DIS);
 		newp->reqpp = 0;
 		if(type == ONCE_ONLY) 
 		{
-			execute_service(newp->req_id);
+			ret = execute_service(newp->req_id);
 			id_free(newp->req_id, SRC_DIS);
 			free(newp);
-			clip = create_client(conn_id, servp, &new_client);
+			if(ret >= 0)
+				clip = create_client(conn_id, servp, &new_client);
 			return;
 		}
 		if(type == COMMAND) 
 		{
 			Curr_conn_id = conn_id;
-			execute_command(servp, dic_packet);
+			ret = execute_command(servp, dic_packet);
 			Curr_conn_id = 0;
+			if(!ret)
+			{
+				id_free(newp->req_id, SRC_DIS);
+				free(newp);
+				return;
+			}
 			reqp = servp->request_head;
 			while( (reqp = (REQUEST *) dll_get_next((DLL *)servp->request_head,
 				(DLL *) reqp)) ) 
@@ -1358,11 +1592,17 @@ printf("Received Request for %s, from %d  %s@%s\n",
 				}
 			}
 			if(!found)
-				dll_insert_queue( (DLL *) servp->request_head, (DLL *) newp );
+			{
+				SERVICE_LOCK(servp)
+				dll_insert_queue_unlocked( (DLL *) servp->request_head, (DLL *) newp );
+				SERVICE_UNLOCK(servp)
+			}
 			clip = create_client(conn_id, servp, &new_client);
 			return;
 		}
-		dll_insert_queue( (DLL *) servp->request_head, (DLL *) newp );
+		SERVICE_LOCK(servp)
+		dll_insert_queue_unlocked( (DLL *) servp->request_head, (DLL *) newp );
+		SERVICE_UNLOCK(servp)
 		clip = create_client(conn_id, servp, &new_client);
 		reqpp = (REQUEST_PTR *)malloc(sizeof(REQUEST_PTR));
 		reqpp->reqp = newp;
@@ -1370,7 +1610,9 @@ printf("Received Request for %s, from %d  %s@%s\n",
 		newp->reqpp = reqpp;
 		if((type != MONIT_ONLY) && (type != UPDATE))
 		{
-			execute_service(newp->req_id);
+			/* The connection is released if the first update cannot be sent */
+			if(execute_service(newp->req_id) < 0)
+				return;
 		}
 		if((type != MONIT_ONLY) && (type != MONIT_FIRST))
 		{
@@ -1394,13 +1636,9 @@ printf("Received Request for %s, from %d  %s@%s\n",
 
 /* A timeout for a timed or monitored service occured, serve it. */
 
-int execute_service( int req_id )
+static int encode_service_packet( DIS_STAMPED_PACKET *packet, int format, int stamped,
+					SERVICE *servp, int *buffp, int size )
 {
-	int *buffp, size;
-	register REQUEST *reqp;
-	register SERVICE *servp;
-	char str[80], def[MAX_NAME];
-	int conn_id, last_conn_id;
 	int *pkt_buffer, header_size, aux;
 #ifdef WIN32
 	struct timeb timebuf;
@@ -1410,6 +1648,257 @@ int execute_service( int req_id )
 #endif
 	FORMAT_STR format_data_cp[MAX_NAME/4];
 
+	if(stamped)
+	{
+		pkt_buffer = ((DIS_STAMPED_PACKET *)packet)->buffer;
+		header_size = DIS_STAMPED_HEADER;
+		if(!servp->user_secs)
+		{
+#ifdef WIN32
+			ftime(&timebuf);
+			aux = timebuf.millitm;
+			packet->time_stamp[0] = htovl(aux);
+			packet->time_stamp[1] = htovl((int)timebuf.time);
+#else
+			tz = 0;
+		        gettimeofday(&tv, tz);
+			aux = (int)tv.tv_usec / 1000;
+			packet->time_stamp[0] = htovl(aux);
+			packet->time_stamp[1] = htovl((int)tv.tv_sec);
+#endif
+		}
+		else
+		{
+			aux = /*0xc0de0000 |*/ servp->user_millisecs;
+			packet->time_stamp[0] = htovl(aux);
+			packet->time_stamp[1] = htovl(servp->user_secs);
+		}
+		packet->reserved[0] = (int)htovl(0xc0dec0de);
+		packet->quality = htovl(servp->quality);
+	}
+	else
+	{
+		pkt_buffer = ((DIS_PACKET *)packet)->buffer;
+		header_size = DIS_HEADER;
+	}
+	memcpy(format_data_cp, servp->format_data, sizeof(format_data_cp));
+	size = copy_swap_buffer_out(format, format_data_cp, 
+		pkt_buffer,
+		buffp, size);
+	packet->size = htovl(header_size + size);
+	return(header_size + size);
+}
+
+static int encode_fanout_packet( FANOUT *fanout, DIS_STAMPED_PACKET *packet, REQUEST *reqp,
+					SERVICE *servp, int *buffp, int size, int stamped )
+{
+	/* With a loan the packet holds only the header, its size counts the
+	 * loaned data written after it.
+	 */
+	int write_size;
+
+	if(fanout->loanp)
+	{
+		write_size = encode_service_packet(packet, reqp->format, stamped,
+			servp, buffp, 0) + size;
+		packet->size = htovl(write_size);
+	}
+	else
+		write_size = encode_service_packet(packet, reqp->format, stamped,
+			servp, buffp, size);
+	return(write_size);
+}
+
+static DIS_STAMPED_PACKET *get_fanout_packet( FANOUT *fanout, REQUEST *reqp, SERVICE *servp,
+					int *buffp, int size, int stamped, int *write_size )
+{
+	/* The packets are shared by the clients asking for the same encoding
+	 * of the same buffer. Only used for the services published from an
+	 * address or a loan, see update_service.
+	 */
+	FANOUT_PACKET *fanp;
+	int i, packet_size;
+
+	for(i = 0; i < fanout->n_packets; i++)
+	{
+		fanp = &fanout->packets[i];
+		if((fanp->format == reqp->format) && (fanp->stamped == stamped) &&
+			(fanp->buffp == buffp) && (fanp->size == size))
+		{
+			*write_size = fanp->write_size;
+			return(fanp->packet);
+		}
+	}
+	if(fanout->n_packets == MAX_FANOUT_PACKETS)
+		return((DIS_STAMPED_PACKET *)0);
+	fanp = &fanout->packets[fanout->n_packets];
+	packet_size = DIS_STAMPED_HEADER + (fanout->loanp ? 0 : size);
+	if( packet_size > fanp->packet_size ) 
+	{
+		if( fanp->packet_size )
+			free( fanp->packet );
+		fanp->packet = (DIS_STAMPED_PACKET *)malloc((size_t)packet_size);
+		if(!fanp->packet)
+		{
+			fanp->packet_size = 0;
+			return((DIS_STAMPED_PACKET *)0);
+		}
+		fanp->packet_size = packet_size;
+	}
+	fanp->format = reqp->format;
+	fanp->stamped = stamped;
+	fanp->buffp = buffp;
+	fanp->size = size;
+	fanp->write_size = encode_fanout_packet(fanout, fanp->packet, reqp, servp,
+		buffp, size, stamped);
+	fanout->n_packets++;
+	*write_size = fanp->write_size;
+	return(fanp->packet);
+}
+
+static FANOUT_SET *get_fanout_set( FANOUT *fanout, int defer )
+{
+	/* If defer is set the writes are only collected, to be sent by
+	 * write_fanout_set once the DIM lock or the service lock is released.
+	 */
+	FANOUT_SET *setp;
+	int i;
+
+	FANOUT_LOCK
+	for(i = 0; i < MAX_FANOUT_SETS; i++)
+	{
+		setp = &Dis_fanout_sets[i];
+		if(!setp->busy)
+		{
+			setp->busy = 1;
+			FANOUT_UNLOCK
+			setp->n_writes = 0;
+			fanout->n_packets = 0;
+			fanout->packets = setp->packets;
+			fanout->defer = defer ? setp : (FANOUT_SET *)0;
+			fanout->loanp = (DIS_LOAN *)0;
+			return(setp);
+		}
+	}
+	FANOUT_UNLOCK
+	return((FANOUT_SET *)0);
+}
+
+static void put_fanout_set( FANOUT_SET *setp )
+{
+	FANOUT_WRITE *writep;
+	int i;
+
+	for(i = 0, writep = setp->writes; i < setp->n_writes; i++, writep++)
+	{
+		if(writep->own)
+			free(writep->packet);
+	}
+	setp->n_writes = 0;
+	FANOUT_LOCK
+	setp->busy = 0;
+	FANOUT_UNLOCK
+}
+
+static int defer_service_write( FANOUT_SET *setp, REQUEST *reqp, DIS_STAMPED_PACKET *packetp,
+					int write_size, DIS_LOAN *loanp, int tag )
+{
+	/* The write generation of the connection is the one of the request,
+	 * the write is skipped if the connection was closed since.
+	 */
+	FANOUT_WRITE *writep;
+	int conn_id, n;
+
+	conn_id = reqp->conn_id;
+	if(setp->n_writes == setp->max_writes)
+	{
+		n = setp->max_writes ? setp->max_writes * 2 : 16;
+		writep = (FANOUT_WRITE *)realloc(setp->writes, (size_t)n * sizeof(FANOUT_WRITE));
+		if(!writep)
+			return(0);
+		setp->writes = writep;
+		setp->max_writes = n;
+	}
+	writep = &setp->writes[setp->n_writes++];
+	writep->req_id = reqp->req_id;
+	writep->conn_id = conn_id;
+	writep->gen = reqp->conn_gen;
+	writep->tag = tag;
+	writep->header[0] = packetp->size;
+	writep->header[1] = htovl(reqp->service_id);
+	writep->packet = packetp;
+	writep->own = 0;
+	writep->write_size = write_size;
+	writep->loanp = loanp;
+	if(loanp)
+		writep->write_size -= loanp->size;
+	writep->ret = 1;
+	writep->err.what = 0;
+	return(1);
+}
+
+static void write_fanout_set( FANOUT_SET *setp )
+{
+	/* Called without the DIM lock, the connections are protected by their
+	 * write locks and closed ones are detected by their write generation.
+	 */
+	FANOUT_WRITE *writep;
+	int i;
+
+	for(i = 0, writep = setp->writes; i < setp->n_writes; i++, writep++)
+	{
+		if(writep->loanp)
+			writep->ret = dna_write_nowait_shared(writep->conn_id, writep->gen,
+				writep->header, DIS_HEADER, (char *)writep->packet + DIS_HEADER,
+				writep->write_size - DIS_HEADER, &writep->loanp->shared,
+				writep->loanp->buffp, writep->loanp->size, writep->tag, &writep->err);
+		else
+			writep->ret = dna_write_nowait_gen(writep->conn_id, writep->gen,
+				writep->header, DIS_HEADER, (char *)writep->packet + DIS_HEADER,
+				writep->write_size - DIS_HEADER, writep->tag, &writep->err);
+	}
+}
+
+static void release_fanout_set( FANOUT_SET *setp, SERVICE *servp )
+{
+	/* Called with the DIM lock, the requests whose client could not be
+	 * written are released at the end of the update.
+	 */
+	FANOUT_WRITE *writep;
+	REQUEST *reqp;
+	int i, conn_id;
+
+	for(i = 0, writep = setp->writes; i < setp->n_writes; i++, writep++)
+	{
+		conn_id = writep->conn_id;
+		if(writep->ret || (Net_conns[conn_id].write_gen != writep->gen))
+			continue;
+		tcpip_report_write_error(conn_id, &writep->err);
+		if(Net_conns[conn_id].write_timedout)
+		{
+			dim_print_date_time();
+			printf(" Server (Explicitly) Updating Service %s: Couldn't write to Conn %3d : Client %s@%s\n",
+				servp->name, conn_id,
+				Net_conns[conn_id].task, Net_conns[conn_id].node);
+			fflush(stdout);
+		}
+		reqp = (REQUEST *)id_get_ptr(writep->req_id, SRC_DIS);
+		if(reqp && (reqp->conn_id == conn_id))
+			reqp->to_delete = 1;
+	}
+	put_fanout_set(setp);
+}
+
+static int do_execute_service( int req_id, FANOUT *fanout, DIS_LOAN *loanp, int droppable )
+{
+	int *buffp, size;
+	register REQUEST *reqp;
+	register SERVICE *servp;
+	char str[80], def[MAX_NAME];
+	int conn_id, last_conn_id;
+	int stamped, write_size;
+	DIS_STAMPED_PACKET *packetp;
+
 	reqp = (REQUEST *)id_get_ptr(req_id, SRC_DIS);
 	if(!reqp)
 		return(0);
@@ -1437,6 +1926,11 @@ printf("Updating %s for %s@%s (req_id = %d)\n",
 		size = 26;
 		sprintf(def,"c:26");
 	}
+	else if( loanp )
+	{
+		buffp = loanp->buffp;
+		size = loanp->size;
+	}
 	else if( servp->user_routine != 0 ) 
 	{
 		if(reqp->first_time)
@@ -1460,58 +1954,49 @@ printf("Updating %s for %s@%s (req_id = %d)\n",
 		reqp->delay_delete--;
 		return(0);
 	}
-	if( DIS_STAMPED_HEADER + size > Dis_packet_size ) 
+	stamped = ((reqp->type & 0xFF000) == STAMPED);
+	packetp = (DIS_STAMPED_PACKET *)0;
+	if(fanout)
+		packetp = get_fanout_packet(fanout, reqp, servp, buffp, size, stamped,
+			&write_size);
+	if(!packetp)
 	{
-		if( Dis_packet_size )
-			free( Dis_packet );
-		Dis_packet = (DIS_STAMPED_PACKET *)malloc((size_t)(DIS_STAMPED_HEADER + size));
-		if(!Dis_packet)
+		if( DIS_STAMPED_HEADER + size > Dis_packet_size ) 
 		{
-			reqp->delay_delete--;
-			return(0);
+			if( Dis_packet_size )
+				free( Dis_packet );
+			Dis_packet = (DIS_STAMPED_PACKET *)malloc((size_t)(DIS_STAMPED_HEADER + size));
+			if(!Dis_packet)
+			{
+				Dis_packet_size = 0;
+				reqp->delay_delete--;
+				return(0);
+			}
+			Dis_packet_size = DIS_STAMPED_HEADER + size;
 		}
-		Dis_packet_size = DIS_STAMPED_HEADER + size;
+		packetp = Dis_packet;
+		write_size = encode_service_packet(packetp, reqp->format, stamped,
+			servp, buffp, size);
 	}
-	Dis_packet->service_id = htovl(reqp->service_id);
-	if((reqp->type & 0xFF000) == STAMPED)
+	else if(fanout->defer)
 	{
-		pkt_buffer = ((DIS_STAMPED_PACKET *)Dis_packet)->buffer;
-		header_size = DIS_STAMPED_HEADER;
-		if(!servp->user_secs)
+		if(defer_service_write(fanout->defer, reqp, packetp, write_size, fanout->loanp,
+			droppable ? reqp->service_id : 0))
 		{
-#ifdef WIN32
-			ftime(&timebuf);
-			aux = timebuf.millitm;
-			Dis_packet->time_stamp[0] = htovl(aux);
-			Dis_packet->time_stamp[1] = htovl((int)timebuf.time);
-#else
-			tz = 0;
-		        gettimeofday(&tv, tz);
-			aux = (int)tv.tv_usec / 1000;
-			Dis_packet->time_stamp[0] = htovl(aux);
-			Dis_packet->time_stamp[1] = htovl((int)tv.tv_sec);
-#endif
+			reqp->delay_delete--;
+			return(1);
 		}
-		else
+/* A loaned packet has no data, it can only be written deferred */
+		if(fanout->loanp)
 		{
-			aux = /*0xc0de0000 |*/ servp->user_millisecs;
-			Dis_packet->time_stamp[0] = htovl(aux);
-			Dis_packet->time_stamp[1] = htovl(servp->user_secs);
+			reqp->delay_delete--;
+			return(0);
 		}
-		Dis_packet->reserved[0] = (int)htovl(0xc0dec0de);
-		Dis_packet->quality = htovl(servp->quality);
 	}
-	else
-	{
-		pkt_buffer = ((DIS_PACKET *)Dis_packet)->buffer;
-		header_size = DIS_HEADER;
-	}
-	memcpy(format_data_cp, servp->format_data, sizeof(format_data_cp));
-	size = copy_swap_buffer_out(reqp->format, format_data_cp, 
-		pkt_buffer,
-		buffp, size);
-	Dis_packet->size = htovl(header_size + size);
-	if( !dna_write_nowait(conn_id, Dis_packet, header_size + size) ) 
+	packetp->service_id = htovl(reqp->service_id);
+/* A broadcast update is superseded by the next one, a slow client may skip it */
+	if( !dna_write_nowait_tag(conn_id, packetp, write_size,
+		droppable ? reqp->service_id : 0) ) 
 	{
 		if(Net_conns[conn_id].write_timedout)
 		{
@@ -1536,8 +2021,10 @@ printf("Updating %s for %s@%s (req_id = %d)\n",
 		}
 		else
 		{
+			/* Releases the request too */
 			reqp->delay_delete = 0;
 			release_conn(conn_id, 1, 0);
+			return(-1);
 		}
 	}
 /*
@@ -1555,6 +2042,11 @@ printf("Updating %s for %s@%s (req_id = %d)\n",
 	return(1);
 }
 
+int execute_service( int req_id )
+{
+	return(do_execute_service(req_id, (FANOUT *)0, (DIS_LOAN *)0, 0));
+}
+
 void remove_service( int req_id )
 {
 	register REQUEST *reqp;
@@ -1586,35 +2078,75 @@ Has to be dna_write otherwise the client gets the message much before the DNS
 	}
 }
 
-void execute_command(SERVICE *servp, DIC_PACKET *packet)
+static int release_command(SERVICE *servp)
 {
-	int size;
+	/* Drops the hold of execute_command() on the service, returns 0 if it
+	   is being removed */
+	servp->delay_delete--;
+	if(!servp->to_delete)
+		return(1);
+	if(!servp->delay_delete)
+		dis_remove_service((unsigned)servp->id);
+	return(0);
+}
+
+int execute_command(SERVICE *servp, DIC_PACKET *packet)
+{
+	/* With several IO threads the user routine runs without the DIM lock,
+	   one at a time per command, the service is kept meanwhile. Returns 0
+	   if the service is being removed */
+	int size, ret = 1;
 	int format;
 	FORMAT_STR format_data_cp[MAX_NAME/4], *formatp;
-	static int *buffer;
-	static int buffer_size = 0;
-	int add_size;
+	static DIM_THREAD_LOCAL int *buffer;
+	static DIM_THREAD_LOCAL int buffer_size = 0;
+	int add_size, in_buffer = 0;
+	int *data = 0;
+	void *wait_handle = 0, *handle;
+	void (*user_routine)();
+	dim_long tag;
 
 	size = vtohl(packet->size) - DIC_HEADER;
-	add_size = size + (size/2);
-	if(!buffer_size)
+	if(servp->cb_owner)
+	{
+		/* A command of another client is handled by another thread, the
+		   packet is kept while waiting */
+		servp->delay_delete++;
+		wait_handle = dim_retain_data(packet);
+		while(servp->cb_owner && !servp->to_delete && (dim_lock_depth() == 1))
+			dim_wait_callbacks();
+		if(!release_command(servp))
+		{
+			dim_release_data(wait_handle);
+			return(0);
+		}
+	}
+	dis_set_timestamp(servp->id, 0, 0);
+	if(servp->user_routine && copy_swap_raw_format(servp->format_data))
 	{
-		buffer = (int *)malloc((size_t)add_size);
-		buffer_size = add_size;
-	} 
-	else 
+		/* Raw data is passed up in the receive buffer of the connection,
+		 * it can be kept past the callback with dim_retain_data()
+		 */
+		data = packet->buffer;
+		in_buffer = 1;
+	}
+	else if(servp->user_routine != 0)
 	{
-		if( add_size > buffer_size ) 
+		add_size = size + (size/2);
+		if(!buffer_size)
 		{
-			free(buffer);
 			buffer = (int *)malloc((size_t)add_size);
 			buffer_size = add_size;
+		} 
+		else 
+		{
+			if( add_size > buffer_size ) 
+			{
+				free(buffer);
+				buffer = (int *)malloc((size_t)add_size);
+				buffer_size = add_size;
+			}
 		}
-	}
-
-	dis_set_timestamp(servp->id, 0, 0);
-	if(servp->user_routine != 0)
-	{
 		format = vtohl(packet->format);
 		memcpy(format_data_cp, servp->format_data, sizeof(format_data_cp));
 		if((format & 0xF) == ((MY_FORMAT) & 0xF)) 
@@ -1637,8 +2169,36 @@ void execute_command(SERVICE *servp, DIC_PACKET *packet)
 		size = copy_swap_buffer_in(format_data_cp, 
 						 buffer, 
 						 packet->buffer, size);
-		(servp->user_routine)(&servp->tag, buffer, &size);
+		data = buffer;
+	}
+	if(servp->user_routine != 0)
+	{
+		/* The default handler queues the commands under the DIM lock */
+		Current_command = servp;
+		user_routine = servp->user_routine;
+		tag = servp->tag;
+		servp->cb_owner = (void *)&Current_command;
+		servp->delay_delete++;
+		if((user_routine != std_cmnd_handler) &&
+		   dna_unlock_callback(in_buffer ? data : 0, &handle))
+		{
+			(user_routine)(&tag, data, &size);
+			dna_lock_callback(handle);
+			servp->cb_owner = 0;
+			dim_callback_done();
+			ret = release_command(servp);
+		}
+		else
+		{
+			servp->cb_owner = 0;
+			servp->delay_delete--;
+			(servp->user_routine)(&servp->tag, data, &size);
+		}
+		Current_command = 0;
 	}
+	if(wait_handle)
+		dim_release_data(wait_handle);
+	return(ret);
 }
 
 void dis_report_service(char *serv_name)
@@ -1696,6 +2256,13 @@ int do_update_service();
 	return(do_update_service(service_id, client_ids));
 }
 
+static int raw_service_format( SERVICE *servp )
+{
+	/* Whether the data is sent as is to clients of any format
+	 */
+	return(copy_swap_raw_format(servp->format_data));
+}
+
 int check_client(REQUEST *reqp, int *client_ids)
 {
 	if(!client_ids)
@@ -1711,17 +2278,218 @@ int check_client(REQUEST *reqp, int *client_ids)
 	return(0);
 }
 
-int do_update_service(unsigned service_id, int *client_ids)
+static void release_deleted_requests( SERVICE *servp )
 {
+	/* Called with the DIM lock at the end of an update, releases the
+	 * requests whose client could not be written, or that were cancelled
+	 * while being updated.
+	 */
 	register REQUEST *reqp;
-	register SERVICE *servp;
 	REQUEST_PTR *reqpp;
 	CLIENT *clip;
+	int more, conn_id;
+	int release_request();
+
+	do
+	{
+		more = 0;
+		reqp = servp->request_head;
+		while( (reqp = (REQUEST *) dll_get_next((DLL *)servp->request_head,
+			(DLL *) reqp)) ) 
+		{
+			if(reqp->to_delete & 0x1)
+			{
+				more = 1;
+				reqp->to_delete = 0;
+				release_conn(reqp->conn_id, 1, 0);
+				break;
+			}
+			else if(reqp->to_delete & 0x2)
+			{
+				more = 1;
+				reqp->to_delete = 0;
+				reqpp = reqp->reqpp;
+				conn_id = reqp->conn_id;
+				release_request(reqp, reqpp, 1);
+				clip = find_client(conn_id);
+				if(clip)
+				{
+					if( dll_empty((DLL *)clip->requestp_head) ) 
+					{
+						release_conn( conn_id, 0, 0);
+					}
+				}
+				break;
+			}
+		}
+	}while(more);
+}
+
+#ifdef DIS_LOCKS
+static SERVICE *pin_service( unsigned service_id )
+{
+	/* Looks a service up without the DIM lock, it is not freed before
+	 * unpin_service.
+	 */
+	SERVICE *servp;
+
+	SERVICE_TABLE_LOCK
+	servp = (SERVICE *)id_get_ptr(service_id, SRC_DIS);
+	if(servp && (servp->id == (int)service_id))
+		servp->refs++;
+	else
+		servp = (SERVICE *)0;
+	SERVICE_TABLE_UNLOCK
+	return(servp);
+}
+
+static void unpin_service( SERVICE *servp )
+{
+	int service_id = 0;
+
+	SERVICE_TABLE_LOCK
+	servp->refs--;
+	if(!servp->refs && servp->to_delete)
+		service_id = servp->id;
+	SERVICE_TABLE_UNLOCK
+	if(service_id)
+		dis_remove_service((unsigned)service_id);
+}
+
+static int defer_update_write( FANOUT *fanout, REQUEST *reqp, SERVICE *servp,
+					int *buffp, int size, int tag )
+{
+	/* Called with the service lock, prepares the update of a request.
+	 * Without a packet to share one is allocated for this write.
+	 */
+	DIS_STAMPED_PACKET *packetp;
+	int stamped, write_size, own = 0;
+
+	stamped = ((reqp->type & 0xFF000) == STAMPED);
+	packetp = get_fanout_packet(fanout, reqp, servp, buffp, size, stamped,
+		&write_size);
+	if(!packetp)
+	{
+		packetp = (DIS_STAMPED_PACKET *)malloc((size_t)(DIS_STAMPED_HEADER +
+			(fanout->loanp ? 0 : size)));
+		if(!packetp)
+			return(0);
+		write_size = encode_fanout_packet(fanout, packetp, reqp, servp,
+			buffp, size, stamped);
+		own = 1;
+	}
+	if(!defer_service_write(fanout->defer, reqp, packetp, write_size, fanout->loanp, tag))
+	{
+		if(own)
+			free(packetp);
+		return(0);
+	}
+	fanout->defer->writes[fanout->defer->n_writes - 1].own = own;
+	return(1);
+}
+
+static int update_service_unlocked( unsigned service_id, int *client_ids, DIS_LOAN *loanp )
+{
+	/* Updates a service without the DIM lock: the service is pinned, its
+	 * requests are read and the packets encoded under its own lock, and
+	 * they are written once it is released. Only a failed write takes the
+	 * DIM lock, to release the client. A user routine may call DIM, the
+	 * services having one are updated this way only with given data.
+	 * Returns -1 if the update needs the DIM lock.
+	 */
+	register REQUEST *reqp;
+	SERVICE *servp;
+	FANOUT fanout;
+	FANOUT_SET *setp;
+	int *buffp, size;
+	int found = 0, failed = 0, i;
+
+	servp = pin_service(service_id);
+	if(!servp)
+		return(-1);
+	if((servp->type == COMMAND) || (servp->user_routine && !loanp))
+	{
+		unpin_service(servp);
+		return(-1);
+	}
+	setp = get_fanout_set(&fanout, 1);
+	if(!setp)
+	{
+		unpin_service(servp);
+		return(-1);
+	}
+	if(loanp)
+	{
+		buffp = loanp->buffp;
+		size = loanp->size;
+		if(loanp->release && raw_service_format(servp))
+			fanout.loanp = loanp;
+	}
+	SERVICE_LOCK(servp)
+	if(!loanp)
+	{
+		buffp = servp->address;
+		size = servp->size;
+	}
+	reqp = servp->request_head;
+	while( (reqp = (REQUEST *) dll_get_next_unlocked((DLL *)servp->request_head,
+		(DLL *) reqp)) ) 
+	{
+		if(((reqp->type & 0xFFF) == COMMAND) || ((reqp->type & 0xFFF) == TIMED_ONLY))
+			continue;
+		if(!check_client(reqp, client_ids))
+			continue;
+/* A broadcast update is superseded by the next one, a slow client may skip it */
+		if(defer_update_write(&fanout, reqp, servp, buffp, size,
+			(client_ids == 0) ? reqp->service_id : 0))
+			found++;
+	}
+	SERVICE_UNLOCK(servp)
+	write_fanout_set(setp);
+	for(i = 0; i < setp->n_writes; i++)
+	{
+		if(!setp->writes[i].ret)
+			failed = 1;
+	}
+	if(failed)
+	{
+		dim_lock();
+		release_fanout_set(setp, servp);
+		release_deleted_requests(servp);
+		dim_unlock();
+	}
+	else
+		put_fanout_set(setp);
+	unpin_service(servp);
+	return(found);
+}
+#endif
+
+static int update_service(unsigned service_id, int *client_ids, DIS_LOAN *loanp)
+{
+#ifdef DIS_LOCKS
+	int found;
+
+	if(service_id && tcpip_unlocked_writes() && !DIM_Threads_OFF)
+	{
+		found = update_service_unlocked(service_id, client_ids, loanp);
+		if(found >= 0)
+			return(found);
+	}
+#endif
+	return(update_service_locked(service_id, client_ids, loanp));
+}
+
+static int update_service_locked(unsigned service_id, int *client_ids, DIS_LOAN *loanp)
+{
+	register REQUEST *reqp;
+	register SERVICE *servp;
 	register int found = 0;
-	int to_delete = 0, more, conn_id;
+	int to_delete = 0;
 	char str[128];
-	int release_request();
-	int n_clients = 0;
+	int n_clients = 0, unlocked = 0;
+	FANOUT fanout, *fanoutp = (FANOUT *)0;
+	FANOUT_SET *setp = (FANOUT_SET *)0;
 
 	DISABLE_AST
 	if(Serving == -1)
@@ -1747,7 +2515,7 @@ int do_update_service(unsigned service_id, int *client_ids)
 		ENABLE_AST
 		return(found);
 	}
-	servp->delay_delete = 1;
+	servp->delay_delete++;
 	reqp = servp->request_head;
 	while( (reqp = (REQUEST *) dll_get_next((DLL *)servp->request_head,
 		(DLL *) reqp)) ) 
@@ -1771,6 +2539,22 @@ printf("Updating %s (id = %d, ptr = %08lX) for %s@%s (req_id = %d, req_ptr = %08
 	{
 	DISABLE_AST
 	Last_n_clients = n_clients;
+/* Without a free fan-out set the data is encoded per client. Holding the
+   DIM lock only once, the writes are sent after releasing it. The writes
+   of a loan are always collected, its packets have no data. A user routine
+   may return the same buffer with per-client contents, its packets are
+   never shared */
+	if(((n_clients > 1) && !servp->user_routine) || loanp)
+	{
+		unlocked = (dim_lock_depth() == 1) && tcpip_unlocked_writes();
+		setp = get_fanout_set(&fanout, unlocked || loanp);
+		if(setp)
+		{
+			fanoutp = &fanout;
+			if(loanp && loanp->release && raw_service_format(servp))
+				fanout.loanp = loanp;
+		}
+	}
 	reqp = servp->request_head;
 	while( (reqp = (REQUEST *) dll_get_next((DLL *)servp->request_head,
 		(DLL *) reqp)) ) 
@@ -1784,7 +2568,7 @@ printf("Updating %s (id = %d, ptr = %08lX) for %s@%s (req_id = %d, req_ptr = %08
 /*
 				DISABLE_AST
 */
-				execute_service(reqp->req_id);
+				do_execute_service(reqp->req_id, fanoutp, loanp, (client_ids == 0));
 				found++;
 				ENABLE_AST
 				{
@@ -1794,8 +2578,21 @@ printf("Updating %s (id = %d, ptr = %08lX) for %s@%s (req_id = %d, req_ptr = %08
 		}
 		}
 	}
+	if(setp && fanout.defer && !unlocked)
+		write_fanout_set(setp);
+	if(setp && !(fanout.defer && unlocked))
+		release_fanout_set(setp, servp);
 	ENABLE_AST
 	}
+	if(setp && fanout.defer && unlocked)
+	{
+		write_fanout_set(setp);
+		{
+		DISABLE_AST
+		release_fanout_set(setp, servp);
+		ENABLE_AST
+		}
+	}
 	{
 	DISABLE_AST
 	reqp = servp->request_head;
@@ -1814,45 +2611,13 @@ printf("Updating %s (id = %d, ptr = %08lX) for %s@%s (req_id = %d, req_ptr = %08
 	if(to_delete)
 	{
 		DISABLE_AST
-		do
-		{
-			more = 0;
-			reqp = servp->request_head;
-			while( (reqp = (REQUEST *) dll_get_next((DLL *)servp->request_head,
-				(DLL *) reqp)) ) 
-			{
-				if(reqp->to_delete & 0x1)
-				{
-					more = 1;
-					reqp->to_delete = 0;
-					release_conn(reqp->conn_id, 1, 0);
-					break;
-				}
-				else if(reqp->to_delete & 0x2)
-				{
-					more = 1;
-					reqp->to_delete = 0;
-					reqpp = reqp->reqpp;
-					conn_id = reqp->conn_id;
-					release_request(reqp, reqpp, 1);
-					clip = find_client(conn_id);
-					if(clip)
-					{
-						if( dll_empty((DLL *)clip->requestp_head) ) 
-						{
-							release_conn( conn_id, 0, 0);
-						}
-					}
-					break;
-				}
-			}
-		}while(more);
+		release_deleted_requests(servp);
 		ENABLE_AST
 	}
 	{
 	DISABLE_AST
-	servp->delay_delete = 0;
-	if(servp->to_delete)
+	servp->delay_delete--;
+	if(!servp->delay_delete && servp->to_delete)
 	{
 		dis_remove_service(servp->id);
 	}
@@ -1862,6 +2627,67 @@ printf("Updating %s (id = %d, ptr = %08lX) for %s@%s (req_id = %d, req_ptr = %08
 	return(found);
 }
 
+int do_update_service(unsigned service_id, int *client_ids)
+{
+	return(update_service(service_id, client_ids, (DIS_LOAN *)0));
+}
+
+static void release_loan( TCPIP_SHARED *sharedp )
+{
+	DIS_LOAN *loanp = (DIS_LOAN *)sharedp;
+
+	loanp->release(loanp->arg);
+	free(loanp);
+}
+
+int dis_update_service_loan(unsigned service_id, int *client_ids, void *buffer, int size,
+	void (*release)(void *), void *arg)
+{
+	/* Update the service with data loaned by the caller, to all clients or
+	 * to a 0 terminated list. The data is not copied when the service format
+	 * needs no conversion: the subscribers that cannot take it immediately
+	 * keep it queued. release(arg) is called once it is no longer used,
+	 * possibly before returning and holding internal DIM locks: it must not
+	 * call DIM.
+	 */
+	DIS_LOAN *loanp;
+	int found;
+
+	loanp = (DIS_LOAN *)malloc(sizeof(DIS_LOAN));
+	if(!loanp)
+	{
+		release(arg);
+		return(0);
+	}
+	loanp->shared.refs = 1;
+	loanp->shared.release = release_loan;
+	loanp->buffp = (int *)buffer;
+	loanp->size = size;
+	loanp->release = release;
+	loanp->arg = arg;
+	found = update_service(service_id, client_ids, loanp);
+	tcpip_shared_release(&loanp->shared);
+	return(found);
+}
+
+int dis_update_service_copy(unsigned service_id, int *client_ids, void *buffer, int size)
+{
+	/* Update the service with the given data instead of the one of its
+	 * address or user routine, to all clients or to a 0 terminated list.
+	 * The data is copied before returning. Unless a client cannot be
+	 * written, the update does not take the DIM lock.
+	 */
+	DIS_LOAN copy;
+
+	copy.shared.refs = 1;
+	copy.shared.release = 0;
+	copy.buffp = (int *)buffer;
+	copy.size = size;
+	copy.release = 0;
+	copy.arg = 0;
+	return(update_service(service_id, client_ids, &copy));
+}
+
 int dis_get_n_clients(unsigned service_id)
 {
 	register REQUEST *reqp;
@@ -1949,7 +2775,9 @@ void dis_set_quality( unsigned serv_id, int quality )
 	    ENABLE_AST
 		return;
 	}
+	SERVICE_LOCK(servp)
 	servp->quality = quality;
+	SERVICE_UNLOCK(servp)
 	ENABLE_AST
 }
 
@@ -1983,6 +2811,7 @@ int dis_set_timestamp( unsigned serv_id, int secs, int millisecs )
 	    ENABLE_AST
 		return(0);
 	}
+	SERVICE_LOCK(servp)
 	if(secs == 0)
 	{
 #ifdef WIN32
@@ -2004,6 +2833,7 @@ int dis_set_timestamp( unsigned serv_id, int secs, int millisecs )
 */
 		servp->user_millisecs = millisecs;
 	}
+	SERVICE_UNLOCK(servp)
 	ENABLE_AST
 	return(1);
 }
@@ -2141,18 +2971,36 @@ int dis_remove_service(unsigned service_id)
 		ENABLE_AST
 		return(found);
 	}
+	/* The user routine may be running in another thread */
+	while(servp->cb_owner && (servp->cb_owner != (void *)&Current_command) &&
+	      (dim_lock_depth() == 1))
+	{
+		dim_wait_callbacks();
+		servp = (SERVICE *)id_get_ptr(service_id, SRC_DIS);
+		if(!servp || (servp->id != (int)service_id))
+		{
+			ENABLE_AST
+			return(found);
+		}
+	}
 if(Debug_on)
 {
 dim_print_date_time();
  printf("Removing service %s, delay_delete = %d\n",
 	servp->name, servp->delay_delete);
 }
-	if(servp->delay_delete)
+	/* An update in progress removes it when done */
+	SERVICE_TABLE_LOCK
+	if(servp->delay_delete || servp->refs)
 	{
 		servp->to_delete = 1;
+		SERVICE_TABLE_UNLOCK
 		ENABLE_AST
 		return(found);
 	}
+	/* No update can pin it any more */
+	id_free(servp->id, SRC_DIS);
+	SERVICE_TABLE_UNLOCK
 	/* remove from name server */
 	
 	dnsp = servp->dnsp;
@@ -2174,8 +3022,10 @@ dim_print_date_time();
 	if(servp->id == (int)dnsp->dis_client_id)
 	  dnsp->dis_client_id = 0;
 	dis_hash_service_remove(servp);
-	id_free(servp->id, SRC_DIS);
 	free(servp->request_head);
+#ifdef DIS_LOCKS
+	pthread_mutex_destroy(&servp->lock);
+#endif
 	free(servp);
 /*
 	if(dnsp != Default_DNS)
@@ -2315,6 +3165,9 @@ printf("Cleaning dnsp variables\n");
 
 	dnsp->dis_first_time = 1;
 	dnsp->dis_n_services = 0;
+	dnsp->n_unreg_services = 0;
+	dnsp->held_updates = 0;
+	dnsp->removed_length = 0;
 	dnsp->dis_dns_packet.size = 0;
 	dnsp->dis_dns_packet.src_type = 0;
 	close_dns(dnsp->dnsid, SRC_DIS);
@@ -2656,7 +3509,9 @@ int release_request(REQUEST *reqp, REQUEST_PTR *reqpp, int remove)
 	conn_id = reqp->conn_id;
 	if(reqpp)
 		dll_remove((DLL *)reqpp);
-	dll_remove((DLL *)reqp);
+	SERVICE_LOCK(reqp->service_ptr)
+	dll_remove_unlocked((DLL *)reqp);
+	SERVICE_UNLOCK(reqp->service_ptr)
 	if(reqp->timr_ent)
 		dtq_rem_entry(Dis_timer_q, reqp->timr_ent);
 	id_free(reqp->req_id, SRC_DIS);
@@ -2964,7 +3819,7 @@ void service_info(dim_long *tag, int **bufp, int *size, int *first_time)
 	int hash_index;
 
 	DISABLE_AST
-	max_size = (dnsp->dis_n_services+10) * (MAX_NAME*2 + 4);
+	max_size = (dnsp->dis_n_services+10) * (MAX_NAME*2 + 4) + dnsp->removed_length;
 	if(!curr_allocated_size)
 	{
 		service_info_buffer = (char *)malloc((size_t)max_size);
@@ -3002,6 +3857,12 @@ void service_info(dim_long *tag, int **bufp, int *size, int *first_time)
 	}
 	else
 	{
+		/* The services removed while the DNS updates were held */
+		if(dnsp->removed_length)
+		{
+			strcpy(buff_ptr, dnsp->removed_list);
+			buff_ptr += dnsp->removed_length;
+		}
 		while( (servp = dis_hash_service_get_next(&hash_index, servp, 0)) )
 		{
 			if(servp->dnsp != dnsp)
@@ -3225,31 +4086,21 @@ static void error_handler(int conn_id, int severity, int errcode, char *reason,
 		exit_handler(&exit_tag, &exit_code, &exit_size);
 	}
 }
-/*
-#define MAX_HASH_ENTRIES 2000
-*/
-#define MAX_HASH_ENTRIES 5000
-
-static SERVICE *Service_hash_table[MAX_HASH_ENTRIES];
-static int Service_new_entries[MAX_HASH_ENTRIES];
+/* Services by name. Service_new_entries counts the ones inserted and not
+   yet registered with a DNS, when there are none the DNS update of new
+   services does not need to look at the table */
+static NAME_TABLE Service_table;
+static int Service_new_entries = 0;
 
 int dis_hash_service_init()
 {
 
-  int i;
   static int done = 0;
 
   if(!done)
   {
-	for( i = 0; i < MAX_HASH_ENTRIES; i++ ) 
-	{
-/*
-		Service_hash_table[i] = (SERVICE *) malloc(sizeof(SERVICE));
-		dll_init((DLL *) Service_hash_table[i]);
-*/
-		Service_hash_table[i] = 0;
-		Service_new_entries[i] = 0;
-	}
+	name_table_init(&Service_table, (int)offsetof(SERVICE, name));
+	Service_new_entries = 0;
 	done = 1;
   }
 
@@ -3258,101 +4109,68 @@ int dis_hash_service_init()
 
 int dis_hash_service_insert(SERVICE *servp)
 {
-	int index;
-	index = HashFunction(servp->name, MAX_HASH_ENTRIES);
-	if(!Service_hash_table[index])
-	{
-		Service_hash_table[index] = (SERVICE *) malloc(sizeof(SERVICE));
-		dll_init((DLL *) Service_hash_table[index]);
-	}
-	Service_new_entries[index]++;
-	dll_insert_queue((DLL *) Service_hash_table[index], 
-			 (DLL *) servp);
+	servp->new_entry = 1;
+	Service_new_entries++;
+	SERVICE_TABLE_LOCK
+	name_table_insert(&Service_table, servp);
+	SERVICE_TABLE_UNLOCK
 	return(1);
 }
 
 int dis_hash_service_registered(int index, SERVICE *servp)
 {
+	if(index){}
 	servp->registered = 1;
-	Service_new_entries[index]--;
-	if(Service_new_entries[index] < 0)
-		Service_new_entries[index] = 0;
+	if(servp->new_entry)
+	{
+		servp->new_entry = 0;
+		Service_new_entries--;
+	}
 	return 1;
 }
 
 int dis_hash_service_remove(SERVICE *servp)
 {
-	int index;
-	index = HashFunction(servp->name, MAX_HASH_ENTRIES);
-	if(!Service_hash_table[index])
+	int removed;
+
+	SERVICE_TABLE_LOCK
+	removed = name_table_remove(&Service_table, servp);
+	SERVICE_TABLE_UNLOCK
+	if(!removed)
 	{
 		return(0);
 	}
-	dll_remove( (DLL *) servp );
+	if(servp->new_entry)
+	{
+		servp->new_entry = 0;
+		Service_new_entries--;
+	}
 	return(1);
 }
 
 
 SERVICE *dis_hash_service_exists(char *name)
 {
-	int index;
-	SERVICE *servp;
-
-	index = HashFunction(name, MAX_HASH_ENTRIES);
-	if(!Service_hash_table[index])
-	{
-		return((SERVICE *)0);
-	}
-	if( (servp = (SERVICE *) dll_search(
-					(DLL *) Service_hash_table[index],
-			      		name, (int)strlen(name)+1)) )
-	{
-		return(servp);
-	}
-	return((SERVICE *)0);
-}			
+	return((SERVICE *)name_table_find(&Service_table, name));
+}
 
+/* Iterates over the services: *curr_index is the table slot of prevp, -1 to
+   start. With a slot but no prevp the slot is looked at again, the service
+   following a removed one can have moved into its slot */
 SERVICE *dis_hash_service_get_next(int *curr_index, SERVICE *prevp, int new_entries)
 {
 	int index;
-	SERVICE *servp = 0;
-/*
-	if(!prevp)
+	SERVICE *servp;
+
+	if((new_entries) && (!Service_new_entries))
 	{
-		index = -1;
+		*curr_index = -1;
+		return((SERVICE *) 0);
 	}
-*/
 	index = *curr_index;
-	if(index == -1)
-	{
-		index++;
-		prevp = Service_hash_table[index];
-	}
-	if(!prevp)
-	{
-		prevp = Service_hash_table[index];
-	}
-	do
-	{
-		if(prevp)
-		{
-			if((!new_entries) || (Service_new_entries[index] > 0))
-			{
-				servp = (SERVICE *) dll_get_next(
-						(DLL *) Service_hash_table[index],
-						(DLL *) prevp);
-				if(servp)
-					break;
-			}
-		}
-		index++;
-		if(index == MAX_HASH_ENTRIES)
-		{
-			*curr_index = -1;
-			return((SERVICE *) 0);
-		}
-		prevp = Service_hash_table[index];
-	} while(!servp);
+	if((index != -1) && (!prevp))
+		index--;
+	servp = (SERVICE *)name_table_next(&Service_table, &index);
 	*curr_index = index;
 	return(servp);
 }
@@ -3405,31 +4223,25 @@ DIS_DNS_CONN *find_dns_by_conn_id(int conn_id)
 void dis_print_hash_table()
 {
 	SERVICE *servp;
-	int i;
+	int i, index;
 	int n_entries, max_entry_index = 0;
 	int max_entries = 0;
 
-	for( i = 0; i < MAX_HASH_ENTRIES; i++ ) 
+	/* The longest probe sequence, from the home slot of a service */
+	for( i = 0; i < Service_table.size; i++ ) 
 	{
-		n_entries = 0;
-		servp = Service_hash_table[i];
-		while( (servp = (SERVICE *) dll_get_next(
-						(DLL *) Service_hash_table[i],
-						(DLL *) servp)) )
-		{
-			n_entries++;
-			if(n_entries == 1)
-				printf("    Name = %s\n",servp->name);
-		}
-		if(n_entries != 0)
-			printf("HASH[%d] - %d entries\n", i, n_entries);
+		if( !(servp = (SERVICE *)Service_table.slots[i].item) )
+			continue;
+		index = (int)(Service_table.slots[i].hash & (unsigned)(Service_table.size - 1));
+		n_entries = ((i - index) & (Service_table.size - 1)) + 1;
 		if(n_entries > max_entries)
 		{
 			max_entries = n_entries;
 			max_entry_index = i;
 		}
 	}
-	printf("Maximum : HASH[%d] - %d entries\n", max_entry_index, max_entries);  
+	printf("%d services in %d slots\n", Service_table.n_items, Service_table.size);
+	printf("Maximum : HASH[%d] - %d probes\n", max_entry_index, max_entries);  
 	fflush(stdout);
 }
 
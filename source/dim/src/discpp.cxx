@@ -1252,6 +1252,24 @@ int DimService::selectiveUpdateService( void *structure, int size, int *cids )
 	}
 	return -1;
 }
+
+int DimService::loanUpdateService( void *structure, int size, int *cids,
+	void (*release)(void *), void *arg )
+{
+	if(!itsId)
+	{
+		release(arg);
+		return 0;
+	}
+	return dis_update_service_loan( itsId, cids, structure, size, release, arg );
+}
+
+int DimService::copyUpdateService( void *structure, int size, int *cids )
+{
+	if(!itsId)
+		return 0;
+	return dis_update_service_copy( itsId, cids, structure, size );
+}
 	
 void DimService::setQuality(int quality)
 {
@@ -1486,13 +1504,15 @@ char *DimCommand::getName()
 
 DimCommand::~DimCommand()
 {
+	// Not holding the DIM lock, to wait for a commandHandler() running
+	// in another IO thread
+	if(itsId)
+		dis_remove_service( itsId );
 	DISABLE_AST
 	delete[] itsName;
 	delete[] itsFormat;
 //	if(itsTagId)
 //		id_free(itsTagId, SRC_DIS);
-	if(itsId)
-		dis_remove_service( itsId );
 	itsId = 0;
 	ENABLE_AST
 }
@@ -1513,14 +1533,16 @@ DimRpc::DimRpc(DimServerDns *dns, const char *name, const char *formatin, const
 
 DimRpc::~DimRpc()
 {
+	// Not holding the DIM lock, to wait for an rpcHandler() running in
+	// another IO thread
+	if(itsIdIn)
+		dis_remove_service( itsIdIn );
 	DISABLE_AST
 	delete[] itsName;
 	delete[] itsNameIn;
 	delete[] itsNameOut;
 //	if(itsTagId)
 //		id_free(itsTagId, SRC_DIS);
-	if(itsIdIn)
-		dis_remove_service( itsIdIn );
 	if(itsIdOut)
 		dis_remove_service( itsIdOut );
 	itsIdIn = 0;
@@ -20,29 +20,42 @@ void dll_init( DLL* head )
 }
 
 
-void dll_insert_queue( DLL* head, DLL* item )
+/* The _unlocked versions do not take the DIM lock, for the lists guarded
+   by a lock of their own: the request lists of the services (dis.c) and
+   the timer queues (dtq.c) */
+void dll_insert_queue_unlocked( DLL* head, DLL* item )
 {
 	register DLL *prevp;
 
-	DISABLE_AST
 	item->next = head;
 	prevp = head->prev;
 	item->prev = prevp;
 	prevp->next = item;
 	head->prev = item;
+}
+
+void dll_insert_queue( DLL* head, DLL* item )
+{
+	DISABLE_AST
+	dll_insert_queue_unlocked(head, item);
 	ENABLE_AST
 }	
 
-void dll_insert_after( DLL* atitem, DLL* item )
+void dll_insert_after_unlocked( DLL* atitem, DLL* item )
 {
 	register DLL *auxp;
 
-	DISABLE_AST
 	auxp = atitem->next;
 	item->next = auxp;
 	item->prev = atitem;
 	atitem->next = item;
 	auxp->prev = item;
+}
+
+void dll_insert_after( DLL* atitem, DLL* item )
+{
+	DISABLE_AST
+	dll_insert_after_unlocked(atitem, item);
 	ENABLE_AST
 }	
 
@@ -63,15 +76,21 @@ DLL *dll_search( DLL* head, char *data, int size )
 }
 
 
+DLL *dll_get_next_unlocked( DLL* head, DLL* item )
+{
+	if( item->next != head )
+		return(item->next);
+	return((DLL *) 0);
+}
+
 DLL *dll_get_next( DLL* head, DLL* item )
 {
+	DLL *nextp;
+
 	DISABLE_AST
-	if( item->next != head ) {
-		ENABLE_AST
-		return(item->next);
-	}
+	nextp = dll_get_next_unlocked(head, item);
 	ENABLE_AST
-	return((DLL *) 0);
+	return(nextp);
 }
 
 DLL *dll_get_prev( DLL* head, DLL* item )
@@ -85,27 +104,36 @@ DLL *dll_get_prev( DLL* head, DLL* item )
 	return((DLL *) 0);
 }
 
+int dll_empty_unlocked( DLL* head )
+{
+	return(head->next == head);
+}
+
 int dll_empty( DLL* head )
 {
+	int empty;
+
 	DISABLE_AST
-	if( head->next != head ) {
-		ENABLE_AST
-		return(0);
-	}
+	empty = dll_empty_unlocked(head);
 	ENABLE_AST
-	return(1);
+	return(empty);
 }
 
 
-void dll_remove( DLL* item ) 
+void dll_remove_unlocked( DLL* item )
 {
 	register DLL *prevp, *nextp;
 
-	DISABLE_AST
 	prevp = item->prev;
 	nextp = item->next;
 	prevp->next = item->next;
 	nextp->prev = prevp;
+}
+
+void dll_remove( DLL* item ) 
+{
+	DISABLE_AST
+	dll_remove_unlocked(item);
 	ENABLE_AST
 }	
 
@@ -40,6 +40,25 @@ static PENDING_OPEN Pending_conns_tmout[MAX_TMOUT_PENDING_CONNS];
 
 static int DNA_Initialized = FALSE;
 
+/* Receive buffers retained past their delivery by dim_retain_data(),
+ * released buffers are kept for the connections to read into
+ */
+typedef struct dna_rbuf {
+	struct dna_rbuf *next;
+	int refs;
+	int size;
+	int *buffer;
+} DNA_RBUF;
+
+#define MAX_FREE_RBUFS 16
+#define MAX_FREE_RBUF_BYTES (64*1024*1024)
+static DNA_RBUF *Free_rbufs = 0;
+static int N_free_rbufs = 0;
+static int Free_rbuf_bytes = 0;
+/* The delivery in progress in the calling thread */
+static DIM_THREAD_LOCAL int Curr_read_conn_id = 0;
+static DIM_THREAD_LOCAL DNA_RBUF *Curr_read_rbuf = 0;
+
 extern int Tcpip_max_io_data_write;
 extern int Tcpip_max_io_data_read;
 
@@ -111,10 +130,16 @@ static int is_header( int conn_id )
 	return(ret);
 }
 
-static void read_data( int conn_id)
+static int read_data( int conn_id)
 {
+	/* Returns 0 if the connection was closed meanwhile, the user routines
+	 * may have run without the DIM lock
+	 */
 	register DNA_CONNECTION *dna_connp = &Dna_conns[conn_id];
+	int prev_conn_id, gen;
+	DNA_RBUF *prev_rbufp, *rbufp;
 
+	gen = Net_conns[conn_id].write_gen;
 	if( !dna_connp->saw_init &&
 	    vtohl(dna_connp->buffer[0]) == (int)OPN_MAGIC)
 	{
@@ -126,9 +151,160 @@ static void read_data( int conn_id)
 /*
 printf("passing up %d bytes, conn_id %d\n",dna_connp->full_size, conn_id); 
 */
+		prev_conn_id = Curr_read_conn_id;
+		prev_rbufp = Curr_read_rbuf;
+		Curr_read_conn_id = conn_id;
+		Curr_read_rbuf = 0;
 		dna_connp->read_ast(conn_id, dna_connp->buffer,
 			dna_connp->full_size, STA_DATA);
+		rbufp = Curr_read_rbuf;
+		Curr_read_conn_id = prev_conn_id;
+		Curr_read_rbuf = prev_rbufp;
+		if(rbufp)
+			dim_release_data(rbufp);
 	}
+	return(Net_conns[conn_id].write_gen == gen);
+}
+
+static DNA_RBUF *detach_read_buffer( int conn_id )
+{
+	/* Hand the receive buffer of the connection over to a retained
+	 * buffer, the connection goes on with a released one
+	 */
+	register DNA_CONNECTION *dna_connp = &Dna_conns[conn_id];
+	DNA_RBUF *rbufp, **rbufpp, **bestpp = 0;
+	int *buffer;
+	int buffer_size;
+
+	for(rbufpp = &Free_rbufs; *rbufpp; rbufpp = &(*rbufpp)->next)
+	{
+		if(!bestpp)
+			bestpp = rbufpp;
+		if( (*rbufpp)->size >= dna_connp->buffer_size )
+		{
+			bestpp = rbufpp;
+			break;
+		}
+	}
+	if(bestpp)
+	{
+		rbufp = *bestpp;
+		*bestpp = rbufp->next;
+		N_free_rbufs--;
+		Free_rbuf_bytes -= rbufp->size;
+		buffer = rbufp->buffer;
+		buffer_size = rbufp->size;
+	}
+	else
+	{
+		if(!(rbufp = (DNA_RBUF *)malloc(sizeof(DNA_RBUF))))
+			return(0);
+		buffer_size = TCP_RCV_BUF_SIZE;
+		if(!(buffer = (int *)malloc((size_t)buffer_size)))
+		{
+			free(rbufp);
+			return(0);
+		}
+	}
+	rbufp->next = 0;
+	rbufp->refs = 1;
+	rbufp->buffer = dna_connp->buffer;
+	rbufp->size = dna_connp->buffer_size;
+	dna_connp->buffer = buffer;
+	dna_connp->buffer_size = buffer_size;
+	return(rbufp);
+}
+
+void *dim_retain_data( void *data )
+{
+	/* Keep data received in the current callback valid after it returns,
+	 * returns the handle to give to dim_release_data() or 0 if the data
+	 * is not in a receive buffer
+	 */
+	register DNA_CONNECTION *dna_connp;
+	DNA_RBUF *rbufp = 0;
+	char *ptr = (char *)data;
+
+	DISABLE_AST
+	if(Curr_read_rbuf)
+	{
+		if( (ptr >= (char *)Curr_read_rbuf->buffer) &&
+		    (ptr <= (char *)Curr_read_rbuf->buffer + Curr_read_rbuf->size) )
+		{
+			rbufp = Curr_read_rbuf;
+			rbufp->refs++;
+		}
+	}
+	else if(Curr_read_conn_id)
+	{
+		dna_connp = &Dna_conns[Curr_read_conn_id];
+		if( dna_connp->buffer && (ptr >= (char *)dna_connp->buffer) &&
+		    (ptr <= (char *)dna_connp->buffer + dna_connp->full_size) )
+		{
+			if( (rbufp = detach_read_buffer(Curr_read_conn_id)) )
+			{
+				/* one reference for the delivery, one for the caller */
+				rbufp->refs++;
+				Curr_read_rbuf = rbufp;
+			}
+		}
+	}
+	ENABLE_AST
+	return(rbufp);
+}
+
+void dim_release_data( void *handle )
+{
+	DNA_RBUF *rbufp = (DNA_RBUF *)handle;
+
+	if(!rbufp)
+		return;
+	DISABLE_AST
+	if(--rbufp->refs == 0)
+	{
+		if( (N_free_rbufs < MAX_FREE_RBUFS) &&
+		    (Free_rbuf_bytes + rbufp->size <= MAX_FREE_RBUF_BYTES) )
+		{
+			rbufp->next = Free_rbufs;
+			Free_rbufs = rbufp;
+			N_free_rbufs++;
+			Free_rbuf_bytes += rbufp->size;
+		}
+		else
+		{
+			free(rbufp->buffer);
+			free(rbufp);
+		}
+	}
+	ENABLE_AST
+}
+
+int dna_unlock_callback( void *data, void **handle )
+{
+	/* Called by the upper layers before a user routine of the delivery in
+	 * progress. With several IO threads it runs without the DIM lock, the
+	 * reading thread doesn't read the connection meanwhile so the callbacks
+	 * of a connection stay in order. Returns 1 after releasing the lock,
+	 * data (if in the receive buffer) is kept until dna_lock_callback().
+	 */
+	*handle = 0;
+	if( !Curr_read_conn_id || (dim_get_io_threads() < 2) ||
+	    (dim_lock_depth() != 1) || !dim_in_dim_thread() )
+		return(0);
+	if(data)
+		*handle = dim_retain_data(data);
+	DIM_UNLOCK
+	return(1);
+}
+
+void dna_lock_callback( void *handle )
+{
+	/* Takes the DIM lock back after dna_unlock_callback(), the service and
+	 * the connection may be gone
+	 */
+	DIM_LOCK
+	if(handle)
+		dim_release_data(handle);
 }
 
 static void ast_read_h( int conn_id, int status, int size )
@@ -200,9 +376,11 @@ static void ast_read_h( int conn_id, int status, int size )
 				}
 				break;
 			case RD_DATA :
-				read_data(conn_id);
-				dna_connp->state = RD_HDR;
-				dna_start_read(conn_id, READ_HEADER_SIZE);
+				if(read_data(conn_id))
+				{
+					dna_connp->state = RD_HDR;
+					dna_start_read(conn_id, READ_HEADER_SIZE);
+				}
 				break;
 			default:
 				break;
@@ -411,9 +589,19 @@ static int do_dna_write(int id)
 
 int dna_write_nowait(int conn_id, void *buffer, int size)
 {
+	return(dna_write_nowait_tag(conn_id, buffer, size, 0));
+}
+
+int dna_write_nowait_tag(int conn_id, void *buffer, int size, int tag)
+{
+	/* Write without waiting for the peer, what does not fit in the socket
+	 * is queued on the connection. Queued writes with the same non zero tag
+	 * can be dropped if the queue overflows.
+	 */
 	register DNA_CONNECTION *dna_connp;
 	DNA_HEADER header_pkt;
 	register DNA_HEADER *header_p = &header_pkt;
+	TCPIP_IOVEC iov[2];
 	int tcpip_code, ret = 1;
 
 	DISABLE_AST
@@ -428,15 +616,19 @@ int dna_write_nowait(int conn_id, void *buffer, int size)
 	header_p->header_size = htovl(READ_HEADER_SIZE);
 	header_p->data_size = htovl(size);
 	header_p->header_magic = (int)htovl(HDR_MAGIC);
-	tcpip_code = dna_write_bytes(conn_id, &header_pkt, READ_HEADER_SIZE, 1);
-	if(tcpip_failure(tcpip_code)) 
+/* Header and data go out in a single system call */
+	iov[0].buffer = (char *)&header_pkt;
+	iov[0].size = READ_HEADER_SIZE;
+	iov[1].buffer = (char *)buffer;
+	iov[1].size = size;
+	tcpip_code = tcpip_writev_queued(conn_id, iov, 2, tag);
+	if(tcpip_code == -1)
 	{
-		dna_connp->writing = FALSE;
-		ENABLE_AST
-		return(0);
+		dna_report_error(conn_id, -1,
+			"Write timeout, writing to", DIM_WARNING, DIMTCPWRTMO);
+		ret = 0;
 	}
-	tcpip_code = dna_write_bytes(conn_id, buffer, size, 1);
-	if(tcpip_failure(tcpip_code)) 
+	else if(tcpip_failure(tcpip_code)) 
 	{
 		ret = 0;
 	}
@@ -445,6 +637,66 @@ int dna_write_nowait(int conn_id, void *buffer, int size)
 	return(ret);
 }	
 
+int dna_write_nowait_gen(int conn_id, int gen, void *header, int header_size,
+	void *buffer, int size, int tag, TCPIP_WRITE_ERROR *errp)
+{
+	/* As dna_write_nowait_tag, without the DIM lock: the message is made
+	 * of header and buffer, gen is the write generation of the connection
+	 * when the message was prepared. Returns 2 if the connection was
+	 * closed since, errors are reported by the caller under the DIM lock.
+	 */
+	DNA_HEADER header_pkt;
+	TCPIP_IOVEC iov[3];
+	int tcpip_code;
+
+	header_pkt.header_size = htovl(READ_HEADER_SIZE);
+	header_pkt.data_size = htovl(header_size + size);
+	header_pkt.header_magic = (int)htovl(HDR_MAGIC);
+	iov[0].buffer = (char *)&header_pkt;
+	iov[0].size = READ_HEADER_SIZE;
+	iov[1].buffer = (char *)header;
+	iov[1].size = header_size;
+	iov[2].buffer = (char *)buffer;
+	iov[2].size = size;
+	tcpip_code = tcpip_writev_gen(conn_id, gen, iov, 3, tag, errp);
+	if(tcpip_code == -2)
+		return(2);
+	if(tcpip_failure(tcpip_code) || (tcpip_code == -1))
+		return(0);
+	return(1);
+}
+
+int dna_write_nowait_shared(int conn_id, int gen, void *header, int header_size,
+	void *buffer, int size, TCPIP_SHARED *sharedp, void *data, int data_size,
+	int tag, TCPIP_WRITE_ERROR *errp)
+{
+	/* As dna_write_nowait_gen, the message ends with data, a part of the
+	 * shared data sharedp. If the socket does not take it all, the write
+	 * queue keeps a reference on sharedp instead of a copy of data.
+	 */
+	DNA_HEADER header_pkt;
+	TCPIP_IOVEC iov[4];
+	int tcpip_code;
+
+	header_pkt.header_size = htovl(READ_HEADER_SIZE);
+	header_pkt.data_size = htovl(header_size + size + data_size);
+	header_pkt.header_magic = (int)htovl(HDR_MAGIC);
+	iov[0].buffer = (char *)&header_pkt;
+	iov[0].size = READ_HEADER_SIZE;
+	iov[1].buffer = (char *)header;
+	iov[1].size = header_size;
+	iov[2].buffer = (char *)buffer;
+	iov[2].size = size;
+	iov[3].buffer = (char *)data;
+	iov[3].size = data_size;
+	tcpip_code = tcpip_writev_shared(conn_id, gen, iov, 4, tag, sharedp, errp);
+	if(tcpip_code == -2)
+		return(2);
+	if(tcpip_failure(tcpip_code) || (tcpip_code == -1))
+		return(0);
+	return(1);
+}
+
 typedef struct
 {
 	DNA_HEADER header;
@@ -11,16 +11,16 @@
 
 #define DNS
 #include <stdio.h>
+#include <stddef.h>
 #include <dim.h>
 #include <dis.h>
 
 #ifndef WIN32
 #include <netdb.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #endif
-/*
-#define MAX_HASH_ENTRIES 5000
-*/
-#define MAX_HASH_ENTRIES 25000
 FILE	*foutptr;
 
 typedef struct node {
@@ -44,31 +44,40 @@ typedef struct red_node {
 typedef struct serv {
 	struct serv *server_next;
 	struct serv *server_prev;
-	struct serv *next;
-	struct serv *prev;
 	char serv_name[MAX_NAME];
 	char serv_def[MAX_NAME];
 	int state;
 	int conn_id;
 	int server_format;
 	int serv_id;
+	int provisional;
+	struct view_service *viewp;
 	RED_NODE *node_head;
+	struct name_node *name_node;
+	struct last_seg *last_seg;
+	struct serv *seg_next;
+	struct serv *seg_prev;
 } DNS_SERVICE;
 
-typedef struct red_serv {
-	struct red_serv *next;
-	struct red_serv *prev;
-	char serv_name[MAX_NAME];
-	char serv_def[MAX_NAME];
-	int state;
-	int conn_id;
-	int server_format;
-	int serv_id;
-	RED_NODE *node_head;
-} RED_DNS_SERVICE;
+/* Browse index: the service names split at '/' into a trie */
+typedef struct name_node {
+	struct name_node *parent;
+	NAME_TABLE children;
+	DNS_SERVICE *servp;
+	int n_services;
+	char name[1];
+} NAME_NODE;
+
+/* and the services with the same last name segment */
+typedef struct last_seg {
+	DNS_SERVICE *head;
+	int n_services;
+	char name[1];
+} LAST_SEG;
 
-static DNS_SERVICE **Service_info_list;
-static RED_DNS_SERVICE *Service_hash_table[MAX_HASH_ENTRIES];
+static NAME_TABLE Service_table;
+static NAME_NODE Name_root;
+static NAME_TABLE Last_segs;
 static int Curr_n_services = 0;
 static int Curr_n_servers = 0;
 static int Last_conn_id;
@@ -81,9 +90,122 @@ static int Timer_q;
 static int Server_info_id, Server_new_info_id, 
 		   Rpc_id, wake_up;
 
+/* Directory change feed */
+typedef struct {
+	char *buffer;
+	int size;
+	int length;
+} DIR_TEXT;
+
+static int Dir_changes_id;
+static unsigned int Dir_sequence = 0;
+static DIR_TEXT Dir_changes = {0, 0, 0};
+
 static char RPC_dummy = 0;
 static char *Rpc_info = &RPC_dummy;
 static int Rpc_info_size = 0;
+static int Rpc_info_length = 0;
+
+/* Directory snapshot, reloaded on restart */
+#define DNS_SNAPSHOT_MAGIC		0x444e5331
+#define DNS_SNAPSHOT_DELAY		2
+#define DNS_PROVISIONAL_TMOUT	WATCHDOG_TMOUT_MAX
+
+typedef struct {
+	int magic;
+	int size;
+	int n_servers;
+	int n_services;
+	int time;
+} DNS_SNAPSHOT_HEADER;
+
+typedef struct {
+	char node_name[MAX_NODE_NAME];
+	char task_name[MAX_TASK_NAME-4];
+	char long_task_name[MAX_NAME];
+	char node_addr[4];
+	int pid;
+	int port;
+	int protocol;
+	int n_services;
+} DNS_SNAPSHOT_SERVER;
+
+typedef struct {
+	char serv_name[MAX_NAME];
+	char serv_def[MAX_NAME];
+	int serv_id;
+	int server_format;
+} DNS_SNAPSHOT_SERVICE;
+
+static char *Snapshot_file = 0;
+static char *Snapshot_tmp_file = 0;
+static int Snapshot_pending = 0;
+
+/* Read view of the directory, for the reader threads */
+#define DNS_READ_THREADS	2
+#define DNS_VIEW_DELAY		1
+#define DNS_JOB_LOOKUP		1
+#define DNS_JOB_BROWSE		2
+
+typedef struct view_service {
+	char serv_name[MAX_NAME];
+	char serv_def[MAX_NAME];
+	int serv_id;
+	int server_format;
+	char node_name[MAX_NODE_NAME];
+	char task_name[MAX_TASK_NAME-4];
+	char node_addr[4];
+	int port;
+	int pid;
+	int protocol;
+	int dropped;
+	char *last_seg;
+} VIEW_SERVICE;
+
+/* The services by name, and by last name segment as in the browse index */
+typedef struct dir_view {
+	struct dir_view *next;
+	unsigned int epoch;
+	int n_services;
+	VIEW_SERVICE **services;
+	VIEW_SERVICE **by_seg;
+	int n_dropped;
+	VIEW_SERVICE **dropped;
+} DIR_VIEW;
+
+static int N_readers = 0;
+static DIR_VIEW *Dir_view = 0;
+static DIR_VIEW *Retired_views = 0;
+static unsigned int View_epoch = 1;
+static VIEW_SERVICE **View_adds = 0;
+static int View_n_adds = 0;
+static int View_max_adds = 0;
+static int View_n_drops = 0;
+static int View_stale = 0;
+
+typedef struct dns_job {
+	struct dns_job *next;
+	int type;
+	int conn_id;
+	int gen;
+	int size;
+	char data[1];
+} DNS_JOB;
+
+#ifndef WIN32
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	DNS_JOB *head;
+	DNS_JOB *tail;
+	unsigned int epoch;
+	DNS_DIC_PACKET *replies;
+	int max_replies;
+	DIR_TEXT text;
+} DNS_READER;
+
+static DNS_READER *Readers = 0;
+#endif
 
 static char DNS_accepted_domains[1024] = {0};
 static char DNS_accepted_nodes[1024] = {0};
@@ -99,7 +221,22 @@ _DIM_PROTO( void print_hash_table,       (void) );
 _DIM_PROTO( void get_rpc_info,       	 (int *tag, char **info, int *size) );
 _DIM_PROTO( void set_rpc_info,       	 (int *tag, char *name, int *size) );
 _DIM_PROTO( void print_hash_table,       (void) );
+_DIM_PROTO( int find_services,           (char *wild_name, void (*user_routine)(DNS_SERVICE *, char *)) );
 _DIM_PROTO( static void release_conn,    (int conn_id) );
+_DIM_PROTO( static void dir_server_change,  (int conn_id, int op) );
+_DIM_PROTO( static void dir_service_change, (DNS_SERVICE *servp, int op) );
+_DIM_PROTO( static void dir_publish,     (void) );
+_DIM_PROTO( static void adopt_provisional, (int conn_id) );
+_DIM_PROTO( static void sweep_provisional, (int conn_id) );
+_DIM_PROTO( static void load_snapshot,   (void) );
+_DIM_PROTO( static void write_snapshot,  (void *tag) );
+_DIM_PROTO( static void check_provisional, (int conn_id) );
+_DIM_PROTO( static void view_service_changed, (DNS_SERVICE *servp) );
+_DIM_PROTO( static void view_service_drop, (DNS_SERVICE *servp) );
+_DIM_PROTO( static void view_publish,    (void) );
+_DIM_PROTO( static void reader_queue,    (int type, int conn_id, void *data, int size) );
+_DIM_PROTO( static void readers_init,    (int n) );
+_DIM_PROTO( static void readers_start,   (void) );
 
 
 static void recv_rout( int conn_id, DIC_DNS_PACKET *packet, int size, int status )
@@ -136,7 +273,7 @@ static void recv_rout( int conn_id, DIC_DNS_PACKET *packet, int size, int status
 			handle_registration(conn_id, (DIS_DNS_PACKET *)packet, 1);
 			break;
 		case SRC_DIC :
-			handle_client_request(conn_id,(DIC_DNS_PACKET *)packet);
+			handle_client_request(conn_id,(DIC_DNS_PACKET *)packet, size);
 			break;
 		default:
 			dim_print_date_time();
@@ -228,6 +365,7 @@ int handle_registration( int conn_id, DIS_DNS_PACKET *packet, int tmout_flag )
 		dll_init( (DLL *) Dns_conns[conn_id].service_head );
 		Dns_conns[conn_id].n_services = 0;
 		Dns_conns[conn_id].timr_ent = NULL;
+		Dns_conns[conn_id].provisional = 0;
 		Curr_n_servers++;
 		Dns_conns[conn_id].src_type = SRC_DIS;
 		Dns_conns[conn_id].protocol = vtohl(packet->protocol);
@@ -322,6 +460,9 @@ int handle_registration( int conn_id, DIS_DNS_PACKET *packet, int tmout_flag )
 		Dns_conns[conn_id].old_n_services = 0;
 */
 		Dns_conns[conn_id].n_services = 0;
+		adopt_provisional(conn_id);
+		Dns_conns[conn_id].listed = 1;
+		dir_server_change(conn_id, '+');
 	} 
 	else 
 	{
@@ -335,6 +476,7 @@ int handle_registration( int conn_id, DIS_DNS_PACKET *packet, int tmout_flag )
 				Dns_conns[conn_id].task_name );
 			fflush(stdout);
 			Dns_conns[conn_id].n_services = 0;
+			dir_server_change(conn_id, '+');
 		}
 	}
 	n_services = vtohl(packet->n_services);
@@ -362,6 +504,13 @@ int handle_registration( int conn_id, DIS_DNS_PACKET *packet, int tmout_flag )
 				break;
 			}
 		}
+		if( (servp = service_exists(packet->services[i].service_name)) &&
+			(servp->conn_id) && (servp->conn_id != conn_id) &&
+			(Dns_conns[servp->conn_id].provisional) )
+		{
+			/* only known from the snapshot, that server did not come back */
+			release_conn(servp->conn_id);
+		}
 		if( (servp = service_exists(packet->services[i].service_name)) )
 		{
 			/* if service available on another server send kill signal */
@@ -456,12 +605,15 @@ printf(" Service %s already declared by conn %d - %s@%s:%d (PID %d), killing ser
 						packet->services[i].service_def,(size_t)MAX_NAME );
 					servp->conn_id = conn_id;
 					servp->state = 1;
+					servp->provisional = 0;
 					servp->server_format = vtohl(packet->format);
 					servp->serv_id = vtohl(packet->services[i].service_id);
 					dll_insert_queue((DLL *)
 						Dns_conns[conn_id].service_head,
 						(DLL *) servp);
 					Dns_conns[conn_id].n_services++;
+					dir_service_change(servp, '>');
+					view_service_changed(servp);
 
 /*
 					if(n_services == 1)
@@ -478,8 +630,9 @@ printf(" Service %s already declared by conn %d - %s@%s:%d (PID %d), killing ser
 					service_id = vtohl(packet->services[i].service_id);
 					if((unsigned)service_id & 0x80000000)
 					{
+						dir_service_change(servp, '<');
 						dll_remove((DLL *) servp);
-						service_remove(&(servp->next));
+						service_remove(servp);
 						Curr_n_services--;
 						free(servp);
 						Dns_conns[conn_id].n_services--;
@@ -498,11 +651,15 @@ printf(" Service %s already declared by conn %d - %s@%s:%d (PID %d), killing ser
 						}
 						continue;
                     }
+					/* re-registered, no longer only known from the snapshot */
+					servp->provisional = 0;
 				}
 			} 
 			else 
 			{
 				servp->state = 1;
+				servp->provisional = 0;
+				view_service_changed(servp);
 				Dns_conns[conn_id].n_services++;
 /*
 				if(n_services == 1)
@@ -538,6 +695,7 @@ printf(" Service %s already declared by conn %d - %s@%s:%d (PID %d), killing ser
 				packet->services[i].service_def,
 				(size_t)MAX_NAME );
 			servp->state = 1;
+			servp->provisional = 0;
 			servp->conn_id = conn_id;
 			servp->server_format = vtohl(packet->format);
 			servp->serv_id = vtohl(packet->services[i].service_id);
@@ -545,12 +703,15 @@ printf(" Service %s already declared by conn %d - %s@%s:%d (PID %d), killing ser
 					  Dns_conns[conn_id].service_head, 
 					  (DLL *) servp );
 			Dns_conns[conn_id].n_services++;
-			service_insert( &(servp->next) );
+			service_insert(servp);
 			servp->node_head = (RED_NODE *) malloc(sizeof(NODE));
 			dll_init( (DLL *) servp->node_head );
 			Curr_n_services++;
+			dir_service_change(servp, '>');
+			view_service_changed(servp);
 		} 
 	}
+	dir_publish();
 	if(update_did)
 		do_update_did(conn_id);
     if( Debug )
@@ -613,6 +774,7 @@ void check_validity(int conn_id)
 	DNS_DIS_PACKET dis_packet;
 	void set_in_error();
 
+	sweep_provisional(conn_id);
 	if(Dns_conns[conn_id].validity < 0)
 	{
 		/* timeout reached kill all services and connection */
@@ -657,13 +819,14 @@ void check_validity(int conn_id)
 }		
 
 
-int handle_client_request( int conn_id, DIC_DNS_PACKET *packet )
+/* Returns -1 if the client connection was released, 1 if the answer is in
+   dic_packet, 0 if the request needs no answer */
+static int handle_service_request( int conn_id, SERVICE_REQ *serv_reqp, DNS_DIC_PACKET *dic_packet )
 {
 	DNS_SERVICE *servp;
 	NODE *nodep;
 	RED_NODE *red_nodep; 
 	int i, service_id;
-	DNS_DIC_PACKET dic_packet;
 	SERVICE_REG *serv_regp; 
 	void service_insert();
 	void service_remove();
@@ -671,7 +834,7 @@ int handle_client_request( int conn_id, DIC_DNS_PACKET *packet )
 	char *ptr, *ptr1;
 	int found;
 
-	serv_regp = (SERVICE_REG *)(&(packet->service));
+	serv_regp = (SERVICE_REG *)serv_reqp;
 	if(Debug)
 	{
 		dim_print_date_time();
@@ -712,18 +875,18 @@ int handle_client_request( int conn_id, DIC_DNS_PACKET *packet )
 		}
 		if(!found)
 		{
-			dic_packet.service_id = serv_regp->service_id;
-			dic_packet.node_name[0] = (char)0xFF; 
-			dic_packet.task_name[0] = 0;
-			dic_packet.node_addr[0] = 0;
-			dic_packet.pid = 0;
-			dic_packet.size = htovl(DNS_DIC_HEADER);
+			dic_packet->service_id = serv_regp->service_id;
+			dic_packet->node_name[0] = (char)0xFF; 
+			dic_packet->task_name[0] = 0;
+			dic_packet->node_addr[0] = 0;
+			dic_packet->pid = 0;
+			dic_packet->size = htovl(DNS_DIC_HEADER);
 			dim_print_date_time();
 			printf(" Connection from %s refused, stopping client pid=%s\n",
 					Net_conns[conn_id].node,
 					Net_conns[conn_id].task);
 			fflush(stdout);
-			if( !dna_write_nowait(conn_id, &dic_packet, DNS_DIC_HEADER) )
+			if( !dna_write_nowait(conn_id, dic_packet, DNS_DIC_HEADER) )
 			{
 				dim_print_date_time();
 				printf(" Stop Client: Couldn't write, releasing Conn %3d : Client %s@%s\n",conn_id,
@@ -733,7 +896,7 @@ int handle_client_request( int conn_id, DIC_DNS_PACKET *packet )
 			}
 			release_conn(conn_id);
 
-			return 0;
+			return(-1);
 		}
 	}
 	
@@ -771,7 +934,7 @@ int handle_client_request( int conn_id, DIC_DNS_PACKET *packet )
 					printf("\tand Removing Service\n");
 					fflush(stdout);
 				}
-				service_remove(&(servp->next));
+				service_remove(servp);
 				Curr_n_services--;
 				free(servp);
 			}
@@ -813,7 +976,7 @@ int handle_client_request( int conn_id, DIC_DNS_PACKET *packet )
 					printf("\tand Removing Service\n");
 					fflush(stdout);
 				}
-				service_remove(&(servp->next));
+				service_remove(servp);
 				Curr_n_services--;
 				free(servp);
 			}
@@ -821,14 +984,20 @@ int handle_client_request( int conn_id, DIC_DNS_PACKET *packet )
 		return(0);
 	}
 	/* Is already in v.format */
-	dic_packet.service_id = serv_regp->service_id;
-	dic_packet.node_name[0] = 0; 
-	dic_packet.task_name[0] = 0;
-	dic_packet.node_addr[0] = 0;
-	dic_packet.pid = 0;
-	dic_packet.size = htovl(DNS_DIC_HEADER);
+	dic_packet->service_id = serv_regp->service_id;
+	dic_packet->node_name[0] = 0; 
+	dic_packet->task_name[0] = 0;
+	dic_packet->node_addr[0] = 0;
+	dic_packet->pid = 0;
+	dic_packet->size = htovl(DNS_DIC_HEADER);
 	if( Dns_conns[conn_id].src_type == SRC_NONE )
 		dna_set_test_write(conn_id, dim_get_keepalive_timeout());
+	if( !service_id && !strcmp(serv_regp->service_name, DIC_DNS_PROBE_NAME) )
+	{
+		/* Tell the client that several requests can be sent per packet */
+		strcpy( dic_packet->task_name, "DIS_DNS" );
+		return(1);
+	}
 	if( !(servp = service_exists(serv_regp->service_name)) ) 
 	{
 		if(Debug)
@@ -847,8 +1016,9 @@ int handle_client_request( int conn_id, DIC_DNS_PACKET *packet )
 		strncpy( servp->serv_name, serv_regp->service_name, (size_t)MAX_NAME );
 		servp->serv_def[0] = '\0';
 		servp->state = 0;
+		servp->provisional = 0;
 		servp->conn_id = 0;
-		service_insert(&(servp->next));
+		service_insert(servp);
 		Curr_n_services++;
 		servp->node_head = (RED_NODE *)malloc(sizeof(NODE));
 		dll_init( (DLL *) servp->node_head );
@@ -872,23 +1042,23 @@ int handle_client_request( int conn_id, DIC_DNS_PACKET *packet )
 			}
 #endif
 			Dns_conns[conn_id].src_type = SRC_DIC;
-			strcpy( dic_packet.node_name,
+			strcpy( dic_packet->node_name,
 				Dns_conns[servp->conn_id].node_name );
-			strcpy( dic_packet.task_name,
+			strcpy( dic_packet->task_name,
 				Dns_conns[servp->conn_id].task_name );
 			for(i = 0; i < 4; i++)
-				dic_packet.node_addr[i] =
+				dic_packet->node_addr[i] =
 					Dns_conns[servp->conn_id].node_addr[i];
-			dic_packet.port = htovl(Dns_conns[servp->conn_id].port);
-			dic_packet.pid = htovl(Dns_conns[servp->conn_id].pid);
-			dic_packet.protocol = htovl(Dns_conns[servp->conn_id].protocol);
-			dic_packet.format = htovl(servp->server_format);
-			strcpy( dic_packet.service_def, servp->serv_def );
+			dic_packet->port = htovl(Dns_conns[servp->conn_id].port);
+			dic_packet->pid = htovl(Dns_conns[servp->conn_id].pid);
+			dic_packet->protocol = htovl(Dns_conns[servp->conn_id].protocol);
+			dic_packet->format = htovl(servp->server_format);
+			strcpy( dic_packet->service_def, servp->serv_def );
 			if(Debug)
 			{
 				printf("\tService exists in %s@%s, port = %d\n",
-					dic_packet.task_name, dic_packet.node_name, 
-					dic_packet.port);
+					dic_packet->task_name, dic_packet->node_name, 
+					dic_packet->port);
 				fflush(stdout);
 			}
 		} 
@@ -924,9 +1094,67 @@ int handle_client_request( int conn_id, DIC_DNS_PACKET *packet )
 					 (DLL *) &(nodep->next));
 		}
 	}
+	return(1);
+}
+
+int handle_client_request( int conn_id, DIC_DNS_PACKET *packet, int size )
+{
+	static DNS_DIC_PACKET *dic_packets = 0;
+	static int n_allocated = 0;
+	DNS_DIC_PACKET dic_packet;
+	int i, n_requests, n_replies, ret;
+
+	if(DNS_accepted_nodes[0] == 0)
+	{
+		if(!get_dns_accepted_nodes(DNS_accepted_nodes))
+			DNS_accepted_nodes[0] = (char)0xFF;
+	}
+	if( N_readers && (DNS_accepted_nodes[0] == (char)0xFF) )
+	{
+		/* Answered by a reader thread, what needs the directory itself
+		   is handed back to this one */
+		if( Dns_conns[conn_id].src_type == SRC_NONE )
+		{
+			dna_set_test_write(conn_id, dim_get_keepalive_timeout());
+			Dns_conns[conn_id].src_type = SRC_DIC;
+		}
+		reader_queue(DNS_JOB_LOOKUP, conn_id, packet, size);
+		return(1);
+	}
+	n_requests = (size - DIC_DNS_HEADER) / (int)sizeof(SERVICE_REQ);
+	n_replies = 0;
+	if( n_requests <= 1 )
+	{
+		ret = handle_service_request(conn_id, &packet->service, &dic_packet);
+		if(ret < 0)
+			return(0);
+		n_replies = ret;
+	}
+	else
+	{
+		/* Several requests, answered in one packet */
+		if(n_requests > n_allocated)
+		{
+			if(dic_packets)
+				free(dic_packets);
+			dic_packets = (DNS_DIC_PACKET *)malloc((size_t)n_requests * sizeof(DNS_DIC_PACKET));
+			n_allocated = n_requests;
+		}
+		for(i = 0; i < n_requests; i++)
+		{
+			ret = handle_service_request(conn_id, &(&packet->service)[i],
+				&dic_packets[n_replies]);
+			if(ret < 0)
+				return(0);
+			n_replies += ret;
+		}
+	}
+	if(!n_replies)
+		return(0);
 /* Should it be dna_write_nowait? 16/9/2008 */
 /* moved from dna_write to dna_write_nowait in 14/10/2008 */
-	if( !dna_write_nowait(conn_id, &dic_packet, DNS_DIC_HEADER) )
+	if( !dna_write_nowait(conn_id, (n_requests <= 1) ? &dic_packet : dic_packets,
+		n_replies * DNS_DIC_HEADER) )
 	{
 		dim_print_date_time();
 		printf(" Client Request: Couldn't write, releasing Conn %3d : Client %s@%s\n",conn_id,
@@ -1104,6 +1332,13 @@ static void release_conn(int conn_id)
 			}
 		}
 		Curr_n_servers--;
+		Dns_conns[conn_id].provisional = 0;
+		if( Dns_conns[conn_id].listed )
+		{
+			Dns_conns[conn_id].listed = 0;
+			dir_server_change(conn_id, '-');
+			dir_publish();
+		}
 		if( Dns_conns[conn_id].timr_ent ) 
 		{
 			dtq_rem_entry( Timer_q, Dns_conns[conn_id].timr_ent );
@@ -1117,7 +1352,7 @@ static void release_conn(int conn_id)
 			dll_remove((DLL *) servp);
 			if(dll_empty((DLL *) servp->node_head)) 
 			{
-				service_remove(&(servp->next));
+				service_remove(servp);
 				Curr_n_services--;
 				old_servp = servp;
 				servp = servp->server_prev;
@@ -1127,9 +1362,11 @@ static void release_conn(int conn_id)
 			{
 				servp->state = 0;
 				servp->conn_id = 0;
+				view_service_changed(servp);
 				servp = servp->server_prev;
 			}
 		}
+		view_publish();
 		if(Dns_conns[conn_id].n_services)
 		{
 			Dns_conns[conn_id].n_services = 0;
@@ -1170,7 +1407,7 @@ static void release_conn(int conn_id)
 				if( (dll_empty((DLL *) servp->node_head)) &&
 				    (!servp->conn_id) )
 				{
-					service_remove(&(servp->next));
+					service_remove(servp);
 					Curr_n_services--;
 					free( servp );
 				}
@@ -1208,8 +1445,13 @@ void set_in_error(int conn_id)
 		while( (servp = (DNS_SERVICE *) dll_get_next(
 				(DLL *) Dns_conns[conn_id].service_head,
 				(DLL *) servp)) )
+		{
 			servp->state = -1;
+			view_service_changed(servp);
+		}
 		Dns_conns[conn_id].n_services = -1;
+		dir_server_change(conn_id, '!');
+		dir_publish();
 	}
 }
 
@@ -1416,189 +1658,653 @@ void get_new_dns_server_info(int *tag, int **bufp, int *size, int *first_time)
 	ENABLE_AST
 }
 
-int main(int argc, char **argv)
-{
-	int i, protocol, dns_port;
-	int *bufp;
-	int size;
-	int conn_id, id;
-	DIS_DNS_PACKET *dis_dns_packet;
-	char node[MAX_NAME];
-	void service_init();
-	
-	if(argc > 1)
-	{
-		if(!strcmp(argv[1],"-d"))
-			set_debug_on();
-		else
-		{
-			printf("Parameters: -d	Debug On\n");
-			exit(0);
-		}
-	}
-	dim_set_write_timeout(10);
-	dim_set_listen_backlog(1024);
-	dim_set_keepalive_timeout(90);
-	dim_set_write_buffer_size(32768);
-	dim_set_read_buffer_size(32768);
-	dim_init();
-	conn_arr_create( SRC_DNS );
-	service_init();
-	Timer_q = dtq_create();
-	get_node_name(node);
-	dim_print_date_time();
-	printf(" DNS version %d starting up on %s\n",DIM_VERSION_NUMBER, node); 
-	fflush(stdout);
+/*
+ * Directory change feed
+ *
+ * The changes are collected while a registration or a disconnection is
+ * handled and published at the end as one update, see dim.h for the format.
+ * A server gone is a single line, its services are not listed.
+ */
 
-	Server_new_info_id =(int) dis_add_service( "DIS_DNS/SERVER_LIST", "C", 0, 0, 
-						get_new_dns_server_info, 0 );
-	Server_info_id = (int)dis_add_service( "DIS_DNS/SERVER_INFO", 0, 0, 0, 
-						get_dns_server_info, 0 );
-	dis_add_cmnd( "DIS_DNS/PRINT_STATS", 0, print_stats, 0 );
-	dis_add_cmnd( "DIS_DNS/DEBUG_ON", 0, set_debug_on, 0 );
-	dis_add_cmnd( "DIS_DNS/DEBUG_OFF", 0, set_debug_off, 0 );
-	dis_add_cmnd( "DIS_DNS/KILL_SERVERS", "I", kill_servers, 0 );
-	dis_add_cmnd( "DIS_DNS/PRINT_HASH_TABLE", 0, print_hash_table, 0 );
-	dis_add_cmnd( "DIS_DNS/SERVICE_INFO/RpcIn", "C", set_rpc_info, 0 );
-	Rpc_id = (int)dis_add_service( "DIS_DNS/SERVICE_INFO/RpcOut", "C", 0, 0, 
-						get_rpc_info, 0 );
-	dns_port = get_dns_port_number();
-	if( !dna_open_server(DNS_TASK, recv_rout, &protocol, &dns_port, error_handler) )
-		return(0);
+static void dir_text_append(DIR_TEXT *textp, char *str)
+{
+	int length;
 
-	id = dis_start_serving("DIS_DNS");
-	dis_dns_packet = (DIS_DNS_PACKET *) id_get_ptr(id, SRC_DIS);
-	id_free(id, SRC_DIS);
-	conn_id = conn_get();
-	handle_registration(conn_id, dis_dns_packet, 0);
-	dtq_add_entry(Timer_q, 5, update_did, 0xded0000);
-	while(1)
+	length = (int)strlen(str);
+	if(textp->length + length + 1 > textp->size)
 	{
-#ifdef VMS
-		sys$hiber(); 
-#else
-		wake_up = FALSE;
-		while( !wake_up )
-        {
-			dim_wait();
-        }
-#endif
- 		for( i = 0; i< Curr_N_Conns; i++ )
-		{
-			if( Dns_conns[i].src_type == SRC_DIS )
-			{
-				send_dns_server_info( i, &bufp, &size );
-				dis_send_service( Server_info_id, bufp, size );
-			}
-		}
+		textp->size = textp->size ? textp->size * 2 : 4096;
+		while(textp->length + length + 1 > textp->size)
+			textp->size *= 2;
+		textp->buffer = (char *)realloc(textp->buffer, (size_t)textp->size);
 	}
-	return(1);
+	memcpy(textp->buffer + textp->length, str, (size_t)(length + 1));
+	textp->length += length;
 }
 
-
-void print_stats()
+static void dir_text_server(DIR_TEXT *textp, int conn_id, int op)
 {
-	int i;
-	int n_conns = 0;
-	int n_services = 0;
-	int n_servers = 0;
-	int n_clients = 0;
+	char line[MAX_NAME + MAX_NODE_NAME + 32];
 
-	dim_print_date_time();
-	printf(" Connection Statistics :\n");
-	for(i = 0; i< Curr_N_Conns; i++)
-	{
-		switch(Dns_conns[i].src_type)
-		{
-		case SRC_DIS :
-			printf("%d - Server %s@%s (PID %d) %d services\n",
-				i, Dns_conns[i].task_name,
-				Dns_conns[i].node_name,
-				Dns_conns[i].pid, Dns_conns[i].n_services);
-			fflush(stdout);
-			n_services +=  Dns_conns[i].n_services;
-			n_servers++;
-			n_conns++;
-			break;
-		case SRC_DIC :
-			printf("%d - Client %s@%s\n",
-				i, Net_conns[i].task, Net_conns[i].node); 
-			fflush(stdout);
-			n_conns++;
-			n_clients++;
-			break;
-		default :
-			if(Dna_conns[i].busy)
-			{
-				if(Net_conns[i].task[0] && Net_conns[i].node[0])
-					printf("%d - Undefined %s@%s\n",
-						i, Net_conns[i].task,
-						Net_conns[i].node);
-				else 
-					printf("%d - Undefined\n", i);
-				fflush(stdout);
-				n_conns++;
-			}
-			else
-			{
-				printf("%d - Empty\n", i);
-				fflush(stdout);
-			}
-		}
-	}
-	printf("Number of Connections = %d : %d servers, %d clients\n", n_conns,
-		n_servers, n_clients);
-	printf("Number of Services = %d\n", n_services);
-	fflush(stdout);
+	if(op == '+')
+		sprintf(line, "+%s@%s|%d\n", Dns_conns[conn_id].long_task_name,
+			Dns_conns[conn_id].node_name, Dns_conns[conn_id].pid);
+	else
+		sprintf(line, "%c%s@%s\n", op, Dns_conns[conn_id].long_task_name,
+			Dns_conns[conn_id].node_name);
+	dir_text_append(textp, line);
 }
 
-
-void set_debug_on()
+static void dir_text_service(DIR_TEXT *textp, DNS_SERVICE *servp, int op)
 {
-	Debug = 1;
+	char line[MAX_NAME * 3 + MAX_NODE_NAME + 32];
+	DNS_CONNECTION *connp;
+
+	connp = &Dns_conns[servp->conn_id];
+	if(op == '>')
+		sprintf(line, ">%s@%s|%s|%s|%s\n", connp->long_task_name, connp->node_name,
+			servp->serv_name, servp->serv_def,
+			(servp->serv_id & 0x10000000) ? "CMD" : "");
+	else
+		sprintf(line, "<%s@%s|%s\n", connp->long_task_name, connp->node_name,
+			servp->serv_name);
+	dir_text_append(textp, line);
 }
 
+static void dir_server_change(int conn_id, int op)
+{
+	dir_text_server(&Dir_changes, conn_id, op);
+}
 
-void set_debug_off()
+static void dir_service_change(DNS_SERVICE *servp, int op)
 {
-	Debug = 0;
+	dir_text_service(&Dir_changes, servp, op);
 }
 
+static void dir_publish()
+{
+	char header[16];
+	int header_length;
 
-void kill_servers(int *tag, int *code, int *size)
+	view_publish();
+	if(!Dir_changes.length)
+		return;
+	Dir_sequence++;
+	sprintf(header, "D%u\n", Dir_sequence);
+	header_length = (int)strlen(header);
+	dir_text_append(&Dir_changes, header);
+	memmove(Dir_changes.buffer + header_length, Dir_changes.buffer,
+		(size_t)(Dir_changes.length - header_length));
+	memcpy(Dir_changes.buffer, header, (size_t)header_length);
+	dis_update_service((unsigned)Dir_changes_id);
+	Dir_changes.length = 0;
+	if(Snapshot_file && !Snapshot_pending)
+	{
+		Snapshot_pending = 1;
+		dtq_start_timer(DNS_SNAPSHOT_DELAY, write_snapshot, 0);
+	}
+}
+
+void get_directory_changes(int *tag, int **bufp, int *size, int *first_time)
 {
+	static DIR_TEXT snapshot = {0, 0, 0};
+	DNS_SERVICE *servp;
+	char header[16];
 	int i;
-	DNS_DIS_PACKET dis_packet;
-	int soft_code = 0, soft_size = 0;
-	int type;
-	
+
 	if(tag){}
-	if(size)
+	DISABLE_AST
+	if(!*first_time)
 	{
-		soft_size = *size;
-		if(code)
-		{
-			soft_code = *code;
-		}
+		*bufp = (int *)Dir_changes.buffer;
+		*size = Dir_changes.length + 1;
+		ENABLE_AST
+		return;
 	}
-	for(i = 0; i< Curr_N_Conns; i++)
+	snapshot.length = 0;
+	sprintf(header, "S%u\n", Dir_sequence);
+	dir_text_append(&snapshot, header);
+ 	for( i = 0; i< Curr_N_Conns; i++ )
 	{
-		if(Dns_conns[i].src_type == SRC_DIS)
-		{
-			if(!strcmp(Dns_conns[i].task_name,"DIS_DNS"))
-				continue;
-			fflush(stdout);
-			type = DNS_DIS_EXIT;
-			if(soft_size)
-			{
-				type = DNS_DIS_SOFT_EXIT;
-				type |= (soft_code << (int)16) & (int)0xFFFF0000;
-				dim_print_date_time();
-				printf(" Killing server %s@%s with exit code %d\n",
-					Dns_conns[i].task_name, Dns_conns[i].node_name, soft_code);
-			}
-			else
-			{
+		if( (Dns_conns[i].src_type != SRC_DIS) || !Dns_conns[i].listed )
+			continue;
+		dir_text_server(&snapshot, i, '+');
+		servp = (DNS_SERVICE *)Dns_conns[i].service_head;
+		while( (servp = (DNS_SERVICE *) dll_get_next(
+				(DLL *) Dns_conns[i].service_head, (DLL *) servp)) )
+			dir_text_service(&snapshot, servp, '>');
+		if(Dns_conns[i].n_services == -1)
+			dir_text_server(&snapshot, i, '!');
+		else if(Dns_conns[i].provisional)
+			dir_text_server(&snapshot, i, '?');
+	}
+	*bufp = (int *)snapshot.buffer;
+	*size = snapshot.length + 1;
+	ENABLE_AST
+}
+
+/*
+ * Directory snapshot
+ *
+ * With DIM_DNS_SNAPSHOT set to a file name, the servers and their services
+ * are written to that file (through a memory mapping, then renamed over the
+ * previous one) a few seconds after each change of the directory, and read
+ * back on startup. Until a server connects again its services are answered
+ * from the snapshot and the server is provisional: marked '?' in the feed,
+ * removed after DNS_PROVISIONAL_TMOUT. A server coming back with the same
+ * pid and port takes over its services without announcing them again; those
+ * it does not register again are removed at its first validity check.
+ */
+
+static int snapshot_server_size(int conn_id)
+{
+	DNS_SERVICE *servp;
+	int n_services = 0;
+
+	if( (Dns_conns[conn_id].src_type != SRC_DIS) || (Dns_conns[conn_id].n_services <= 0) ||
+		!strcmp(Dns_conns[conn_id].task_name,"DIS_DNS") )
+		return(0);
+	servp = (DNS_SERVICE *)Dns_conns[conn_id].service_head;
+	while( (servp = (DNS_SERVICE *) dll_get_next(
+			(DLL *) Dns_conns[conn_id].service_head, (DLL *) servp)) )
+		n_services++;
+	return((int)sizeof(DNS_SNAPSHOT_SERVER) + n_services * (int)sizeof(DNS_SNAPSHOT_SERVICE));
+}
+
+static void write_snapshot(void *tag)
+{
+#ifndef WIN32
+	DNS_SNAPSHOT_HEADER *headerp;
+	DNS_SNAPSHOT_SERVER *serverp;
+	DNS_SNAPSHOT_SERVICE *servicep;
+	DNS_SERVICE *servp;
+	char *map, *ptr;
+	int i, fd, size;
+	int n_servers = 0, n_services = 0;
+
+	if(tag){}
+	DISABLE_AST
+	Snapshot_pending = 0;
+	size = (int)sizeof(DNS_SNAPSHOT_HEADER);
+ 	for( i = 0; i< Curr_N_Conns; i++ )
+		size += snapshot_server_size(i);
+	fd = open(Snapshot_tmp_file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd == -1)
+	{
+		dim_print_date_time();
+		printf(" Could not write the directory snapshot %s\n", Snapshot_tmp_file);
+		fflush(stdout);
+		ENABLE_AST
+		return;
+	}
+	map = MAP_FAILED;
+	if(!ftruncate(fd, (off_t)size))
+		map = (char *)mmap(0, (size_t)size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED)
+	{
+		dim_print_date_time();
+		printf(" Could not map the directory snapshot %s\n", Snapshot_tmp_file);
+		fflush(stdout);
+		close(fd);
+		unlink(Snapshot_tmp_file);
+		ENABLE_AST
+		return;
+	}
+	headerp = (DNS_SNAPSHOT_HEADER *)map;
+	headerp->magic = DNS_SNAPSHOT_MAGIC;
+	headerp->size = size;
+	headerp->time = (int)time(NULL);
+	ptr = map + sizeof(DNS_SNAPSHOT_HEADER);
+ 	for( i = 0; i< Curr_N_Conns; i++ )
+	{
+		if(!snapshot_server_size(i))
+			continue;
+		serverp = (DNS_SNAPSHOT_SERVER *)ptr;
+		memcpy(serverp->node_name, Dns_conns[i].node_name, (size_t)MAX_NODE_NAME);
+		memcpy(serverp->task_name, Dns_conns[i].task_name, (size_t)(MAX_TASK_NAME-4));
+		memcpy(serverp->long_task_name, Dns_conns[i].long_task_name, (size_t)MAX_NAME);
+		memcpy(serverp->node_addr, Dns_conns[i].node_addr, (size_t)4);
+		serverp->pid = Dns_conns[i].pid;
+		serverp->port = Dns_conns[i].port;
+		serverp->protocol = Dns_conns[i].protocol;
+		serverp->n_services = 0;
+		servicep = (DNS_SNAPSHOT_SERVICE *)(serverp + 1);
+		servp = (DNS_SERVICE *)Dns_conns[i].service_head;
+		while( (servp = (DNS_SERVICE *) dll_get_next(
+				(DLL *) Dns_conns[i].service_head, (DLL *) servp)) )
+		{
+			memcpy(servicep->serv_name, servp->serv_name, (size_t)MAX_NAME);
+			memcpy(servicep->serv_def, servp->serv_def, (size_t)MAX_NAME);
+			servicep->serv_id = servp->serv_id;
+			servicep->server_format = servp->server_format;
+			servicep++;
+			serverp->n_services++;
+		}
+		n_servers++;
+		n_services += serverp->n_services;
+		ptr = (char *)servicep;
+	}
+	headerp->n_servers = n_servers;
+	headerp->n_services = n_services;
+	msync(map, (size_t)size, MS_ASYNC);
+	munmap(map, (size_t)size);
+	close(fd);
+	if(rename(Snapshot_tmp_file, Snapshot_file))
+	{
+		dim_print_date_time();
+		printf(" Could not replace the directory snapshot %s\n", Snapshot_file);
+		fflush(stdout);
+	}
+	else if(Debug)
+	{
+		dim_print_date_time();
+		printf(" Directory snapshot written: %d servers, %d services\n",
+			n_servers, n_services);
+		fflush(stdout);
+	}
+	ENABLE_AST
+#else
+	if(tag){}
+#endif
+}
+
+static void load_snapshot()
+{
+#ifndef WIN32
+	DNS_SNAPSHOT_HEADER *headerp;
+	DNS_SNAPSHOT_SERVER *serverp;
+	DNS_SNAPSHOT_SERVICE *servicep;
+	DNS_SERVICE *servp;
+	struct stat st;
+	char *map, *ptr, *end;
+	int i, j, fd, conn_id;
+	int n_servers = 0, n_services = 0;
+	void service_insert();
+
+	if( (fd = open(Snapshot_file, O_RDONLY)) == -1 )
+		return;
+	map = MAP_FAILED;
+	if( !fstat(fd, &st) && (st.st_size >= (off_t)sizeof(DNS_SNAPSHOT_HEADER)) )
+		map = (char *)mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+		return;
+	headerp = (DNS_SNAPSHOT_HEADER *)map;
+	if( (headerp->magic != DNS_SNAPSHOT_MAGIC) || (headerp->size != (int)st.st_size) )
+	{
+		dim_print_date_time();
+		printf(" Directory snapshot %s not valid, ignored\n", Snapshot_file);
+		fflush(stdout);
+		munmap(map, (size_t)st.st_size);
+		return;
+	}
+	ptr = map + sizeof(DNS_SNAPSHOT_HEADER);
+	end = map + st.st_size;
+	for( i = 0; i < headerp->n_servers; i++ )
+	{
+		serverp = (DNS_SNAPSHOT_SERVER *)ptr;
+		if( (ptr + sizeof(DNS_SNAPSHOT_SERVER) > end) || (serverp->n_services <= 0) ||
+			((size_t)serverp->n_services > (size_t)(end - ptr - (int)sizeof(DNS_SNAPSHOT_SERVER)) /
+			 sizeof(DNS_SNAPSHOT_SERVICE)) )
+			break;
+		ptr = (char *)((DNS_SNAPSHOT_SERVICE *)(serverp + 1) + serverp->n_services);
+		conn_id = conn_get();
+		Dns_conns[conn_id].src_type = SRC_DIS;
+		strncpy(Dns_conns[conn_id].node_name, serverp->node_name, (size_t)MAX_NODE_NAME);
+		Dns_conns[conn_id].node_name[MAX_NODE_NAME-1] = '\0';
+		strncpy(Dns_conns[conn_id].task_name, serverp->task_name, (size_t)(MAX_TASK_NAME-4));
+		Dns_conns[conn_id].task_name[MAX_TASK_NAME-4-1] = '\0';
+		strncpy(Dns_conns[conn_id].long_task_name, serverp->long_task_name, (size_t)MAX_NAME);
+		Dns_conns[conn_id].long_task_name[MAX_NAME-1] = '\0';
+		memcpy(Dns_conns[conn_id].node_addr, serverp->node_addr, (size_t)4);
+		Dns_conns[conn_id].pid = serverp->pid;
+		Dns_conns[conn_id].port = serverp->port;
+		Dns_conns[conn_id].protocol = serverp->protocol;
+		Dns_conns[conn_id].validity = (int)time(NULL);
+		Dns_conns[conn_id].already = 0;
+		Dns_conns[conn_id].node_head = 0;
+		Dns_conns[conn_id].service_head = (char *) malloc(sizeof(DNS_SERVICE));
+		dll_init( (DLL *) Dns_conns[conn_id].service_head );
+		Dns_conns[conn_id].n_services = 0;
+		Dns_conns[conn_id].listed = 1;
+		Dns_conns[conn_id].provisional = 1;
+		Dns_conns[conn_id].timr_ent = dtq_add_entry( Timer_q,
+			DNS_PROVISIONAL_TMOUT, check_provisional, conn_id);
+		Curr_n_servers++;
+		servicep = (DNS_SNAPSHOT_SERVICE *)(serverp + 1);
+		for( j = 0; j < serverp->n_services; j++, servicep++ )
+		{
+			if( !servicep->serv_name[0] || memchr(servicep->serv_name, 0, (size_t)MAX_NAME) == NULL ||
+				service_exists(servicep->serv_name) )
+				continue;
+			servp = (DNS_SERVICE *)malloc(sizeof(DNS_SERVICE));
+			strcpy(servp->serv_name, servicep->serv_name);
+			strncpy(servp->serv_def, servicep->serv_def, (size_t)MAX_NAME);
+			servp->serv_def[MAX_NAME-1] = '\0';
+			servp->state = 1;
+			servp->provisional = 1;
+			servp->conn_id = conn_id;
+			servp->server_format = servicep->server_format;
+			servp->serv_id = servicep->serv_id;
+			dll_insert_queue( (DLL *) Dns_conns[conn_id].service_head, (DLL *) servp );
+			Dns_conns[conn_id].n_services++;
+			service_insert(servp);
+			view_service_changed(servp);
+			servp->node_head = (RED_NODE *) malloc(sizeof(NODE));
+			dll_init( (DLL *) servp->node_head );
+			Curr_n_services++;
+			n_services++;
+		}
+		Dns_conns[conn_id].old_n_services = Dns_conns[conn_id].n_services;
+		n_servers++;
+	}
+	view_publish();
+	dim_print_date_time();
+	printf(" Directory snapshot %s loaded: %d servers, %d services (provisional)\n",
+		Snapshot_file, n_servers, n_services);
+	fflush(stdout);
+	munmap(map, (size_t)st.st_size);
+#endif
+}
+
+static void check_provisional(int conn_id)
+{
+	if(!Dns_conns[conn_id].provisional)
+		return;
+	dim_print_date_time();
+	printf(" Server %s@%s from the snapshot did not register again, removing it\n",
+		Dns_conns[conn_id].task_name, Dns_conns[conn_id].node_name);
+	fflush(stdout);
+	release_conn(conn_id);
+}
+
+static void adopt_provisional(int conn_id)
+{
+	DNS_CONNECTION *connp, *oldp;
+	DNS_SERVICE *servp;
+	int i;
+
+	connp = &Dns_conns[conn_id];
+ 	for( i = 0; i< Curr_N_Conns; i++ )
+	{
+		oldp = &Dns_conns[i];
+		if( !oldp->provisional || (i == conn_id) ||
+			strcmp(oldp->task_name, connp->task_name) || strcmp(oldp->node_name, connp->node_name) )
+			continue;
+		if( (oldp->pid == connp->pid) && (oldp->port == connp->port) )
+		{
+			/* the same server, it keeps its services until it registers them again */
+			while( (servp = (DNS_SERVICE *) dll_get_next(
+					(DLL *) oldp->service_head, (DLL *) oldp->service_head)) )
+			{
+				dll_remove((DLL *) servp);
+				servp->conn_id = conn_id;
+				dll_insert_queue((DLL *) connp->service_head, (DLL *) servp);
+				connp->n_services++;
+			}
+			strcpy(connp->long_task_name, oldp->long_task_name);
+			oldp->listed = 0;
+			oldp->n_services = 0;
+			if(Debug)
+			{
+				dim_print_date_time();
+				printf(" Conn %3d : Server %s@%s back, %d services from the snapshot\n",
+					conn_id, connp->task_name, connp->node_name, connp->n_services);
+				fflush(stdout);
+			}
+		}
+		/* otherwise restarted, what the snapshot knew of it is gone */
+		release_conn(i);
+		break;
+	}
+}
+
+static void sweep_provisional(int conn_id)
+{
+	DNS_SERVICE *servp, *old_servp;
+	int n_removed = 0;
+	void service_remove();
+
+	if( (Dns_conns[conn_id].src_type != SRC_DIS) || !Dns_conns[conn_id].service_head )
+		return;
+	servp = (DNS_SERVICE *)Dns_conns[conn_id].service_head;
+	while( (servp = (DNS_SERVICE *) dll_get_next(
+			(DLL *) Dns_conns[conn_id].service_head, (DLL *) servp)) )
+	{
+		if(!servp->provisional)
+			continue;
+		dir_service_change(servp, '<');
+		dll_remove((DLL *) servp);
+		Dns_conns[conn_id].n_services--;
+		n_removed++;
+		if(dll_empty((DLL *) servp->node_head)) 
+		{
+			service_remove(servp);
+			Curr_n_services--;
+			old_servp = servp;
+			servp = servp->server_prev;
+			free(old_servp);
+		} 
+		else 
+		{
+			servp->state = 0;
+			servp->conn_id = 0;
+			servp->provisional = 0;
+			view_service_changed(servp);
+			servp = servp->server_prev;
+		}
+	}
+	if(!n_removed)
+		return;
+	dim_print_date_time();
+	printf(" Server %s@%s did not register again %d services from the snapshot, removed\n",
+		Dns_conns[conn_id].task_name, Dns_conns[conn_id].node_name, n_removed);
+	fflush(stdout);
+	dir_publish();
+	do_update_did(conn_id);
+}
+
+int main(int argc, char **argv)
+{
+	int i, protocol, dns_port;
+	int *bufp;
+	int size;
+	int conn_id, id;
+	DIS_DNS_PACKET *dis_dns_packet;
+	char node[MAX_NAME];
+	void service_init();
+	extern int get_dns_read_threads();
+	
+	if(argc > 1)
+	{
+		if(!strcmp(argv[1],"-d"))
+			set_debug_on();
+		else
+		{
+			printf("Parameters: -d	Debug On\n");
+			exit(0);
+		}
+	}
+	dim_set_write_timeout(10);
+	dim_set_listen_backlog(1024);
+	dim_set_keepalive_timeout(90);
+	dim_set_write_buffer_size(32768);
+	dim_set_read_buffer_size(32768);
+	dim_init();
+	conn_arr_create( SRC_DNS );
+	service_init();
+	Timer_q = dtq_create();
+	get_node_name(node);
+	dim_print_date_time();
+	printf(" DNS version %d starting up on %s\n",DIM_VERSION_NUMBER, node); 
+	fflush(stdout);
+
+	Server_new_info_id =(int) dis_add_service( "DIS_DNS/SERVER_LIST", "C", 0, 0, 
+						get_new_dns_server_info, 0 );
+	Server_info_id = (int)dis_add_service( "DIS_DNS/SERVER_INFO", 0, 0, 0, 
+						get_dns_server_info, 0 );
+	dis_add_cmnd( "DIS_DNS/PRINT_STATS", 0, print_stats, 0 );
+	dis_add_cmnd( "DIS_DNS/DEBUG_ON", 0, set_debug_on, 0 );
+	dis_add_cmnd( "DIS_DNS/DEBUG_OFF", 0, set_debug_off, 0 );
+	dis_add_cmnd( "DIS_DNS/KILL_SERVERS", "I", kill_servers, 0 );
+	dis_add_cmnd( "DIS_DNS/PRINT_HASH_TABLE", 0, print_hash_table, 0 );
+	dis_add_cmnd( "DIS_DNS/SERVICE_INFO/RpcIn", "C", set_rpc_info, 0 );
+	Rpc_id = (int)dis_add_service( "DIS_DNS/SERVICE_INFO/RpcOut", "C", 0, 0, 
+						get_rpc_info, 0 );
+	Dir_changes_id = (int)dis_add_service( DNS_DIRECTORY_CHANGES, "C", 0, 0, 
+						get_directory_changes, 0 );
+	if( (i = get_dns_read_threads()) < 0 )
+		i = DNS_READ_THREADS;
+	readers_init(i);
+	if( (Snapshot_file = getenv("DIM_DNS_SNAPSHOT")) && Snapshot_file[0] )
+	{
+		Snapshot_tmp_file = malloc(strlen(Snapshot_file) + 5);
+		sprintf(Snapshot_tmp_file, "%s.tmp", Snapshot_file);
+		load_snapshot();
+	}
+	else
+		Snapshot_file = 0;
+	dns_port = get_dns_port_number();
+	if( !dna_open_server(DNS_TASK, recv_rout, &protocol, &dns_port, error_handler) )
+		return(0);
+	readers_start();
+
+	id = dis_start_serving("DIS_DNS");
+	dis_dns_packet = (DIS_DNS_PACKET *) id_get_ptr(id, SRC_DIS);
+	id_free(id, SRC_DIS);
+	conn_id = conn_get();
+	handle_registration(conn_id, dis_dns_packet, 0);
+	dtq_add_entry(Timer_q, 5, update_did, 0xded0000);
+	while(1)
+	{
+#ifdef VMS
+		sys$hiber(); 
+#else
+		wake_up = FALSE;
+		while( !wake_up )
+        {
+			dim_wait();
+        }
+#endif
+ 		for( i = 0; i< Curr_N_Conns; i++ )
+		{
+			if( Dns_conns[i].src_type == SRC_DIS )
+			{
+				send_dns_server_info( i, &bufp, &size );
+				dis_send_service( Server_info_id, bufp, size );
+			}
+		}
+	}
+	return(1);
+}
+
+
+void print_stats()
+{
+	int i;
+	int n_conns = 0;
+	int n_services = 0;
+	int n_servers = 0;
+	int n_clients = 0;
+
+	dim_print_date_time();
+	printf(" Connection Statistics :\n");
+	for(i = 0; i< Curr_N_Conns; i++)
+	{
+		switch(Dns_conns[i].src_type)
+		{
+		case SRC_DIS :
+			printf("%d - Server %s@%s (PID %d) %d services%s\n",
+				i, Dns_conns[i].task_name,
+				Dns_conns[i].node_name,
+				Dns_conns[i].pid, Dns_conns[i].n_services,
+				Dns_conns[i].provisional ? " (from snapshot)" : "");
+			fflush(stdout);
+			n_services +=  Dns_conns[i].n_services;
+			n_servers++;
+			n_conns++;
+			break;
+		case SRC_DIC :
+			printf("%d - Client %s@%s\n",
+				i, Net_conns[i].task, Net_conns[i].node); 
+			fflush(stdout);
+			n_conns++;
+			n_clients++;
+			break;
+		default :
+			if(Dna_conns[i].busy)
+			{
+				if(Net_conns[i].task[0] && Net_conns[i].node[0])
+					printf("%d - Undefined %s@%s\n",
+						i, Net_conns[i].task,
+						Net_conns[i].node);
+				else 
+					printf("%d - Undefined\n", i);
+				fflush(stdout);
+				n_conns++;
+			}
+			else
+			{
+				printf("%d - Empty\n", i);
+				fflush(stdout);
+			}
+		}
+	}
+	printf("Number of Connections = %d : %d servers, %d clients\n", n_conns,
+		n_servers, n_clients);
+	printf("Number of Services = %d\n", n_services);
+	fflush(stdout);
+}
+
+
+void set_debug_on()
+{
+	Debug = 1;
+}
+
+
+void set_debug_off()
+{
+	Debug = 0;
+}
+
+
+void kill_servers(int *tag, int *code, int *size)
+{
+	int i;
+	DNS_DIS_PACKET dis_packet;
+	int soft_code = 0, soft_size = 0;
+	int type;
+	
+	if(tag){}
+	if(size)
+	{
+		soft_size = *size;
+		if(code)
+		{
+			soft_code = *code;
+		}
+	}
+	for(i = 0; i< Curr_N_Conns; i++)
+	{
+		if(Dns_conns[i].src_type == SRC_DIS)
+		{
+			if(!strcmp(Dns_conns[i].task_name,"DIS_DNS"))
+				continue;
+			if(Dns_conns[i].provisional)
+				continue;
+			fflush(stdout);
+			type = DNS_DIS_EXIT;
+			if(soft_size)
+			{
+				type = DNS_DIS_SOFT_EXIT;
+				type |= (soft_code << (int)16) & (int)0xFFFF0000;
+				dim_print_date_time();
+				printf(" Killing server %s@%s with exit code %d\n",
+					Dns_conns[i].task_name, Dns_conns[i].node_name, soft_code);
+			}
+			else
+			{
 				dim_print_date_time();
 				printf(" Killing server %s@%s\n",
 					Dns_conns[i].task_name, Dns_conns[i].node_name);
@@ -1617,321 +2323,1075 @@ void kill_servers(int *tag, int *code, int *size)
 }
 
 
-void service_init()
+/*
+ * Browse index
+ *
+ * Each trie node counts the services of its subtree, so a pattern starting
+ * with literal segments ("DQM/Folder/...") only visits the services below
+ * them. A pattern ending with a literal segment ("... /SERVICE_LIST") can
+ * instead check the services with that last segment, whichever is fewer.
+ */
+
+static void name_index_insert(DNS_SERVICE *servp)
+{
+	NAME_NODE *nodep, *childp;
+	LAST_SEG *segp;
+	char seg[MAX_NAME], *ptr, *end;
+	int len;
+
+	nodep = &Name_root;
+	nodep->n_services++;
+	ptr = servp->serv_name;
+	while(1)
+	{
+		if( (end = strchr(ptr, '/')) )
+			len = (int)(end - ptr);
+		else
+			len = (int)strlen(ptr);
+		memcpy(seg, ptr, (size_t)len);
+		seg[len] = '\0';
+		if( !(childp = (NAME_NODE *)name_table_find(&nodep->children, seg)) )
+		{
+			childp = (NAME_NODE *)malloc(sizeof(NAME_NODE) + (size_t)len);
+			childp->parent = nodep;
+			name_table_init(&childp->children, (int)offsetof(NAME_NODE, name));
+			childp->servp = 0;
+			childp->n_services = 0;
+			strcpy(childp->name, seg);
+			name_table_insert(&nodep->children, childp);
+		}
+		nodep = childp;
+		nodep->n_services++;
+		if(!end)
+			break;
+		ptr = end + 1;
+	}
+	nodep->servp = servp;
+	servp->name_node = nodep;
+	if( !(segp = (LAST_SEG *)name_table_find(&Last_segs, seg)) )
+	{
+		segp = (LAST_SEG *)malloc(sizeof(LAST_SEG) + (size_t)len);
+		segp->head = 0;
+		segp->n_services = 0;
+		strcpy(segp->name, seg);
+		name_table_insert(&Last_segs, segp);
+	}
+	servp->seg_prev = 0;
+	servp->seg_next = segp->head;
+	if(segp->head)
+		segp->head->seg_prev = servp;
+	segp->head = servp;
+	segp->n_services++;
+	servp->last_seg = segp;
+}
+
+
+static void name_index_remove(DNS_SERVICE *servp)
+{
+	NAME_NODE *nodep, *parentp;
+	LAST_SEG *segp;
+
+	nodep = servp->name_node;
+	nodep->servp = 0;
+	while(nodep != &Name_root)
+	{
+		parentp = nodep->parent;
+		if(!--nodep->n_services)
+		{
+			name_table_remove(&parentp->children, nodep);
+			name_table_free(&nodep->children);
+			free(nodep);
+		}
+		nodep = parentp;
+	}
+	Name_root.n_services--;
+	segp = servp->last_seg;
+	if(servp->seg_prev)
+		servp->seg_prev->seg_next = servp->seg_next;
+	else
+		segp->head = servp->seg_next;
+	if(servp->seg_next)
+		servp->seg_next->seg_prev = servp->seg_prev;
+	if(!--segp->n_services)
+	{
+		name_table_remove(&Last_segs, segp);
+		free(segp);
+	}
+}
+
+
+void service_init()
+{
+	name_table_init(&Service_table, (int)offsetof(DNS_SERVICE, serv_name));
+	name_table_init(&Name_root.children, (int)offsetof(NAME_NODE, name));
+	name_table_init(&Last_segs, (int)offsetof(LAST_SEG, name));
+}
+
+
+void service_insert(DNS_SERVICE *servp)
+{
+	servp->viewp = 0;
+	name_table_insert(&Service_table, servp);
+	name_index_insert(servp);
+}
+
+
+void service_remove(DNS_SERVICE *servp)
+{
+	if( servp->node_head )
+		free( servp->node_head );
+	if( servp->viewp )
+		view_service_drop(servp);
+	if( name_table_remove(&Service_table, servp) )
+		name_index_remove(servp);
+}
+
+
+DNS_SERVICE *service_exists(char *name)
+{
+	return((DNS_SERVICE *)name_table_find(&Service_table, name));
+}			
+
+void print_hash_table()
+{
+	int i, index;
+	int n_entries, max_entry_index = 0;
+	int max_entries = 0;
+
+	/* The longest probe sequence, from the home slot of a service */
+	for( i = 0; i < Service_table.size; i++ ) 
+	{
+		if( !Service_table.slots[i].item )
+			continue;
+		index = (int)(Service_table.slots[i].hash & (unsigned)(Service_table.size - 1));
+		n_entries = ((i - index) & (Service_table.size - 1)) + 1;
+		if(n_entries > max_entries)
+		{
+			max_entries = n_entries;
+			max_entry_index = i;
+		}
+	}
+	printf("%d services in %d slots\n", Service_table.n_items, Service_table.size);
+	printf("Maximum : HASH[%d] - %d probes\n", max_entry_index, max_entries);  
+	fflush(stdout);
+}
+
+/* '*' matches any string, the name ends at name_end */
+static int wild_match(char *pattern, char *name, char *name_end)
+{
+	char *star = 0, *back = 0;
+
+	while(name < name_end)
+	{
+		if(*pattern == '*')
+		{
+			star = ++pattern;
+			back = name;
+		}
+		else if(*pattern && (*pattern == *name))
+		{
+			pattern++;
+			name++;
+		}
+		else if(star)
+		{
+			pattern = star;
+			name = ++back;
+		}
+		else
+			return(0);
+	}
+	while(*pattern == '*')
+		pattern++;
+	return(!*pattern);
+}
+
+/* The name of an RPC also matches its RpcIn service */
+static int name_matches(char *wild_name, char *name)
+{
+	char *end;
+
+	end = name + strlen(name);
+	if(wild_match(wild_name, name, end))
+		return(1);
+	if(((end - name) > 6) && !strcmp(end - 6, "/RpcIn"))
+		return(wild_match(wild_name, name, end - 6));
+	return(0);
+}
+
+static int service_matches(char *wild_name, DNS_SERVICE *servp)
+{
+	return(name_matches(wild_name, servp->serv_name));
+}
+
+static int find_in_subtree(NAME_NODE *nodep, char *wild_name,
+	void (*user_routine)(DNS_SERVICE *, char *))
+{
+	NAME_NODE *childp;
+	int index = -1, count = 0;
+
+	if(nodep->servp && (nodep->servp->state == 1) &&
+		service_matches(wild_name, nodep->servp))
+	{
+		user_routine(nodep->servp, wild_name);
+		count++;
+	}
+	while( (childp = (NAME_NODE *)name_table_next(&nodep->children, &index)) )
+		count += find_in_subtree(childp, wild_name, user_routine);
+	return(count);
+}
+
+static int find_in_last_seg(LAST_SEG *segp, char *wild_name,
+	void (*user_routine)(DNS_SERVICE *, char *))
+{
+	DNS_SERVICE *servp;
+	int count = 0;
+
+	if(!segp)
+		return(0);
+	for(servp = segp->head; servp; servp = servp->seg_next)
+	{
+		if((servp->state == 1) && service_matches(wild_name, servp))
+		{
+			user_routine(servp, wild_name);
+			count++;
+		}
+	}
+	return(count);
+}
+
+/* Calls user_routine for each service matching wild_name, returns their number */
+int find_services(char *wild_name, void (*user_routine)(DNS_SERVICE *, char *))
+{
+	NAME_NODE *nodep, *childp;
+	LAST_SEG *segp, *rpcp = 0;
+	DNS_SERVICE *servp;
+	char seg[MAX_NAME], *ptr, *end, *star;
+	int index, len, n, count = 0;
+
+	if( !(star = strchr(wild_name, '*')) )
+	{
+		servp = service_exists(wild_name);
+		if(servp && (servp->state == 1))
+		{
+			user_routine(servp, wild_name);
+			return(1);
+		}
+		return(0);
+	}
+	/* Go down the complete segments before the first '*' */
+	nodep = &Name_root;
+	ptr = wild_name;
+	while( (end = strchr(ptr, '/')) && (end < star) )
+	{
+		len = (int)(end - ptr);
+		if(len >= MAX_NAME)
+			return(0);
+		memcpy(seg, ptr, (size_t)len);
+		seg[len] = '\0';
+		if( !(nodep = (NAME_NODE *)name_table_find(&nodep->children, seg)) )
+			return(0);
+		ptr = end + 1;
+	}
+	/* The services with the last segment may be fewer, also checking
+	   the RpcIn services */
+	if( (end = strrchr(wild_name, '/')) && (end > strrchr(wild_name, '*')) )
+	{
+		segp = (LAST_SEG *)name_table_find(&Last_segs, end + 1);
+		if(strcmp(end + 1, "RpcIn"))
+			rpcp = (LAST_SEG *)name_table_find(&Last_segs, "RpcIn");
+		n = (segp ? segp->n_services : 0) + (rpcp ? rpcp->n_services : 0);
+		if(n < nodep->n_services)
+		{
+			count = find_in_last_seg(segp, wild_name, user_routine);
+			count += find_in_last_seg(rpcp, wild_name, user_routine);
+			return(count);
+		}
+	}
+	/* The first partial segment selects the children, without any the
+	   service table is quicker to go through than the trie */
+	len = (int)(star - ptr);
+	index = -1;
+	if((nodep == &Name_root) && !len)
+	{
+		while( (servp = (DNS_SERVICE *)name_table_next(&Service_table, &index)) )
+		{
+			if((servp->state == 1) && service_matches(wild_name, servp))
+			{
+				user_routine(servp, wild_name);
+				count++;
+			}
+		}
+		return(count);
+	}
+	while( (childp = (NAME_NODE *)name_table_next(&nodep->children, &index)) )
+	{
+		if(!strncmp(childp->name, ptr, (size_t)len))
+			count += find_in_subtree(childp, wild_name, user_routine);
+	}
+	return(count);
+}
+
+/* Appends to the answer of a browse request */
+static void rpc_info_add(char *str)
+{
+	int len, size;
+
+	len = (int)strlen(str);
+	if(Rpc_info_length + len + 1 > Rpc_info_size)
+	{
+		size = Rpc_info_size ? Rpc_info_size : MAX_NAME*16;
+		while(Rpc_info_length + len + 1 > size)
+			size *= 2;
+		if(Rpc_info_size)
+			Rpc_info = realloc(Rpc_info, (size_t)size);
+		else
+			Rpc_info = malloc((size_t)size);
+		Rpc_info_size = size;
+	}
+	strcpy(Rpc_info + Rpc_info_length, str);
+	Rpc_info_length += len;
+}
+
+/* An RPC is given once, with the formats of its RpcIn and RpcOut services */
+static void browse_service(DNS_SERVICE *servp, char *wild_name)
+{
+	char aux[MAX_NAME+8], rpcaux[MAX_NAME*3+16];
+	DNS_SERVICE *in_servp, *out_servp;
+	int len;
+
+	len = (int)strlen(servp->serv_name);
+	strcpy(aux, servp->serv_name);
+	if((len > 6) && !strcmp(&aux[len-6], "/RpcIn"))
+	{
+		len -= 6;
+		in_servp = servp;
+		strcpy(&aux[len], "/RpcOut");
+		out_servp = service_exists(aux);
+	}
+	else if((len > 7) && !strcmp(&aux[len-7], "/RpcOut"))
+	{
+		len -= 7;
+		out_servp = servp;
+		strcpy(&aux[len], "/RpcIn");
+		in_servp = service_exists(aux);
+		if(in_servp && (in_servp->state == 1) && service_matches(wild_name, in_servp))
+			return;
+	}
+	else
+	{
+		sprintf(rpcaux, "%s|%s|%s\n", servp->serv_name, servp->serv_def,
+			(servp->serv_id & 0x10000000) ? "CMD" : "");
+		rpc_info_add(rpcaux);
+		return;
+	}
+	if(in_servp && out_servp)
+	{
+		sprintf(rpcaux, "%.*s|%s,%s|RPC\n", len, servp->serv_name,
+			in_servp->serv_def, out_servp->serv_def);
+		rpc_info_add(rpcaux);
+	}
+}
+
+void set_rpc_info(int *tag, char *buffer, int *size)
+{
+    int n, id[2], conn_id;
+
+	if(size){}
+	if(tag){}
+	if(Debug)
+	{
+		dim_print_date_time();
+		conn_id = dis_get_conn_id();
+		printf(" Got Browse Request <%s> from conn: %d %s@%s\n", buffer, conn_id,
+			Net_conns[conn_id].task,Net_conns[conn_id].node);
+	}
+	if(N_readers)
+	{
+		reader_queue(DNS_JOB_BROWSE, dis_get_conn_id(), buffer, *size);
+		return;
+	}
+	Rpc_info_length = 0;
+	if(Rpc_info_size)
+		Rpc_info[0] = '\0';
+	n = find_services(buffer, browse_service);
+	if(Debug)
+	{
+		dim_print_date_time();
+		conn_id = dis_get_conn_id();
+		printf(" Browse Request <%s> found %d services\n", buffer, n);
+	}
+	id[0] = dis_get_conn_id();
+	id[1] = 0;
+	dis_selective_update_service(Rpc_id, id); 
+}
+
+void get_rpc_info(int *tag, char **buffer, int *size)
+{
+
+	if(tag){}
+	*buffer = Rpc_info;
+	*size = Rpc_info_length+1;
+}
+
+
+/*
+ * Read view
+ *
+ * Lookups and browses are answered by reader threads from a read-copy-update
+ * view of the directory: an array of the registered services sorted by name,
+ * never modified once published. The DNS thread stays the only writer: each
+ * change of a service flags its entry as dropped and queues a new one. As
+ * publishing copies the whole view, the changes are merged into a new view
+ * at once only when they are a large part of it, otherwise after
+ * DNS_VIEW_DELAY seconds or before the next browse. A replaced view is freed
+ * once no reader has been using it since: a reader announces the epoch it
+ * started in and clears it when done.
+ * Whatever a view cannot answer (an unknown or dropped service, a client to
+ * put on the waiting list, a request removal) is handled by the reader
+ * holding the DIM lock, as in the DNS thread.
+ * DIM_DNS_READ_THREADS sets the number of reader threads, DNS_READ_THREADS by
+ * default, 0 answering everything in the DNS thread.
+ */
+
+static void view_service_drop(DNS_SERVICE *servp)
+{
+#ifndef WIN32
+	__atomic_store_n(&servp->viewp->dropped, 1, __ATOMIC_RELAXED);
+#endif
+	servp->viewp = 0;
+	View_n_drops++;
+}
+
+static void view_service_changed(DNS_SERVICE *servp)
+{
+	VIEW_SERVICE *viewp;
+	DNS_CONNECTION *connp;
+
+	if(!N_readers)
+		return;
+	if(servp->viewp)
+		view_service_drop(servp);
+	if( (servp->state != 1) || !servp->conn_id )
+		return;
+	viewp = (VIEW_SERVICE *)malloc(sizeof(VIEW_SERVICE));
+	connp = &Dns_conns[servp->conn_id];
+	memcpy(viewp->serv_name, servp->serv_name, (size_t)MAX_NAME);
+	memcpy(viewp->serv_def, servp->serv_def, (size_t)MAX_NAME);
+	viewp->serv_id = servp->serv_id;
+	viewp->server_format = servp->server_format;
+	memcpy(viewp->node_name, connp->node_name, (size_t)MAX_NODE_NAME);
+	memcpy(viewp->task_name, connp->task_name, (size_t)(MAX_TASK_NAME-4));
+	memcpy(viewp->node_addr, connp->node_addr, (size_t)4);
+	viewp->port = connp->port;
+	viewp->pid = connp->pid;
+	viewp->protocol = connp->protocol;
+	viewp->dropped = 0;
+	if( (viewp->last_seg = strrchr(viewp->serv_name, '/')) )
+		viewp->last_seg++;
+	else
+		viewp->last_seg = viewp->serv_name;
+	if(View_n_adds == View_max_adds)
+	{
+		View_max_adds = View_max_adds ? View_max_adds * 2 : 1024;
+		View_adds = (VIEW_SERVICE **)realloc(View_adds,
+			(size_t)View_max_adds * sizeof(VIEW_SERVICE *));
+	}
+	View_adds[View_n_adds++] = viewp;
+	servp->viewp = viewp;
+}
+
+static int view_compare(const void *ptr1, const void *ptr2)
+{
+	return(strcmp((*(VIEW_SERVICE **)ptr1)->serv_name, (*(VIEW_SERVICE **)ptr2)->serv_name));
+}
+
+static int view_seg_compare(const void *ptr1, const void *ptr2)
 {
-  int i;
+	VIEW_SERVICE *servp1 = *(VIEW_SERVICE **)ptr1, *servp2 = *(VIEW_SERVICE **)ptr2;
+	int cmp;
 
-	for( i = 0; i < MAX_HASH_ENTRIES; i++ ) {
-		Service_hash_table[i] = (RED_DNS_SERVICE *) malloc(sizeof(RED_DNS_SERVICE));
-		dll_init((DLL *) Service_hash_table[i]);
-	}
+	if( (cmp = strcmp(servp1->last_seg, servp2->last_seg)) )
+		return(cmp);
+	return(strcmp(servp1->serv_name, servp2->serv_name));
 }
 
+static void view_free(DIR_VIEW *viewp)
+{
+	int i;
+
+	for(i = 0; i < viewp->n_dropped; i++)
+		free(viewp->dropped[i]);
+	if(viewp->dropped)
+		free(viewp->dropped);
+	free(viewp->services);
+	free(viewp->by_seg);
+	free(viewp);
+}
 
-void service_insert(RED_DNS_SERVICE *servp)
+static void view_reclaim()
 {
-	int index;
+#ifndef WIN32
+	DIR_VIEW *viewp, **prevp;
+	unsigned int epoch, oldest = 0;
+	int i;
 
-	index = HashFunction(servp->serv_name, MAX_HASH_ENTRIES);
-	dll_insert_queue((DLL *) Service_hash_table[index], 
-			 (DLL *) servp);
+	for(i = 0; i < N_readers; i++)
+	{
+		epoch = __atomic_load_n(&Readers[i].epoch, __ATOMIC_SEQ_CST);
+		if(epoch && (!oldest || (epoch < oldest)))
+			oldest = epoch;
+	}
+	prevp = &Retired_views;
+	while( (viewp = *prevp) )
+	{
+		if(!oldest || (viewp->epoch <= oldest))
+		{
+			*prevp = viewp->next;
+			view_free(viewp);
+		}
+		else
+			prevp = &viewp->next;
+	}
+#endif
 }
 
+static void view_publish_now()
+{
+	DIR_VIEW *oldp, *newp;
+	VIEW_SERVICE *viewp;
+	int i, j, n, n_old, n_adds;
+
+#ifndef WIN32
+	__atomic_store_n(&View_stale, 0, __ATOMIC_RELAXED);
+#endif
+	if( !View_n_adds && !View_n_drops )
+		return;
+	/* Entries dropped before being published are not seen by anybody */
+	for( i = 0, n_adds = 0; i < View_n_adds; i++ )
+	{
+		viewp = View_adds[i];
+		if(viewp->dropped)
+		{
+			free(viewp);
+			View_n_drops--;
+		}
+		else
+			View_adds[n_adds++] = viewp;
+	}
+	qsort(View_adds, (size_t)n_adds, sizeof(VIEW_SERVICE *), view_compare);
+	oldp = Dir_view;
+	n_old = oldp ? oldp->n_services : 0;
+	newp = (DIR_VIEW *)malloc(sizeof(DIR_VIEW));
+	newp->next = 0;
+	newp->epoch = 0;
+	newp->n_dropped = 0;
+	newp->dropped = 0;
+	newp->services = (VIEW_SERVICE **)malloc(
+		(size_t)(n_old - View_n_drops + n_adds + 1) * sizeof(VIEW_SERVICE *));
+	newp->by_seg = (VIEW_SERVICE **)malloc(
+		(size_t)(n_old - View_n_drops + n_adds + 1) * sizeof(VIEW_SERVICE *));
+	if(oldp && View_n_drops)
+		oldp->dropped = (VIEW_SERVICE **)malloc((size_t)View_n_drops * sizeof(VIEW_SERVICE *));
+	i = j = n = 0;
+	while( (i < n_old) || (j < n_adds) )
+	{
+		if( (i < n_old) && oldp->services[i]->dropped )
+			oldp->dropped[oldp->n_dropped++] = oldp->services[i++];
+		else if( (j < n_adds) && ((i == n_old) ||
+			(strcmp(View_adds[j]->serv_name, oldp->services[i]->serv_name) < 0)) )
+			newp->services[n++] = View_adds[j++];
+		else
+			newp->services[n++] = oldp->services[i++];
+	}
+	newp->n_services = n;
+	/* The same merge by last segment, the dropped entries are known */
+	qsort(View_adds, (size_t)n_adds, sizeof(VIEW_SERVICE *), view_seg_compare);
+	i = j = n = 0;
+	while( (i < n_old) || (j < n_adds) )
+	{
+		if( (i < n_old) && oldp->by_seg[i]->dropped )
+			i++;
+		else if( (j < n_adds) && ((i == n_old) ||
+			(view_seg_compare(&View_adds[j], &oldp->by_seg[i]) < 0)) )
+			newp->by_seg[n++] = View_adds[j++];
+		else
+			newp->by_seg[n++] = oldp->by_seg[i++];
+	}
+	View_n_adds = 0;
+	View_n_drops = 0;
+#ifndef WIN32
+	__atomic_store_n(&Dir_view, newp, __ATOMIC_SEQ_CST);
+	if(oldp)
+	{
+		oldp->epoch = __atomic_add_fetch(&View_epoch, 1, __ATOMIC_SEQ_CST);
+		oldp->next = Retired_views;
+		Retired_views = oldp;
+	}
+	view_reclaim();
+#endif
+}
 
-void service_remove(RED_DNS_SERVICE *servp)
+static void view_publish_timer(dim_long tag)
 {
-	if( servp->node_head )
-		free( servp->node_head );
-	dll_remove( (DLL *) servp );
+	if(tag){}
+	DISABLE_AST
+	view_publish_now();
+	ENABLE_AST
 }
 
+static void view_publish()
+{
+	if( !N_readers || (!View_n_adds && !View_n_drops) )
+		return;
+	if( Dir_view && ((View_n_adds + View_n_drops) * 8 < Dir_view->n_services) )
+	{
+		if(!View_stale)
+		{
+#ifndef WIN32
+			__atomic_store_n(&View_stale, 1, __ATOMIC_RELAXED);
+#endif
+			dtq_start_timer(DNS_VIEW_DELAY, view_publish_timer, 0);
+		}
+		return;
+	}
+	view_publish_now();
+}
 
-DNS_SERVICE *service_exists(char *name)
+static VIEW_SERVICE *view_find(DIR_VIEW *viewp, char *name)
 {
-	int index;
-	RED_DNS_SERVICE *servp;
-	char *ptr;
+	int low, high, mid, cmp;
 
-	index = HashFunction(name, MAX_HASH_ENTRIES);
-	if( (servp = (RED_DNS_SERVICE *) dll_search(
-					(DLL *) Service_hash_table[index],
-			      		name, (int)strlen(name)+1)) )
+	low = 0;
+	high = viewp->n_services - 1;
+	while(low <= high)
 	{
-		ptr = (char *)servp - (2 * sizeof(void *));
-		return((DNS_SERVICE *)ptr);
+		mid = (low + high) / 2;
+		cmp = strcmp(viewp->services[mid]->serv_name, name);
+		if(!cmp)
+			return(viewp->services[mid]);
+		if(cmp < 0)
+			low = mid + 1;
+		else
+			high = mid - 1;
 	}
+	return(0);
+}
 
-	return((DNS_SERVICE *)0);
-}			
-
-void print_hash_table()
+/* As browse_service */
+static void view_browse_service(DIR_VIEW *viewp, VIEW_SERVICE *servp, char *wild_name,
+	DIR_TEXT *textp)
 {
-	int i;
-	RED_DNS_SERVICE *servp;
-	int n_entries, max_entry_index = 0;
-	int max_entries = 0;
+	char aux[MAX_NAME+8], rpcaux[MAX_NAME*3+16];
+	VIEW_SERVICE *in_servp, *out_servp;
+	int len;
 
-#ifdef VMS
-	if( ( foutptr = fopen( "scratch$week:[cp_operator]dim_dns.log", "w" ) 
-		) == (FILE *)0 )
+	len = (int)strlen(servp->serv_name);
+	strcpy(aux, servp->serv_name);
+	if((len > 6) && !strcmp(&aux[len-6], "/RpcIn"))
 	{
-		printf("Cannot open: scratch$week:[cp_operator]dim_dns.log for writing\n");
-		fflush(stdout);
+		len -= 6;
+		in_servp = servp;
+		strcpy(&aux[len], "/RpcOut");
+		out_servp = view_find(viewp, aux);
+	}
+	else if((len > 7) && !strcmp(&aux[len-7], "/RpcOut"))
+	{
+		len -= 7;
+		out_servp = servp;
+		strcpy(&aux[len], "/RpcIn");
+		in_servp = view_find(viewp, aux);
+		if(in_servp && name_matches(wild_name, in_servp->serv_name))
+			return;
+	}
+	else
+	{
+		sprintf(rpcaux, "%s|%s|%s\n", servp->serv_name, servp->serv_def,
+			(servp->serv_id & 0x10000000) ? "CMD" : "");
+		dir_text_append(textp, rpcaux);
 		return;
-	}	
-#endif								 
-	
-	for( i = 0; i < MAX_HASH_ENTRIES; i++ ) 
+	}
+	if(in_servp && out_servp)
 	{
-		n_entries = 0;
-#ifdef VMS
-		fprintf(foutptr,"HASH[%d] : \n",i);
-#endif								 
-		servp = Service_hash_table[i];
-		while( (servp = (RED_DNS_SERVICE *) dll_get_next(
-						(DLL *) Service_hash_table[i],
-						(DLL *) servp)) )
+		sprintf(rpcaux, "%.*s|%s,%s|RPC\n", len, servp->serv_name,
+			in_servp->serv_def, out_servp->serv_def);
+		dir_text_append(textp, rpcaux);
+	}
+}
+
+/* Finds the services whose name starts with the len first characters of
+   name, returns their number */
+static int view_prefix_range(DIR_VIEW *viewp, char *name, int len, int *firstp)
+{
+	int low, high, mid;
+
+	low = 0;
+	high = viewp->n_services;
+	while(low < high)
+	{
+		mid = (low + high) / 2;
+		if(strncmp(viewp->services[mid]->serv_name, name, (size_t)len) < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	*firstp = low;
+	high = viewp->n_services;
+	while(low < high)
+	{
+		mid = (low + high) / 2;
+		if(strncmp(viewp->services[mid]->serv_name, name, (size_t)len) <= 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return(low - *firstp);
+}
+
+/* Finds the services whose last name segment is seg in by_seg, returns their
+   number */
+static int view_seg_range(DIR_VIEW *viewp, char *seg, int *firstp)
+{
+	int low, high, mid;
+
+	low = 0;
+	high = viewp->n_services;
+	while(low < high)
+	{
+		mid = (low + high) / 2;
+		if(strcmp(viewp->by_seg[mid]->last_seg, seg) < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	*firstp = low;
+	high = viewp->n_services;
+	while(low < high)
+	{
+		mid = (low + high) / 2;
+		if(strcmp(viewp->by_seg[mid]->last_seg, seg) <= 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return(low - *firstp);
+}
+
+static int view_browse_range(DIR_VIEW *viewp, VIEW_SERVICE **services, int first, int n,
+	char *wild_name, DIR_TEXT *textp)
+{
+	int i, count = 0;
+
+	for(i = first; i < first + n; i++)
+	{
+		if(name_matches(wild_name, services[i]->serv_name))
 		{
-#ifdef VMS
-			fprintf(foutptr,"%s\n",servp->serv_name);
-#endif								 
-			n_entries++;
+			view_browse_service(viewp, services[i], wild_name, textp);
+			count++;
 		}
-#ifdef VMS
-		fprintf(foutptr,"\n\n");
-#endif								 
-		if(n_entries != 0)
-			printf("HASH[%d] - %d entries\n", i, n_entries);  
-		if(n_entries > max_entries)
+	}
+	return(count);
+}
+
+/* As find_services: the names starting with the text before the first '*'
+   are next to each other, so are the ones with the same last segment in
+   by_seg. The fewest of them are checked */
+static int view_find_services(DIR_VIEW *viewp, char *wild_name, DIR_TEXT *textp)
+{
+	VIEW_SERVICE *servp;
+	char *star, *end;
+	int first, n, seg_first, n_seg, rpc_first, n_rpc, count;
+
+	if(!viewp)
+		return(0);
+	if( !(star = strchr(wild_name, '*')) )
+	{
+		if( !(servp = view_find(viewp, wild_name)) )
+			return(0);
+		view_browse_service(viewp, servp, wild_name, textp);
+		return(1);
+	}
+	n = view_prefix_range(viewp, wild_name, (int)(star - wild_name), &first);
+	/* Also checking the RpcIn services */
+	if( (end = strrchr(wild_name, '/')) && (end > strrchr(wild_name, '*')) )
+	{
+		n_seg = view_seg_range(viewp, end + 1, &seg_first);
+		n_rpc = 0;
+		if(strcmp(end + 1, "RpcIn"))
+			n_rpc = view_seg_range(viewp, "RpcIn", &rpc_first);
+		if(n_seg + n_rpc < n)
 		{
-			max_entries = n_entries;
-			max_entry_index = i;
+			count = view_browse_range(viewp, viewp->by_seg, seg_first, n_seg,
+				wild_name, textp);
+			if(n_rpc)
+				count += view_browse_range(viewp, viewp->by_seg, rpc_first, n_rpc,
+					wild_name, textp);
+			return(count);
 		}
 	}
-#ifdef VMS
-	fclose(foutptr);
-#endif								 
-	printf("Maximum : HASH[%d] - %d entries\n", max_entry_index, max_entries);  
-	fflush(stdout);
+	return(view_browse_range(viewp, viewp->services, first, n, wild_name, textp));
+}
+
+#ifndef WIN32
+
+static DIR_VIEW *view_enter(DNS_READER *readerp)
+{
+	__atomic_store_n(&readerp->epoch, __atomic_load_n(&View_epoch, __ATOMIC_SEQ_CST),
+		__ATOMIC_SEQ_CST);
+	return(__atomic_load_n(&Dir_view, __ATOMIC_SEQ_CST));
 }
 
-int find_services(char *wild_name)
+static void view_leave(DNS_READER *readerp)
 {
+	__atomic_store_n(&readerp->epoch, 0, __ATOMIC_SEQ_CST);
+}
 
-	int i;
-	RED_DNS_SERVICE *servp;
-	DNS_SERVICE *servp1;
-	char tmp[MAX_NAME], *ptr, *ptr1, *dptr, *dptr1;
-	int match, count = 0;
+static void reader_queue(int type, int conn_id, void *data, int size)
+{
+	DNS_READER *readerp;
+	DNS_JOB *jobp;
+
+	/* The requests of a client are answered in order by the same reader */
+	readerp = &Readers[conn_id % N_readers];
+	jobp = (DNS_JOB *)malloc(sizeof(DNS_JOB) + (size_t)size);
+	jobp->next = 0;
+	jobp->type = type;
+	jobp->conn_id = conn_id;
+	jobp->gen = Net_conns[conn_id].write_gen;
+	jobp->size = size;
+	memcpy(jobp->data, data, (size_t)size);
+	jobp->data[size] = '\0';
+	pthread_mutex_lock(&readerp->lock);
+	if(readerp->tail)
+		readerp->tail->next = jobp;
+	else
+		readerp->head = jobp;
+	readerp->tail = jobp;
+	pthread_cond_signal(&readerp->cond);
+	pthread_mutex_unlock(&readerp->lock);
+}
 
-	Service_info_list = (DNS_SERVICE **)
-		malloc((size_t)(Curr_n_services*(int)sizeof(DNS_SERVICE *)));
+static int reader_conn_valid(DNS_JOB *jobp)
+{
+	return( Dna_conns[jobp->conn_id].busy &&
+		(Net_conns[jobp->conn_id].write_gen == jobp->gen) );
+}
 
-	if(!strchr(wild_name, '*'))
+static void reader_lookup(DNS_READER *readerp, DNS_JOB *jobp)
+{
+	DIC_DNS_PACKET *packet;
+	SERVICE_REQ *serv_reqp;
+	DNS_DIC_PACKET *dic_packet;
+	DIR_VIEW *viewp;
+	VIEW_SERVICE *servp;
+	TCPIP_WRITE_ERROR err;
+	int i, n_requests, n_replies, n_locked, service_id, ret, conn_id;
+
+	conn_id = jobp->conn_id;
+	packet = (DIC_DNS_PACKET *)jobp->data;
+	n_requests = (jobp->size - DIC_DNS_HEADER) / (int)sizeof(SERVICE_REQ);
+	if(n_requests < 1)
+		n_requests = 1;
+	if(n_requests > readerp->max_replies)
 	{
-		servp1 = service_exists(wild_name);
-		if(servp1)
+		if(readerp->replies)
+			free(readerp->replies);
+		readerp->replies = (DNS_DIC_PACKET *)malloc((size_t)n_requests * sizeof(DNS_DIC_PACKET));
+		readerp->max_replies = n_requests;
+	}
+	/* The services found in the view are answered from it */
+	n_locked = 0;
+	viewp = view_enter(readerp);
+	for(i = 0; i < n_requests; i++)
+	{
+		serv_reqp = &(&packet->service)[i];
+		dic_packet = &readerp->replies[i];
+		dic_packet->size = 0;
+		service_id = vtohl(serv_reqp->service_id);
+		if( !viewp || ((unsigned)service_id & 0x80000000) ||
+			(!service_id && !strcmp(serv_reqp->service_name, DIC_DNS_PROBE_NAME)) ||
+			!(servp = view_find(viewp, serv_reqp->service_name)) ||
+			__atomic_load_n(&servp->dropped, __ATOMIC_RELAXED) )
 		{
-			if(servp1->state == 1)
-			{
-				Service_info_list[count] = (DNS_SERVICE *)servp1;
-				count++;
-				return 1;
-			}
+			n_locked++;
+			continue;
 		}
-		return 0;
+		dic_packet->service_id = serv_reqp->service_id;
+		strcpy(dic_packet->node_name, servp->node_name);
+		strcpy(dic_packet->task_name, servp->task_name);
+		memcpy(dic_packet->node_addr, servp->node_addr, (size_t)4);
+		dic_packet->port = htovl(servp->port);
+		dic_packet->pid = htovl(servp->pid);
+		dic_packet->protocol = htovl(servp->protocol);
+		dic_packet->format = htovl(servp->server_format);
+		strcpy(dic_packet->service_def, servp->serv_def);
+		dic_packet->size = htovl(DNS_DIC_HEADER);
 	}
-	for( i = 0; i < MAX_HASH_ENTRIES; i++ ) 
+	view_leave(readerp);
+	/* The others by the directory itself */
+	if(n_locked)
 	{
-		servp = Service_hash_table[i];
-		while( (servp = (RED_DNS_SERVICE *) dll_get_next(
-						(DLL *) Service_hash_table[i],
-						(DLL *) servp)) )
+		DISABLE_AST
+		if(!reader_conn_valid(jobp))
 		{
-			ptr = wild_name;
-			dptr = servp->serv_name;
-			match = 1;
-
-            while( (ptr1 = strchr(ptr,'*')) )
-			{
-				if(ptr1 == ptr)
-				{
-					ptr++;
-					if(!*ptr)
-					{
-						dptr = ptr; 
-						break;
-					}
-					strcpy(tmp,ptr);
-					if( (ptr1 = strchr(ptr,'*')) )
-					{
-						tmp[ptr1-ptr] = '\0';
-					}
-					if( (dptr1 = strstr(dptr, tmp)) )
-					{
-						if(!ptr1)
-						{
-							dptr = dptr1;
-							break;
-						}
-						dptr1 += (int)strlen(tmp);
-						ptr = ptr1;
-						dptr = dptr1;
-					}
-					else
-					{
-						match = 0;
-						break;
-					}
-				}
-				else
-				{
-					strcpy(tmp,ptr);
-					tmp[ptr1-ptr] = '\0';
-					if(!strncmp(dptr, tmp, strlen(tmp)))
-					{
-						dptr += (int)strlen(tmp);
-						ptr = ptr1;
-					}
-					else
-					{
-						match = 0;
-						break;
-					}
-				}
-			}			
-			if(strcmp(dptr, ptr))
-			{
-				strcpy(tmp,ptr);
-				strcat(tmp,"/RpcIn");
-				if(strcmp(dptr, tmp))
-					match = 0;
-			}
-		    if(match)
+			ENABLE_AST
+			return;
+		}
+		for(i = 0; i < n_requests; i++)
+		{
+			dic_packet = &readerp->replies[i];
+			if(dic_packet->size)
+				continue;
+			ret = handle_service_request(conn_id, &(&packet->service)[i], dic_packet);
+			if(ret < 0)
 			{
-				if(servp->state == 1)
-				{
-					ptr = (char *)servp - (2 * sizeof(void *));
-					Service_info_list[count] = (DNS_SERVICE *)ptr;
-					count++;
-				}
+				ENABLE_AST
+				return;
 			}
+			if(!ret)
+				dic_packet->size = 0;
 		}
+		ENABLE_AST
 	}
-	return(count);
+	for(i = 0, n_replies = 0; i < n_requests; i++)
+	{
+		if(!readerp->replies[i].size)
+			continue;
+		if(i != n_replies)
+			readerp->replies[n_replies] = readerp->replies[i];
+		n_replies++;
+	}
+	if(!n_replies)
+		return;
+	if(tcpip_unlocked_writes())
+		ret = dna_write_nowait_gen(conn_id, jobp->gen, readerp->replies,
+			n_replies * DNS_DIC_HEADER, 0, 0, 0, &err);
+	else
+	{
+		DISABLE_AST
+		ret = reader_conn_valid(jobp) ?
+			dna_write_nowait(conn_id, readerp->replies, n_replies * DNS_DIC_HEADER) : 2;
+		err.what = 0;
+		ENABLE_AST
+	}
+	if(ret)
+		return;
+	DISABLE_AST
+	if(reader_conn_valid(jobp))
+	{
+		tcpip_report_write_error(conn_id, &err);
+		dim_print_date_time();
+		printf(" Client Request: Couldn't write, releasing Conn %3d : Client %s@%s\n",conn_id,
+					Net_conns[conn_id].task,
+					Net_conns[conn_id].node);
+		fflush(stdout);
+		release_conn(conn_id);
+	}
+	ENABLE_AST
 }
 
-void set_rpc_info(int *tag, char *buffer, int *size)
+static void reader_browse(DNS_READER *readerp, DNS_JOB *jobp)
 {
-	char aux[MAX_NAME], rpcaux[MAX_NAME+32], *ptr, *rpcptr;
-    int i, n, rpc, id[2], conn_id;
-	DNS_SERVICE *servp, *aux_servp;
+	DIR_VIEW *viewp;
+	char *rpc_info;
+	int n, id[2], rpc_info_length;
 
-	if(size){}
-	if(tag){}
-	if(Debug)
+	/* A browse sees the registrations done before it */
+	if(__atomic_load_n(&View_stale, __ATOMIC_RELAXED))
 	{
-		dim_print_date_time();
-		conn_id = dis_get_conn_id();
-		printf(" Got Browse Request <%s> from conn: %d %s@%s\n", buffer, conn_id,
-			Net_conns[conn_id].task,Net_conns[conn_id].node);
+		DISABLE_AST
+		view_publish_now();
+		ENABLE_AST
 	}
-	n = find_services(buffer);
+	readerp->text.length = 0;
+	dir_text_append(&readerp->text, "");
+	viewp = view_enter(readerp);
+	n = view_find_services(viewp, jobp->data, &readerp->text);
+	view_leave(readerp);
 	if(Debug)
 	{
 		dim_print_date_time();
-		conn_id = dis_get_conn_id();
-		printf(" Browse Request <%s> found %d services\n", buffer, n);
+		printf(" Browse Request <%s> found %d services\n", jobp->data, n);
 	}
-	if(!Rpc_info_size)
+	DISABLE_AST
+	if(reader_conn_valid(jobp))
 	{
-		Rpc_info = malloc((size_t)(MAX_NAME*(n+1)*2));
-		Rpc_info_size = MAX_NAME*(n+1)*2;
+		rpc_info = Rpc_info;
+		rpc_info_length = Rpc_info_length;
+		Rpc_info = readerp->text.buffer;
+		Rpc_info_length = readerp->text.length;
+		id[0] = jobp->conn_id;
+		id[1] = 0;
+		dis_selective_update_service(Rpc_id, id);
+		Rpc_info = rpc_info;
+		Rpc_info_length = rpc_info_length;
 	}
-	else if(Rpc_info_size < MAX_NAME*n*2)
+	ENABLE_AST
+}
+
+static void reader_thread(void *tag)
+{
+	DNS_READER *readerp;
+	DNS_JOB *jobp;
+
+	readerp = &Readers[(int)(dim_long)tag];
+	while(1)
 	{
-		free(Rpc_info);
-		Rpc_info = malloc((size_t)(MAX_NAME*(n+1)*2));
-		Rpc_info_size = MAX_NAME*(n+1)*2;
+		pthread_mutex_lock(&readerp->lock);
+		while(!readerp->head)
+			pthread_cond_wait(&readerp->cond, &readerp->lock);
+		jobp = readerp->head;
+		if( !(readerp->head = jobp->next) )
+			readerp->tail = 0;
+		pthread_mutex_unlock(&readerp->lock);
+		if(jobp->type == DNS_JOB_LOOKUP)
+			reader_lookup(readerp, jobp);
+		else
+			reader_browse(readerp, jobp);
+		free(jobp);
 	}
-	Rpc_info[0] = '\0';
-	rpcptr = Rpc_info;
+}
+
+static void readers_init(int n)
+{
+	int i;
+
+	if(n <= 0)
+		return;
+	Readers = (DNS_READER *)calloc((size_t)n, sizeof(DNS_READER));
 	for(i = 0; i < n; i++)
-	{		
-		rpc = 0;
-		servp = Service_info_list[i];
-		if(strstr(servp->serv_name,"/Rpc"))
-		{
-			strcpy(aux,servp->serv_name);
-			if( (ptr = strstr(aux,"/RpcIn")) )
-			{
-				*ptr = '\0';
-				rpc = 1;
-				if( (ptr = strstr(Rpc_info, aux)) )
-				{
-					ptr += (int)strlen(aux);
-					if(*ptr == '|')
-						rpc = 2;
-				}
-			}
-			if( (ptr = strstr(aux,"/RpcOut")) )
-			{
-				*ptr = '\0';
-				rpc = 1;
-				if( (ptr = strstr(Rpc_info, aux)) )
-				{
-					ptr += (int)strlen(aux);
-					if(*ptr == '|')
-						rpc = 2;
-				}
-			}
-			if(rpc == 1)
-			{
-				strcpy(rpcaux, aux);
-				strcat(rpcaux,"|");
-				strcat(aux,"/RpcIn");
-				if( (aux_servp = service_exists(aux)) )
-				{
-					strcat(rpcaux, aux_servp->serv_def);
-					strcat(rpcaux,",");
-					ptr = strstr(aux,"/RpcIn");
-					*ptr = '\0';
-					strcat(aux,"/RpcOut");
-					if( (aux_servp = service_exists(aux)) )
-					{
-						strcat(rpcaux,aux_servp->serv_def);
-						strcat(rpcaux,"|RPC\n");
-						strcpy(rpcptr, rpcaux);
-						rpcptr += (int)strlen(rpcaux);
-					}
-				}
-			}
-		}
-		else
-		{
-			strcpy(rpcaux, servp->serv_name);
-			strcat(rpcaux,"|");
-			strcat(rpcaux,servp->serv_def);
-			if(servp->serv_id & 0x10000000)
-				strcat(rpcaux,"|CMD\n");
-			else
-				strcat(rpcaux,"|\n");
-			strcpy(rpcptr, rpcaux);
-			rpcptr += (int)strlen(rpcaux);
-		}
+	{
+		pthread_mutex_init(&Readers[i].lock, NULL);
+		pthread_cond_init(&Readers[i].cond, NULL);
 	}
-	*rpcptr = '\0';
-	id[0] = dis_get_conn_id();
-	id[1] = 0;
-	dis_selective_update_service(Rpc_id, id); 
-	free(Service_info_list);
+	N_readers = n;
 }
 
-void get_rpc_info(int *tag, char **buffer, int *size)
+static void readers_start()
+{
+	int i;
+
+	for(i = 0; i < N_readers; i++)
+		dim_start_thread(reader_thread, (void *)(dim_long)i);
+}
+
+#else
+
+static void reader_queue(int type, int conn_id, void *data, int size)
+{
+	if(type){}
+	if(conn_id){}
+	if(data){}
+	if(size){}
+}
+
+static void readers_init(int n)
 {
+	if(n){}
+}
 
-	if(tag){}
-	*buffer = Rpc_info;
-	*size = (int)strlen(Rpc_info)+1;
+static void readers_start()
+{
 }
 
+#endif
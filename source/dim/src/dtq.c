@@ -27,19 +27,29 @@ int DIM_Threads_OFF = 1;
 
 #include <sys/timeb.h>
 
+#if defined(__linux__) && !defined(NOTHREADS) && !defined(DIM_NO_TIMERFD)
+/* The timer thread sleeps on a timerfd armed for the next expiry, instead
+   of polling */
+#define DIM_TIMERFD
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
 /* global definitions */
 #define MAX_TIMER_QUEUES	16	/* Number of normal queue's     */
 #define SPECIAL_QUEUE		16	/* The queue for the queue-less */
-#define WRITE_QUEUE			17 
+#define WRITE_QUEUE			17
+
+#define TIMR_POOL_CHUNK		256	/* Entries allocated at a time  */
+#define TAG_HASH			256	/* Buckets of SPECIAL_QUEUE tags */
+#define DTQ_NEVER			((longlong)1 << 62)
 
 _DIM_PROTO( static void alrm_sig_handler,  (int num) );
 _DIM_PROTO( static void Std_timer_handler, () );
-_DIM_PROTO( static int stop_it,			   (int new_time) );
-_DIM_PROTO( static int start_it,		   (int new_time) );
 _DIM_PROTO( static int scan_it,			   () );
-_DIM_PROTO( static int get_minimum,		   (int deltat) );
 _DIM_PROTO( int dtq_task, (void *dummy) );
-_DIM_PROTO( static int my_alarm, (int secs) );
 _DIM_PROTO( int dim_dtq_init,	   (int thr_flag) );
 #ifndef WIN32
 _DIM_PROTO( static void dummy_alrm_sig_handler, (int num) );
@@ -51,24 +61,48 @@ typedef struct {
 } QUEUE_ENT;
 
 
-static QUEUE_ENT timer_queues[MAX_TIMER_QUEUES + 2] = { 
+static QUEUE_ENT timer_queues[MAX_TIMER_QUEUES + 2] = {
 	{0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0},
 	{0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}
 };
 
-static int Inside_ast = 0;
-static int Alarm_runs = 0;
+/* Timed entries of all the queues are kept in a binary heap ordered by
+   expiry time (in milliseconds), the queue lists are only used to delete a
+   queue. Entries are recycled through a free list */
+static TIMR_ENT **Timer_heap = 0;
+static int Timer_heap_size = 0;
+static int Timer_heap_max = 0;
+static TIMR_ENT *Free_entries = 0;
+static TIMR_ENT *Tag_hash[TAG_HASH];
+
 static int sigvec_done = 0;
 
 #ifdef VxWorks
 static timer_t Timer_id;
 #endif
 
-static time_t DIM_last_time = 0;
-static int DIM_last_time_millies = 0;
-static int DIM_next_time = 0;
-static int DIM_time_left = 0;
+static longlong Armed_time = DTQ_NEVER;
 static int Threads_off = 0;
+#ifdef DIM_TIMERFD
+static int Timer_fd = -1;
+#endif
+
+/* The timer heap, the queues and the armed time have a lock of their own,
+   timers are started and restarted without the DIM lock. Entries are
+   removed and their routines called holding the DIM lock as well, the
+   timer lock is a leaf */
+#if defined(__unix__) && !defined(NOTHREADS) && !defined(VxWorks)
+static pthread_mutex_t Dtq_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define DTQ_LOCK			DISABLE_SIG pthread_mutex_lock(&Dtq_mutex);
+#define DTQ_UNLOCK			pthread_mutex_unlock(&Dtq_mutex); ENABLE_SIG
+#define DTQ_MUTEX_LOCK		pthread_mutex_lock(&Dtq_mutex);
+#define DTQ_MUTEX_UNLOCK	pthread_mutex_unlock(&Dtq_mutex);
+#else
+#define DTQ_LOCK			DISABLE_AST
+#define DTQ_UNLOCK			ENABLE_AST
+#define DTQ_MUTEX_LOCK
+#define DTQ_MUTEX_UNLOCK
+#endif
 
 /*
  * DTQ routines
@@ -81,7 +115,7 @@ void dim_no_threads()
 {
 	extern void dic_no_threads();
 	extern void dis_no_threads();
-	
+
 	DIM_Threads_OFF = 1;
 	Threads_off = 1;
 	dic_no_threads();
@@ -97,11 +131,9 @@ int ret = 0;
 /*
 	pid = getpid();
 */
-	if( !sigvec_done) 
+	if( !sigvec_done)
 	{
-	    Inside_ast = 0;
-	    Alarm_runs = 0;
-	    DIM_last_time = 0;
+	    Armed_time = DTQ_NEVER;
 /*
 	    for(i = 0; i < MAX_TIMER_QUEUES + 2; i++)
 	    {
@@ -123,10 +155,16 @@ int ret = 0;
 	    {
 	        Threads_off = 1;
 	    }
+#ifdef DIM_TIMERFD
+		else if(Timer_fd == -1)
+		{
+			Timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+		}
+#endif
 		sigemptyset(&set);
-	  
+
 		sigaddset(&set,SIGIO);
-		
+
 		if(thr_flag)
 			sig_info.sa_handler = dummy_alrm_sig_handler;
 		else
@@ -141,7 +179,7 @@ int ret = 0;
 			perror( "sigaction(SIGALRM)" );
 			exit(1);
 		}
-	    
+
 	    sigvec_done = 1;
 	    ret = 1;
 	}
@@ -161,9 +199,7 @@ int dim_dtq_init(int thr_flag)
 	void create_alrm_thread(void);
 
 	if( !sigvec_done ) {
-		Inside_ast = 0;
-	    Alarm_runs = 0;
-	    DIM_last_time = 0;
+	    Armed_time = DTQ_NEVER;
 /*
 	    for(i = 0; i < MAX_TIMER_QUEUES + 2; i++)
 	    {
@@ -215,79 +251,240 @@ void dim_dtq_stop()
 	if( timer_queues[WRITE_QUEUE].queue_head != NULL)
 	{
 		dtq_delete(WRITE_QUEUE);
-		free((TIMR_ENT *)timer_queues[WRITE_QUEUE].queue_head);
-		timer_queues[WRITE_QUEUE].queue_head = 0;
 	}
+#ifdef DIM_TIMERFD
+	if(Timer_fd != -1)
+	{
+		close(Timer_fd);
+		Timer_fd = -1;
+	}
+#endif
 	sigvec_done = 0;
 }
 
-static int get_current_time(int *millies)
+static longlong get_current_time()
 {
-	int secs;
 #ifdef WIN32
 	struct timeb timebuf;
-#else
-	struct timeval tv;
-	struct timezone *tz;
-#endif
 
-#ifdef WIN32
 	ftime(&timebuf);
-	secs = (int)timebuf.time;
-	*millies = timebuf.millitm;
+	return (longlong)timebuf.time * 1000 + timebuf.millitm;
 #else
-	tz = 0;
-	gettimeofday(&tv, tz);
-	secs = (int)tv.tv_sec;
-	*millies = (int)tv.tv_usec / 1000;
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (longlong)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#else
+	struct timeval tv;
+
+	gettimeofday(&tv, 0);
+	return (longlong)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+#endif
 #endif
-	return secs;
 }
 
-static int get_elapsed_time()
+/* Seconds left before the entry expires, rounded up */
+static int get_time_left(TIMR_ENT *entry, longlong now)
 {
-	int millies, deltat;
-	int now;
+	longlong left;
 
-	now = get_current_time(&millies);
-	deltat = now - (int)DIM_last_time;
-	if((millies + 50) < DIM_last_time_millies)
-	{
-		deltat --;
-	}
-	return deltat;
+	left = entry->expires - now;
+	if(left <= 0)
+		return(0);
+	return (int)((left + 999) / 1000);
 }
 
-static int my_alarm(int secs)
+/* Called with the timer lock: the timer thread (or SIGALRM) is set to fire
+   at next_time, 0 means as soon as possible */
+static void arm_timer(longlong next_time)
 {
-	int ret;
+#ifdef DIM_TIMERFD
+	struct itimerspec its;
+#endif
+#ifndef WIN32
+	struct itimerval itv;
+	longlong delta;
+#endif
 
-	DIM_next_time = secs;
+	Armed_time = next_time;
+#ifdef DIM_TIMERFD
+	if(Timer_fd != -1)
+	{
+		memset(&its, 0, sizeof(its));
+		if(next_time != DTQ_NEVER)
+		{
+			/* An absolute time in the past fires at once, 0 would disarm */
+			if(next_time <= 0)
+				next_time = 1;
+			its.it_value.tv_sec = (time_t)(next_time / 1000);
+			its.it_value.tv_nsec = (long)(next_time % 1000) * 1000000;
+		}
+		timerfd_settime(Timer_fd, TFD_TIMER_ABSTIME, &its, 0);
+		return;
+	}
+#endif
 #ifndef WIN32
 	if(Threads_off)
 	{
-		if( secs < 0)
+		memset(&itv, 0, sizeof(itv));
+		if(next_time != DTQ_NEVER)
 		{
-			kill(getpid(),SIGALRM);
-			return(0);
+			delta = next_time - get_current_time();
+			if(delta <= 0)
+			{
+				kill(getpid(),SIGALRM);
+				return;
+			}
+			itv.it_value.tv_sec = (long)(delta / 1000);
+			itv.it_value.tv_usec = (long)(delta % 1000) * 1000;
 		}
-		else
+		setitimer(ITIMER_REAL, &itv, 0);
+	}
+#endif
+}
+
+static void check_timer(longlong next_time)
+{
+	if(next_time < Armed_time)
+		arm_timer(next_time);
+}
+
+static longlong get_next_time()
+{
+	TIMR_ENT *queue_head;
+
+	queue_head = timer_queues[WRITE_QUEUE].queue_head;
+	if( queue_head && dll_get_next_unlocked((DLL *)queue_head,(DLL *)queue_head))
+		return(0);
+	if(Timer_heap_size)
+		return(Timer_heap[0]->expires);
+	return(DTQ_NEVER);
+}
+
+static TIMR_ENT *alloc_entry()
+{
+	TIMR_ENT *entry;
+	int i;
+
+	if(!Free_entries)
+	{
+		entry = (TIMR_ENT *)malloc(TIMR_POOL_CHUNK * sizeof(TIMR_ENT));
+		for(i = 0; i < TIMR_POOL_CHUNK; i++)
 		{
-			return((int)alarm((unsigned int)secs));
+			entry[i].next = Free_entries;
+			Free_entries = &entry[i];
 		}
 	}
-	else
+	entry = Free_entries;
+	Free_entries = entry->next;
+	memset(entry, 0, sizeof(TIMR_ENT));
+	entry->heap_index = -1;
+	return(entry);
+}
+
+static void free_entry(TIMR_ENT *entry)
+{
+	entry->next = Free_entries;
+	Free_entries = entry;
+}
+
+static void heap_set(int index, TIMR_ENT *entry)
+{
+	Timer_heap[index] = entry;
+	entry->heap_index = index;
+}
+
+static void heap_up(int index)
+{
+	TIMR_ENT *entry;
+	int parent;
+
+	entry = Timer_heap[index];
+	while(index > 0)
 	{
-#endif
+		parent = (index - 1) / 2;
+		if(Timer_heap[parent]->expires <= entry->expires)
+			break;
+		heap_set(index, Timer_heap[parent]);
+		index = parent;
+	}
+	heap_set(index, entry);
+}
 
-		ret = DIM_time_left;
+static void heap_down(int index)
+{
+	TIMR_ENT *entry;
+	int child;
 
-		if(secs == 0)
-			DIM_next_time = -1;
-		return(ret);
-#ifndef WIN32
+	entry = Timer_heap[index];
+	while((child = 2 * index + 1) < Timer_heap_size)
+	{
+		if((child + 1 < Timer_heap_size) &&
+			(Timer_heap[child + 1]->expires < Timer_heap[child]->expires))
+			child++;
+		if(entry->expires <= Timer_heap[child]->expires)
+			break;
+		heap_set(index, Timer_heap[child]);
+		index = child;
+	}
+	heap_set(index, entry);
+}
+
+static void heap_insert(TIMR_ENT *entry)
+{
+	if(Timer_heap_size == Timer_heap_max)
+	{
+		Timer_heap_max = Timer_heap_max ? Timer_heap_max * 2 : TIMR_POOL_CHUNK;
+		Timer_heap = (TIMR_ENT **)realloc(Timer_heap,
+			(size_t)Timer_heap_max * sizeof(TIMR_ENT *));
+	}
+	heap_set(Timer_heap_size++, entry);
+	heap_up(entry->heap_index);
+}
+
+static void heap_remove(TIMR_ENT *entry)
+{
+	int index;
+
+	index = entry->heap_index;
+	if(index < 0)
+		return;
+	entry->heap_index = -1;
+	Timer_heap_size--;
+	if(index == Timer_heap_size)
+		return;
+	heap_set(index, Timer_heap[Timer_heap_size]);
+	heap_up(index);
+	heap_down(Timer_heap[index]->heap_index);
+}
+
+static void heap_update(TIMR_ENT *entry)
+{
+	heap_up(entry->heap_index);
+	heap_down(entry->heap_index);
+}
+
+static int tag_hash(dim_long tag)
+{
+	unsigned long h;
+
+	h = (unsigned long)tag;
+	return (int)((h ^ (h >> 8) ^ (h >> 16)) % TAG_HASH);
+}
+
+static void tag_remove(TIMR_ENT *entry)
+{
+	TIMR_ENT **auxp;
+
+	for(auxp = &Tag_hash[tag_hash(entry->tag)]; *auxp; auxp = &(*auxp)->next_tag)
+	{
+		if(*auxp == entry)
+		{
+			*auxp = entry->next_tag;
+			break;
+		}
 	}
-#endif
 }
 
 void dim_usleep(int usecs)
@@ -306,42 +503,43 @@ void dim_usleep(int usecs)
 
 int dtq_task(void *dummy)
 {
-int deltat;
-static int to_go;
+longlong next_time;
+#ifdef DIM_TIMERFD
+longlong expirations;
+#endif
 
 	if(dummy){}
 	while(1)
 	{
-		if(DIM_next_time)
+#ifdef DIM_TIMERFD
+		if(Timer_fd != -1)
 		{
-			DISABLE_AST
-			DIM_time_left = DIM_next_time;
-			if(DIM_time_left == -1)
-				DIM_time_left = 0;
-			to_go = DIM_next_time;
-			DIM_next_time = 0;
-			ENABLE_AST
+			if(read(Timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+			{
+				alrm_sig_handler(2);
+				return(1);
+			}
+			if((errno == EINTR) || (errno == EAGAIN))
+				continue;
+			{
+			DTQ_LOCK
+			close(Timer_fd);
+			Timer_fd = -1;
+			DTQ_UNLOCK
+			}
 		}
-		if(DIM_time_left < 0)
-		{
-			DIM_time_left = 0;
-			alrm_sig_handler(2);
-#ifndef WIN32
-			return(1);
 #endif
+		{
+		DTQ_LOCK
+		next_time = Armed_time;
+		DTQ_UNLOCK
 		}
-		else if(DIM_time_left > 0)
+		if(next_time <= get_current_time())
 		{
-			dim_usleep(100000);
-			deltat = get_elapsed_time();
-			DIM_time_left = to_go - deltat;
-			if(DIM_time_left <= 0)
-			{
-				alrm_sig_handler(2);
+			alrm_sig_handler(2);
 #ifndef WIN32
-				return(1);
+			return(1);
 #endif
-			}
 		}
 		else
 		{
@@ -380,383 +578,192 @@ int dtq_delete(int queue_id)
 	TIMR_ENT *queue_head, *entry;
 
 	DISABLE_AST
+	DTQ_MUTEX_LOCK
 	queue_head = timer_queues[queue_id].queue_head;
 	if(queue_head)
 	{
-		while(!dll_empty((DLL *)queue_head))
+		while(!dll_empty_unlocked((DLL *)queue_head))
 		{
 			entry = queue_head->next;
-			dll_remove(entry);
-			free(entry);
+			dll_remove_unlocked(entry);
+			heap_remove(entry);
+			if(queue_id == SPECIAL_QUEUE)
+				tag_remove(entry);
+			free_entry(entry);
 		}
 		free(queue_head);
 		timer_queues[queue_id].queue_head = 0;
 	}
+	DTQ_MUTEX_UNLOCK
 	ENABLE_AST
-	return(1);			
+	return(1);
 }
-	
+
 TIMR_ENT *dtq_add_entry(int queue_id, int time, void (*user_routine)(), dim_long tag)
 {
-	TIMR_ENT *new_entry, *queue_head, *auxp, *prevp;
-	int next_time, min_time = 100000;
-	int time_left, deltat = 0;
+	TIMR_ENT *new_entry, *queue_head;
+	int index;
 
-	DISABLE_AST 
+	DTQ_LOCK
 
-	next_time = time;
-	if(!next_time)
-		next_time = -10;
-	if(Alarm_runs)
-	{
-		time_left = DIM_time_left;
-		if(!time_left)
-			time_left = DIM_next_time;
-		if((time_left > next_time) || (queue_id == SPECIAL_QUEUE))
-	    {
-			if(next_time != -10)
-			{
-				min_time = stop_it();
-				if((next_time > min_time) && (min_time != 0))
-					next_time = min_time;
-			}
-			else
-				my_alarm(next_time);
-	    }
-		else
-		{
-		    deltat = get_elapsed_time();
-		}
-	}
-	new_entry = (TIMR_ENT *)malloc( sizeof(TIMR_ENT) );
+	new_entry = alloc_entry();
 	new_entry->time = time;
     if( user_routine )
    	   	new_entry->user_routine = user_routine;
 	else
        	new_entry->user_routine = Std_timer_handler;
 	new_entry->tag = tag;
-	new_entry->time_left = time + deltat;
+	new_entry->queue_id = queue_id;
 
 	queue_head = timer_queues[queue_id].queue_head;
-	if(!time)
+	dll_insert_after_unlocked((DLL *)queue_head->prev, (DLL *)new_entry);
+	if(queue_id == WRITE_QUEUE)
 	{
-		dll_insert_after((DLL *)queue_head->prev, (DLL *)new_entry);
+		check_timer(0);
 	}
 	else
 	{
-		if(queue_head)
+		new_entry->expires = get_current_time() + (longlong)time * 1000;
+		heap_insert(new_entry);
+		if(queue_id == SPECIAL_QUEUE)
 		{
-			auxp = queue_head;
-			prevp = auxp;
-			while((auxp = (TIMR_ENT *)dll_get_prev((DLL *)queue_head, (DLL *)auxp)))
-			{
-				if(time >= auxp->time)
-				{
-					break;
-				}
-				prevp = auxp;
-			}
-/*
-			if(auxp)
-			{
-				if(queue_id != SPECIAL_QUEUE)
-				{
-					if(auxp->time_left > 0)
-					{
-						if(auxp->time == time)
-							new_entry->time_left = auxp->time_left;
-					}
-				}
-				prevp = auxp;
-			}
-*/
-			dll_insert_after((DLL *)prevp, (DLL *)new_entry);
+			index = tag_hash(tag);
+			new_entry->next_tag = Tag_hash[index];
+			Tag_hash[index] = new_entry;
 		}
+		check_timer(new_entry->expires);
 	}
-	if(!Alarm_runs)
-	{
-		if((next_time != -10) && (min_time == 100000))
-		{
-			min_time = get_minimum(0);
-			if(next_time > min_time)
-				next_time = min_time;
-		}
-		start_it(next_time);
-	}
-	ENABLE_AST
-	return(new_entry); 
+	DTQ_UNLOCK
+	return(new_entry);
 }
 
 int dtq_clear_entry(TIMR_ENT *entry)
 {
-	int time_left, deltat = 0;
+	int time_left;
+	longlong now;
 
-	DISABLE_AST
-	deltat = get_elapsed_time();
-	time_left = entry->time_left - deltat;
-	entry->time_left = entry->time + deltat;
-	ENABLE_AST
-	return(time_left);
-}
-
-
-int dtq_rem_entry(int queue_id, TIMR_ENT *entry)
-{
-	int time_left, deltat = 0;
-
-	DISABLE_AST
-	deltat = get_elapsed_time();
-	time_left = entry->time_left - deltat;
-	if( Inside_ast ) 
+	DTQ_LOCK
+	now = get_current_time();
+	time_left = get_time_left(entry, now);
+	if(entry->heap_index >= 0)
 	{
-		timer_queues[queue_id].remove_entries++;
-		entry->time = -1;
-		ENABLE_AST
-		return(time_left);
+		entry->expires = now + (longlong)entry->time * 1000;
+		heap_update(entry);
+		check_timer(entry->expires);
 	}
-	dll_remove(entry);
-	free(entry);
-
-	ENABLE_AST
+	DTQ_UNLOCK
 	return(time_left);
 }
 
-static int rem_deleted_entries(int queue_id)
+static int rem_entry(int queue_id, TIMR_ENT *entry)
 {
-	TIMR_ENT *auxp, *prevp, *queue_head;
-	int n;
-
-	DISABLE_AST
-	queue_head = timer_queues[queue_id].queue_head;
-	n = timer_queues[queue_id].remove_entries;
-	if(queue_head)
-	{
-		auxp = queue_head;
-		prevp = auxp;
-		while( (auxp = (TIMR_ENT *)dll_get_next((DLL *)queue_head, (DLL *)auxp)) )
-		{
-			if(auxp->time == -1)
-			{
-				dll_remove(auxp);
-				free(auxp);
-				auxp = prevp;
-				n--;
-				if(!n)
-					break;
-			}
-			else
-				prevp = auxp;
-		}
-	}
-	ENABLE_AST;
-	return(1);
-}
-
-static int get_minimum(int deltat)
-{
-	TIMR_ENT *auxp, *queue_head;
-	int queue_id;
-	int min_time = 100000;
-
-	queue_head = timer_queues[WRITE_QUEUE].queue_head;
-	if( dll_get_next((DLL *)queue_head,(DLL *)queue_head))
-		min_time = -10;
-	if((min_time != -10) || deltat)
-	{
-		if( (queue_head = timer_queues[SPECIAL_QUEUE].queue_head) != NULL)
-		{
-			auxp = queue_head;
-			while( (auxp = (TIMR_ENT *)dll_get_next((DLL *)queue_head,(DLL *)auxp)) )
-			{
-				auxp->time_left -= deltat;
-				if(auxp->time_left > 0)
-				{
-					if(auxp->time_left < min_time)
-					{
-						min_time = auxp->time_left;
-					}
-				}
-			}
-		}
-		for( queue_id = 0; queue_id < MAX_TIMER_QUEUES; queue_id++ ) 
-		{
-			if( (queue_head = timer_queues[queue_id].queue_head) == NULL )
-				continue;
-			auxp = queue_head;
-			while( (auxp = (TIMR_ENT *)dll_get_next((DLL *)queue_head,(DLL *)auxp)) )
-			{
-				auxp->time_left -= deltat;
-				if(auxp->time_left > 0)
-				{
-					if(auxp->time_left < min_time)
-					{
-						min_time = auxp->time_left;
-					}
-				}
-				else
-				{
-					if(auxp->time < min_time)
-					{
-						min_time = auxp->time;
-					}
-				}
-				if((!deltat) && (min_time <= 1))
-					break;
-			}
-		}
-	}
-	if(min_time == 100000)
-		min_time = 0;
-	return min_time;
-}
-
-static int stop_it()
-{
-	int min_time;
-    int deltat = 0;
-
-	DISABLE_AST
-	if(Alarm_runs)
-	{
-		my_alarm(0);
-        deltat = get_elapsed_time();
-		if(deltat != 0)
-			DIM_last_time = get_current_time(&DIM_last_time_millies);
-		Alarm_runs = 0;
-	}
-	min_time = get_minimum(deltat);
-	ENABLE_AST
-	return(min_time);
+	/* Called with the DIM lock and the timer lock */
+	int time_left;
+
+	time_left = get_time_left(entry, get_current_time());
+	dll_remove_unlocked(entry);
+	heap_remove(entry);
+	if(queue_id == SPECIAL_QUEUE)
+		tag_remove(entry);
+	free_entry(entry);
+	return(time_left);
 }
 
-static int start_it(int new_time)
+int dtq_rem_entry(int queue_id, TIMR_ENT *entry)
 {
-	int next_time;
-	TIMR_ENT *queue_head;
+	int time_left;
 
 	DISABLE_AST
-	next_time = new_time;
-	if(next_time > 0)
-	{
-		queue_head = timer_queues[WRITE_QUEUE].queue_head;
-		if( dll_get_next((DLL *)queue_head,(DLL *)queue_head))
-		{
-			next_time = -10;
-		}
-	}
-	if(next_time)
-	{
-		my_alarm(next_time);
-		Alarm_runs = 1;
-		if(!DIM_last_time)
-			DIM_last_time = get_current_time(&DIM_last_time_millies);
-	}
-	else
-		DIM_last_time = 0;
-
+	DTQ_MUTEX_LOCK
+	time_left = rem_entry(queue_id, entry);
+	DTQ_MUTEX_UNLOCK
 	ENABLE_AST
-	return(1);
+	return(time_left);
 }
 
 static int scan_it()
 {
-	int queue_id, i, n = 0;
-	static int curr_queue_id = 0;
-	static TIMR_ENT *curr_entry = 0;
-	TIMR_ENT *auxp, *prevp, *queue_head;
+	int i, n = 0;
+	TIMR_ENT *auxp, *queue_head;
 	TIMR_ENT *done[1024];
+	longlong now;
+	void (*user_routine)();
+	dim_long tag;
 
-	DISABLE_AST
+	DTQ_LOCK
 	queue_head = timer_queues[WRITE_QUEUE].queue_head;
 	if(!queue_head)
 	{
-		ENABLE_AST
+		DTQ_UNLOCK
 		return(0);
 	}
 	auxp = queue_head;
-	while( (auxp = (TIMR_ENT *)dll_get_next((DLL *)queue_head,(DLL *)auxp)) )
-	{	
+	while( (auxp = (TIMR_ENT *)dll_get_next_unlocked((DLL *)queue_head,(DLL *)auxp)) )
+	{
 		done[n++] = auxp;
 		if(n == 1000)
 			break;
 	}
-	ENABLE_AST
+	DTQ_UNLOCK
 	for(i = 0; i < n; i++)
 	{
 		auxp = done[i];
 		auxp->user_routine( auxp->tag );
 	}
 	{
-		DISABLE_AST
+		DTQ_LOCK
 		for(i = 0; i < n; i++)
 		{
 			auxp = done[i];
-			dll_remove(auxp);
-			free(auxp);
+			dll_remove_unlocked(auxp);
+			free_entry(auxp);
 		}
 		if(n == 1000)
 		{
-			ENABLE_AST
+			DTQ_UNLOCK
 			return(1);
 		}
-		ENABLE_AST
+		DTQ_UNLOCK
 	}
 	{
+	/* The routines run with the DIM lock, the timer lock is released
+	   around them. An entry is only removed holding both */
 	DISABLE_AST
-	queue_head = timer_queues[SPECIAL_QUEUE].queue_head;
-	auxp = queue_head;
-	prevp = auxp;
-	while( (auxp = (TIMR_ENT *)dll_get_next((DLL *)queue_head,(DLL *)auxp)) )
-	{	
-		if(auxp->time_left <= 0)
+	now = get_current_time();
+	DTQ_MUTEX_LOCK
+	while(Timer_heap_size && (Timer_heap[0]->expires <= now))
+	{
+		auxp = Timer_heap[0];
+		user_routine = auxp->user_routine;
+		tag = auxp->tag;
+		if(auxp->queue_id == SPECIAL_QUEUE)
 		{
-			dll_remove(auxp);
-			auxp->user_routine( auxp->tag );
-			free(auxp);
-			auxp = prevp;
-			n++;
-			if(n == 100)
-			{
-				ENABLE_AST
-				return(1);
-			}
+			dll_remove_unlocked(auxp);
+			heap_remove(auxp);
+			tag_remove(auxp);
+			free_entry(auxp);
 		}
 		else
-			prevp = auxp;
-	}
-	for( queue_id = curr_queue_id; queue_id < MAX_TIMER_QUEUES; queue_id++ ) 
-	{
-		if( (queue_head = timer_queues[queue_id].queue_head) == NULL )
-			continue;
-		Inside_ast = 1;
-		if((curr_entry) && (queue_id == curr_queue_id))
-			auxp = curr_entry;
-		else
-			auxp = queue_head;
-		while( (auxp = (TIMR_ENT *)dll_get_next((DLL *)queue_head,(DLL *)auxp)) )
-		{	
-			if(auxp->time_left <= 0)
-			{
-				auxp->user_routine( auxp->tag );
-				auxp->time_left = auxp->time; /*restart clock*/
-				n++;
-				if(n == 100)
-				{
-					curr_queue_id = queue_id;
-					curr_entry = auxp;
-					ENABLE_AST
-					return(1);
-				}
-			}
+		{
+			/* restart clock, before the routine which may remove the entry */
+			if(auxp->time > 0)
+				auxp->expires = now + (longlong)auxp->time * 1000;
+			else
+				auxp->expires = now + 1;
+			heap_down(0);
 		}
-		Inside_ast = 0;
-		if( timer_queues[queue_id].remove_entries ) {
-			rem_deleted_entries( queue_id );
-			timer_queues[queue_id].remove_entries = 0;
+		DTQ_MUTEX_UNLOCK
+		user_routine( tag );
+		DTQ_MUTEX_LOCK
+		n++;
+		if(n == 100)
+		{
+			DTQ_MUTEX_UNLOCK
+			ENABLE_AST
+			return(1);
 		}
 	}
-	curr_queue_id = 0;
-	curr_entry = 0;
+	DTQ_MUTEX_UNLOCK
 	ENABLE_AST
 	}
 	return(0);
@@ -764,22 +771,26 @@ static int scan_it()
 
 static void alrm_sig_handler( int num)
 {
-	int next_time;
+	int more = 0;
 
 	if(num){}
-	next_time = stop_it();
+	{
+	DTQ_LOCK
+	Armed_time = DTQ_NEVER;
+	DTQ_UNLOCK
+	}
 	if(Threads_off)
 	{
-		if(scan_it())
-			next_time = -10;
+		more = scan_it();
 	}
 	else
 	{
 		while(scan_it());
 	}
-	if(!Alarm_runs)
 	{
-		start_it(next_time);
+	DTQ_LOCK
+	arm_timer(more ? 0 : get_next_time());
+	DTQ_UNLOCK
 	}
 }
 
@@ -805,19 +816,23 @@ void dtq_start_timer(int time, void (*user_routine)(), dim_long tag)
 
 int dtq_stop_timer(dim_long tag)
 {
-	TIMR_ENT *entry, *queue_head;
+	TIMR_ENT *entry, *found = 0;
 	int time_left = -1;
 
-	queue_head = timer_queues[SPECIAL_QUEUE].queue_head;
-	entry = queue_head;
-	while( (entry = (TIMR_ENT *)dll_get_next((DLL *)queue_head,(DLL *)entry)) )
+	DISABLE_AST
+	DTQ_MUTEX_LOCK
+	for(entry = Tag_hash[tag_hash(tag)]; entry; entry = entry->next_tag)
 	{
-		if( entry->tag == tag ) 
+		if( entry->tag == tag )
 		{
-			time_left = dtq_rem_entry( SPECIAL_QUEUE, entry );
-			break;
+			if((!found) || (entry->expires < found->expires))
+				found = entry;
 		}
 	}
+	if(found)
+		time_left = rem_entry( SPECIAL_QUEUE, found );
+	DTQ_MUTEX_UNLOCK
+	ENABLE_AST
 	return(time_left);
 }
 
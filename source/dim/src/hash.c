@@ -37,3 +37,160 @@ int HashFunction(char *name, int max)
 
    return ((int)(hash % (unsigned)max));
 }
+
+/*
+ * Name tables
+ *
+ * Open addressing with linear probing. The items are found by the name
+ * stored at name_offset in them, the hash of the name is kept in the slot
+ * so the names are only compared when the hashes match. Several items can
+ * have the same name, name_table_find() returns the first one inserted.
+ */
+
+#define NAME_TABLE_MIN	64
+
+unsigned int name_hash(char *name)
+{
+	register unsigned int hash = 2166136261U;
+
+	while(*name)
+	{
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619U;
+	}
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bU;
+	hash ^= hash >> 13;
+	return hash;
+}
+
+void name_table_init(NAME_TABLE *table, int name_offset)
+{
+	table->slots = 0;
+	table->size = 0;
+	table->n_items = 0;
+	table->name_offset = name_offset;
+}
+
+void name_table_free(NAME_TABLE *table)
+{
+	if(table->slots)
+		free(table->slots);
+	table->slots = 0;
+	table->size = 0;
+	table->n_items = 0;
+}
+
+static void name_table_put(NAME_TABLE *table, unsigned int hash, void *item)
+{
+	register int mask, index;
+
+	mask = table->size - 1;
+	index = (int)(hash & (unsigned)mask);
+	while(table->slots[index].item)
+		index = (index + 1) & mask;
+	table->slots[index].hash = hash;
+	table->slots[index].item = item;
+}
+
+static void name_table_resize(NAME_TABLE *table, int size)
+{
+	NAME_SLOT *old_slots;
+	int i, old_size;
+
+	old_slots = table->slots;
+	old_size = table->size;
+	table->slots = (NAME_SLOT *)calloc((size_t)size, sizeof(NAME_SLOT));
+	table->size = size;
+	for(i = 0; i < old_size; i++)
+	{
+		if(old_slots[i].item)
+			name_table_put(table, old_slots[i].hash, old_slots[i].item);
+	}
+	if(old_slots)
+		free(old_slots);
+}
+
+void name_table_insert(NAME_TABLE *table, void *item)
+{
+	/* Kept at most 2/3 full */
+	if((table->n_items + 1) * 3 > table->size * 2)
+		name_table_resize(table, table->size ? table->size * 2 : NAME_TABLE_MIN);
+	name_table_put(table, name_hash((char *)item + table->name_offset), item);
+	table->n_items++;
+}
+
+void *name_table_find(NAME_TABLE *table, char *name)
+{
+	register int mask, index;
+	register unsigned int hash;
+	register NAME_SLOT *slotp;
+
+	if(!table->n_items)
+		return(0);
+	hash = name_hash(name);
+	mask = table->size - 1;
+	index = (int)(hash & (unsigned)mask);
+	while( (slotp = &table->slots[index])->item )
+	{
+		if((slotp->hash == hash) &&
+			!strcmp((char *)slotp->item + table->name_offset, name))
+			return(slotp->item);
+		index = (index + 1) & mask;
+	}
+	return(0);
+}
+
+int name_table_remove(NAME_TABLE *table, void *item)
+{
+	register int mask, index, next, home;
+	unsigned int hash;
+
+	if(!table->n_items)
+		return(0);
+	hash = name_hash((char *)item + table->name_offset);
+	mask = table->size - 1;
+	index = (int)(hash & (unsigned)mask);
+	while(table->slots[index].item != item)
+	{
+		if(!table->slots[index].item)
+			return(0);
+		index = (index + 1) & mask;
+	}
+	/* Move back the following items of the cluster which would not be
+	   found any more, there are no tombstones */
+	next = index;
+	while(1)
+	{
+		next = (next + 1) & mask;
+		if(!table->slots[next].item)
+			break;
+		home = (int)(table->slots[next].hash & (unsigned)mask);
+		if(((next - home) & mask) >= ((next - index) & mask))
+		{
+			table->slots[index] = table->slots[next];
+			index = next;
+		}
+	}
+	table->slots[index].item = 0;
+	table->n_items--;
+	return(1);
+}
+
+/* The next item after slot *index (-1 to start), in slot order. Removing
+   the returned item can move a following one into its slot */
+void *name_table_next(NAME_TABLE *table, int *index)
+{
+	register int i;
+
+	for(i = *index + 1; i < table->size; i++)
+	{
+		if(table->slots[i].item)
+		{
+			*index = i;
+			return(table->slots[i].item);
+		}
+	}
+	*index = -1;
+	return(0);
+}
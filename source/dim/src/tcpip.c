@@ -72,9 +72,28 @@ typedef int pid_t;
 #include <sys/ioctl.h>
 #include <errno.h>
 #include <netdb.h>
+#include <sys/uio.h>
 
 #endif
 
+#if defined(__linux__) && !defined(DIM_NO_EPOLL) && !defined(NOTHREADS)
+/* The IO threads use epoll, sockets are registered once and only the
+   ready ones are dispatched. Poll is kept for the signal driven mode */
+#define DIM_EPOLL
+#include <sys/epoll.h>
+#include <stdint.h>
+#include <pthread.h>
+#define MAX_EPOLL_EVENTS 256
+#endif
+
+#if defined(__unix__) && !defined(NOTHREADS) && !defined(VxWorks)
+/* Writes to a connection are serialized by its write lock, so service
+   updates can be sent without holding the DIM lock. Connections share
+   WRITE_LOCKS locks, by conn_id */
+#define DIM_WRITE_LOCKS
+#define WRITE_LOCKS 64
+#endif
+
 #ifdef __linux__
 #include <poll.h>
 #define MY_FD_ZERO(set)	
@@ -102,6 +121,31 @@ static struct sockaddr_in DIM_sockname;
 static int DIM_IO_path[2] = {-1,-1};
 static int DIM_IO_Done = 0;
 static int DIM_IO_valid = 1;
+static int IO_threads = 1;
+static int IO_threads_set = 0;
+#ifdef DIM_EPOLL
+/* One reactor per IO thread, connections are spread over them when they
+   start reading. The reactor lock protects the receive rings of its
+   connections, which are filled without holding the DIM lock */
+typedef struct {
+	int epoll_fd;
+	int n_conns;
+	pthread_mutex_t lock;
+	struct epoll_event events[MAX_EPOLL_EVENTS];
+} IO_REACTOR;
+
+static IO_REACTOR Reactors[MAX_IO_THREADS];
+static int N_reactors = 0;
+#endif
+#ifdef DIM_WRITE_LOCKS
+static pthread_mutex_t Write_locks[WRITE_LOCKS];
+static int Write_locks_init = 0;
+#define WRITE_LOCK(conn_id)		if(Write_locks_init) pthread_mutex_lock(&Write_locks[(conn_id) % WRITE_LOCKS]);
+#define WRITE_UNLOCK(conn_id)	if(Write_locks_init) pthread_mutex_unlock(&Write_locks[(conn_id) % WRITE_LOCKS]);
+#else
+#define WRITE_LOCK(conn_id)
+#define WRITE_UNLOCK(conn_id)
+#endif
 
 static int Listen_backlog = SOMAXCONN;
 static int Keepalive_timeout_set = 0;
@@ -109,6 +153,176 @@ static int Write_timeout = WRITE_TMOUT;
 static int Write_timeout_set = 0;
 static int Write_buffer_size = TCP_SND_BUF_SIZE;
 static int Read_buffer_size = TCP_RCV_BUF_SIZE;
+static int Write_queue_limit = WRITE_QUEUE_LIMIT;
+static int Write_queue_policy = DIM_WQ_DROP_OLDEST;
+
+/* Data that could not be written immediately, sent by the IO thread
+   when the socket becomes writable. The last shared_size bytes are not
+   copied, they are referenced in shared data held until sent */
+typedef struct tcpip_wentry {
+	struct tcpip_wentry *next;
+	int tag;
+	int started;
+	int size;
+	int offset;
+	TCPIP_SHARED *sharedp;
+	char *shared_data;
+	int shared_size;
+	char data[1];
+} TCPIP_WENTRY;
+
+/* Write errors, noted under the write lock and reported after it */
+#define WERR_NONE			0
+#define WERR_OVERFLOW		1
+#define WERR_NONBLOCKING	2
+#define WERR_QUEUED			3
+#define WERR_RETRY			4
+#define WERR_BLOCKING		5
+
+static struct {
+	int code;
+	char *text;
+	int severity;
+	int errcode;
+} Write_errors[] = {
+	{ -1, "", 0, 0 },
+	{ -1, "Write queue overflow, disconnecting", DIM_WARNING, DIMTCPWRTMO },
+	{ 0, "Writing (non-blocking) to", DIM_ERROR, DIMTCPWRRTY },
+	{ 0, "Writing (queued) to", DIM_ERROR, DIMTCPWRRTY },
+	{ 0, "Writing to", DIM_ERROR, DIMTCPWRRTY },
+	{ 0, "Writing (blocking) to", DIM_ERROR, DIMTCPWRRTY }
+};
+
+int set_non_blocking(int channel);
+static int tcpip_last_error();
+static void write_queue_free(int conn_id);
+static int write_queue_append(int conn_id, TCPIP_IOVEC *iov, int n_iov, int skip, int tag,
+	TCPIP_SHARED *sharedp, TCPIP_WRITE_ERROR *errp);
+
+#ifdef DIM_EPOLL
+static void epoll_update(int conn_id, int op)
+{
+	/* (Re)register conn_id, watching for writes while data is queued.
+	 * The event carries the channel to detect reused connection slots.
+	 */
+	struct epoll_event ev;
+	int i, r;
+
+	if(!N_reactors)
+		return;
+	if(op == EPOLL_CTL_ADD)
+	{
+		/* Listening sockets stay on the first reactor, the others go
+		   to the least loaded one */
+		r = 0;
+		if(Net_conns[conn_id].reading == TRUE)
+		{
+			for(i = 1; i < N_reactors; i++)
+			{
+				if(Reactors[i].n_conns < Reactors[r].n_conns)
+					r = i;
+			}
+		}
+		Reactors[r].n_conns++;
+		Net_conns[conn_id].reactor = r + 1;
+	}
+	if(!Net_conns[conn_id].reactor)
+		return;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	if(Net_conns[conn_id].write_head)
+		ev.events |= EPOLLOUT;
+	ev.data.u64 = ((uint64_t)(unsigned)Net_conns[conn_id].channel << 32) | (unsigned)conn_id;
+	epoll_ctl(Reactors[Net_conns[conn_id].reactor - 1].epoll_fd, op,
+		Net_conns[conn_id].channel, &ev);
+}
+#endif
+
+void tcpip_lock_reactors()
+{
+	/* Called before Net_conns is reallocated, reactors read it without
+	 * the DIM lock.
+	 */
+#ifdef DIM_EPOLL
+	int i;
+
+	for(i = 0; i < N_reactors; i++)
+		pthread_mutex_lock(&Reactors[i].lock);
+#endif
+}
+
+void tcpip_unlock_reactors()
+{
+#ifdef DIM_EPOLL
+	int i;
+
+	for(i = N_reactors - 1; i >= 0; i--)
+		pthread_mutex_unlock(&Reactors[i].lock);
+#endif
+}
+
+void tcpip_lock_writes()
+{
+	/* Called before Net_conns is reallocated, service updates write to
+	 * the connections without the DIM lock.
+	 */
+#ifdef DIM_WRITE_LOCKS
+	int i;
+
+	if(!Write_locks_init)
+		return;
+	for(i = 0; i < WRITE_LOCKS; i++)
+		pthread_mutex_lock(&Write_locks[i]);
+#endif
+}
+
+void tcpip_unlock_writes()
+{
+#ifdef DIM_WRITE_LOCKS
+	int i;
+
+	if(!Write_locks_init)
+		return;
+	for(i = WRITE_LOCKS - 1; i >= 0; i--)
+		pthread_mutex_unlock(&Write_locks[i]);
+#endif
+}
+
+int tcpip_unlocked_writes()
+{
+	/* Can connections be written without holding the DIM lock
+	 */
+#ifdef DIM_WRITE_LOCKS
+	return(Write_locks_init);
+#else
+	return(0);
+#endif
+}
+
+static void write_error( TCPIP_WRITE_ERROR *errp, int what )
+{
+	errp->what = what;
+	errp->error = tcpip_last_error();
+}
+
+void tcpip_report_write_error( int conn_id, TCPIP_WRITE_ERROR *errp )
+{
+	/* Report a write error once the write lock is released, the user
+	 * error handler may take the DIM lock.
+	 */
+	int what = errp->what;
+
+	if(!what)
+		return;
+	errp->what = WERR_NONE;
+#ifndef WIN32
+	errno = errp->error;
+#else
+	WSASetLastError(errp->error);
+#endif
+	dna_report_error(conn_id, Write_errors[what].code, Write_errors[what].text,
+		Write_errors[what].severity, Write_errors[what].errcode);
+}
 
 int Tcpip_max_io_data_write = TCP_SND_BUF_SIZE - 16;
 int Tcpip_max_io_data_read = TCP_RCV_BUF_SIZE - 16;
@@ -160,6 +374,76 @@ int dim_get_write_timeout()
 	return(Write_timeout);
 }
 
+void dim_set_write_queue_limit(int bytes)
+{
+	Write_queue_limit = bytes;
+}
+
+int dim_get_write_queue_limit()
+{
+	return(Write_queue_limit);
+}
+
+void dim_set_write_queue_policy(int policy)
+{
+	Write_queue_policy = policy;
+}
+
+int dim_get_write_queue_policy()
+{
+	return(Write_queue_policy);
+}
+
+static int conn_write_limit(int conn_id)
+{
+	if(Net_conns[conn_id].write_limit)
+		return(Net_conns[conn_id].write_limit);
+	return(Write_queue_limit);
+}
+
+static int conn_write_policy(int conn_id)
+{
+	if(Net_conns[conn_id].write_limit)
+		return(Net_conns[conn_id].write_policy);
+	return(Write_queue_policy);
+}
+
+int dim_set_conn_write_queue(int conn_id, int bytes, int policy)
+{
+	DISABLE_AST
+	if((conn_id <= 0) || (conn_id >= Curr_N_Conns) || !Net_conns[conn_id].channel)
+	{
+		ENABLE_AST
+		return(0);
+	}
+	WRITE_LOCK(conn_id)
+	Net_conns[conn_id].write_limit = bytes;
+	Net_conns[conn_id].write_policy = policy;
+	WRITE_UNLOCK(conn_id)
+	ENABLE_AST
+	return(1);
+}
+
+int dim_get_conn_write_queue_info(int conn_id, DIM_WRITE_QUEUE_INFO *info)
+{
+	DISABLE_AST
+	if((conn_id <= 0) || (conn_id >= Curr_N_Conns) || !Net_conns[conn_id].channel)
+	{
+		ENABLE_AST
+		return(0);
+	}
+	WRITE_LOCK(conn_id)
+	info->bytes = Net_conns[conn_id].write_bytes;
+	info->entries = Net_conns[conn_id].write_entries;
+	info->peak_bytes = Net_conns[conn_id].write_peak;
+	info->limit = conn_write_limit(conn_id);
+	info->policy = conn_write_policy(conn_id);
+	info->drops = Net_conns[conn_id].write_drops;
+	WRITE_UNLOCK(conn_id)
+	ENABLE_AST
+	return(1);
+}
+
 int dim_set_write_buffer_size(int size)
 {
 	if(size >= TCP_SND_BUF_SIZE)
@@ -192,6 +476,27 @@ int dim_get_read_buffer_size()
 	return(Read_buffer_size);
 }
 
+int dim_set_io_threads(int n)
+{
+	/* Only taken into account before DIM starts */
+	if(init_done || (n < 1) || (n > MAX_IO_THREADS))
+		return(0);
+	IO_threads = n;
+	IO_threads_set = 1;
+	return(1);
+}
+
+int dim_get_io_threads()
+{
+#ifdef DIM_EPOLL
+	if(N_reactors)
+		return(N_reactors);
+	return(IO_threads);
+#else
+	return(1);
+#endif
+}
+
 #ifdef WIN32
 int init_sock()
 {
@@ -251,11 +556,19 @@ int dim_tcpip_init(int thr_flag)
 	void tcpip_pipe_sig_handler();
 #endif
 	extern int get_write_tmout();
+	extern int get_io_threads();
+	int n;
 
 	if(init_done) 
 		return(1);
 
 	dim_get_write_timeout();
+	if(!IO_threads_set)
+	{
+		n = get_io_threads();
+		if((n >= 1) && (n <= MAX_IO_THREADS))
+			IO_threads = n;
+	}
 #ifdef WIN32
 	init_sock();
 	Threads_on = 1;
@@ -322,6 +635,40 @@ int dim_tcpip_init(int thr_flag)
       int retval __attribute__((unused));
 			retval = pipe(DIM_IO_path);
 		}
+#ifdef DIM_WRITE_LOCKS
+		if(!Write_locks_init)
+		{
+			int i;
+
+			for(i = 0; i < WRITE_LOCKS; i++)
+				pthread_mutex_init(&Write_locks[i], NULL);
+			Write_locks_init = 1;
+		}
+#endif
+#ifdef DIM_EPOLL
+		if(!N_reactors)
+		{
+			struct epoll_event ev;
+			int i;
+
+			for(i = 0; i < IO_threads; i++)
+			{
+				if( (Reactors[i].epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1 )
+					break;
+				Reactors[i].n_conns = 0;
+				pthread_mutex_init(&Reactors[i].lock, NULL);
+			}
+			N_reactors = i;
+			if(N_reactors)
+			{
+				/* Wakeups are only needed by the first reactor */
+				memset(&ev, 0, sizeof(ev));
+				ev.events = EPOLLIN;
+				ev.data.u64 = 0;
+				epoll_ctl(Reactors[0].epoll_fd, EPOLL_CTL_ADD, DIM_IO_path[0], &ev);
+			}
+		}
+#endif
 #endif
 	}
 	if(!queue_id)
@@ -349,6 +696,18 @@ void dim_tcpip_stop()
 #else
 	close(DIM_IO_path[0]);
 	close(DIM_IO_path[1]);
+#endif
+#ifdef DIM_EPOLL
+	{
+		int i;
+
+		for(i = 0; i < N_reactors; i++)
+		{
+			close(Reactors[i].epoll_fd);
+			pthread_mutex_destroy(&Reactors[i].lock);
+		}
+		N_reactors = 0;
+	}
 #endif
 	DIM_IO_path[0] = -1;
 	DIM_IO_path[1] = -1;
@@ -356,25 +715,20 @@ void dim_tcpip_stop()
 	init_done = 0;
 }
 
-static int enable_sig(int conn_id)
+static void wakeup_io_thread()
 {
-	int ret = 1, flags = 1;
-#ifndef WIN32
-	int pid;
+	/* Make the IO thread rebuild its list of sockets
+	 */
+	int flags = 1;
+#ifdef WIN32
+	int ret;
 #endif
 
-#ifdef DEBUG
-	if(!Net_conns[conn_id].channel)
-	{
-	    printf("Enabling signals on channel 0\n");
-	    fflush(stdout);
-	}
+#ifdef DIM_EPOLL
+/* epoll picks up (de)registrations by itself */
+	if(N_reactors)
+		return;
 #endif
-
-	if(!init_done)
-	{
-		dim_tcpip_init(0);
-	}
 	if(Threads_on)
 	{
 #ifdef WIN32
@@ -387,7 +741,7 @@ static int enable_sig(int conn_id)
 		if( (DIM_IO_path[0] = (int)socket(AF_INET, SOCK_STREAM, 0)) == -1 ) 
 		{
 			perror("socket");
-			return(1);
+			return;
 		}		
 		ret = ioctl(DIM_IO_path[0], FIONBIO, &flags);
 		if(ret != 0)
@@ -407,6 +761,28 @@ static int enable_sig(int conn_id)
 		}
 #endif
 	}
+}
+
+static int enable_sig(int conn_id)
+{
+	int ret = 1, flags = 1;
+#ifndef WIN32
+	int pid;
+#endif
+
+#ifdef DEBUG
+	if(!Net_conns[conn_id].channel)
+	{
+	    printf("Enabling signals on channel 0\n");
+	    fflush(stdout);
+	}
+#endif
+
+	if(!init_done)
+	{
+		dim_tcpip_init(0);
+	}
+	wakeup_io_thread();
 #ifndef WIN32
 	if(!Threads_on)
 	{
@@ -537,7 +913,7 @@ static int poll_test(int fd)
 }
 #endif
 
-static int list_to_fds( fd_set *fds )
+static int list_to_fds( fd_set *fds, fd_set *wfds )
 {
 	int	i;
 	int found = 0;
@@ -545,9 +921,12 @@ static int list_to_fds( fd_set *fds )
 	DISABLE_AST
 #ifdef __linux__
 	if(fds) {}
+	if(wfds) {}
 	poll_create();
 #else
 	FD_ZERO( fds ) ;
+	if(wfds)
+		FD_ZERO( wfds ) ;
 #endif
 	for( i = 1; i < Curr_N_Conns; i++ )
     {
@@ -561,8 +940,13 @@ static int list_to_fds( fd_set *fds )
 				found = 1;
 #ifdef __linux__
 				Pollfds[i].fd = Net_conns[i].channel;
+				Pollfds[i].events = POLLIN;
+				if(Net_conns[i].write_head)
+					Pollfds[i].events |= POLLOUT;
 #else
 				FD_SET( Net_conns[i].channel, fds );
+				if(wfds && Net_conns[i].write_head)
+					FD_SET( Net_conns[i].channel, wfds );
 #endif
 
 			}
@@ -572,6 +956,36 @@ static int list_to_fds( fd_set *fds )
 	return(found);
 }
 
+static void write_queue_flush( int conn_id );
+
+static void flush_write_queues( fd_set *wfds )
+{
+	/* Send the queued data of the sockets that became writable
+	 */
+	int	i;
+
+	DISABLE_AST
+#ifdef __linux__
+	if(wfds) {}
+	for( i = 1; (i < Curr_N_Conns) && (i < Pollfd_size); i++ )
+	{
+		if( (Pollfds[i].fd == -1) || (Pollfds[i].fd != Net_conns[i].channel) )
+			continue;
+		if( !(Pollfds[i].revents & (POLLOUT | POLLERR)) )
+			continue;
+		Pollfds[i].revents &= ~POLLOUT;
+#else
+	for( i = 1; i < Curr_N_Conns; i++ )
+	{
+		if( !Net_conns[i].channel || !FD_ISSET(Net_conns[i].channel, wfds) )
+			continue;
+#endif
+		if( Dna_conns[i].busy && Net_conns[i].write_head )
+			write_queue_flush(i);
+	}
+	ENABLE_AST
+}
+
 static int fds_get_entry( fd_set *fds, int *conn_id ) 
 {
 	int	i;
@@ -687,36 +1101,136 @@ void tcpip_pipe_sig_handler( int num )
 */
 }
 
-static int get_bytes_to_read(int conn_id)
+static int read_ring( int conn_id, int *more )
 {
-	int i, ret, count = 0;
-	
-	for(i = 0; i < 3; i++)
+	/* Read what fits in the connection's receive ring.
+	 * Returns the number of bytes read, 0 if nothing could be read now
+	 * or -1 if the connection was closed by the other side.
+	 */
+	int	len, space, ret;
+	int tcpip_would_block();
+
+	*more = 0;
+	if(!Net_conns[conn_id].rcv_ring)
+	{
+		Net_conns[conn_id].rcv_ring = malloc(RCV_RING_SIZE);
+		Net_conns[conn_id].rcv_start = 0;
+		Net_conns[conn_id].rcv_end = 0;
+	}
+	if(Net_conns[conn_id].rcv_start == Net_conns[conn_id].rcv_end)
+	{
+		Net_conns[conn_id].rcv_start = 0;
+		Net_conns[conn_id].rcv_end = 0;
+	}
+	else if(Net_conns[conn_id].rcv_start)
+	{
+		memmove(Net_conns[conn_id].rcv_ring,
+			Net_conns[conn_id].rcv_ring + Net_conns[conn_id].rcv_start,
+			(size_t)(Net_conns[conn_id].rcv_end - Net_conns[conn_id].rcv_start));
+		Net_conns[conn_id].rcv_end -= Net_conns[conn_id].rcv_start;
+		Net_conns[conn_id].rcv_start = 0;
+	}
+	space = RCV_RING_SIZE - Net_conns[conn_id].rcv_end;
+	if( (len = (int)readsock(Net_conns[conn_id].channel,
+		Net_conns[conn_id].rcv_ring + Net_conns[conn_id].rcv_end, (size_t)space, 0)) <= 0 ) 
 	{
-		ret = ioctl( Net_conns[conn_id].channel, FIONREAD, &count );
-	    if( ret != 0)
+		if(len < 0)
 		{
-			count = 0;
-			break;
-	    }
-	    if(count > 0)
-	    {
-			break;
-	    }
+			ret = tcpip_last_error();
+			if(ret == EINTR)
+			{
+				*more = 1;
+				return 0;
+			}
+			if(tcpip_would_block(ret))
+				return 0;
+		}
+		return -1;
 	}
-	return(count);
+	*more = (len == space);
+	Net_conns[conn_id].rcv_end += len;
+	return len;
+}
+
+static void deliver_ring( int conn_id )
+{
+	/* Hand the buffered bytes out in the sizes asked for by
+	 * tcpip_start_read(), several messages are parsed per system call.
+	 * read_rout() restarts the read with the next size, or closes the
+	 * connection (which empties the ring), Net_conns may also move.
+	 * The user routines may run without the DIM lock, the connection can
+	 * then be closed and reopened by the time read_rout() returns.
+	 */
+	int	len, channel, gen;
+
+	channel = Net_conns[conn_id].channel;
+	gen = Net_conns[conn_id].write_gen;
+	Net_conns[conn_id].last_used = time(NULL);
+	while( (Net_conns[conn_id].channel == channel) &&
+		(Net_conns[conn_id].write_gen == gen) &&
+		(Net_conns[conn_id].reading == TRUE) &&
+		(Net_conns[conn_id].rcv_start < Net_conns[conn_id].rcv_end) )
+	{
+		len = Net_conns[conn_id].rcv_end - Net_conns[conn_id].rcv_start;
+		if(len > Net_conns[conn_id].size)
+			len = Net_conns[conn_id].size;
+		memcpy(Net_conns[conn_id].buffer,
+			Net_conns[conn_id].rcv_ring + Net_conns[conn_id].rcv_start, (size_t)len);
+		Net_conns[conn_id].rcv_start += len;
+		Net_conns[conn_id].read_rout( conn_id, 1, len );
+	}
+}
+
+static int read_direct( int conn_id )
+{
+	/* The ring is empty and the read is big, go straight to the
+	 * destination buffer.
+	 */
+	return (Net_conns[conn_id].rcv_start == Net_conns[conn_id].rcv_end) &&
+		(Net_conns[conn_id].size >= RCV_RING_SIZE);
 }
 
 static int do_read( int conn_id )
 {
 	/* There is 'data' pending, read it.
+	 * Returns 1 if more data may still be pending on the socket.
 	 */
-	int	len, totlen, size, count;
-	char	*p;
+	int	len, size, ret, more, channel, gen;
+	int tcpip_would_block();
 
-	count = get_bytes_to_read(conn_id);
-	if(!count)
+	channel = Net_conns[conn_id].channel;
+	gen = Net_conns[conn_id].write_gen;
+	if(Net_conns[conn_id].write_failed)
+		len = -1;
+	else if(!read_direct(conn_id))
+	{
+		len = read_ring(conn_id, &more);
+		if(len > 0)
+			deliver_ring(conn_id);
+	}
+	else
+	{
+		size = Net_conns[conn_id].size;
+		more = 0;
+		if( (len = (int)readsock(channel, Net_conns[conn_id].buffer, (size_t)size, 0)) > 0 )
+		{
+			more = (len == size);
+			Net_conns[conn_id].last_used = time(NULL);
+			Net_conns[conn_id].read_rout( conn_id, 1, len );
+		}
+		else if(len == 0)
+			len = -1;
+		else
+		{
+			ret = tcpip_last_error();
+			more = (ret == EINTR);
+			if(more || tcpip_would_block(ret))
+				len = 0;
+		}
+	}
+	if(len < 0)
 	{
+		/* Connection closed by other side. */
 /*
 		dna_report_error(conn_id, -1,
 			"Connection closed by remote peer", DIM_ERROR, DIMTCPRDERR);
@@ -725,45 +1239,8 @@ static int do_read( int conn_id )
 		Net_conns[conn_id].read_rout( conn_id, -1, 0 );
 		return 0;
 	}
-
-	size = Net_conns[conn_id].size;
-	p = Net_conns[conn_id].buffer;
-	totlen = 0;
-/*
-	count = 1;
-*/
-	while( size > 0 && count > 0 )
-	{
-/*
-		would this be better? not sure afterwards...
-		nbytes = (size < count) ? size : count;
-		if( (len = readsock(Net_conns[conn_id].channel, p, (size_t)nbytes, 0)) <= 0 ) 
-*/
-		if( (len = (int)readsock(Net_conns[conn_id].channel, p, (size_t)size, 0)) <= 0 ) 
-		{	/* Connection closed by other side. */
-			Net_conns[conn_id].read_rout( conn_id, -1, 0 );
-			return 0;
-		} 
-		else 
-		{
-			
-			/*
-			printf("tcpip: read %d bytes:\n",len); 
-			printf( "buffer[0]=%d\n", vtohl((int *)p[0]));
-			printf( "buffer[1]=%d\n", vtohl((int *)p[1]));
-			printf( "buffer[2]=%x\n", vtohl((int *)p[2]));
-			*/
-			totlen += len;
-			size -= len;
-			p += len;
-		}
-		if(size)
-			count = get_bytes_to_read(conn_id);
-	}
-
-	Net_conns[conn_id].last_used = time(NULL);
-	Net_conns[conn_id].read_rout( conn_id, 1, totlen );
-	return 1;
+	return(more && (Net_conns[conn_id].channel == channel) &&
+		(Net_conns[conn_id].write_gen == gen));
 }
 
 
@@ -825,7 +1302,7 @@ void io_sig_handler(int num)
 	if(num){}
 	do
 	{
-		list_to_fds( &rfds );
+		list_to_fds( &rfds, NULL );
 #ifdef __linux__
 		selret = poll(Pollfds, Pollfd_size, 0);
 #else
@@ -845,8 +1322,7 @@ void io_sig_handler(int num)
 					{
 						if(Net_conns[conn_id].channel)
 						{
-							do_read( conn_id );
-							count = get_bytes_to_read(conn_id);
+							count = do_read( conn_id );
 						}
 						else
 						{
@@ -864,27 +1340,140 @@ void io_sig_handler(int num)
 	}while(selret > 0);
 }
 
-void tcpip_task( void *dummy)
+#ifdef DIM_EPOLL
+static void epoll_task(int r)
 {
-	/* wait for an IO signal, find out what is happening and
-	 * call the right routine to handle the situation.
+	/* Wait for events and dispatch the ready connections only.
+	 * Sockets are read under the reactor lock, the data is then handed
+	 * to the upper layers under the DIM lock. With several reactors they
+	 * call the user routines without it (dna_unlock_callback), the next
+	 * read of a connection waits for them.
 	 */
-	fd_set	rfds;
-  fd_set	*pfds __attribute__((unused));
-#ifndef __linux__
-	fd_set efds;
-#endif
-	int	conn_id, ret, count;
-#ifndef WIN32
-	int data;
+	IO_REACTOR *reactor = &Reactors[r];
+	int	i, n, conn_id, channel, count, data, listening, direct, len, state, gen;
+
+	n = epoll_wait(reactor->epoll_fd, reactor->events, MAX_EPOLL_EVENTS, -1);
+	if(n < 0)
+	{
+		if(errno != EINTR)
+		    printf("epoll_wait returned %d, errno %d\n", n, errno);
+		return;
+	}
+	for(i = 0; i < n; i++)
+	{
+		conn_id = (int)(reactor->events[i].data.u64 & 0xFFFFFFFF);
+		channel = (int)(reactor->events[i].data.u64 >> 32);
+		if(!conn_id)
+		{
+        int retval __attribute__((unused));
+			retval = read(DIM_IO_path[0], &data, 4);
+			DIM_IO_Done = 0;
+			continue;
+		}
+		if(reactor->events[i].events & (EPOLLOUT | EPOLLERR))
+		{
+			DISABLE_AST
+			if( Dna_conns[conn_id].busy && (Net_conns[conn_id].channel == channel) &&
+				Net_conns[conn_id].write_head )
+				write_queue_flush(conn_id);
+			ENABLE_AST
+		}
+		if(!(reactor->events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+			continue;
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+		pthread_mutex_lock(&reactor->lock);
+		listening = (Net_conns[conn_id].reading == FALSE);
+		pthread_mutex_unlock(&reactor->lock);
+		if(!listening)
+		{
+			do
+			{
+				count = 0;
+				len = 0;
+				pthread_mutex_lock(&reactor->lock);
+				direct = 1;
+				if( (Net_conns[conn_id].channel == channel) && !read_direct(conn_id) )
+				{
+					direct = 0;
+					len = read_ring(conn_id, &count);
+				}
+				pthread_mutex_unlock(&reactor->lock);
+				DISABLE_AST
+				if( Dna_conns[conn_id].busy && (Net_conns[conn_id].channel == channel) )
+				{
+					gen = Net_conns[conn_id].write_gen;
+					if(direct)
+						count = do_read( conn_id );
+					else if((len < 0) || Net_conns[conn_id].write_failed)
+						Net_conns[conn_id].read_rout( conn_id, -1, 0 );
+					else if(len > 0)
+						deliver_ring( conn_id );
+					count = count && (Net_conns[conn_id].channel == channel) &&
+						(Net_conns[conn_id].write_gen == gen);
+				}
+				else
+				{
+					count = 0;
+				}
+				ENABLE_AST
+			}while(count > 0 );
+		}
+		else
+		{
+			DISABLE_AST
+			if( Dna_conns[conn_id].busy && (Net_conns[conn_id].channel == channel) )
+				do_accept( conn_id );
+			ENABLE_AST
+		}
+		pthread_setcancelstate(state, NULL);
+	}
+}
+
+#endif
+
+void tcpip_reactor_task(int r)
+{
+	/* Body of the additional IO threads
+	 */
+#ifdef DIM_EPOLL
+	if(r < N_reactors)
+	{
+		epoll_task(r);
+		return;
+	}
+#endif
+	if(r){}
+	dim_usleep(100000);
+}
+
+void tcpip_task( void *dummy)
+{
+	/* wait for an IO signal, find out what is happening and
+	 * call the right routine to handle the situation.
+	 */
+	fd_set	rfds, wfds;
+  fd_set	*pfds __attribute__((unused));
+#ifndef __linux__
+	fd_set efds;
+#endif
+	int	conn_id, ret, count;
+#ifndef WIN32
+	int data;
 #endif
 	if(dummy){}
+#ifdef DIM_EPOLL
+	if(N_reactors)
+	{
+		epoll_task(0);
+		return;
+	}
+#endif
 	while(1)
 	{
 		while(!DIM_IO_valid)
 			dim_usleep(1000);
 
-		list_to_fds( &rfds );
+		list_to_fds( &rfds, &wfds );
 		MY_FD_ZERO(&efds);
 #ifdef WIN32
 		pfds = &efds;
@@ -895,7 +1484,7 @@ void tcpip_task( void *dummy)
 #ifdef __linux__
 		ret = poll(Pollfds, Pollfd_size, -1);
 #else
-		ret = select(FD_SETSIZE, &rfds, NULL, &efds, NULL);
+		ret = select(FD_SETSIZE, &rfds, &wfds, &efds, NULL);
 #endif
 		if(ret <= 0)
 		{
@@ -912,6 +1501,7 @@ void tcpip_task( void *dummy)
 #endif
 				MY_FD_CLR( (unsigned)DIM_IO_path[0], pfds );
 			}
+			flush_write_queues( &wfds );
 /*
 			{
 			DISABLE_AST
@@ -927,8 +1517,7 @@ void tcpip_task( void *dummy)
 						DISABLE_AST
 						if(Net_conns[conn_id].channel)
 						{
-							do_read( conn_id );
-							count = get_bytes_to_read(conn_id);
+							count = do_read( conn_id );
 						}
 						else
 						{
@@ -963,6 +1552,8 @@ int tcpip_start_read( int conn_id, char *buffer, int size, void (*ast_routine)()
 	 * as size, and use buffer.
 	 */
 
+	int first = 0;
+
 	Net_conns[conn_id].read_rout = ast_routine;
 	Net_conns[conn_id].buffer = buffer;
 	Net_conns[conn_id].size = size;
@@ -975,8 +1566,15 @@ int tcpip_start_read( int conn_id, char *buffer, int size, void (*ast_routine)()
 #endif
 			return(0);
 		}
+		first = 1;
 	}
 	Net_conns[conn_id].reading = TRUE;
+#ifdef DIM_EPOLL
+	if(first)
+		epoll_update(conn_id, EPOLL_CTL_ADD);
+#else
+	if(first){}
+#endif
 	return(1);
 }
 
@@ -1178,6 +1776,8 @@ int tcpip_open_client( int conn_id, char *node, char *task, int port )
 			return(0);
 		}
 	}
+/* Connected sockets stay non-blocking, writes wait for space with poll */
+	set_non_blocking(path);
 	strcpy( Net_conns[conn_id].node, node );
 	strcpy( Net_conns[conn_id].task, task );
 	Net_conns[conn_id].channel = path;
@@ -1186,6 +1786,7 @@ int tcpip_open_client( int conn_id, char *node, char *task, int port )
 	Net_conns[conn_id].reading = -1;
 	Net_conns[conn_id].timr_ent = NULL;
 	Net_conns[conn_id].write_timedout = 0;
+	Net_conns[conn_id].write_failed = 0;
 	return(1);
 }
 
@@ -1311,6 +1912,7 @@ printf("Trying port %d, ret = %d\n", *port, ret);
 	Net_conns[conn_id].reading = -1;
 	Net_conns[conn_id].timr_ent = NULL;
 	Net_conns[conn_id].write_timedout = 0;
+	Net_conns[conn_id].write_failed = 0;
 	return(1);
 }
 
@@ -1321,6 +1923,7 @@ int tcpip_start_listen( int conn_id, void (*ast_routine)() )
 	 * some necessary information: we are NOT reading, thus
 	 * no size.
 	 */
+	int first = 0;
 
 	Net_conns[conn_id].read_rout = ast_routine;
 	Net_conns[conn_id].size = -1;
@@ -1333,8 +1936,15 @@ int tcpip_start_listen( int conn_id, void (*ast_routine)() )
 #endif
 			return(0);
 		}
+		first = 1;
 	}
 	Net_conns[conn_id].reading = FALSE;
+#ifdef DIM_EPOLL
+	if(first)
+		epoll_update(conn_id, EPOLL_CTL_ADD);
+#else
+	if(first){}
+#endif
 	return(1);
 }
 
@@ -1379,6 +1989,7 @@ int tcpip_open_connection( int conn_id, int path )
 		return(0);
 	}
 
+	set_non_blocking(path);
 	Net_conns[conn_id].channel = path;
 	Net_conns[conn_id].node[0] = 0;
 	Net_conns[conn_id].task[0] = 0;
@@ -1386,6 +1997,7 @@ int tcpip_open_connection( int conn_id, int path )
 	Net_conns[conn_id].reading = -1;
 	Net_conns[conn_id].timr_ent = NULL;
 	Net_conns[conn_id].write_timedout = 0;
+	Net_conns[conn_id].write_failed = 0;
 	return(1);
 }
 
@@ -1396,24 +2008,89 @@ void tcpip_get_node_task( int conn_id, char *node, char *task )
 	strcpy( task, Net_conns[conn_id].task );
 }
 
-int tcpip_write( int conn_id, char *buffer, int size )
+static int tcpip_wait_write( int conn_id, int timeout )
 {
-	/* Do a (synchronous) write to conn_id.
+	/* Wait until conn_id can be written, timeout in seconds (-1 = forever)
 	 */
-	int	wrote;
+	int selret;
+#ifdef __linux__
+	struct pollfd pollitem;
 
-	wrote = (int)writesock( Net_conns[conn_id].channel, buffer, (size_t)size, 0 );
-	if( wrote == -1 ) {
+	pollitem.fd = Net_conns[conn_id].channel;
+	pollitem.events = POLLOUT;
+	pollitem.revents = 0;
+	selret = poll(&pollitem, 1, (timeout < 0) ? -1 : timeout*1000);
+#else
+	struct timeval	tmout;
+	fd_set wfds;
+
+	tmout.tv_sec = timeout;
+	tmout.tv_usec = 0;
+	FD_ZERO(&wfds);
+	FD_SET( Net_conns[conn_id].channel, &wfds);
+	selret = select(FD_SETSIZE, NULL, &wfds, NULL, (timeout < 0) ? NULL : &tmout);
+#endif
+	return(selret);
+}
+
+static int tcpip_last_error()
+{
+#ifndef WIN32
+	return(errno);
+#else
+	return(WSAGetLastError());
+#endif
+}
+
+static int do_tcpip_write( int conn_id, char *buffer, int size, TCPIP_WRITE_ERROR *errp )
+{
+	int	wrote, ret;
+	int tcpip_would_block();
+	TCPIP_IOVEC iov;
+
+/* Keep the stream ordered behind what is already queued */
+	if(Net_conns[conn_id].write_head)
+	{
+		iov.buffer = buffer;
+		iov.size = size;
+		return(write_queue_append(conn_id, &iov, 1, 0, 0, 0, errp) ? size : 0);
+	}
+	while(1)
+	{
+		wrote = (int)writesock( Net_conns[conn_id].channel, buffer, (size_t)size, 0 );
+		if( wrote != -1 )
+			break;
+		ret = tcpip_last_error();
+		if((ret != EINTR) && !tcpip_would_block(ret))
+		{
 /*
-		Net_conns[conn_id].read_rout( conn_id, -1, 0 );
+			Net_conns[conn_id].read_rout( conn_id, -1, 0 );
 */
-		dna_report_error(conn_id, 0,
-			"Writing (blocking) to", DIM_ERROR, DIMTCPWRRTY);
-		return(0);
+			write_error(errp, WERR_BLOCKING);
+			return(0);
+		}
+		if(tcpip_would_block(ret))
+			tcpip_wait_write(conn_id, -1);
 	}
 	return(wrote);
 }
 
+int tcpip_write( int conn_id, char *buffer, int size )
+{
+	/* Do a (synchronous) write to conn_id.
+	 * The socket is non-blocking, wait until it can be written.
+	 */
+	TCPIP_WRITE_ERROR err;
+	int wrote;
+
+	err.what = WERR_NONE;
+	WRITE_LOCK(conn_id)
+	wrote = do_tcpip_write(conn_id, buffer, size, &err);
+	WRITE_UNLOCK(conn_id)
+	tcpip_report_write_error(conn_id, &err);
+	return(wrote);
+}
+
 int set_non_blocking(int channel)
 {
   int ret, flags = 1;
@@ -1442,31 +2119,121 @@ int set_blocking(int channel)
 	return(1);
 }
 
-int tcpip_write_nowait( int conn_id, char *buffer, int size )
+static int do_tcpip_writev( int conn_id, TCPIP_IOVEC *iov, int n_iov )
 {
-	/* Do a (asynchronous) write to conn_id.
+	/* Scatter-gather write of iov to conn_id in a single system call
 	 */
-	int	wrote, ret, selret;
-	int tcpip_would_block();
+#ifndef WIN32
+	struct iovec vec[TCPIP_MAX_IOVEC];
 #ifdef __linux__
-	struct pollfd pollitem;
+	struct msghdr msg;
+#endif
+	int i;
+
+	if(n_iov > TCPIP_MAX_IOVEC)
+		n_iov = TCPIP_MAX_IOVEC;
+	for(i = 0; i < n_iov; i++)
+	{
+		vec[i].iov_base = iov[i].buffer;
+		vec[i].iov_len = (size_t)iov[i].size;
+	}
+#if defined(__linux__) && !defined (darwin)
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = vec;
+	msg.msg_iovlen = (size_t)n_iov;
+	return((int)sendmsg(Net_conns[conn_id].channel, &msg, MSG_NOSIGNAL));
 #else
-	struct timeval	timeout;
-	fd_set wfds;
+	return((int)writev(Net_conns[conn_id].channel, vec, n_iov));
+#endif
+#else
+	WSABUF vec[TCPIP_MAX_IOVEC];
+	DWORD wrote;
+	int i;
+
+	if(n_iov > TCPIP_MAX_IOVEC)
+		n_iov = TCPIP_MAX_IOVEC;
+	for(i = 0; i < n_iov; i++)
+	{
+		vec[i].buf = iov[i].buffer;
+		vec[i].len = (ULONG)iov[i].size;
+	}
+	if(WSASend(Net_conns[conn_id].channel, vec, (DWORD)n_iov, &wrote, 0, NULL, NULL) != 0)
+		return(-1);
+	return((int)wrote);
 #endif
+}
+
+static int do_tcpip_writev_nowait( int conn_id, TCPIP_IOVEC *iov, int n_iov,
+	TCPIP_WRITE_ERROR *errp )
+{
+	int	wrote, ret;
+	int tcpip_would_block();
+
+	wrote = do_tcpip_writev(conn_id, iov, n_iov);
+	if(wrote == -1)
+	{
+		ret = tcpip_last_error();
+		if(tcpip_would_block(ret))
+		{
+			if(tcpip_wait_write(conn_id, Write_timeout) > 0)
+			{
+				wrote = do_tcpip_writev(conn_id, iov, n_iov);
+				if( wrote == -1 ) 
+				{
+					write_error(errp, WERR_RETRY);
+					return(0);
+				}
+			}
+		}
+		else
+		{
+			write_error(errp, WERR_NONBLOCKING);
+			return(0);
+		}
+	}
+	if(wrote == -1)
+	{
+		Net_conns[conn_id].write_timedout = 1;
+	}
+	return(wrote);
+}
+
+int tcpip_writev_nowait( int conn_id, TCPIP_IOVEC *iov, int n_iov )
+{
+	/* Do a (asynchronous) scatter-gather write to conn_id.
+	 * Returns the number of bytes written, possibly less than requested,
+	 * -1 on write timeout and 0 on error.
+	 */
+	TCPIP_WRITE_ERROR err;
+	int wrote;
+
+	err.what = WERR_NONE;
+	WRITE_LOCK(conn_id)
+	wrote = do_tcpip_writev_nowait(conn_id, iov, n_iov, &err);
+	WRITE_UNLOCK(conn_id)
+	tcpip_report_write_error(conn_id, &err);
+	return(wrote);
+}
+
+static int do_tcpip_write_nowait( int conn_id, char *buffer, int size, TCPIP_WRITE_ERROR *errp )
+{
+	int	wrote, ret;
+	int tcpip_would_block();
+	TCPIP_IOVEC iov;
 	
-	set_non_blocking(Net_conns[conn_id].channel);
+	if(Net_conns[conn_id].write_head)
+	{
+		iov.buffer = buffer;
+		iov.size = size;
+		return(write_queue_append(conn_id, &iov, 1, 0, 0, 0, errp) ? size : 0);
+	}
 /*
 #ifdef __linux__
 	tcpip_get_send_space(conn_id);
 #endif
 */
 	wrote = (int)writesock( Net_conns[conn_id].channel, buffer, (size_t)size, 0 );
-#ifndef WIN32
-	ret = errno;
-#else
-	ret = WSAGetLastError();
-#endif
+	ret = tcpip_last_error();
 /*
 	if((wrote == -1) && (!tcpip_would_block(ret)))
 	{
@@ -1475,38 +2242,23 @@ int tcpip_write_nowait( int conn_id, char *buffer, int size )
 printf("Writing %d, ret = %d\n", size, ret);
 	}
 */
-	set_blocking(Net_conns[conn_id].channel);
 	if(wrote == -1)
 	{
 		if(tcpip_would_block(ret))
 		{
-#ifdef __linux__
-		  pollitem.fd = Net_conns[conn_id].channel;
-		  pollitem.events = POLLOUT;
-		  pollitem.revents = 0;
-		  selret = poll(&pollitem, 1, Write_timeout*1000);
-#else
-			timeout.tv_sec = Write_timeout;
-			timeout.tv_usec = 0;
-			FD_ZERO(&wfds);
-			FD_SET( Net_conns[conn_id].channel, &wfds);
-			selret = select(FD_SETSIZE, NULL, &wfds, NULL, &timeout);
-#endif
-			if(selret > 0)
+			if(tcpip_wait_write(conn_id, Write_timeout) > 0)
 			{
 				wrote = (int)writesock( Net_conns[conn_id].channel, buffer, (size_t)size, 0 );
 				if( wrote == -1 ) 
 				{
-					dna_report_error(conn_id, 0,
-						"Writing to", DIM_ERROR, DIMTCPWRRTY);
+					write_error(errp, WERR_RETRY);
 					return(0);
 				}
 			}
 		}
 		else
 		{
-			dna_report_error(conn_id, 0,
-				"Writing (non-blocking) to", DIM_ERROR, DIMTCPWRRTY);
+			write_error(errp, WERR_NONBLOCKING);
 			return(0);
 		}
 	}
@@ -1517,9 +2269,379 @@ printf("Writing %d, ret = %d\n", size, ret);
 	return(wrote);
 }
 
+int tcpip_write_nowait( int conn_id, char *buffer, int size )
+{
+	/* Do a (asynchronous) write to conn_id.
+	 */
+	TCPIP_WRITE_ERROR err;
+	int wrote;
+
+	err.what = WERR_NONE;
+	WRITE_LOCK(conn_id)
+	wrote = do_tcpip_write_nowait(conn_id, buffer, size, &err);
+	WRITE_UNLOCK(conn_id)
+	tcpip_report_write_error(conn_id, &err);
+	return(wrote);
+}
+
+void tcpip_shared_hold( TCPIP_SHARED *sharedp )
+{
+#ifdef DIM_WRITE_LOCKS
+	__atomic_add_fetch(&sharedp->refs, 1, __ATOMIC_RELAXED);
+#else
+	sharedp->refs++;
+#endif
+}
+
+void tcpip_shared_release( TCPIP_SHARED *sharedp )
+{
+	/* Drop a reference, the last one calls the release routine. Queued
+	 * writes are released under the write lock of their connection
+	 */
+#ifdef DIM_WRITE_LOCKS
+	if(!__atomic_sub_fetch(&sharedp->refs, 1, __ATOMIC_ACQ_REL))
+#else
+	if(!--sharedp->refs)
+#endif
+		sharedp->release(sharedp);
+}
+
+static void write_entry_free( TCPIP_WENTRY *entryp )
+{
+	if(entryp->sharedp)
+		tcpip_shared_release(entryp->sharedp);
+	free(entryp);
+}
+
+static void write_queue_free( int conn_id )
+{
+	TCPIP_WENTRY *entryp, *nextp;
+
+	for(entryp = Net_conns[conn_id].write_head; entryp; entryp = nextp)
+	{
+		nextp = entryp->next;
+		write_entry_free(entryp);
+	}
+	Net_conns[conn_id].write_head = 0;
+	Net_conns[conn_id].write_tail = 0;
+	Net_conns[conn_id].write_bytes = 0;
+	Net_conns[conn_id].write_entries = 0;
+}
+
+static void write_queue_drop_tag( int conn_id, int tag, int size, int limit )
+{
+	/* Drop the oldest queued updates with the same tag until size fits.
+	 * Entries already partially sent are never dropped.
+	 */
+	TCPIP_WENTRY *entryp, *prevp, *nextp;
+
+	prevp = 0;
+	for(entryp = Net_conns[conn_id].write_head; entryp; entryp = nextp)
+	{
+		nextp = entryp->next;
+		if(Net_conns[conn_id].write_bytes + size <= limit)
+			break;
+		if((entryp->tag == tag) && !entryp->started)
+		{
+			if(prevp)
+				prevp->next = nextp;
+			else
+				Net_conns[conn_id].write_head = nextp;
+			if(Net_conns[conn_id].write_tail == entryp)
+				Net_conns[conn_id].write_tail = prevp;
+			Net_conns[conn_id].write_bytes -= entryp->size;
+			Net_conns[conn_id].write_entries--;
+			Net_conns[conn_id].write_drops++;
+			write_entry_free(entryp);
+			continue;
+		}
+		prevp = entryp;
+	}
+}
+
+static int write_queue_append( int conn_id, TCPIP_IOVEC *iov, int n_iov, int skip, int tag,
+	TCPIP_SHARED *sharedp, TCPIP_WRITE_ERROR *errp )
+{
+	/* Queue the data of iov, skipping the first skip bytes (already sent).
+	 * With sharedp the last iov is referenced instead of copied.
+	 */
+	TCPIP_WENTRY *entryp;
+	int i, size, limit, n, shared_size, shared_skip;
+	char *p;
+
+	size = -skip;
+	for(i = 0; i < n_iov; i++)
+		size += iov[i].size;
+	shared_size = 0;
+	shared_skip = 0;
+	if(sharedp)
+	{
+		n_iov--;
+		shared_size = iov[n_iov].size;
+		if(size < shared_size)
+		{
+			shared_skip = shared_size - size;
+			shared_size = size;
+		}
+	}
+	limit = conn_write_limit(conn_id);
+	if(Net_conns[conn_id].write_bytes + size > limit)
+	{
+		if(tag && !skip && (conn_write_policy(conn_id) == DIM_WQ_DROP_OLDEST))
+			write_queue_drop_tag(conn_id, tag, size, limit);
+		if(Net_conns[conn_id].write_bytes + size > limit)
+		{
+			write_error(errp, WERR_OVERFLOW);
+			Net_conns[conn_id].write_timedout = 1;
+/* The IO thread sees the connection closing and releases it */
+			shutdown(Net_conns[conn_id].channel, 2);
+			return(0);
+		}
+	}
+	entryp = (TCPIP_WENTRY *)malloc(sizeof(TCPIP_WENTRY) + (size_t)(size - shared_size));
+	if(!entryp)
+		return(0);
+	entryp->next = 0;
+	entryp->tag = tag;
+	entryp->started = (skip > 0);
+	entryp->size = size;
+	entryp->offset = 0;
+	entryp->sharedp = 0;
+	entryp->shared_data = 0;
+	entryp->shared_size = shared_size;
+	if(shared_size)
+	{
+		tcpip_shared_hold(sharedp);
+		entryp->sharedp = sharedp;
+		entryp->shared_data = iov[n_iov].buffer + shared_skip;
+	}
+	p = entryp->data;
+	for(i = 0; i < n_iov; i++)
+	{
+		n = iov[i].size;
+		if(skip >= n)
+		{
+			skip -= n;
+			continue;
+		}
+		memcpy(p, iov[i].buffer + skip, (size_t)(n - skip));
+		p += n - skip;
+		skip = 0;
+	}
+	if(Net_conns[conn_id].write_tail)
+		Net_conns[conn_id].write_tail->next = entryp;
+	else
+		Net_conns[conn_id].write_head = entryp;
+	Net_conns[conn_id].write_tail = entryp;
+	Net_conns[conn_id].write_bytes += size;
+	Net_conns[conn_id].write_entries++;
+	if(Net_conns[conn_id].write_bytes > Net_conns[conn_id].write_peak)
+		Net_conns[conn_id].write_peak = Net_conns[conn_id].write_bytes;
+	if(Net_conns[conn_id].write_head == entryp)
+	{
+#ifdef DIM_EPOLL
+		epoll_update(conn_id, EPOLL_CTL_MOD);
+#endif
+		wakeup_io_thread();
+	}
+	return(1);
+}
+
+static int do_write_queue_flush( int conn_id, TCPIP_WRITE_ERROR *errp )
+{
+	TCPIP_WENTRY *entryp;
+	TCPIP_IOVEC iov[TCPIP_MAX_IOVEC];
+	int n_iov, wrote, ret, n, copied;
+	int tcpip_would_block();
+
+	while(Net_conns[conn_id].write_head)
+	{
+		n_iov = 0;
+		for(entryp = Net_conns[conn_id].write_head; entryp && (n_iov < TCPIP_MAX_IOVEC);
+			entryp = entryp->next)
+		{
+			copied = entryp->size - entryp->shared_size;
+			if(entryp->offset < copied)
+			{
+				iov[n_iov].buffer = entryp->data + entryp->offset;
+				iov[n_iov].size = copied - entryp->offset;
+				n_iov++;
+				if(!entryp->shared_size)
+					continue;
+/* The shared part goes in the next write if there is no room left */
+				if(n_iov == TCPIP_MAX_IOVEC)
+					break;
+				iov[n_iov].buffer = entryp->shared_data;
+				iov[n_iov].size = entryp->shared_size;
+			}
+			else
+			{
+				iov[n_iov].buffer = entryp->shared_data + entryp->offset - copied;
+				iov[n_iov].size = entryp->size - entryp->offset;
+			}
+			n_iov++;
+		}
+		wrote = do_tcpip_writev(conn_id, iov, n_iov);
+		if(wrote == -1)
+		{
+			ret = tcpip_last_error();
+			if(tcpip_would_block(ret) || (ret == EINTR))
+				return(1);
+			write_error(errp, WERR_QUEUED);
+			write_queue_free(conn_id);
+			return(0);
+		}
+		Net_conns[conn_id].write_bytes -= wrote;
+		while(wrote > 0)
+		{
+			entryp = Net_conns[conn_id].write_head;
+			n = entryp->size - entryp->offset;
+			if(wrote < n)
+			{
+				entryp->offset += wrote;
+				entryp->started = 1;
+				break;
+			}
+			wrote -= n;
+			Net_conns[conn_id].write_head = entryp->next;
+			if(!entryp->next)
+				Net_conns[conn_id].write_tail = 0;
+			Net_conns[conn_id].write_entries--;
+			write_entry_free(entryp);
+		}
+	}
+#ifdef DIM_EPOLL
+	epoll_update(conn_id, EPOLL_CTL_MOD);
+#endif
+	return(1);
+}
+
+static void write_queue_flush( int conn_id )
+{
+	/* Called by the IO thread, holding the DIM lock, when the socket
+	 * is writable. A failed connection is only closed by the read path,
+	 * the shutdown makes the socket report a hang-up to it.
+	 */
+	TCPIP_WRITE_ERROR err;
+	int ret;
+
+	err.what = WERR_NONE;
+	WRITE_LOCK(conn_id)
+	ret = do_write_queue_flush(conn_id, &err);
+	if(!ret)
+	{
+		Net_conns[conn_id].write_failed = 1;
+		shutdown(Net_conns[conn_id].channel, 2);
+	}
+	WRITE_UNLOCK(conn_id)
+	tcpip_report_write_error(conn_id, &err);
+}
+
+static int do_tcpip_writev_queued( int conn_id, TCPIP_IOVEC *iov, int n_iov, int tag,
+	TCPIP_SHARED *sharedp, TCPIP_WRITE_ERROR *errp )
+{
+	int	total, wrote, ret, i;
+	int tcpip_would_block();
+
+	if(n_iov > TCPIP_MAX_IOVEC)
+		n_iov = TCPIP_MAX_IOVEC;
+	total = 0;
+	for(i = 0; i < n_iov; i++)
+		total += iov[i].size;
+	if(!Threads_on)
+	{
+		while(n_iov > 0)
+		{
+			wrote = do_tcpip_writev_nowait(conn_id, iov, n_iov, errp);
+			if(wrote <= 0)
+				return(wrote);
+			while((n_iov > 0) && (wrote >= iov->size))
+			{
+				wrote -= iov->size;
+				iov++;
+				n_iov--;
+			}
+			if(n_iov > 0)
+			{
+				iov->buffer += wrote;
+				iov->size -= wrote;
+			}
+		}
+		return(total);
+	}
+/* Keep the stream ordered behind what is already queued */
+	if(Net_conns[conn_id].write_head)
+		return(write_queue_append(conn_id, iov, n_iov, 0, tag, sharedp, errp) ? total : 0);
+	wrote = do_tcpip_writev(conn_id, iov, n_iov);
+	if(wrote == -1)
+	{
+		ret = tcpip_last_error();
+		if(!tcpip_would_block(ret) && (ret != EINTR))
+		{
+			write_error(errp, WERR_NONBLOCKING);
+			return(0);
+		}
+		wrote = 0;
+	}
+	if(wrote == total)
+		return(total);
+	return(write_queue_append(conn_id, iov, n_iov, wrote, tag, sharedp, errp) ? total : 0);
+}
+
+int tcpip_writev_queued( int conn_id, TCPIP_IOVEC *iov, int n_iov, int tag )
+{
+	/* Write iov to conn_id without waiting: whatever the socket does not
+	 * accept is queued and sent later by the IO thread. The tag identifies
+	 * updates that can be superseded (0 = never dropped).
+	 * Returns the number of bytes written or queued, -1 on write timeout
+	 * and 0 on error. Without IO thread, waits as tcpip_writev_nowait.
+	 */
+	TCPIP_WRITE_ERROR err;
+	int wrote;
+
+	err.what = WERR_NONE;
+	WRITE_LOCK(conn_id)
+	wrote = do_tcpip_writev_queued(conn_id, iov, n_iov, tag, 0, &err);
+	WRITE_UNLOCK(conn_id)
+	tcpip_report_write_error(conn_id, &err);
+	return(wrote);
+}
+
+int tcpip_writev_gen( int conn_id, int gen, TCPIP_IOVEC *iov, int n_iov, int tag,
+	TCPIP_WRITE_ERROR *errp )
+{
+	/* As tcpip_writev_queued, for callers not holding the DIM lock.
+	 * gen is the write generation of conn_id read under the DIM lock,
+	 * returns -2 if the connection was closed since. Errors are left in
+	 * errp, to be reported with tcpip_report_write_error.
+	 */
+	return(tcpip_writev_shared(conn_id, gen, iov, n_iov, tag, 0, errp));
+}
+
+int tcpip_writev_shared( int conn_id, int gen, TCPIP_IOVEC *iov, int n_iov, int tag,
+	TCPIP_SHARED *sharedp, TCPIP_WRITE_ERROR *errp )
+{
+	/* As tcpip_writev_gen. If sharedp is set the last iov is in shared
+	 * data, the write queue holds a reference instead of copying it.
+	 */
+	int wrote;
+
+	errp->what = WERR_NONE;
+	WRITE_LOCK(conn_id)
+	if(!Net_conns[conn_id].channel || (Net_conns[conn_id].write_gen != gen))
+		wrote = -2;
+	else
+		wrote = do_tcpip_writev_queued(conn_id, iov, n_iov, tag, sharedp, errp);
+	WRITE_UNLOCK(conn_id)
+	return(wrote);
+}
+
 int tcpip_close( int conn_id )
 {
 	int channel;
+#ifdef DIM_EPOLL
+	int reactor;
+#endif
 	/* Clear all traces of the connection conn_id.
 	 */
 	if(Net_conns[conn_id].timr_ent)
@@ -1527,11 +2649,47 @@ int tcpip_close( int conn_id )
 		dtq_rem_entry(queue_id, Net_conns[conn_id].timr_ent);
 		Net_conns[conn_id].timr_ent = NULL;
 	}
+	/* Updates may be writing to the connection without the DIM lock */
+	WRITE_LOCK(conn_id)
+#ifdef DIM_EPOLL
+	reactor = Net_conns[conn_id].reactor;
+	Net_conns[conn_id].reactor = 0;
+	if(reactor > N_reactors)
+		reactor = 0;
+	if(reactor)
+	{
+		if(Net_conns[conn_id].channel)
+			epoll_ctl(Reactors[reactor - 1].epoll_fd, EPOLL_CTL_DEL,
+				Net_conns[conn_id].channel, NULL);
+		Reactors[reactor - 1].n_conns--;
+		/* The reactor may be reading into the ring */
+		pthread_mutex_lock(&Reactors[reactor - 1].lock);
+	}
+#endif
+	write_queue_free(conn_id);
+	if(Net_conns[conn_id].rcv_ring)
+	{
+		free(Net_conns[conn_id].rcv_ring);
+		Net_conns[conn_id].rcv_ring = 0;
+	}
+	Net_conns[conn_id].rcv_start = 0;
+	Net_conns[conn_id].rcv_end = 0;
+	Net_conns[conn_id].write_peak = 0;
+	Net_conns[conn_id].write_limit = 0;
+	Net_conns[conn_id].write_policy = 0;
+	Net_conns[conn_id].write_drops = 0;
 	channel = Net_conns[conn_id].channel;
 	Net_conns[conn_id].channel = 0;
 	Net_conns[conn_id].port = 0;
 	Net_conns[conn_id].node[0] = 0;
 	Net_conns[conn_id].task[0] = 0;
+	Net_conns[conn_id].write_failed = 0;
+	Net_conns[conn_id].write_gen++;
+#ifdef DIM_EPOLL
+	if(reactor)
+		pthread_mutex_unlock(&Reactors[reactor - 1].lock);
+#endif
+	WRITE_UNLOCK(conn_id)
 	if(channel)
 	{
 		if(Net_conns[conn_id].write_timedout)
@@ -305,3 +305,25 @@ int get_write_tmout()
 		return(atoi(p));
 	}
 }
+
+int get_io_threads()
+{
+	char	*p;
+
+	if( (p = getenv("DIM_IO_THREADS")) == NULL )
+		return(0);
+	else {
+		return(atoi(p));
+	}
+}
+
+int get_dns_read_threads()
+{
+	char	*p;
+
+	if( (p = getenv("DIM_DNS_READ_THREADS")) == NULL )
+		return(-1);
+	else {
+		return(atoi(p));
+	}
+}
@@ -40,6 +40,13 @@
 
 // -- std headers
 #include <algorithm>
+#include <deque>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 
 namespace dqm4hep {
 
@@ -83,7 +90,10 @@ namespace dqm4hep {
       void sendRequest(const std::string &name, const Request &request) const;
 
       /**
-       *  @brief  Send a request. Wait for the server response (blocking)
+       *  @brief  Send a request. Wait for the server response (blocking).
+       *          The response is received by the dim threads, so this can't be
+       *          called from a dim callback (service or request handler, command,
+       *          subscription). It throws there, use sendRequestAsync() instead
        *
        *  @param  name the request name
        *  @param  request the request to send
@@ -92,6 +102,35 @@ namespace dqm4hep {
       template <typename Operation>
       void sendRequest(const std::string &name, const Buffer &request, Operation operation) const;
 
+      /**
+       *  @brief  Send a request without waiting for the server response.
+       *          Several requests can be in flight on the same request handler,
+       *          responses are matched to requests using a correlation id.
+       *
+       *          The operation is called from the dim thread with the server
+       *          response, or with an empty buffer if the server exited before
+       *          answering. The response buffer is only valid during the call,
+       *          Buffer::retain() keeps it without copy.
+       *          The operation must not wait for another response of this client.
+       *
+       *  @param  name the request name
+       *  @param  request the request to send
+       *  @param  operation the callback operation to perform on data reception
+       *  @return the request correlation id
+       */
+      uint32_t sendRequestAsync(const std::string &name, const Buffer &request,
+                                std::function<void(const Buffer &)> operation) const;
+
+      /**
+       *  @brief  Send a request without waiting for the server response.
+       *          See sendRequestAsync() with an operation for details
+       *
+       *  @param  name the request name
+       *  @param  request the request to send
+       *  @return a future to the server response. The response buffer owns its data
+       */
+      std::future<Buffer> sendRequestAsync(const std::string &name, const Buffer &request) const;
+
       /**
        *  @brief  Send a command.
        *
@@ -103,7 +142,32 @@ namespace dqm4hep {
       void sendCommand(const std::string &name, const Command &command, bool blocking = false) const;
 
       /**
-       *  @brief  Subscribe to service
+       *  @brief  Send a command and get notified of its reception on server side
+       *          without blocking. The operation is called from the dim thread
+       *          with true if the command was delivered, false otherwise
+       *
+       *  @param  name the command name
+       *  @param  command the command to send
+       *  @param  operation the callback operation to perform on acknowledgment
+       */
+      template <typename Command>
+      void sendCommandAsync(const std::string &name, const Command &command,
+                            std::function<void(bool)> operation) const;
+
+      /**
+       *  @brief  Send a command without blocking.
+       *
+       *  @param  name the command name
+       *  @param  command the command to send
+       *  @return a future to the command acknowledgment
+       */
+      template <typename Command>
+      std::future<bool> sendCommandAsync(const std::string &name, const Command &command) const;
+
+      /**
+       *  @brief  Subscribe to service.
+       *          The update buffer is only valid during the call, Buffer::retain()
+       *          keeps it without copy, e.g to process it in another thread
        *
        *  @param  serviceName the service name
        *  @param  pController the class instance that will receive the service updates
@@ -121,6 +185,19 @@ namespace dqm4hep {
       void subscribe(const std::string &serviceName, Controller *pController,
                      void (Controller::*function)(const Buffer &));
 
+      /**
+       *  @brief  Subscribe to a set of services at once.
+       *          The services are looked up with a few dns requests holding
+       *          many names each, instead of one request per service
+       *
+       *  @param  serviceNames the service names
+       *  @param  pController the class instance that will receive the service updates
+       *  @param  function the class method that will receive the service updates
+       */
+      template <typename Controller>
+      void subscribe(const core::StringVector &serviceNames, Controller *pController,
+                     void (Controller::*function)(const Buffer &));
+
       /**
        *  @brief  Unsubscribe from a particular service
        *
@@ -151,54 +228,245 @@ namespace dqm4hep {
        */
       void notifyServerOnExit(const std::string &serverName);
 
+      /**
+       *  @brief  Set the maximum number of rpc channels kept alive in the pool.
+       *          The least recently used channels are evicted first.
+       *          A value of 0 disables the pooling
+       *
+       *  @param  maxChannels the maximum number of pooled channels
+       */
+      void setMaxRpcChannels(unsigned int maxChannels);
+
+      /**
+       *  @brief  Get the maximum number of rpc channels kept alive in the pool
+       */
+      unsigned int maxRpcChannels() const;
+
+      /**
+       *  @brief  Get the number of rpc channels currently in the pool
+       */
+      unsigned int numberOfRpcChannels() const;
+
+      /**
+       *  @brief  Get the number of requests that reused a pooled rpc channel
+       */
+      unsigned long rpcChannelHits() const;
+
+      /**
+       *  @brief  Get the number of requests that had to open a new rpc channel
+       */
+      unsigned long rpcChannelMisses() const;
+
+      /**
+       *  @brief  Close all the pooled rpc channels
+       */
+      void clearRpcChannels();
+
+      /**
+       *  @brief  Set the number of network I/O threads. Connections are spread
+       *          over them as they are accepted or connected. Applies process wide
+       *          and must be called before the first client or server starts.
+       *          Default is 1, or the DIM_IO_THREADS environment variable
+       *
+       *  @param  nThreads the number of I/O threads
+       *  @return false if the network layer is already running or nThreads is out of range
+       */
+      static bool setIOThreads(unsigned int nThreads);
+
+      /**
+       *  @brief  Get the number of network I/O threads
+       */
+      static unsigned int ioThreads();
+
+    private:
+      /**
+       *  @brief  RpcChannel class.
+       *          A live connection to the pipelined rpc of a request handler
+       *          (see RpcHeader::pipelinedName()), kept in the
+       *          client pool and reused across requests. Requests are sent
+       *          with a correlation id so that several of them can be in
+       *          flight at the same time on the channel.
+       *          Servers built before the pipelined rpc do not publish it: the
+       *          channel then falls back to the plain rpc, on which requests
+       *          are sent one at a time.
+       */
+      class RpcChannel {
+      public:
+        typedef std::function<void(const Buffer &)> ResponseFunction;
+
+        /**
+         *  @brief  Constructor
+         *
+         *  @param  name the request handler name
+         */
+        RpcChannel(const std::string &name);
+
+        /**
+         *  @brief  Destructor. Pending requests receive an empty response
+         */
+        ~RpcChannel();
+
+        RpcChannel(const RpcChannel &) = delete;
+        RpcChannel &operator=(const RpcChannel &) = delete;
+
+        /**
+         *  @brief  Send a request on the channel. The function is called with the
+         *          response from the dim thread, or with an empty buffer if the
+         *          server link is lost. An empty function means that no response
+         *          is expected
+         *
+         *  @param  data the request data
+         *  @param  size the request size
+         *  @param  function the function receiving the response
+         *  @return the request correlation id
+         */
+        uint32_t send(const char *data, size_t size, ResponseFunction function);
+
+        /**
+         *  @brief  Whether the channel is still linked to a running server
+         */
+        bool isValid() const;
+
+        /**
+         *  @brief  Whether requests are waiting to be sent or for a response
+         */
+        bool hasPendingRequests() const;
+
+      private:
+        /**
+         *  @brief  RpcInfo class.
+         *          The subscription to the rpc output of the request handler
+         */
+        class RpcInfo : public DimInfo {
+        public:
+          RpcInfo(RpcChannel *pChannel, const std::string &name, bool pipelined);
+          ~RpcInfo();
+          RpcInfo(const RpcInfo &) = delete;
+          RpcInfo &operator=(const RpcInfo &) = delete;
+          void infoHandler() override;
+
+        private:
+          RpcChannel *m_pChannel = {nullptr}; ///< The channel owner instance
+          bool m_pipelined = {true};          ///< Whether this is the subscription to the pipelined rpc
+        };
+
+        /**
+         *  @brief  Handle a rpc output update from the dim thread
+         *
+         *  @param  data the update data
+         *  @param  size the update size
+         *  @param  linked whether the update comes from the server (false on link loss)
+         *  @param  pipelined whether the update comes from the pipelined rpc
+         */
+        void receive(const char *data, size_t size, bool linked, bool pipelined);
+
+        /**
+         *  @brief  Send a framed request to the server rpc input.
+         *          The header is stripped for the plain rpc
+         *
+         *  @param  request the framed request
+         *  @param  pipelined whether to send to the pipelined rpc
+         */
+        void sendFramed(std::vector<char> &request, bool pipelined);
+
+        typedef std::map<uint32_t, ResponseFunction> PendingRequestMap;
+
+        std::string m_name = {""};                     ///< The request handler name
+        std::string m_inputName = {""};                ///< The pipelined rpc input (command) name
+        std::string m_plainInputName = {""};           ///< The plain rpc input (command) name
+        std::unique_ptr<RpcInfo> m_rpcInfo = {nullptr}; ///< The pipelined rpc output subscription
+        std::unique_ptr<RpcInfo> m_plainRpcInfo = {nullptr}; ///< The plain rpc output subscription, on fallback
+        mutable std::mutex m_mutex = {};               ///< The channel mutex
+        bool m_pipelined = {true};                     ///< Whether the channel uses the pipelined rpc
+        bool m_connected = {false};                    ///< Whether the rpc output subscription is established
+        bool m_linkLost = {false};                     ///< Whether the server link was lost
+        bool m_plainRequestSent = {false};             ///< Whether a plain request waits for its response
+        uint32_t m_plainCorrelationId = {0};           ///< The correlation id of the plain request sent
+        PendingRequestMap m_pendingRequests = {};      ///< The requests waiting for a response
+        std::deque<std::vector<char>> m_queuedRequests = {}; ///< The requests waiting for the subscription or the plain response
+      };
+
+      typedef std::shared_ptr<RpcChannel> RpcChannelPtr;
+      typedef std::list<std::string> RpcChannelLru;
+      typedef std::map<std::string, std::pair<RpcChannelPtr, RpcChannelLru::iterator>> RpcChannelMap;
+
+      /**
+       *  @brief  Get a rpc channel from the pool or open a new one
+       *
+       *  @param  name the request handler name
+       */
+      RpcChannelPtr acquireRpcChannel(const std::string &name) const;
+
+      /**
+       *  @brief  Evict the least recently used idle channels from the pool.
+       *          Must be called with the pool lock held
+       *
+       *  @param  maxChannels the number of channels to keep at most
+       *  @param  evictedChannels the evicted channels, to release outside of the pool lock
+       */
+      void evictRpcChannels(size_t maxChannels, std::vector<RpcChannelPtr> &evictedChannels) const;
+
+      /**
+       *  @brief  Release the channels out of the pool that have no request left.
+       *          Must be called with the pool lock held
+       *
+       *  @param  releasedChannels the released channels, to close outside of the pool lock
+       */
+      void releaseUnpooledRpcChannels(std::vector<RpcChannelPtr> &releasedChannels) const;
+
+      /**
+       *  @brief  Holds back the dns requests of the new subscriptions
+       *          while in scope, they are then sent in full packets
+       */
+      struct DnsRequestBatch {
+        DnsRequestBatch() { dic_hold_dns_requests(); }
+        ~DnsRequestBatch() { dic_flush_dns_requests(); }
+      };
+
     private:
       typedef std::map<std::string, ServiceHandler *> ServiceHandlerMap;
       typedef std::vector<ServiceHandler *> ServiceHandlerList;
       ServiceHandlerMap m_serviceHandlerMap = {}; ///< The service map
+
+      mutable std::mutex m_rpcChannelMutex = {};    ///< The rpc channel pool mutex
+      mutable RpcChannelMap m_rpcChannelMap = {};   ///< The rpc channel pool
+      mutable RpcChannelLru m_rpcChannelLru = {};   ///< The rpc channel usage order, most recent first
+      mutable std::vector<RpcChannelPtr> m_unpooledRpcChannels = {}; ///< The channels opened with pooling disabled
+      unsigned int m_maxRpcChannels = {64};         ///< The maximum number of pooled rpc channels
+      mutable unsigned long m_rpcChannelHits = {0};   ///< The number of rpc channel reuses
+      mutable unsigned long m_rpcChannelMisses = {0}; ///< The number of rpc channel creations
     };
 
     //-------------------------------------------------------------------------------------------------
     //-------------------------------------------------------------------------------------------------
     //-------------------------------------------------------------------------------------------------
 
-    template <typename Request>
-    inline void Client::sendRequest(const std::string &name, const Request &request) const {
-      DimRpcInfo rpcInfo(const_cast<char *>(name.c_str()), (void *)nullptr, 0);
-      Buffer contents;
-      auto model = contents.createModel<Request>();
-      model->copy(request);
-      contents.setModel(model);
-      rpcInfo.setData((void *)contents.begin(), contents.size());
+    template <>
+    inline void Client::sendRequest(const std::string &name, const Buffer &request) const {
+      auto channel = this->acquireRpcChannel(name);
+      channel->send(request.begin(), request.size(), nullptr);
     }
 
     //-------------------------------------------------------------------------------------------------
 
-    template <>
-    inline void Client::sendRequest(const std::string &name, const Buffer &request) const {
-      DimRpcInfo rpcInfo(const_cast<char *>(name.c_str()), (void *)nullptr, 0);
-      Buffer contents;
-      contents.adopt(request.begin(), request.size());
-      rpcInfo.setData((void *)contents.begin(), contents.size());
+    template <typename Request>
+    inline void Client::sendRequest(const std::string &name, const Request &request) const {
+      Buffer contents(request);
+      this->sendRequest(name, contents);
     }
 
     //-------------------------------------------------------------------------------------------------
 
     template <typename Operation>
     inline void Client::sendRequest(const std::string &name, const Buffer &request, Operation operation) const {
-      DimRpcInfo rpcInfo(const_cast<char *>(name.c_str()), (void *)nullptr, 0);
-
-      // send request
-      rpcInfo.setData((void *)request.begin(), request.size());
-
-      // wait for answer from server
-      char *data = (char *)rpcInfo.getData();
-      int size = rpcInfo.getSize();
-
-      Buffer response;
-
-      if (nullptr != data && 0 != size)
-        response.adopt(data, size);
-
+      // the response would never be delivered
+      if (dim_in_dim_thread())
+        throw std::runtime_error("Client::sendRequest(): blocking request '" + name +
+                                 "' from a dim callback, use sendRequestAsync()");
+
+      // send request and wait for answer from server
+      auto future = this->sendRequestAsync(name, request);
+      Buffer response(future.get());
       operation(response);
     }
 
@@ -206,10 +474,7 @@ namespace dqm4hep {
 
     template <typename Command>
     inline void Client::sendCommand(const std::string &name, const Command &command, bool blocking) const {
-      Buffer contents;
-      auto model = contents.createModel<Command>();
-      model->copy(command);
-      contents.setModel(model);
+      Buffer contents(command);
 
       if (blocking) {
         DimClient::sendCommand(const_cast<char *>(name.c_str()), (void *)contents.begin(), contents.size());
@@ -231,6 +496,30 @@ namespace dqm4hep {
 
     //-------------------------------------------------------------------------------------------------
 
+    template <>
+    void Client::sendCommandAsync(const std::string &name, const Buffer &buffer,
+                                  std::function<void(bool)> operation) const;
+
+    //-------------------------------------------------------------------------------------------------
+
+    template <typename Command>
+    inline void Client::sendCommandAsync(const std::string &name, const Command &command,
+                                         std::function<void(bool)> operation) const {
+      Buffer contents(command);
+      this->sendCommandAsync(name, contents, operation);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    template <typename Command>
+    inline std::future<bool> Client::sendCommandAsync(const std::string &name, const Command &command) const {
+      auto promise = std::make_shared<std::promise<bool>>();
+      this->sendCommandAsync(name, command, [promise](bool delivered) { promise->set_value(delivered); });
+      return promise->get_future();
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
     template <typename Controller>
     inline void Client::subscribe(const std::string &name, Controller *pController,
                                   void (Controller::*function)(const Buffer &)) {
@@ -247,6 +536,17 @@ namespace dqm4hep {
 
     //-------------------------------------------------------------------------------------------------
 
+    template <typename Controller>
+    inline void Client::subscribe(const core::StringVector &serviceNames, Controller *pController,
+                                  void (Controller::*function)(const Buffer &)) {
+      DnsRequestBatch batch;
+
+      for (auto &name : serviceNames)
+        this->subscribe(name, pController, function);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
     template <typename Controller>
     inline void Client::unsubscribe(const std::string &serviceName, Controller *pController) {
       for (auto iter = m_serviceHandlerMap.begin(), endIter = m_serviceHandlerMap.end(); endIter != iter; ++iter) {
@@ -0,0 +1,300 @@
+/// \file DirectoryCache.h
+/*
+ *
+ * DirectoryCache.h header template automatically generated by a class generator
+ * Creation date : sam. oct. 17 2026
+ *
+ * This file is part of DQM4HEP libraries.
+ *
+ * DQM4HEP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * DQM4HEP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DQM4HEP.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @author Remi Ete
+ * @copyright CNRS , IPNL
+ */
+
+#ifndef DQM4HEP_DIRECTORYCACHE_H
+#define DQM4HEP_DIRECTORYCACHE_H
+
+// -- std headers
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// -- dqm4hep headers
+#include <dqm4hep/Internal.h>
+#include <dqm4hep/Signal.h>
+
+// -- dim headers
+#include <dic.hxx>
+
+namespace dqm4hep {
+
+  namespace net {
+
+    /**
+     *  @brief  DirectoryEntry struct.
+     *          A service, command or rpc published by a server
+     */
+    struct DirectoryEntry {
+      std::string       name = {""};          ///< The service name (rpc base name for rpcs)
+      std::string       server = {""};        ///< The name of the server publishing it
+      std::string       format = {""};        ///< The dim format ("in,out" for rpcs)
+      int               type = {DimSERVICE};  ///< DimSERVICE, DimCOMMAND or DimRPC
+    };
+
+    //-------------------------------------------------------------------------------------------------
+    //-------------------------------------------------------------------------------------------------
+
+    /**
+     *  @brief  DirectoryCache class.
+     *          A process wide copy of the dns directory. Follows the dns
+     *          directory change feed, a snapshot followed by the changes, and
+     *          answers the queries on servers and services from memory instead
+     *          of browsing the dns.
+     *          With a dns not publishing the feed, subscribes to the dns server
+     *          list and to the service list of each running server instead.
+     *          The cache is updated asynchronously: a service registered a
+     *          moment ago may not be known yet.
+     *          The signals are processed in the dim thread, after the cache has
+     *          been updated.
+     */
+    class DirectoryCache {
+    public:
+      typedef core::Signal<const std::string &> ServerSignal;
+      typedef core::Signal<const DirectoryEntry &> ServiceSignal;
+
+      /**
+       *  @brief  Get the directory cache. Subscribes to the dns on first call
+       */
+      static DirectoryCache &instance();
+
+      DirectoryCache(const DirectoryCache &) = delete;
+      DirectoryCache &operator=(const DirectoryCache &) = delete;
+
+      /**
+       *  @brief  Wait for the initial copy of the directory: the feed snapshot, or
+       *          the server list and the service lists of all the servers running
+       *          at startup.
+       *          Does not wait when called from a dim callback, as the updates
+       *          are received in the dim thread
+       *
+       *  @param  timeout the maximum time to wait (ms)
+       *  @return whether the initial copy is complete
+       */
+      bool waitReady(unsigned int timeout = 5000) const;
+
+      /**
+       *  @brief  Whether the initial copy of the directory is complete
+       */
+      bool isReady() const;
+
+      /**
+       *  @brief  Get the names of the running servers
+       */
+      core::StringVector servers() const;
+
+      /**
+       *  @brief  Whether the server is running
+       *
+       *  @param  serverName the server name
+       */
+      bool hasServer(const std::string &serverName) const;
+
+      /**
+       *  @brief  Get the node a server runs on. Empty if the server is not running
+       *
+       *  @param  serverName the server name
+       */
+      std::string serverNode(const std::string &serverName) const;
+
+      /**
+       *  @brief  Get the services, commands and rpcs published by a server
+       *
+       *  @param  serverName the server name
+       */
+      std::vector<DirectoryEntry> serverServices(const std::string &serverName) const;
+
+      /**
+       *  @brief  Whether a service of the given type is published by a running server
+       *
+       *  @param  name the service name (rpc base name for rpcs)
+       *  @param  type DimSERVICE, DimCOMMAND or DimRPC
+       */
+      bool hasService(const std::string &name, int type) const;
+
+      /**
+       *  @brief  Look for a service. If several servers publish it, the entry
+       *          of any of them is returned
+       *
+       *  @param  name the service name (rpc base name for rpcs)
+       *  @param  entry the entry to receive
+       *  @return whether the service was found
+       */
+      bool findService(const std::string &name, DirectoryEntry &entry) const;
+
+      /**
+       *  @brief  Get the names of a set published as the given type by a running server
+       *
+       *  @param  names the service names
+       *  @param  type DimSERVICE, DimCOMMAND or DimRPC
+       */
+      core::StringVector existingServices(const core::StringVector &names, int type) const;
+
+      /**
+       *  @brief  Get the signal processed when a server starts
+       */
+      ServerSignal &onServerAdded();
+
+      /**
+       *  @brief  Get the signal processed when a server stops.
+       *          Processed after the removal of all its services
+       */
+      ServerSignal &onServerRemoved();
+
+      /**
+       *  @brief  Get the signal processed when a service, command or rpc appears
+       */
+      ServiceSignal &onServiceAdded();
+
+      /**
+       *  @brief  Get the signal processed when a service, command or rpc disappears
+       */
+      ServiceSignal &onServiceRemoved();
+
+    private:
+      /**
+       *  @brief  ChangesInfo class.
+       *          Subscription to the dns directory change feed
+       */
+      class ChangesInfo : public DimInfo {
+      public:
+        ChangesInfo(DirectoryCache *pCache, unsigned int generation);
+        ~ChangesInfo();
+        void infoHandler() override;
+
+      private:
+        DirectoryCache *m_pCache = {nullptr};
+        unsigned int m_generation = {0};
+      };
+
+      /**
+       *  @brief  ServerListInfo class.
+       *          Subscription to the dns server list
+       */
+      class ServerListInfo : public DimInfo {
+      public:
+        ServerListInfo(DirectoryCache *pCache);
+        ~ServerListInfo();
+        void infoHandler() override;
+
+      private:
+        DirectoryCache *m_pCache = {nullptr};
+      };
+
+      /**
+       *  @brief  ServiceListInfo class.
+       *          Subscription to the service list of a server
+       */
+      class ServiceListInfo : public DimInfo {
+      public:
+        ServiceListInfo(DirectoryCache *pCache, const std::string &serverName, unsigned int generation);
+        ~ServiceListInfo();
+        void infoHandler() override;
+
+      private:
+        DirectoryCache *m_pCache = {nullptr};
+        std::string m_serverName = {""};
+        unsigned int m_generation = {0};
+      };
+
+      typedef std::map<std::string, DirectoryEntry> EntryMap;
+
+      /**
+       *  @brief  ServerEntry struct.
+       *          A running server and the services it publishes
+       */
+      struct ServerEntry {
+        std::string       node = {""};             ///< The server node
+        ServiceListInfo  *pInfo = {nullptr};       ///< The subscription to its service list
+        unsigned int      generation = {0};        ///< Tells apart the subscriptions of a restarted server
+        bool              received = {false};      ///< Whether its service list has been received once
+        bool              full = {true};           ///< Whether the next service list update is a full list
+        EntryMap          services = {};           ///< Its services, by name
+        core::StringMap   rpcFormats = {};         ///< The formats of its RpcIn and RpcOut services (change feed)
+      };
+
+      /**
+       *  @brief  Change struct.
+       *          A change of the directory, notified once the cache is unlocked
+       */
+      struct Change {
+        enum Kind { SERVER_ADDED, SERVER_REMOVED, SERVICE_ADDED, SERVICE_REMOVED };
+        Kind              kind;
+        DirectoryEntry    entry;
+      };
+
+      typedef std::map<std::string, ServerEntry> ServerMap;
+      typedef std::unordered_multimap<std::string, const DirectoryEntry *> ServiceIndex;
+      typedef std::vector<Change> ChangeList;
+
+      DirectoryCache();
+
+      void receiveChanges(unsigned int generation, const char *data, int size);
+      void applyChanges(const std::string &text, size_t position, bool snapshot, ChangeList &changes,
+                        std::vector<ServiceListInfo *> &released);
+      void receiveServerList(const char *data, int size);
+      void receiveServiceList(const std::string &serverName, unsigned int generation, const char *data, int size);
+      ServerEntry &addServer(const std::string &serverName, const std::string &node, ChangeList &changes);
+      void removeServer(ServerMap::iterator iter, ChangeList &changes, std::vector<ServiceListInfo *> &released);
+      void addService(ServerEntry &server, const std::string &serverName, const std::string &line, ChangeList &changes);
+      void removeService(ServerEntry &server, const std::string &serverName, const std::string &name,
+                         ChangeList &changes);
+      void updateRpc(ServerEntry &server, const std::string &serverName, const std::string &rpcName,
+                     ChangeList &changes);
+      void addEntry(ServerEntry &server, const DirectoryEntry &entry, ChangeList &changes);
+      void removeEntry(ServerEntry &server, EntryMap::iterator iter, ChangeList &changes);
+      void serverReceived(ServerEntry *pServer);
+      void notify(const ChangeList &changes);
+
+    private:
+      mutable std::mutex              m_mutex = {};                ///< Guards the directory
+      mutable std::condition_variable m_readyCondition = {};       ///< Notified when the initial copy is complete
+      ServerMap                       m_servers = {};              ///< The running servers, by name
+      ServiceIndex                    m_serviceIndex = {};         ///< The entries of all the servers, by service name
+      bool                            m_serverListFull = {true};   ///< Whether the next server list update is a full list
+      bool                            m_serverListReceived = {false}; ///< Whether the server list has been received once
+      unsigned int                    m_nPendingServers = {0};     ///< The number of servers whose service list is awaited
+      bool                            m_ready = {false};           ///< Whether the initial copy is complete
+      unsigned int                    m_generation = {0};          ///< The last service list subscription generation
+      ServerSignal                    m_serverAddedSignal = {};    ///< Processed when a server starts
+      ServerSignal                    m_serverRemovedSignal = {};  ///< Processed when a server stops
+      ServiceSignal                   m_serviceAddedSignal = {};   ///< Processed when a service appears
+      ServiceSignal                   m_serviceRemovedSignal = {}; ///< Processed when a service disappears
+      ServerListInfo                 *m_pServerListInfo = {nullptr}; ///< The subscription to the dns server list
+      ChangesInfo                    *m_pChangesInfo = {nullptr};  ///< The subscription to the dns change feed
+      std::vector<ChangesInfo *>      m_oldChangesInfos = {};      ///< Replaced feed subscriptions, released on the next update
+      unsigned int                    m_changesGeneration = {0};   ///< The feed subscription generation
+      bool                            m_followChanges = {false};   ///< Whether the directory comes from the feed
+      unsigned int                    m_changesSequence = {0};     ///< The sequence number of the last feed update applied
+    };
+
+  }
+
+}
+
+#endif //  DQM4HEP_DIRECTORYCACHE_H
@@ -0,0 +1,150 @@
+/// \file Executor.h
+/*
+ *
+ * Executor.h header template automatically generated by a class generator
+ * Creation date : sam. oct. 17 2026
+ *
+ * This file is part of DQM4HEP libraries.
+ *
+ * DQM4HEP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * DQM4HEP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DQM4HEP.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @author Remi Ete
+ * @copyright CNRS , IPNL
+ */
+
+#ifndef DQM4HEP_EXECUTOR_H
+#define DQM4HEP_EXECUTOR_H
+
+// -- std headers
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dqm4hep {
+
+  namespace net {
+
+    /**
+     *  @brief  Executor class.
+     *          A fixed size pool of worker threads processing tasks from a
+     *          bounded queue. Tasks are shed (not executed) when the server is
+     *          overloaded:
+     *          - on submission, if the queue is full or if the oldest queued
+     *            task has been waiting for longer than the maximum latency,
+     *          - on dequeue, if the task has been waiting for longer than the
+     *            maximum latency.
+     *          A shed task gets its shed function called instead, so that the
+     *          caller can fail fast (e.g answer the client that the request
+     *          was rejected).
+     */
+    class Executor {
+    public:
+      typedef std::function<void()> Task;
+
+      /**
+       *  @brief  Constructor. Start the worker threads
+       *
+       *  @param  nThreads the number of worker threads
+       *  @param  maxQueueSize the maximum number of queued tasks
+       *  @param  maxQueueLatency the maximum time (ms) a task can wait in the queue. 0 means no limit
+       */
+      Executor(unsigned int nThreads, unsigned int maxQueueSize, unsigned int maxQueueLatency);
+
+      /**
+       *  @brief  Destructor. Stop the worker threads
+       */
+      ~Executor();
+
+      Executor(const Executor &) = delete;
+      Executor &operator=(const Executor &) = delete;
+
+      /**
+       *  @brief  Submit a task for execution.
+       *          If the task is rejected on submission, the shed function
+       *          is called in the caller thread
+       *
+       *  @param  task the task to execute
+       *  @param  shed the function to call if the task is shed (optional)
+       *  @return whether the task was accepted in the queue
+       */
+      bool submit(Task task, Task shed = nullptr);
+
+      /**
+       *  @brief  Stop the executor. Queued tasks are executed before
+       *          the worker threads are joined. Further submissions are rejected
+       */
+      void stop();
+
+      /**
+       *  @brief  Get the number of worker threads
+       */
+      unsigned int numberOfThreads() const;
+
+      /**
+       *  @brief  Get the current number of queued tasks
+       */
+      unsigned int queueSize() const;
+
+      /**
+       *  @brief  Get the number of executed tasks
+       */
+      unsigned long numberOfExecutedTasks() const;
+
+      /**
+       *  @brief  Get the number of shed tasks (rejected on submission or expired in the queue)
+       */
+      unsigned long numberOfShedTasks() const;
+
+    private:
+      /**
+       *  @brief  The worker thread loop
+       */
+      void run();
+
+      /**
+       *  @brief  Whether a task queued at the given time has waited for too long
+       *
+       *  @param  queueTime the task queue time
+       *  @param  now the current time
+       */
+      bool expired(const std::chrono::steady_clock::time_point &queueTime,
+                   const std::chrono::steady_clock::time_point &now) const;
+
+    private:
+      struct QueuedTask {
+        Task m_task;                                      ///< The task to execute
+        Task m_shed;                                      ///< The function to call if the task is shed
+        std::chrono::steady_clock::time_point m_queueTime; ///< The time the task was queued
+      };
+
+      const unsigned int m_maxQueueSize;               ///< The maximum number of queued tasks
+      const std::chrono::milliseconds m_maxQueueLatency; ///< The maximum queue latency
+      mutable std::mutex m_mutex = {};                 ///< The queue mutex
+      std::condition_variable m_condition = {};        ///< The queue condition
+      std::deque<QueuedTask> m_queue = {};             ///< The task queue
+      std::vector<std::thread> m_threads = {};         ///< The worker threads
+      bool m_stopping = {false};                       ///< Whether the executor is stopping
+      unsigned long m_nExecutedTasks = {0};            ///< The number of executed tasks
+      unsigned long m_nShedTasks = {0};                ///< The number of shed tasks
+    };
+  }
+}
+
+#endif //  DQM4HEP_EXECUTOR_H
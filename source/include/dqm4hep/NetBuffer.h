@@ -29,12 +29,14 @@
 #define DQM4HEP_NETBUFFER_H
 
 #include <algorithm>
+#include <cstddef>
 #include <cstring>
 #include <iostream>
 #include <limits>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <type_traits>
 #include <typeinfo>
 
 namespace dqm4hep {
@@ -191,10 +193,16 @@ namespace dqm4hep {
     //-------------------------------------------------------------------------------------------------
 
     /**
-     *  @brief  Buffer class
+     *  @brief  Buffer class.
+     *          Either a view on memory owned by somebody else (adopt()), a copy of
+     *          a small value in the buffer itself, or a model holding the data
+     *          (setModel()). Only the models are allocated on the heap.
+     *          Received buffers are views, valid during the callback only (see retain())
      */
     class Buffer {
     public:
+      static constexpr size_t inlineSize = {64}; ///< The largest value copied in the buffer itself
+
       Buffer(const Buffer &) = delete;
       Buffer &operator=(const Buffer &) = delete;
       Buffer &&operator=(Buffer &&) = delete;
@@ -210,6 +218,31 @@ namespace dqm4hep {
        */
       Buffer(Buffer &&buffer);
 
+      /**
+       *  @brief  Constructor. Copy a value, in the buffer itself if it is
+       *          trivially copyable and no larger than inlineSize
+       *
+       *  @param  value the value to copy
+       */
+      template <typename T>
+      explicit Buffer(const T &value);
+
+      /**
+       *  @brief  Constructor. Copy a string, in the buffer itself if no larger than inlineSize
+       *
+       *  @param  value the string to copy
+       */
+      explicit Buffer(const std::string &value);
+
+      /**
+       *  @brief  Constructor. View an array of values (not copied !)
+       *
+       *  @param  values the array start address
+       *  @param  nElements the number of elements in the array
+       */
+      template <typename T>
+      Buffer(const T *values, size_t nElements);
+
       /**
        *  @brief  Factory method to create a new model
        */
@@ -244,7 +277,7 @@ namespace dqm4hep {
       size_t size() const;
 
       /**
-       *  @brief  Adopt a new buffer. A new model is created to handle this new buffer
+       *  @brief  Adopt a new buffer (does not own it !)
        *
        *  @param  buffer the start address of the new buffer to adopt
        *  @param  size the size of the new buffer to adopt
@@ -252,12 +285,41 @@ namespace dqm4hep {
       void adopt(const char *buffer, size_t size);
 
       /**
-       *  @brief  Get the model handling the raw buffer
+       *  @brief  Copy a buffer, in the buffer itself if no larger than inlineSize
+       *
+       *  @param  buffer the start address of the buffer to copy
+       *  @param  size the size of the buffer to copy
+       */
+      void copy(const char *buffer, size_t size);
+
+      /**
+       *  @brief  Get a buffer on the same contents, that stays valid after this one is gone.
+       *          Data received from the network is not copied, its receive buffer is shared
+       *          and goes back to the dim pool when the last retained buffer is destroyed.
+       *          Small values and views on any other memory are copied
+       */
+      Buffer retain() const;
+
+      /**
+       *  @brief  Get the model handling the raw buffer. Without model, a new one
+       *          viewing the buffer contents is returned
        */
       BufferModelPtr model() const;
 
     private:
-      BufferModelPtr m_model = {nullptr}; ///< The buffer model handling the raw buffer
+      template <typename T>
+      void copyValue(const T &value, std::true_type inlined);
+
+      template <typename T>
+      void copyValue(const T &value, std::false_type inlined);
+
+      void copyInline(const char *buffer, size_t size);
+
+    private:
+      BufferModelPtr m_model = {nullptr};              ///< The buffer model handling the raw buffer, if any
+      const char *m_pBuffer = {NullBuffer::buffer};    ///< The buffer start address, without model
+      size_t m_size = {NullBuffer::size};              ///< The buffer size, without model
+      alignas(std::max_align_t) char m_inline[inlineSize]; ///< The storage of small values
     };
 
     //-------------------------------------------------------------------------------------------------
@@ -291,6 +353,37 @@ namespace dqm4hep {
     inline std::shared_ptr<BufferModelT<T>> Buffer::createModel() const {
       return std::make_shared<BufferModelT<T>>();
     }
+
+    //-------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    inline Buffer::Buffer(const T &value) {
+      typedef std::integral_constant<bool, std::is_trivially_copyable<T>::value && (sizeof(T) <= inlineSize)> Inlined;
+      this->copyValue(value, Inlined());
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    inline Buffer::Buffer(const T *values, size_t nElements) {
+      this->adopt((const char *)values, nElements * sizeof(T));
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    inline void Buffer::copyValue(const T &value, std::true_type) {
+      this->copyInline((const char *)&value, sizeof(T));
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    inline void Buffer::copyValue(const T &value, std::false_type) {
+      auto model = this->createModel<T>();
+      model->copy(value);
+      this->setModel(model);
+    }
   }
 }
 
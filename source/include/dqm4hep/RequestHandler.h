@@ -31,11 +31,16 @@
 // -- dqm4hep headers
 #include "dqm4hep/Internal.h"
 #include "dqm4hep/NetBuffer.h"
+#include "dqm4hep/RpcHeader.h"
 #include "dqm4hep/Signal.h"
 #include "dqm4hep/json.h"
 
 // -- std headers
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 // -- dim headers
 #include "dis.hxx"
@@ -45,12 +50,16 @@ namespace dqm4hep {
   namespace net {
 
     class Server;
+    class DeferredResponse;
+    typedef std::shared_ptr<DeferredResponse> DeferredResponsePtr;
 
     class RequestHandler {
       friend class Server;
+      friend class DeferredResponse;
 
     public:
       typedef core::Signal<const Buffer &, Buffer &> RequestSignal;
+      typedef core::Signal<const Buffer &, DeferredResponsePtr> DeferredRequestSignal;
 
       /**
        * Get the request name
@@ -72,6 +81,16 @@ namespace dqm4hep {
       template <typename Controller>
       RequestHandler(Server *pServer, const std::string &name, Controller *pController,
                      void (Controller::*function)(const Buffer &request, Buffer &response));
+
+      /**
+       * Constructor with a handler function completing the response later
+       *
+       * @param pServer the server managing the request handler
+       * @param name the request handler name
+       */
+      template <typename Controller>
+      RequestHandler(Server *pServer, const std::string &name, Controller *pController,
+                     void (Controller::*function)(const Buffer &request, DeferredResponsePtr response));
       
       RequestHandler(const RequestHandler&) = delete;
       RequestHandler& operator=(const RequestHandler&) = delete;
@@ -102,6 +121,11 @@ namespace dqm4hep {
        */
       RequestSignal &onRequest();
 
+      /**
+       * Get the signal processed on request reception, for handlers completing the response later
+       */
+      DeferredRequestSignal &onDeferredRequest();
+
     private:
       /** Rpc class.
       *
@@ -111,35 +135,157 @@ namespace dqm4hep {
       public:
         /**
          * Contructor
+         *
+         * @param pHandler the request handler owner instance
+         * @param pipelined whether to run the pipelined rpc (see RpcHeader) or the plain one
          */
-        Rpc(RequestHandler *pHandler);
+        Rpc(RequestHandler *pHandler, bool pipelined);
         Rpc(const Rpc&) = delete;
         Rpc& operator=(const Rpc&) = delete;
 
+        /**
+         * Destructor. Waits for the rpc handler running in another dim thread
+         */
+        ~Rpc();
+
         /**
          * The dim rpc handler
          */
         void rpcHandler() override;
 
+        /**
+         * Send a response to a correlated request, outside of the rpc handler.
+         * Can be called from any thread
+         *
+         * @param clientId the client to answer
+         * @param correlationId the request correlation id
+         * @param data the response data
+         * @param size the response size
+         * @param status the request status
+         */
+        void sendResponse(int clientId, uint32_t correlationId, const char *data, size_t size,
+                          RpcHeader::Status status);
+
       private:
+        /**
+         * Set the rpc output data with a correlation header
+         *
+         * @param buffer the buffer to frame the response in
+         * @param correlationId the request correlation id
+         * @param data the response data
+         * @param size the response size
+         * @param status the request status
+         */
+        void setFramedData(std::vector<char> &buffer, uint32_t correlationId, const char *data, size_t size,
+                           RpcHeader::Status status);
+
         RequestHandler *m_pHandler = {nullptr}; ///< The request handler owner instance
+        bool m_pipelined = {false};              ///< Whether requests and responses carry the correlation header
+        std::vector<char> m_responseBuffer = {}; ///< The framed response buffer set by the rpc handler
+        std::vector<char> m_sendBuffer = {};     ///< The framed response buffer for deferred responses
       };
 
       friend class Rpc;
 
     private:
       /**
-       * [handleRequest description]
-       * @param request  [description]
-       * @param response [description]
+       * Process the request signals and complete the response
+       *
+       * @param request the request
+       * @param response the response to complete
        */
-      void handleRequest(const Buffer &request, Buffer &response);
+      void handleRequest(const Buffer &request, DeferredResponsePtr response);
 
     private:
       std::string           m_name = {""};            ///< The request handler name
       Server               *m_pServer = {nullptr};         ///< The server in which the request handler is declared
       RequestSignal         m_requestSignal = {};
-      Rpc                  *m_pRpc = {nullptr};
+      DeferredRequestSignal m_deferredRequestSignal = {};
+      std::shared_ptr<Rpc>  m_rpc = {nullptr};           ///< The plain rpc, named after the handler
+      std::shared_ptr<Rpc>  m_pipelinedRpc = {nullptr};  ///< The rpc of the pipelining clients
+    };
+
+    //-------------------------------------------------------------------------------------------------
+    //-------------------------------------------------------------------------------------------------
+    //-------------------------------------------------------------------------------------------------
+
+    /**
+     *  @brief  DeferredResponse class.
+     *          Token used to complete the response to a request, possibly
+     *          later and from another thread than the one receiving the request.
+     *          Only the first call to send() or reject() is effective.
+     *
+     *          Clients using the correlated rpc protocol (see RpcHeader) can be
+     *          answered at any time. Plain requests can only be answered before
+     *          the request handler function returns.
+     */
+    class DeferredResponse {
+      friend class RequestHandler;
+
+    public:
+      DeferredResponse(const DeferredResponse &) = delete;
+      DeferredResponse &operator=(const DeferredResponse &) = delete;
+
+      /**
+       *  @brief  Send the response to the client
+       *
+       *  @param  response the response to send
+       */
+      void send(const Buffer &response);
+
+      /**
+       *  @brief  Reject the request, e.g if the server is overloaded.
+       *          The client receives an empty response
+       */
+      void reject();
+
+      /**
+       *  @brief  Whether the response has been sent or the request rejected
+       */
+      bool isCompleted() const;
+
+    private:
+      /**
+       *  @brief  Constructor
+       *
+       *  @param  rpc the rpc that received the request
+       *  @param  clientId the client that sent the request
+       *  @param  correlationId the request correlation id
+       *  @param  correlated whether the request uses the correlated rpc protocol
+       *  @param  inCallback whether the response is created in the handler call (inline execution)
+       */
+      DeferredResponse(std::weak_ptr<RequestHandler::Rpc> rpc, int clientId, uint32_t correlationId, bool correlated,
+                       bool inCallback);
+
+      /**
+       *  @brief  Complete the response
+       *
+       *  @param  data the response data
+       *  @param  size the response size
+       *  @param  status the request status
+       */
+      void complete(const char *data, size_t size, RpcHeader::Status status);
+
+      /**
+       *  @brief  End the synchronous part of the request handling.
+       *          Get the response if it was completed meanwhile
+       *
+       *  @param  response the response completed during the handler call
+       *  @param  status the request status
+       *  @return whether the response was completed during the handler call
+       */
+      bool endCallback(std::string &response, RpcHeader::Status &status);
+
+    private:
+      std::weak_ptr<RequestHandler::Rpc> m_rpc = {};  ///< The rpc that received the request
+      const int m_clientId;                          ///< The client that sent the request
+      const uint32_t m_correlationId;                ///< The request correlation id
+      const bool m_correlated;                       ///< Whether the request uses the correlated rpc protocol
+      mutable std::mutex m_mutex = {};               ///< The response mutex
+      bool m_completed = {false};                    ///< Whether the response was completed
+      bool m_inCallback = {true};                    ///< Whether the handler function is still running
+      std::string m_inlineResponse = {""};           ///< The response completed during the handler call
+      RpcHeader::Status m_inlineStatus = {RpcHeader::OK}; ///< The request status set during the handler call
     };
 
     //-------------------------------------------------------------------------------------------------
@@ -149,10 +295,20 @@ namespace dqm4hep {
     template <typename Controller>
     inline RequestHandler::RequestHandler(Server *pServer, const std::string &rname, Controller *pController,
                                           void (Controller::*function)(const Buffer &request, Buffer &response))
-        : m_name(rname), m_pServer(pServer), m_pRpc(nullptr) {
+        : m_name(rname), m_pServer(pServer) {
       m_requestSignal.connect(pController, function);
     }
 
+    //-------------------------------------------------------------------------------------------------
+
+    template <typename Controller>
+    inline RequestHandler::RequestHandler(Server *pServer, const std::string &rname, Controller *pController,
+                                          void (Controller::*function)(const Buffer &request,
+                                                                       DeferredResponsePtr response))
+        : m_name(rname), m_pServer(pServer) {
+      m_deferredRequestSignal.connect(pController, function);
+    }
+
     //-------------------------------------------------------------------------------------------------
     //-------------------------------------------------------------------------------------------------
     //-------------------------------------------------------------------------------------------------
@@ -173,6 +329,11 @@ namespace dqm4hep {
        */
       Server *server() const;
 
+      /**
+       * Get the number of commands dropped because the server worker pool was overloaded
+       */
+      unsigned long numberOfDroppedCommands() const;
+
     private:
       /**
        * Constructor
@@ -254,11 +415,17 @@ namespace dqm4hep {
        */
       void handleCommand(const Buffer &command);
 
+      /**
+       * Count a command shed by the server worker pool and warn about it
+       */
+      void dropCommand();
+
     private:
       std::string         m_name = {""};           ///< The command handler name
       Server             *m_pServer = {nullptr};   ///< The server in which the command handler is declared
       CommandSignal       m_commandSignal = {};
       Command            *m_pCommand = {nullptr};
+      std::atomic<unsigned long> m_droppedCommands = {0}; ///< The number of commands shed by the worker pool
     };
 
     //-------------------------------------------------------------------------------------------------
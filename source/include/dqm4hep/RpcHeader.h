@@ -0,0 +1,115 @@
+/// \file RpcHeader.h
+/*
+ *
+ * RpcHeader.h header template automatically generated by a class generator
+ * Creation date : sam. oct. 17 2026
+ *
+ * This file is part of DQM4HEP libraries.
+ *
+ * DQM4HEP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * DQM4HEP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DQM4HEP.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @author Remi Ete
+ * @copyright CNRS , IPNL
+ */
+
+#ifndef DQM4HEP_RPCHEADER_H
+#define DQM4HEP_RPCHEADER_H
+
+// -- std headers
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace dqm4hep {
+
+  namespace net {
+
+    /**
+     *  @brief  RpcHeader class.
+     *          Small header prepended to rpc payloads to correlate responses
+     *          with requests. This allows a client to have several requests
+     *          in flight on the same rpc channel.
+     *
+     *          The header is never guessed from the payload: a request handler
+     *          runs a second rpc, named by pipelinedName(), on which every
+     *          request and response carries the header. The rpc under the
+     *          request handler name keeps the plain protocol.
+     *
+     *          A correlation id of 0 means that no response is expected.
+     *          A response header may flag the request as rejected by the
+     *          server (e.g overloaded), in which case no payload follows.
+     */
+    class RpcHeader {
+    public:
+      /**
+       *  @brief  Status enum
+       */
+      enum Status {
+        OK,      ///< Plain request or response
+        REJECTED ///< Request rejected by the server
+      };
+
+      static const std::size_t size = 8;                ///< The header size in bytes
+      static const uint32_t magic = 0x524e5144;         ///< The header magic number ("DQNR")
+      static const uint32_t rejectedMagic = 0x584e5144; ///< The rejected response magic number ("DQNX")
+
+      /**
+       *  @brief  Write the header at the start of the buffer.
+       *          The buffer must be at least RpcHeader::size long
+       *
+       *  @param  pBuffer the buffer to write to
+       *  @param  correlationId the correlation id
+       *  @param  status the request status
+       */
+      static void write(char *pBuffer, uint32_t correlationId, Status status = OK);
+
+      /**
+       *  @brief  Read the header from the start of the buffer
+       *
+       *  @param  pBuffer the buffer to read
+       *  @param  bufferSize the buffer size
+       *  @param  correlationId the correlation id read from the header
+       *  @return whether the buffer starts with a rpc header
+       */
+      static bool read(const char *pBuffer, std::size_t bufferSize, uint32_t &correlationId);
+
+      /**
+       *  @brief  Read the header from the start of the buffer
+       *
+       *  @param  pBuffer the buffer to read
+       *  @param  bufferSize the buffer size
+       *  @param  correlationId the correlation id read from the header
+       *  @param  status the request status read from the header
+       *  @return whether the buffer starts with a rpc header
+       */
+      static bool read(const char *pBuffer, std::size_t bufferSize, uint32_t &correlationId, Status &status);
+
+      /**
+       *  @brief  Get the name of the pipelined rpc of a request handler
+       *
+       *  @param  name the request handler name
+       */
+      static std::string pipelinedName(const std::string &name);
+
+      /**
+       *  @brief  Get a new correlation id, unique within the process
+       */
+      static uint32_t nextCorrelationId();
+    };
+  }
+}
+
+#endif //  DQM4HEP_RPCHEADER_H
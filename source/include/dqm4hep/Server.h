@@ -28,7 +28,11 @@
 #ifndef SERVER_H
 #define SERVER_H
 
+// -- std headers
+#include <atomic>
+
 // -- dqm4hep headers
+#include <dqm4hep/Executor.h>
 #include <dqm4hep/NetBuffer.h>
 #include <dqm4hep/RequestHandler.h>
 #include <dqm4hep/Service.h>
@@ -41,6 +45,31 @@ namespace dqm4hep {
 
   namespace net {
 
+    /**
+     *  @brief  OverflowPolicy enumerator.
+     *          What to do when the outbound queue of a client connection is full
+     */
+    enum OverflowPolicy {
+      DROP_OLDEST = DIM_WQ_DROP_OLDEST,  ///< Drop the oldest queued updates of the same service, then disconnect
+      DISCONNECT = DIM_WQ_DISCONNECT     ///< Disconnect the client
+    };
+
+    /**
+     *  @brief  ClientQueueStats struct.
+     *          Statistics of the outbound queue of a client connection
+     */
+    struct ClientQueueStats {
+      size_t            bytes = {0};          ///< The number of bytes currently queued
+      size_t            entries = {0};        ///< The number of messages currently queued
+      size_t            peakBytes = {0};      ///< The maximum number of bytes ever queued
+      size_t            limit = {0};          ///< The maximum number of bytes allowed in the queue
+      OverflowPolicy    policy = {DROP_OLDEST}; ///< The overflow policy
+      unsigned int      drops = {0};          ///< The number of updates dropped on overflow
+    };
+
+    //-------------------------------------------------------------------------------------------------
+    //-------------------------------------------------------------------------------------------------
+
     /**
      * Server class
      *
@@ -54,7 +83,20 @@ namespace dqm4hep {
      * server startup.
      */
     class Server : public DimServer {
+      friend class Service;
+
     public:
+      /**
+       *  @brief  Holds back the DNS registrations and unregistrations of the process
+       *          while in scope, they are then sent in full packets. Wrap the
+       *          creation of many request or command handlers in a running server
+       *          in a batch, as createServices() does for services. Batches can be nested
+       */
+      struct DnsUpdateBatch {
+        DnsUpdateBatch() { dis_hold_dns_updates(); }
+        ~DnsUpdateBatch() { dis_flush_dns_updates(); }
+      };
+
       /**
        *  @brief  Constructor
        *
@@ -103,6 +145,18 @@ namespace dqm4hep {
        */
       Service *createService(const std::string &name);
 
+      /**
+       *  @brief  Create a set of services at once.
+       *          The names are checked against the services running on the network
+       *          at once and the new services are registered to
+       *          the DNS in full packets. Services already created in this server
+       *          are returned as they are
+       *
+       *  @param  names the service names
+       *  @return the services, in the order of the names
+       */
+      std::vector<Service *> createServices(const core::StringVector &names);
+
       /**
        *  @brief  Create a new request handler
        *
@@ -114,6 +168,17 @@ namespace dqm4hep {
       void createRequestHandler(const std::string &name, Controller *pController,
                                 void (Controller::*function)(const Buffer &request, Buffer &response));
 
+      /**
+       *  @brief  Create a new request handler completing the response later.
+       *          The response can be sent from any thread using the deferred response token
+       *  @param  name the request handler name
+       *  @param  pController the class instance that will handle the request
+       *  @param  function the class method that will treat the request and complete the response
+       */
+      template <typename Controller>
+      void createRequestHandler(const std::string &name, Controller *pController,
+                                void (Controller::*function)(const Buffer &request, DeferredResponsePtr response));
+
       /**
        *  @brief  Create a new command handler
        *
@@ -146,6 +211,13 @@ namespace dqm4hep {
        */
       bool isCommandHandlerRegistered(const std::string &name) const;
 
+      /**
+       *  @brief  Get the number of commands dropped by the worker pool (see setWorkerThreads())
+       *
+       *  @param  name the command handler name
+       */
+      unsigned long numberOfDroppedCommands(const std::string &name) const;
+
       /**
        *  @brief  Start a target service
        *
@@ -215,6 +287,99 @@ namespace dqm4hep {
        */
       Service *service(const std::string &name) const;
 
+      /**
+       *  @brief  Run the request and command handlers in a pool of worker threads
+       *          instead of the dim thread. Requests and commands are queued and
+       *          shed when the queue is full or when queued requests are waiting
+       *          for too long. Shed requests are answered immediately with an
+       *          empty response, shed commands are dropped with a warning.
+       *          Only requests from clients using the correlated rpc protocol
+       *          (dqm4hep Client) are run in the pool, other requests are handled
+       *          in the dim thread.
+       *
+       *  @param  nThreads the number of worker threads. 0 runs the handlers in the dim thread (default)
+       *  @param  maxQueueSize the maximum number of queued requests and commands
+       *  @param  maxQueueLatency the maximum time (ms) a request can wait in the queue. 0 means no limit
+       */
+      void setWorkerThreads(unsigned int nThreads, unsigned int maxQueueSize = 1000,
+                            unsigned int maxQueueLatency = 5000);
+
+      /**
+       *  @brief  Get the worker thread pool running the handlers.
+       *          nullptr if the handlers run in the dim thread
+       */
+      Executor *executor() const;
+
+      /**
+       *  @brief  Set the maximum memory (bytes) used by the last-value caches
+       *          of all the services of this server. See Service::setCacheEnabled().
+       *          Lowering the limit does not evict already cached payloads,
+       *          it only applies to the next service updates
+       *
+       *  @param  limit the maximum cache size in bytes
+       */
+      void setCacheLimit(size_t limit);
+
+      /**
+       *  @brief  Get the maximum memory (bytes) used by the service caches
+       */
+      size_t cacheLimit() const;
+
+      /**
+       *  @brief  Get the memory (bytes) currently used by the service caches
+       */
+      size_t cacheSize() const;
+
+      /**
+       *  @brief  Set the outbound queue limit of a client connection.
+       *          Updates that a client does not read fast enough are queued
+       *          per connection and sent when the client catches up, so that
+       *          a slow client never slows down the others.
+       *          Only service updates sent to all clients can be dropped,
+       *          responses and selective updates are never dropped.
+       *
+       *  @param  clientId the client id (see clientId())
+       *  @param  maxBytes the maximum number of bytes queued for this client
+       *  @param  policy what to do when the queue is full
+       *  @return false if the client is not connected
+       */
+      bool setClientQueueLimit(int clientId, size_t maxBytes, OverflowPolicy policy);
+
+      /**
+       *  @brief  Get the outbound queue statistics of a client connection
+       *
+       *  @param  clientId the client id (see clientId())
+       *  @param  stats the statistics to receive
+       *  @return false if the client is not connected
+       */
+      bool clientQueueStats(int clientId, ClientQueueStats &stats) const;
+
+      /**
+       *  @brief  Set the default outbound queue limit of all client connections
+       *          without specific limit. Default is 32 MB, dropping the oldest updates.
+       *          Applies process wide
+       *
+       *  @param  maxBytes the maximum number of bytes queued per client
+       *  @param  policy what to do when a queue is full
+       */
+      static void setDefaultClientQueueLimit(size_t maxBytes, OverflowPolicy policy);
+
+      /**
+       *  @brief  Set the number of network I/O threads. Connections are spread
+       *          over them as they are accepted or connected. Applies process wide
+       *          and must be called before the first client or server starts.
+       *          Default is 1, or the DIM_IO_THREADS environment variable
+       *
+       *  @param  nThreads the number of I/O threads
+       *  @return false if the network layer is already running or nThreads is out of range
+       */
+      static bool setIOThreads(unsigned int nThreads);
+
+      /**
+       *  @brief  Get the number of network I/O threads
+       */
+      static unsigned int ioThreads();
+
       /**
        *  @brief  Get the signal processed on client exit
        */
@@ -238,7 +403,9 @@ namespace dqm4hep {
       static int dnsPort();
 
       /**
-       *  @brief  Get the list of running servers
+       *  @brief  Get the list of running servers.
+       *          The queries on running servers and services are answered
+       *          by the process directory cache (see DirectoryCache)
        */
       static std::vector<std::string> runningServers();
 
@@ -256,6 +423,13 @@ namespace dqm4hep {
        */
       static bool serviceAlreadyRunning(const std::string &name);
 
+      /**
+       *  @brief  Get the services of a set already running on the network
+       *
+       *  @param  names the service names
+       */
+      static core::StringVector servicesAlreadyRunning(const core::StringVector &names);
+
       /**
        *  @brief  Whether the request handler is already running on the network
        *
@@ -276,6 +450,9 @@ namespace dqm4hep {
       CommandHandler *commandHandler(const std::string &name) const;
       void clientExitHandler() override;
       void commandHandler() override {};
+      void resetExecutor();
+      bool reserveCache(size_t size, size_t releasedSize);
+      void releaseCache(size_t size);
 
     private:
       typedef std::map<std::string, Service *> ServiceMap;
@@ -289,6 +466,12 @@ namespace dqm4hep {
       CommandHandlerMap             m_commandHandlerMap = {};  ///< The map of registered command handlers
       RequestHandler               *m_serverInfoHandler = {nullptr};  ///< The built-in request handler for server info
       core::Signal<int>             m_clientExitSignal = {};   ///< The signal emitted whenever a client exits
+      std::unique_ptr<Executor>     m_executor = {nullptr};    ///< The worker thread pool running the handlers
+      unsigned int                  m_nWorkerThreads = {0};    ///< The number of worker threads
+      unsigned int                  m_maxQueueSize = {1000};   ///< The maximum number of queued requests
+      unsigned int                  m_maxQueueLatency = {5000}; ///< The maximum request queue latency (ms)
+      std::atomic<size_t>           m_cacheLimit = {64*1024*1024}; ///< The maximum memory used by the service caches
+      std::atomic<size_t>           m_cacheSize = {0};         ///< The memory currently used by the service caches
     };
 
     //-------------------------------------------------------------------------------------------------
@@ -323,6 +506,35 @@ namespace dqm4hep {
 
     //-------------------------------------------------------------------------------------------------
 
+    template <typename Controller>
+    inline void Server::createRequestHandler(const std::string &rname, Controller *pController,
+                                             void (Controller::*function)(const Buffer &request,
+                                                                          DeferredResponsePtr response)) {
+      auto findIter = m_requestHandlerMap.find(rname);
+
+      if (findIter != m_requestHandlerMap.end())
+        throw std::runtime_error("Server::createRequestHandler(): request handler '" + rname +
+                                 "' already exists in this client");
+
+      if (Server::requestHandlerAlreadyRunning(rname))
+        throw std::runtime_error("Server::createRequestHandler(): request handler '" + rname +
+                                 "' already running on network");
+
+      // first insert nullptr, then create request handler
+      auto inserted = m_requestHandlerMap.insert(RequestHandlerMap::value_type(rname, nullptr));
+
+      if (inserted.second) {
+        RequestHandler *pRequestHandler = new RequestHandler(this, rname, pController, function);
+        inserted.first->second = pRequestHandler;
+
+        if (this->isRunning())
+          pRequestHandler->startHandlingRequest();
+      } else
+        throw;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
     template <typename Controller>
     inline void Server::createCommandHandler(const std::string &cname, Controller *pController,
                                              void (Controller::*function)(const Buffer &command)) {
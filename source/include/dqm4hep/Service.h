@@ -29,6 +29,7 @@
 #define SERVICE_H
 
 // -- std headers
+#include <memory>
 #include <string>
 #include <typeinfo>
 
@@ -110,6 +111,70 @@ namespace dqm4hep {
        */
       void sendBuffer(const void *ptr, size_t size, const std::vector<int> &clientIds);
 
+      /**
+       * Acquire a buffer of size bytes from the service pool, to fill in place and
+       * publish with commit() without any copy. The buffer goes back to the pool
+       * once written to all the clients: a slow client holds it while it is queued
+       * for it. Blocks while all the buffers of the pool are in use
+       *
+       * @param size the size of the payload to publish
+       * @return the buffer to fill, valid until commit()
+       */
+      void *acquire(size_t size);
+
+      /**
+       * Same as acquire() but returns nullptr instead of blocking if all the
+       * buffers of the pool are in use
+       */
+      void *tryAcquire(size_t size);
+
+      /**
+       * Publish the acquired buffer to all the clients
+       */
+      void commit();
+
+      /**
+       * Publish the acquired buffer to a specific client
+       */
+      void commit(int clientId);
+
+      /**
+       * Publish the acquired buffer to a specific list of clients
+       */
+      void commit(const std::vector<int> &clientIds);
+
+      /**
+       * Set the maximum number of buffers in the service pool (default 4, at least 1)
+       */
+      void setPoolSize(size_t nBuffers);
+
+      /**
+       * Get the maximum number of buffers in the service pool
+       */
+      size_t poolSize() const;
+
+      /**
+       * Enable or disable the last-value cache. When enabled, the last published
+       * payload is kept and served to new subscribers and one-shot reads instead
+       * of an empty buffer. Values sent with send() are kept without copy, the
+       * caller memory of sendArray(), sendBuffer() and commit() is copied.
+       * The memory used by all the service caches
+       * of a server is bounded by Server::setCacheLimit(). A payload that does not
+       * fit in the server cache is published but not cached.
+       * Disabling the cache releases the cached payload
+       */
+      void setCacheEnabled(bool enable);
+
+      /**
+       * Whether the last-value cache is enabled
+       */
+      bool isCacheEnabled() const;
+
+      /**
+       * Get the size of the cached payload. 0 if nothing is cached
+       */
+      size_t cacheSize() const;
+
     private:
       /**
        * Constructor with service name
@@ -142,14 +207,57 @@ namespace dqm4hep {
       bool isServiceConnected() const;
 
       /**
-       *
+       * Send the buffer to all the clients, or to a list of clients
        */
       void sendData(const Buffer &buffer, const std::vector<int> &clientIds);
 
+      /**
+       * Send the buffer to all the clients (no client ids), or to a list of clients.
+       * The list may be terminated by a 0 id
+       */
+      void sendData(const Buffer &buffer, const int *clientIds, size_t nClientIds);
+
+      /**
+       * Release the cached payload and give back its memory to the server cache
+       */
+      void releaseCache();
+
+      /**
+       * Get a buffer of the pool, waiting for one if wait is set
+       */
+      void *acquireBuffer(size_t size, bool wait);
+
+      /**
+       * Publish the acquired buffer to all the clients (no client ids), or to a list of clients
+       */
+      void commitBuffer(const int *clientIds, size_t nClientIds);
+
+      /**
+       * Give back a buffer to its pool, called by dim when no client write uses it anymore
+       */
+      static void releaseBuffer(void *pBuffer);
+
     private:
+      typedef std::shared_ptr<const Buffer> CachePtr;
+      struct PooledBuffer;
+      struct BufferPool;
+      typedef std::shared_ptr<BufferPool> BufferPoolPtr;
+
+      /**
+       * Replace the cached payload by the buffer contents, or drop it if it does not fit in
+       * the server cache. The contents are shared when the buffer owns them (see Buffer::retain()),
+       * views on caller memory are copied. Must be called with the dim lock held. The previous
+       * payload is returned, to be released after the lock
+       */
+      CachePtr replaceCache(const Buffer &buffer);
+
       DimService         *m_pService = {nullptr};      ///< The service implementation
       std::string         m_name = {""};               ///< The service name
       Server             *m_pServer = {nullptr};       ///< The server in which the service is declared
+      bool                m_cacheEnabled = {false};    ///< Whether the last-value cache is enabled
+      CachePtr            m_cache = {nullptr};         ///< The last published payload, if cached
+      BufferPoolPtr       m_pool = {nullptr};          ///< The pool of the buffers to acquire
+      PooledBuffer       *m_pAcquired = {nullptr};     ///< The buffer acquired, not committed yet
     };
 
     //-------------------------------------------------------------------------------------------------
@@ -157,11 +265,8 @@ namespace dqm4hep {
 
     template <typename T>
     inline void Service::send(const T &value) {
-      Buffer buffer;
-      auto model = buffer.createModel<T>();
-      model->copy(value);
-      buffer.setModel(model);
-      this->sendData(buffer, std::vector<int>());
+      Buffer buffer(value);
+      this->sendData(buffer, nullptr, 0);
     }
 
     //-------------------------------------------------------------------------------------------------
@@ -169,7 +274,7 @@ namespace dqm4hep {
     template <typename T>
     inline void Service::sendArray(const T *value, size_t nElements) {
       Buffer buffer(value, nElements);
-      this->sendData(buffer, std::vector<int>());
+      this->sendData(buffer, nullptr, 0);
     }
 
     //-------------------------------------------------------------------------------------------------
@@ -177,7 +282,7 @@ namespace dqm4hep {
     template <typename T>
     inline void Service::send(const T &value, int clientId) {
       Buffer buffer(value);
-      this->sendData(buffer, std::vector<int>(1, clientId));
+      this->sendData(buffer, &clientId, 1);
     }
 
     //-------------------------------------------------------------------------------------------------
@@ -185,7 +290,7 @@ namespace dqm4hep {
     template <typename T>
     inline void Service::sendArray(const T *value, size_t nElements, int clientId) {
       Buffer buffer(value, nElements);
-      this->sendData(buffer, std::vector<int>(1, clientId));
+      this->sendData(buffer, &clientId, 1);
     }
 
     //-------------------------------------------------------------------------------------------------
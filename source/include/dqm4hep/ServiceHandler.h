@@ -98,6 +98,7 @@ namespace dqm4hep {
         /** Contructor
          */
         ServiceInfo(ServiceHandler *pHandler);
+        ~ServiceInfo();
         ServiceInfo() = delete;
         ServiceInfo(const ServiceInfo&) = delete;
         ServiceInfo& operator=(const ServiceInfo&) = delete;
@@ -119,8 +120,8 @@ namespace dqm4hep {
     private:
       std::string          m_name = {""};           ///< The request handler name
       Client              *m_pClient = {nullptr};   ///< The client manager
+      UpdateSignal         m_updateSignal = {};     ///< Outlives the subscription, updates until its release use it
       ServiceInfo          m_serviceInfo;
-      UpdateSignal         m_updateSignal = {};
     };
 
     //-------------------------------------------------------------------------------------------------
@@ -0,0 +1,259 @@
+/// \file test-buffer.cc
+/*
+ *
+ * test-buffer.cc source template automatically generated by a class generator
+ * Creation date : sam. oct. 17 2026
+ *
+ * This file is part of DQM4HEP libraries.
+ *
+ * DQM4HEP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * DQM4HEP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DQM4HEP.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @author Remi Ete
+ * @copyright CNRS , IPNL
+ */
+
+// Microbenchmark of the buffer handling on the send and receive paths.
+// Counts the heap allocations (operator new) and the time per operation:
+// buffer adoption, and broadcast and selective sends of small values
+// received by a subscriber in the same process (needs a dns). The receive
+// side runs in the dim threads, its allocations are counted too. The small
+// values must not allocate, the exit code is 1 if they do.
+// Large payloads are published from a user buffer and from acquired buffers,
+// and received updates are retained past the callback by another thread.
+//
+// Usage: test-buffer [iterations]
+
+#include "dqm4hep/Client.h"
+#include "dqm4hep/Server.h"
+#include "dqm4hep/Service.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <thread>
+
+using namespace dqm4hep::net;
+
+static std::atomic<unsigned long> nAllocations(0);
+
+void *operator new(size_t size) {
+  nAllocations++;
+  void *ptr = malloc(size ? size : 1);
+
+  if (nullptr == ptr)
+    throw std::bad_alloc();
+
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+  free(ptr);
+}
+
+class Receiver {
+public:
+  void receive(const Buffer &buffer) {
+    m_sum += buffer.size();
+
+    if (m_retain) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_retained.emplace_back(new Buffer(buffer.retain()));
+    }
+
+    m_nUpdates++;
+  }
+
+  std::unique_ptr<Buffer> popRetained() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_retained.empty())
+      return nullptr;
+
+    std::unique_ptr<Buffer> buffer = std::move(m_retained.front());
+    m_retained.pop_front();
+    return buffer;
+  }
+
+  std::atomic<unsigned long> m_nUpdates = {0};
+  unsigned long m_sum = {0};
+  std::atomic<bool> m_retain = {false};
+  std::mutex m_mutex = {};
+  std::deque<std::unique_ptr<Buffer>> m_retained = {};
+};
+
+// the subscriber's client id, as seen by the server in a command it sends
+class ClientIdHandler {
+public:
+  ClientIdHandler(Server *pServer) : m_pServer(pServer) {}
+
+  void receive(const Buffer &) {
+    m_clientId = m_pServer->clientId();
+  }
+
+  Server *m_pServer = {nullptr};
+  std::atomic<int> m_clientId = {0};
+};
+
+template <typename Operation>
+double measure(const std::string &what, unsigned int nIterations, Operation operation) {
+  const unsigned long allocations = nAllocations;
+  const auto start = std::chrono::steady_clock::now();
+
+  for (unsigned int i = 0; i < nIterations; i++)
+    operation(i);
+
+  const auto stop = std::chrono::steady_clock::now();
+  const double ns = std::chrono::duration<double, std::nano>(stop - start).count();
+  const double allocationsPerOp = double(nAllocations - allocations) / nIterations;
+  std::cout << what << "\t" << allocationsPerOp << " allocations/op\t" << ns / nIterations << " ns/op" << std::endl;
+  return allocationsPerOp;
+}
+
+// the sender waits for the receiver every 1000 updates, not to overflow the
+// connection write queue
+template <typename Send>
+double measureReceived(const std::string &what, unsigned int nIterations, const Receiver &receiver, Send send) {
+  const unsigned long nReceived = receiver.m_nUpdates;
+
+  return measure(what, nIterations, [&](unsigned int i) {
+    send(i);
+
+    if (999 == i % 1000 || nIterations - 1 == i) {
+      while (receiver.m_nUpdates < nReceived + i + 1)
+        std::this_thread::yield();
+    }
+  });
+}
+
+int main(int argc, char **argv) {
+  unsigned int nIterations = 100000;
+
+  if (argc > 1)
+    nIterations = atoi(argv[1]);
+
+  const std::string smallString(32, 'x');
+  const int value = 42;
+  size_t sink = 0;
+  double smallAllocations = 0;
+
+  smallAllocations += measure("adopt", nIterations, [&](unsigned int) {
+    Buffer buffer;
+    buffer.adopt((const char *)&value, sizeof(value));
+    sink += buffer.size();
+  });
+
+  Server server("BufferBench");
+  Service *pService = server.createService("BufferBench/Value");
+  ClientIdHandler clientIdHandler(&server);
+  server.createCommandHandler("BufferBench/ClientId", &clientIdHandler, &ClientIdHandler::receive);
+  server.start();
+
+  // updates received in this process
+  Receiver receiver;
+  Client client;
+  client.subscribe("BufferBench/Value", &receiver, &Receiver::receive);
+
+  // only the updates following the subscription are received
+  while (receiver.m_nUpdates == 0) {
+    pService->send(value);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+
+  // the command comes on the connection of the subscription
+  client.sendCommand("BufferBench/ClientId", value);
+
+  while (clientIdHandler.m_clientId == 0)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  const int clientId = clientIdHandler.m_clientId;
+
+  smallAllocations += measureReceived("send + receive int", nIterations, receiver,
+                                      [&](unsigned int i) { pService->send(int(i)); });
+  smallAllocations += measureReceived("send + receive string", nIterations, receiver,
+                                      [&](unsigned int) { pService->send(smallString); });
+  smallAllocations += measureReceived("send + receive int to client", nIterations, receiver,
+                                      [&](unsigned int i) { pService->send(int(i), clientId); });
+
+  // large payloads, filled before each update and received one by one
+  const size_t largeSize = 4 * 1024 * 1024;
+  const unsigned int nLarge = std::max(10u, nIterations / 1000);
+  std::vector<char> large(largeSize);
+
+  measure("send + receive 4 MB", nLarge, [&](unsigned int i) {
+    const unsigned long nUpdates = receiver.m_nUpdates;
+    memset(large.data(), i, largeSize);
+    pService->sendBuffer(large.data(), largeSize);
+
+    while (receiver.m_nUpdates == nUpdates)
+      std::this_thread::yield();
+  });
+
+  measure("acquire/commit + receive 4 MB", nLarge, [&](unsigned int i) {
+    const unsigned long nUpdates = receiver.m_nUpdates;
+    memset(pService->acquire(largeSize), i, largeSize);
+    pService->commit();
+
+    while (receiver.m_nUpdates == nUpdates)
+      std::this_thread::yield();
+  });
+
+  // the received updates are kept by this thread, a few at a time, and
+  // checked once the following updates have been received
+  std::deque<std::pair<unsigned int, std::unique_ptr<Buffer>>> retained;
+  unsigned int nCorrupted = 0;
+  receiver.m_retain = true;
+
+  measure("acquire/commit + retain 4 MB", nLarge, [&](unsigned int i) {
+    const unsigned long nUpdates = receiver.m_nUpdates;
+    memset(pService->acquire(largeSize), i, largeSize);
+    pService->commit();
+
+    while (receiver.m_nUpdates == nUpdates)
+      std::this_thread::yield();
+
+    retained.emplace_back(i, receiver.popRetained());
+
+    if (retained.size() > 4) {
+      const Buffer *pBuffer = retained.front().second.get();
+      const char expected = (char)retained.front().first;
+
+      if (nullptr == pBuffer || pBuffer->size() != largeSize ||
+          std::any_of(pBuffer->begin(), pBuffer->end(), [expected](char c) { return c != expected; }))
+        nCorrupted++;
+
+      retained.pop_front();
+    }
+  });
+
+  receiver.m_retain = false;
+
+  if (0 != nCorrupted)
+    std::cout << "corrupted retained updates: " << nCorrupted << std::endl;
+
+  if (0 != smallAllocations)
+    std::cout << "heap allocations on the small value paths" << std::endl;
+
+  return (0 == sink || 0 != nCorrupted || 0 != smallAllocations) ? 1 : 0;
+}
@@ -0,0 +1,185 @@
+/// \file test-publish.cc
+/*
+ *
+ * test-publish.cc source template automatically generated by a class generator
+ * Creation date : sam. oct. 17 2026
+ *
+ * This file is part of DQM4HEP libraries.
+ *
+ * DQM4HEP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * DQM4HEP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DQM4HEP.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @author Remi Ete
+ * @copyright CNRS , IPNL
+ */
+
+// Benchmark of concurrent publishing with Service::send(). Each thread
+// sends to its own service as fast as it can, the services have subscribers
+// in the same process (needs a dns). The sends and the received updates per
+// second are printed for 1, 2, 4... threads. A first step runs a publisher
+// while another thread holds the dim lock: the sends do not wait for it, the
+// received updates do.
+//
+// Usage: test-publish [max threads] [seconds per step] [subscribers per service]
+
+#include "dqm4hep/Client.h"
+#include "dqm4hep/Server.h"
+#include "dqm4hep/Service.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+
+using namespace dqm4hep::net;
+
+class Receiver {
+public:
+  void receive(const Buffer &) {
+    m_nUpdates++;
+  }
+
+  std::atomic<unsigned long> m_nUpdates = {0};
+};
+
+struct Step {
+  double m_sends = {0};      ///< The sends per second
+  double m_received = {0};   ///< The received updates per second
+};
+
+unsigned long nReceived(const std::vector<std::unique_ptr<Receiver>> &receivers) {
+  unsigned long n = 0;
+
+  for (auto &receiver : receivers)
+    n += receiver->m_nUpdates;
+
+  return n;
+}
+
+// let the subscribers read the updates still queued for them. A step starting
+// on full write queues would find no update of its services to drop there
+void drain(const std::vector<std::unique_ptr<Receiver>> &receivers) {
+  unsigned long n = nReceived(receivers), last = 0;
+
+  do {
+    last = n;
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    n = nReceived(receivers);
+  } while (n != last);
+}
+
+Step runStep(const std::vector<Service *> &services, unsigned int nThreads, unsigned int seconds,
+             const std::vector<std::unique_ptr<Receiver>> &receivers, bool holdDimLock) {
+  std::atomic<bool> stop(false);
+  std::vector<unsigned long> nSends(nThreads, 0);
+  std::vector<std::thread> threads;
+
+  drain(receivers);
+  const unsigned long nStartReceived = nReceived(receivers);
+  const auto start = std::chrono::steady_clock::now();
+
+  for (unsigned int t = 0; t < nThreads; t++) {
+    threads.emplace_back([&, t]() {
+      Service *pService = services[t];
+
+      for (int i = 0; !stop; i++) {
+        pService->send(i);
+        nSends[t]++;
+      }
+    });
+  }
+
+  if (holdDimLock)
+    dim_lock();
+
+  std::this_thread::sleep_for(std::chrono::seconds(seconds));
+
+  if (holdDimLock)
+    dim_unlock();
+
+  stop = true;
+
+  for (auto &thread : threads)
+    thread.join();
+
+  const auto end = std::chrono::steady_clock::now();
+  const double elapsed = std::chrono::duration<double>(end - start).count();
+  Step step;
+
+  for (auto n : nSends)
+    step.m_sends += n;
+
+  step.m_sends /= elapsed;
+  step.m_received = (nReceived(receivers) - nStartReceived) / elapsed;
+
+  return step;
+}
+
+int main(int argc, char **argv) {
+  unsigned int maxThreads = 8, seconds = 2, nSubscribers = 4;
+
+  if (argc > 1)
+    maxThreads = std::max(1, atoi(argv[1]));
+
+  if (argc > 2)
+    seconds = std::max(1, atoi(argv[2]));
+
+  if (argc > 3)
+    nSubscribers = std::max(0, atoi(argv[3]));
+
+  Server server("PublishBench");
+  std::vector<Service *> services;
+
+  for (unsigned int t = 0; t < maxThreads; t++)
+    services.push_back(server.createService("PublishBench/Service_" + std::to_string(t)));
+
+  server.start();
+
+  // the clients of a process share its connection to the server, each
+  // subscriber adds an update per send. The clients go first, their
+  // callbacks use the receivers
+  std::vector<std::unique_ptr<Receiver>> receivers;
+  std::vector<std::unique_ptr<Client>> clients;
+
+  for (unsigned int s = 0; s < nSubscribers; s++) {
+    clients.emplace_back(new Client());
+
+    for (auto pService : services) {
+      receivers.emplace_back(new Receiver());
+      clients.back()->subscribe(pService->name(), receivers.back().get(), &Receiver::receive);
+    }
+  }
+
+  // only the updates following the subscriptions are received
+  for (unsigned int r = 0; r < receivers.size(); r++) {
+    while (receivers[r]->m_nUpdates == 0) {
+      services[r % maxThreads]->send(0);
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+
+  std::cout << "threads\tsends/s\treceived/s" << std::endl;
+
+  const Step lockedStep = runStep(services, 1, seconds, receivers, true);
+  std::cout << "1, dim lock held\t" << lockedStep.m_sends << "\t" << lockedStep.m_received << std::endl;
+
+  for (unsigned int nThreads = 1; nThreads <= maxThreads; nThreads *= 2) {
+    const Step step = runStep(services, nThreads, seconds, receivers, false);
+    std::cout << nThreads << "\t" << step.m_sends << "\t" << step.m_received << std::endl;
+  }
+
+  return (0 == lockedStep.m_sends) ? 1 : 0;
+}
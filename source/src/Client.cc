@@ -28,6 +28,7 @@
 // -- dqm4hep headers
 #include "dqm4hep/Client.h"
 #include "dqm4hep/RequestHandler.h"
+#include "dqm4hep/RpcHeader.h"
 
 namespace dqm4hep {
 
@@ -71,5 +72,419 @@ namespace dqm4hep {
     void Client::notifyServerOnExit(const std::string &serverName) {
       DimClient::setExitHandler(serverName.c_str());
     }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void Client::setMaxRpcChannels(unsigned int maxChannels) {
+      std::vector<RpcChannelPtr> evictedChannels;
+      {
+        std::lock_guard<std::mutex> lock(m_rpcChannelMutex);
+        m_maxRpcChannels = maxChannels;
+
+        this->evictRpcChannels(m_maxRpcChannels, evictedChannels);
+      }
+      // evicted channels are closed here, outside of the pool lock
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    unsigned int Client::maxRpcChannels() const {
+      std::lock_guard<std::mutex> lock(m_rpcChannelMutex);
+      return m_maxRpcChannels;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    unsigned int Client::numberOfRpcChannels() const {
+      std::lock_guard<std::mutex> lock(m_rpcChannelMutex);
+      return m_rpcChannelMap.size();
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    unsigned long Client::rpcChannelHits() const {
+      std::lock_guard<std::mutex> lock(m_rpcChannelMutex);
+      return m_rpcChannelHits;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    unsigned long Client::rpcChannelMisses() const {
+      std::lock_guard<std::mutex> lock(m_rpcChannelMutex);
+      return m_rpcChannelMisses;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void Client::clearRpcChannels() {
+      RpcChannelMap channels;
+      {
+        std::lock_guard<std::mutex> lock(m_rpcChannelMutex);
+        channels.swap(m_rpcChannelMap);
+        m_rpcChannelLru.clear();
+      }
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    bool Client::setIOThreads(unsigned int nThreads) {
+      return dim_set_io_threads(static_cast<int>(nThreads)) != 0;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    unsigned int Client::ioThreads() {
+      return static_cast<unsigned int>(dim_get_io_threads());
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    Client::RpcChannelPtr Client::acquireRpcChannel(const std::string &name) const {
+      RpcChannelPtr staleChannel;
+      std::vector<RpcChannelPtr> releasedChannels;
+      {
+        std::lock_guard<std::mutex> lock(m_rpcChannelMutex);
+        this->releaseUnpooledRpcChannels(releasedChannels);
+        auto findIter = m_rpcChannelMap.find(name);
+
+        if (findIter != m_rpcChannelMap.end()) {
+          if (findIter->second.first->isValid()) {
+            m_rpcChannelLru.splice(m_rpcChannelLru.begin(), m_rpcChannelLru, findIter->second.second);
+            ++m_rpcChannelHits;
+            return findIter->second.first;
+          }
+
+          // the server has exited since the last use: re-open the channel
+          staleChannel = findIter->second.first;
+          m_rpcChannelLru.erase(findIter->second.second);
+          m_rpcChannelMap.erase(findIter);
+        }
+
+        ++m_rpcChannelMisses;
+      }
+
+      // open the channel outside of the pool lock, as it requires the dim lock
+      auto channel = std::make_shared<RpcChannel>(name);
+      std::vector<RpcChannelPtr> evictedChannels;
+      {
+        std::lock_guard<std::mutex> lock(m_rpcChannelMutex);
+        auto findIter = m_rpcChannelMap.find(name);
+
+        // another thread opened the same channel in the meantime.
+        // The new one is closed on return, nothing was sent on it yet
+        if (m_rpcChannelMap.end() != findIter) {
+          m_rpcChannelLru.splice(m_rpcChannelLru.begin(), m_rpcChannelLru, findIter->second.second);
+          return findIter->second.first;
+        }
+
+        // not pooled: kept alive until its requests are done
+        if (0 == m_maxRpcChannels) {
+          m_unpooledRpcChannels.push_back(channel);
+          return channel;
+        }
+
+        this->evictRpcChannels(m_maxRpcChannels - 1, evictedChannels);
+
+        m_rpcChannelLru.push_front(name);
+        m_rpcChannelMap.insert(RpcChannelMap::value_type(name, std::make_pair(channel, m_rpcChannelLru.begin())));
+      }
+
+      return channel;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void Client::evictRpcChannels(size_t maxChannels, std::vector<RpcChannelPtr> &evictedChannels) const {
+      auto lruIter = m_rpcChannelLru.end();
+
+      while (m_rpcChannelMap.size() > maxChannels && m_rpcChannelLru.begin() != lruIter) {
+        --lruIter;
+        auto findIter = m_rpcChannelMap.find(*lruIter);
+
+        // channels in use or with requests in flight are kept alive.
+        // Users copy the channel from the pool under the pool lock
+        if (findIter->second.first.use_count() > 1 || findIter->second.first->hasPendingRequests())
+          continue;
+
+        evictedChannels.push_back(findIter->second.first);
+        m_rpcChannelMap.erase(findIter);
+        lruIter = m_rpcChannelLru.erase(lruIter);
+      }
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void Client::releaseUnpooledRpcChannels(std::vector<RpcChannelPtr> &releasedChannels) const {
+      for (auto iter = m_unpooledRpcChannels.begin(); m_unpooledRpcChannels.end() != iter;) {
+        if (iter->use_count() > 1 || (*iter)->hasPendingRequests()) {
+          ++iter;
+          continue;
+        }
+
+        releasedChannels.push_back(*iter);
+        iter = m_unpooledRpcChannels.erase(iter);
+      }
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    uint32_t Client::sendRequestAsync(const std::string &name, const Buffer &request,
+                                      std::function<void(const Buffer &)> operation) const {
+      auto channel = this->acquireRpcChannel(name);
+      return channel->send(request.begin(), request.size(), operation);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    std::future<Buffer> Client::sendRequestAsync(const std::string &name, const Buffer &request) const {
+      auto promise = std::make_shared<std::promise<Buffer>>();
+
+      this->sendRequestAsync(name, request, [promise](const Buffer &response) {
+        // the response is only valid during the callback
+        promise->set_value(response.retain());
+      });
+
+      return promise->get_future();
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    /**
+     *  @brief  Completion routine of asynchronous commands, called by dim
+     */
+    static void commandCompletion(void *tag, int *result) {
+      auto pOperation = *(std::function<void(bool)> **)tag;
+      (*pOperation)(0 != *result);
+      delete pOperation;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    template <>
+    void Client::sendCommandAsync(const std::string &name, const Buffer &buffer,
+                                  std::function<void(bool)> operation) const {
+      // dic_cmnd_callback() always calls back, on success or failure.
+      // The operation is released there
+      auto pOperation = new std::function<void(bool)>(operation ? operation : [](bool) {});
+      dic_cmnd_callback(const_cast<char *>(name.c_str()), (void *)buffer.begin(), buffer.size(),
+                        commandCompletion, (dim_long)pOperation);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+    //-------------------------------------------------------------------------------------------------
+
+    Client::RpcChannel::RpcChannel(const std::string &name)
+        : m_name(name), m_inputName(RpcHeader::pipelinedName(name) + "/RpcIn"), m_plainInputName(name + "/RpcIn") {
+      m_rpcInfo.reset(new RpcInfo(this, RpcHeader::pipelinedName(m_name), true));
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    Client::RpcChannel::~RpcChannel() {
+      // no more callback after this point
+      m_rpcInfo.reset();
+      m_plainRpcInfo.reset();
+
+      PendingRequestMap pendingRequests;
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        pendingRequests.swap(m_pendingRequests);
+      }
+
+      Buffer emptyResponse;
+
+      for (auto iter = pendingRequests.begin(), endIter = pendingRequests.end(); endIter != iter; ++iter)
+        iter->second(emptyResponse);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    uint32_t Client::RpcChannel::send(const char *data, size_t size, ResponseFunction function) {
+      const uint32_t correlationId = function ? RpcHeader::nextCorrelationId() : 0;
+      std::vector<char> request(RpcHeader::size + size);
+      RpcHeader::write(request.data(), correlationId);
+
+      if (0 != size)
+        memcpy(request.data() + RpcHeader::size, data, size);
+
+      bool linkLost = false;
+      bool sendNow = false;
+      bool pipelined = true;
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        linkLost = m_linkLost;
+        pipelined = m_pipelined;
+
+        if (!linkLost) {
+          if (function)
+            m_pendingRequests[correlationId] = function;
+
+          // the output subscription is not yet established: the response could
+          // be missed. Send on first update. The plain rpc answers one request at a time
+          sendNow = m_connected && (m_pipelined || !m_plainRequestSent);
+
+          if (!sendNow)
+            m_queuedRequests.push_back(std::move(request));
+          else if (!m_pipelined) {
+            m_plainRequestSent = true;
+            m_plainCorrelationId = correlationId;
+          }
+        }
+      }
+
+      if (linkLost) {
+        if (function) {
+          Buffer emptyResponse;
+          function(emptyResponse);
+        }
+      } else if (sendNow) {
+        this->sendFramed(request, pipelined);
+      }
+
+      return correlationId;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    bool Client::RpcChannel::isValid() const {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return !m_linkLost;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    bool Client::RpcChannel::hasPendingRequests() const {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return (!m_pendingRequests.empty() || !m_queuedRequests.empty());
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void Client::RpcChannel::receive(const char *data, size_t size, bool linked, bool pipelined) {
+      std::deque<std::vector<char>> queuedRequests;
+      PendingRequestMap completedRequests;
+      bool fallback = false;
+      bool response = false;
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // the pipelined subscription is left over after a fallback to the plain rpc
+        if (m_linkLost || pipelined != m_pipelined)
+          return;
+
+        if (!linked && m_pipelined && !m_connected) {
+          // the server may predate the pipelined rpc: try the plain one
+          m_pipelined = false;
+          fallback = true;
+        } else if (!linked) {
+          // server not running or exited: fail all the pending requests
+          m_linkLost = true;
+          m_connected = false;
+          completedRequests.swap(m_pendingRequests);
+          m_queuedRequests.clear();
+        } else if (m_pipelined) {
+          if (!m_connected) {
+            m_connected = true;
+            queuedRequests.swap(m_queuedRequests);
+          }
+
+          uint32_t correlationId = 0;
+
+          // updates with unknown ids (stale output, other clients
+          // of this process) are ignored
+          if (RpcHeader::read(data, size, correlationId) && 0 != correlationId) {
+            auto findIter = m_pendingRequests.find(correlationId);
+
+            if (m_pendingRequests.end() != findIter) {
+              completedRequests.insert(*findIter);
+              m_pendingRequests.erase(findIter);
+            }
+          }
+
+          response = (size > RpcHeader::size);
+        } else {
+          // the plain rpc answers the request sent last. The first update
+          // only tells that the subscription is established
+          if (!m_connected) {
+            m_connected = true;
+          } else if (m_plainRequestSent) {
+            auto findIter = m_pendingRequests.find(m_plainCorrelationId);
+
+            if (m_pendingRequests.end() != findIter) {
+              completedRequests.insert(*findIter);
+              m_pendingRequests.erase(findIter);
+            }
+
+            m_plainRequestSent = false;
+            response = (0 != size);
+          }
+
+          if (!m_plainRequestSent && !m_queuedRequests.empty()) {
+            queuedRequests.push_back(std::move(m_queuedRequests.front()));
+            m_queuedRequests.pop_front();
+            m_plainRequestSent = true;
+            RpcHeader::read(queuedRequests.front().data(), RpcHeader::size, m_plainCorrelationId);
+          }
+        }
+      }
+
+      // subscribe outside of the channel lock, the first update may come immediately
+      if (fallback) {
+        m_plainRpcInfo.reset(new RpcInfo(this, m_name, false));
+        return;
+      }
+
+      for (auto iter = queuedRequests.begin(), endIter = queuedRequests.end(); endIter != iter; ++iter)
+        this->sendFramed(*iter, pipelined);
+
+      Buffer responseBuffer;
+
+      if (response && pipelined)
+        responseBuffer.adopt(data + RpcHeader::size, size - RpcHeader::size);
+      else if (response)
+        responseBuffer.adopt(data, size);
+
+      for (auto iter = completedRequests.begin(), endIter = completedRequests.end(); endIter != iter; ++iter)
+        iter->second(responseBuffer);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void Client::RpcChannel::sendFramed(std::vector<char> &request, bool pipelined) {
+      if (pipelined)
+        DimClient::sendCommandNB(m_inputName.c_str(), (void *)request.data(), request.size());
+      else
+        DimClient::sendCommandNB(m_plainInputName.c_str(), (void *)(request.data() + RpcHeader::size),
+                                 request.size() - RpcHeader::size);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+    //-------------------------------------------------------------------------------------------------
+
+    Client::RpcChannel::RpcInfo::RpcInfo(RpcChannel *pChannel, const std::string &name, bool pipelined)
+        : DimInfo(), m_pChannel(pChannel), m_pipelined(pipelined) {
+      // subscribe only once the channel is set, as the first update may come immediately
+      std::string outputName = name + "/RpcOut";
+      this->subscribe(const_cast<char *>(outputName.c_str()), 0, (void *)nullptr, 0, nullptr);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    Client::RpcChannel::RpcInfo::~RpcInfo() {
+      // release before ~DimInfo(): an update coming in between would go to
+      // DimInfo::infoHandler(), which copies the data that ~DimInfo() then frees
+      if (0 != this->itsId) {
+        dic_release_service(this->itsId);
+        this->itsId = 0;
+      }
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void Client::RpcChannel::RpcInfo::infoHandler() {
+      // quality is -1 when dim delivers the no-link buffer
+      const bool linked = (-1 != dic_get_quality(0));
+      m_pChannel->receive((const char *)this->getData(), this->getSize(), linked, m_pipelined);
+    }
   }
 }
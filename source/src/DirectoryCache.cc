@@ -0,0 +1,862 @@
+/// \file DirectoryCache.cc
+/*
+ *
+ * DirectoryCache.cc source template automatically generated by a class generator
+ * Creation date : sam. oct. 17 2026
+ *
+ * This file is part of DQM4HEP libraries.
+ *
+ * DQM4HEP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * DQM4HEP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DQM4HEP.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @author Remi Ete
+ * @copyright CNRS , IPNL
+ */
+
+// -- dqm4hep headers
+#include <dqm4hep/DirectoryCache.h>
+#include <dqm4hep/Logging.h>
+
+// -- std headers
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+
+namespace dqm4hep {
+
+  namespace net {
+
+    /**
+     *  @brief  The entry carried by the server changes
+     */
+    static DirectoryEntry serverEntry(const std::string &serverName) {
+      DirectoryEntry entry;
+      entry.server = serverName;
+      return entry;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    DirectoryCache &DirectoryCache::instance() {
+      // never deleted: the subscriptions must not be released after dim has exited
+      static DirectoryCache *pInstance = new DirectoryCache();
+      return *pInstance;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    DirectoryCache::DirectoryCache() {
+      // the subscriptions are created and stored under the dim lock,
+      // no callback can come before the cache has the subscription.
+      // The dim threads are started before, they take the lock on startup
+      dim_init();
+      dim_lock();
+      m_pChangesInfo = new ChangesInfo(this, ++m_changesGeneration);
+      dim_unlock();
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    bool DirectoryCache::waitReady(unsigned int timeout) const {
+      std::unique_lock<std::mutex> lock(m_mutex);
+
+      if (!m_ready && !DimClient::inCallback())
+        m_readyCondition.wait_for(lock, std::chrono::milliseconds(timeout), [this] { return m_ready; });
+
+      if (!m_ready)
+        dqm_warning("DirectoryCache::waitReady: the dns directory is not complete yet !");
+
+      return m_ready;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    bool DirectoryCache::isReady() const {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return m_ready;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    core::StringVector DirectoryCache::servers() const {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      core::StringVector serverNames;
+      serverNames.reserve(m_servers.size());
+
+      for (auto &server : m_servers)
+        serverNames.push_back(server.first);
+
+      return serverNames;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    bool DirectoryCache::hasServer(const std::string &serverName) const {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return (m_servers.find(serverName) != m_servers.end());
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    std::string DirectoryCache::serverNode(const std::string &serverName) const {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      auto findIter = m_servers.find(serverName);
+      return (findIter == m_servers.end() ? "" : findIter->second.node);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    std::vector<DirectoryEntry> DirectoryCache::serverServices(const std::string &serverName) const {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      std::vector<DirectoryEntry> entries;
+      auto findIter = m_servers.find(serverName);
+
+      if (findIter == m_servers.end())
+        return entries;
+
+      entries.reserve(findIter->second.services.size());
+
+      for (auto &service : findIter->second.services)
+        entries.push_back(service.second);
+
+      return entries;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    bool DirectoryCache::hasService(const std::string &sname, int type) const {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      auto range = m_serviceIndex.equal_range(sname);
+
+      for (auto iter = range.first; iter != range.second; ++iter) {
+        if (iter->second->type == type)
+          return true;
+      }
+
+      return false;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    bool DirectoryCache::findService(const std::string &sname, DirectoryEntry &entry) const {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      auto findIter = m_serviceIndex.find(sname);
+
+      if (findIter == m_serviceIndex.end())
+        return false;
+
+      entry = *findIter->second;
+      return true;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    core::StringVector DirectoryCache::existingServices(const core::StringVector &names, int type) const {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      core::StringVector existingNames;
+
+      for (auto &sname : names) {
+        auto range = m_serviceIndex.equal_range(sname);
+
+        for (auto iter = range.first; iter != range.second; ++iter) {
+          if (iter->second->type == type) {
+            existingNames.push_back(sname);
+            break;
+          }
+        }
+      }
+
+      return existingNames;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    DirectoryCache::ServerSignal &DirectoryCache::onServerAdded() {
+      return m_serverAddedSignal;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    DirectoryCache::ServerSignal &DirectoryCache::onServerRemoved() {
+      return m_serverRemovedSignal;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    DirectoryCache::ServiceSignal &DirectoryCache::onServiceAdded() {
+      return m_serviceAddedSignal;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    DirectoryCache::ServiceSignal &DirectoryCache::onServiceRemoved() {
+      return m_serviceRemovedSignal;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void DirectoryCache::receiveChanges(unsigned int generation, const char *data, int size) {
+      ChangeList changes;
+      std::vector<ServiceListInfo *> released;
+      std::vector<ChangesInfo *> releasedChanges;
+      ServerListInfo *pServerListInfo = nullptr;
+      bool followServerList = false;
+      bool subscribeAgain = false;
+
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // a replaced subscription
+        if (generation != m_changesGeneration)
+          return;
+
+        releasedChanges.swap(m_oldChangesInfos);
+
+        if (nullptr == data || size <= 0) {
+          // a dns that published the feed once publishes it again when back.
+          // Else there is no dns yet or it does not publish the feed
+          if (m_followChanges) {
+            while (!m_servers.empty())
+              this->removeServer(m_servers.begin(), changes, released);
+          } else {
+            followServerList = (nullptr == m_pServerListInfo);
+          }
+
+          m_changesSequence = 0;
+        } else {
+          // "S<seq>" for a snapshot or "D<seq>" for changes, then a change per line
+          std::string text(data, strnlen(data, static_cast<size_t>(size)));
+          size_t position = text.find('\n');
+          unsigned int sequence = static_cast<unsigned int>(strtoul(text.c_str() + 1, nullptr, 10));
+          position = (position == std::string::npos ? text.size() : position + 1);
+
+          if (!text.empty() && text[0] == 'S') {
+            // the dns publishes the feed: release the server and service list subscriptions
+            pServerListInfo = m_pServerListInfo;
+            m_pServerListInfo = nullptr;
+
+            for (auto &server : m_servers) {
+              if (nullptr != server.second.pInfo)
+                released.push_back(server.second.pInfo);
+
+              server.second.pInfo = nullptr;
+              server.second.generation = 0;
+              server.second.received = true;
+            }
+
+            m_nPendingServers = 0;
+            m_serverListFull = true;
+            m_followChanges = true;
+            this->applyChanges(text, position, true, changes, released);
+            m_changesSequence = sequence;
+            m_serverListReceived = true;
+            this->serverReceived(nullptr);
+          } else if (!text.empty() && text[0] == 'D' && 0 != m_changesSequence) {
+            if (sequence == m_changesSequence + 1) {
+              this->applyChanges(text, position, false, changes, released);
+              m_changesSequence = sequence;
+            } else if (sequence > m_changesSequence + 1) {
+              // updates dropped for a slow client: subscribe again to get a new snapshot.
+              // The current subscription is released from the next one's callback
+              m_oldChangesInfos.push_back(m_pChangesInfo);
+              m_pChangesInfo = nullptr;
+              m_changesSequence = 0;
+              ++m_changesGeneration;
+              subscribeAgain = true;
+            }
+          }
+        }
+      }
+
+      // with several dim io threads this callback runs without the dim lock
+      if (subscribeAgain) {
+        dim_lock();
+        ChangesInfo *pInfo = new ChangesInfo(this, generation + 1);
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          m_pChangesInfo = pInfo;
+        }
+        dim_unlock();
+      }
+
+      if (followServerList) {
+        dim_lock();
+        ServerListInfo *pInfo = new ServerListInfo(this);
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          m_pServerListInfo = pInfo;
+        }
+        dim_unlock();
+      }
+
+      for (auto pInfo : released)
+        delete pInfo;
+
+      for (auto pInfo : releasedChanges)
+        delete pInfo;
+
+      if (nullptr != pServerListInfo)
+        delete pServerListInfo;
+
+      this->notify(changes);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void DirectoryCache::applyChanges(const std::string &text, size_t position, bool snapshot, ChangeList &changes,
+                                      std::vector<ServiceListInfo *> &released) {
+      // the servers and the services listed in a snapshot, by server name
+      std::map<std::string, std::set<std::string>> listed;
+
+      while (position < text.size()) {
+        size_t end = text.find('\n', position);
+
+        if (end == std::string::npos)
+          end = text.size();
+
+        std::string line(text, position, end - position);
+        position = end + 1;
+
+        if (line.size() < 2)
+          continue;
+
+        // "<op>task@node" followed by "|pid" or "|name|format|type" or "|name"
+        size_t bar = line.find('|');
+        std::string server(line, 1, bar == std::string::npos ? std::string::npos : bar - 1);
+        std::string rest(bar == std::string::npos ? "" : line.substr(bar + 1));
+        size_t at = server.find('@');
+        std::string serverName(server, 0, at);
+        std::string node(at == std::string::npos ? "" : server.substr(at + 1));
+
+        if (serverName.empty())
+          continue;
+
+        auto findIter = m_servers.find(serverName);
+
+        switch (line[0]) {
+        case '+':
+        case '!':
+        case '?':
+          // '!' is a server in error, '?' one the dns reloaded from its snapshot
+          this->addServer(serverName, node, changes);
+          listed[serverName];
+          break;
+        case '-':
+          if (findIter != m_servers.end())
+            this->removeServer(findIter, changes, released);
+          break;
+        case '>': {
+          ServerEntry &serverEntry(this->addServer(serverName, node, changes));
+          this->addService(serverEntry, serverName, rest, changes);
+          listed[serverName].insert(rest.substr(0, rest.find('|')));
+          break;
+        }
+        case '<':
+          if (findIter != m_servers.end())
+            this->removeService(findIter->second, serverName, rest, changes);
+          break;
+        default:
+          break;
+        }
+      }
+
+      if (!snapshot)
+        return;
+
+      // remove what the snapshot does not list
+      for (auto iter = m_servers.begin(); iter != m_servers.end();) {
+        auto current = iter++;
+        auto listedIter = listed.find(current->first);
+
+        if (listedIter == listed.end()) {
+          this->removeServer(current, changes, released);
+          continue;
+        }
+
+        ServerEntry &serverEntry(current->second);
+        const std::set<std::string> &names(listedIter->second);
+        std::set<std::string> rpcNames;
+
+        for (auto rpcIter = serverEntry.rpcFormats.begin(); rpcIter != serverEntry.rpcFormats.end();) {
+          auto rpcCurrent = rpcIter++;
+
+          if (names.find(rpcCurrent->first) == names.end())
+            serverEntry.rpcFormats.erase(rpcCurrent);
+        }
+
+        for (auto entryIter = serverEntry.services.begin(); entryIter != serverEntry.services.end();) {
+          auto entryCurrent = entryIter++;
+
+          if (entryCurrent->second.type == DimRPC)
+            rpcNames.insert(entryCurrent->first);
+          else if (names.find(entryCurrent->first) == names.end())
+            this->removeEntry(serverEntry, entryCurrent, changes);
+        }
+
+        for (auto &rpcName : rpcNames)
+          this->updateRpc(serverEntry, current->first, rpcName, changes);
+      }
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void DirectoryCache::receiveServerList(const char *data, int size) {
+      ChangeList changes;
+      std::vector<std::pair<std::string, unsigned int>> subscriptions;
+      std::vector<ServiceListInfo *> released;
+
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // the directory comes from the feed now
+        if (m_followChanges)
+          return;
+
+        if (nullptr == data || size <= 0) {
+          // no dns: the next server list will be a full one
+          while (!m_servers.empty())
+            this->removeServer(m_servers.begin(), changes, released);
+
+          m_serverListFull = true;
+        } else {
+          // "task@node|task@node|...", each server prefixed by '+', '-' or '!' in updates.
+          // The server pids follow the list
+          std::string list(data, strnlen(data, static_cast<size_t>(size)));
+          std::set<std::string> listedServers;
+          size_t position = 0;
+
+          while (position < list.size()) {
+            size_t end = list.find('|', position);
+
+            if (end == std::string::npos)
+              end = list.size();
+
+            std::string server(list, position, end - position);
+            position = end + 1;
+            char operation = '+';
+
+            if (!m_serverListFull && !server.empty() && std::strchr("+-!", server[0])) {
+              operation = server[0];
+              server.erase(0, 1);
+            }
+
+            size_t at = server.find('@');
+            std::string serverName(server, 0, at);
+            std::string node(at == std::string::npos ? "" : server.substr(at + 1));
+
+            if (serverName.empty())
+              continue;
+
+            listedServers.insert(serverName);
+            auto findIter = m_servers.find(serverName);
+
+            if (operation == '-') {
+              if (findIter != m_servers.end())
+                this->removeServer(findIter, changes, released);
+            } else if (findIter == m_servers.end()) {
+              // '!' is a server in error, still running
+              ServerEntry &entry = m_servers[serverName];
+              entry.node = node;
+              entry.generation = ++m_generation;
+              m_nPendingServers++;
+              subscriptions.push_back(std::make_pair(serverName, entry.generation));
+              changes.push_back(Change{Change::SERVER_ADDED, serverEntry(serverName)});
+            }
+          }
+
+          if (m_serverListFull) {
+            for (auto iter = m_servers.begin(); iter != m_servers.end();) {
+              auto current = iter++;
+
+              if (listedServers.find(current->first) == listedServers.end())
+                this->removeServer(current, changes, released);
+            }
+          }
+
+          m_serverListFull = false;
+        }
+
+        m_serverListReceived = true;
+        this->serverReceived(nullptr);
+      }
+
+      // create the subscriptions out of the cache lock, they may call back.
+      // The dim lock holds their callbacks until they are stored
+      for (auto &subscription : subscriptions) {
+        dim_lock();
+        ServiceListInfo *pInfo = new ServiceListInfo(this, subscription.first, subscription.second);
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          auto findIter = m_servers.find(subscription.first);
+
+          if (findIter != m_servers.end() && findIter->second.generation == subscription.second)
+            findIter->second.pInfo = pInfo;
+          else
+            released.push_back(pInfo);
+        }
+        dim_unlock();
+      }
+
+      for (auto pInfo : released)
+        delete pInfo;
+
+      this->notify(changes);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void DirectoryCache::receiveServiceList(const std::string &serverName, unsigned int generation, const char *data,
+                                            int size) {
+      ChangeList changes;
+
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto findIter = m_servers.find(serverName);
+
+        // an old subscription of a restarted server
+        if (findIter == m_servers.end() || findIter->second.generation != generation)
+          return;
+
+        ServerEntry &server(findIter->second);
+
+        if (nullptr == data || size <= 0) {
+          // no link to the server: the next service list will be a full one
+          while (!server.services.empty())
+            this->removeEntry(server, server.services.begin(), changes);
+
+          server.full = true;
+        } else {
+          // "name|format|type\n" lines, type being empty, "CMD" or "RPC".
+          // In updates, removed entries are prefixed by '-' and the first added one by '+'
+          std::string list(data, strnlen(data, static_cast<size_t>(size)));
+          std::set<std::string> listedNames;
+          size_t position = 0;
+
+          while (position < list.size()) {
+            size_t end = list.find('\n', position);
+
+            if (end == std::string::npos)
+              end = list.size();
+
+            std::string line(list, position, end - position);
+            position = end + 1;
+            bool removed = false;
+
+            if (!server.full && !line.empty() && (line[0] == '-' || line[0] == '+')) {
+              removed = (line[0] == '-');
+              line.erase(0, 1);
+            }
+
+            size_t first = line.find('|');
+            size_t last = line.rfind('|');
+
+            if (first == std::string::npos || first == 0)
+              continue;
+
+            DirectoryEntry entry;
+            entry.name = line.substr(0, first);
+            entry.server = serverName;
+            entry.format = (last > first ? line.substr(first + 1, last - first - 1) : line.substr(first + 1));
+            std::string type(last > first ? line.substr(last + 1) : "");
+            entry.type = (type == "CMD" ? DimCOMMAND : (type == "RPC" ? DimRPC : DimSERVICE));
+
+            if (removed) {
+              auto entryIter = server.services.find(entry.name);
+
+              if (entryIter != server.services.end())
+                this->removeEntry(server, entryIter, changes);
+            } else {
+              listedNames.insert(entry.name);
+              this->addEntry(server, entry, changes);
+            }
+          }
+
+          if (server.full) {
+            for (auto iter = server.services.begin(); iter != server.services.end();) {
+              auto current = iter++;
+
+              if (listedNames.find(current->first) == listedNames.end())
+                this->removeEntry(server, current, changes);
+            }
+          }
+
+          server.full = false;
+        }
+
+        this->serverReceived(&server);
+      }
+
+      this->notify(changes);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    DirectoryCache::ServerEntry &DirectoryCache::addServer(const std::string &serverName, const std::string &node,
+                                                           ChangeList &changes) {
+      auto findIter = m_servers.find(serverName);
+
+      if (findIter != m_servers.end()) {
+        findIter->second.node = node;
+        return findIter->second;
+      }
+
+      ServerEntry &server = m_servers[serverName];
+      server.node = node;
+      server.received = true;
+      server.full = false;
+      changes.push_back(Change{Change::SERVER_ADDED, serverEntry(serverName)});
+      return server;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void DirectoryCache::removeServer(ServerMap::iterator iter, ChangeList &changes,
+                                      std::vector<ServiceListInfo *> &released) {
+      ServerEntry &server(iter->second);
+
+      while (!server.services.empty())
+        this->removeEntry(server, server.services.begin(), changes);
+
+      if (!server.received)
+        m_nPendingServers--;
+
+      if (nullptr != server.pInfo)
+        released.push_back(server.pInfo);
+
+      changes.push_back(Change{Change::SERVER_REMOVED, serverEntry(iter->first)});
+      m_servers.erase(iter);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void DirectoryCache::addService(ServerEntry &server, const std::string &serverName, const std::string &line,
+                                    ChangeList &changes) {
+      // "name|format|type", type being empty or "CMD". The rpcs are listed as
+      // their "/RpcIn" command and "/RpcOut" service
+      size_t first = line.find('|');
+      size_t last = line.rfind('|');
+
+      if (first == std::string::npos || first == 0)
+        return;
+
+      DirectoryEntry entry;
+      entry.name = line.substr(0, first);
+      entry.server = serverName;
+      entry.format = (last > first ? line.substr(first + 1, last - first - 1) : line.substr(first + 1));
+      entry.type = (last > first && line.substr(last + 1) == "CMD" ? DimCOMMAND : DimSERVICE);
+      size_t rpcPosition = entry.name.rfind("/Rpc");
+
+      if (rpcPosition != std::string::npos &&
+          (entry.name.compare(rpcPosition, std::string::npos, "/RpcIn") == 0 ||
+           entry.name.compare(rpcPosition, std::string::npos, "/RpcOut") == 0)) {
+        server.rpcFormats[entry.name] = entry.format;
+        this->updateRpc(server, serverName, entry.name.substr(0, rpcPosition), changes);
+        return;
+      }
+
+      this->addEntry(server, entry, changes);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void DirectoryCache::removeService(ServerEntry &server, const std::string &serverName, const std::string &name,
+                                       ChangeList &changes) {
+      auto rpcIter = server.rpcFormats.find(name);
+
+      if (rpcIter != server.rpcFormats.end()) {
+        server.rpcFormats.erase(rpcIter);
+        this->updateRpc(server, serverName, name.substr(0, name.rfind("/Rpc")), changes);
+        return;
+      }
+
+      auto findIter = server.services.find(name);
+
+      if (findIter != server.services.end() && findIter->second.type != DimRPC)
+        this->removeEntry(server, findIter, changes);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void DirectoryCache::updateRpc(ServerEntry &server, const std::string &serverName, const std::string &rpcName,
+                                   ChangeList &changes) {
+      // an rpc is listed with its "in,out" formats as long as its "/RpcIn" command exists
+      auto inIter = server.rpcFormats.find(rpcName + "/RpcIn");
+
+      if (inIter == server.rpcFormats.end()) {
+        auto findIter = server.services.find(rpcName);
+
+        if (findIter != server.services.end() && findIter->second.type == DimRPC)
+          this->removeEntry(server, findIter, changes);
+
+        return;
+      }
+
+      auto outIter = server.rpcFormats.find(rpcName + "/RpcOut");
+      DirectoryEntry entry;
+      entry.name = rpcName;
+      entry.server = serverName;
+      entry.format = inIter->second + (outIter == server.rpcFormats.end() ? "" : "," + outIter->second);
+      entry.type = DimRPC;
+      this->addEntry(server, entry, changes);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void DirectoryCache::addEntry(ServerEntry &server, const DirectoryEntry &entry, ChangeList &changes) {
+      auto findIter = server.services.find(entry.name);
+
+      if (findIter != server.services.end()) {
+        if (findIter->second.format == entry.format && findIter->second.type == entry.type)
+          return;
+
+        this->removeEntry(server, findIter, changes);
+      }
+
+      auto inserted = server.services.insert(EntryMap::value_type(entry.name, entry));
+      m_serviceIndex.insert(ServiceIndex::value_type(entry.name, &inserted.first->second));
+      changes.push_back(Change{Change::SERVICE_ADDED, entry});
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void DirectoryCache::removeEntry(ServerEntry &server, EntryMap::iterator iter, ChangeList &changes) {
+      auto range = m_serviceIndex.equal_range(iter->first);
+
+      for (auto indexIter = range.first; indexIter != range.second; ++indexIter) {
+        if (indexIter->second == &iter->second) {
+          m_serviceIndex.erase(indexIter);
+          break;
+        }
+      }
+
+      changes.push_back(Change{Change::SERVICE_REMOVED, iter->second});
+      server.services.erase(iter);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void DirectoryCache::serverReceived(ServerEntry *pServer) {
+      if (nullptr != pServer && !pServer->received) {
+        pServer->received = true;
+        m_nPendingServers--;
+      }
+
+      if (!m_ready && m_serverListReceived && 0 == m_nPendingServers) {
+        m_ready = true;
+        m_readyCondition.notify_all();
+      }
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void DirectoryCache::notify(const ChangeList &changes) {
+      for (auto &change : changes) {
+        switch (change.kind) {
+        case Change::SERVER_ADDED:
+          m_serverAddedSignal.process(change.entry.server);
+          break;
+        case Change::SERVER_REMOVED:
+          m_serverRemovedSignal.process(change.entry.server);
+          break;
+        case Change::SERVICE_ADDED:
+          m_serviceAddedSignal.process(change.entry);
+          break;
+        case Change::SERVICE_REMOVED:
+          m_serviceRemovedSignal.process(change.entry);
+          break;
+        }
+      }
+    }
+
+    //-------------------------------------------------------------------------------------------------
+    //-------------------------------------------------------------------------------------------------
+
+    DirectoryCache::ChangesInfo::ChangesInfo(DirectoryCache *pCache, unsigned int generation)
+        : DimInfo(DNS_DIRECTORY_CHANGES, (void *)nullptr, 0), m_pCache(pCache), m_generation(generation) {
+      /* nop */
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    DirectoryCache::ChangesInfo::~ChangesInfo() {
+      // see ~ServerListInfo()
+      if (0 != this->itsId) {
+        dic_release_service(this->itsId);
+        this->itsId = 0;
+      }
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void DirectoryCache::ChangesInfo::infoHandler() {
+      m_pCache->receiveChanges(m_generation, static_cast<const char *>(this->getData()), this->getSize());
+    }
+
+    //-------------------------------------------------------------------------------------------------
+    //-------------------------------------------------------------------------------------------------
+
+    DirectoryCache::ServerListInfo::ServerListInfo(DirectoryCache *pCache)
+        : DimInfo("DIS_DNS/SERVER_LIST", (void *)nullptr, 0), m_pCache(pCache) {
+      /* nop */
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    DirectoryCache::ServerListInfo::~ServerListInfo() {
+      // release before ~DimInfo(): an update coming in between would go to
+      // DimInfo::infoHandler(), which copies the data that ~DimInfo() then frees
+      if (0 != this->itsId) {
+        dic_release_service(this->itsId);
+        this->itsId = 0;
+      }
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void DirectoryCache::ServerListInfo::infoHandler() {
+      m_pCache->receiveServerList(static_cast<const char *>(this->getData()), this->getSize());
+    }
+
+    //-------------------------------------------------------------------------------------------------
+    //-------------------------------------------------------------------------------------------------
+
+    DirectoryCache::ServiceListInfo::ServiceListInfo(DirectoryCache *pCache, const std::string &serverName,
+                                                     unsigned int generation)
+        : DimInfo((serverName + "/SERVICE_LIST").c_str(), (void *)nullptr, 0),
+          m_pCache(pCache),
+          m_serverName(serverName),
+          m_generation(generation) {
+      /* nop */
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    DirectoryCache::ServiceListInfo::~ServiceListInfo() {
+      // see ~ServerListInfo()
+      if (0 != this->itsId) {
+        dic_release_service(this->itsId);
+        this->itsId = 0;
+      }
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void DirectoryCache::ServiceListInfo::infoHandler() {
+      m_pCache->receiveServiceList(m_serverName, m_generation, static_cast<const char *>(this->getData()),
+                                   this->getSize());
+    }
+  }
+}
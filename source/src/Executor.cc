@@ -0,0 +1,157 @@
+/// \file Executor.cc
+/*
+ *
+ * Executor.cc source template automatically generated by a class generator
+ * Creation date : sam. oct. 17 2026
+ *
+ * This file is part of DQM4HEP libraries.
+ *
+ * DQM4HEP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * DQM4HEP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DQM4HEP.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @author Remi Ete
+ * @copyright CNRS , IPNL
+ */
+
+// -- dqm4hep headers
+#include "dqm4hep/Executor.h"
+
+namespace dqm4hep {
+
+  namespace net {
+
+    Executor::Executor(unsigned int nThreads, unsigned int maxQueueSize, unsigned int maxQueueLatency)
+        : m_maxQueueSize(maxQueueSize), m_maxQueueLatency(maxQueueLatency) {
+      for (unsigned int i = 0; i < nThreads; i++)
+        m_threads.push_back(std::thread(&Executor::run, this));
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    Executor::~Executor() {
+      this->stop();
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    bool Executor::submit(Task task, Task shed) {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        bool accepted = !m_stopping && m_queue.size() < m_maxQueueSize;
+
+        // the queue is not draining fast enough
+        if (accepted && !m_queue.empty())
+          accepted = !this->expired(m_queue.front().m_queueTime, std::chrono::steady_clock::now());
+
+        if (accepted) {
+          m_queue.push_back(QueuedTask{task, shed, std::chrono::steady_clock::now()});
+          m_condition.notify_one();
+          return true;
+        }
+
+        ++m_nShedTasks;
+      }
+
+      if (shed)
+        shed();
+
+      return false;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void Executor::stop() {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+        m_condition.notify_all();
+      }
+
+      for (auto &thread : m_threads) {
+        if (thread.joinable())
+          thread.join();
+      }
+
+      m_threads.clear();
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    unsigned int Executor::numberOfThreads() const {
+      return m_threads.size();
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    unsigned int Executor::queueSize() const {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return m_queue.size();
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    unsigned long Executor::numberOfExecutedTasks() const {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return m_nExecutedTasks;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    unsigned long Executor::numberOfShedTasks() const {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return m_nShedTasks;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void Executor::run() {
+      while (1) {
+        QueuedTask queuedTask;
+        bool shed = false;
+        {
+          std::unique_lock<std::mutex> lock(m_mutex);
+          m_condition.wait(lock, [this]() { return m_stopping || !m_queue.empty(); });
+
+          // queued tasks are processed before stopping
+          if (m_queue.empty())
+            return;
+
+          queuedTask = std::move(m_queue.front());
+          m_queue.pop_front();
+          shed = !m_stopping && this->expired(queuedTask.m_queueTime, std::chrono::steady_clock::now());
+
+          if (shed)
+            ++m_nShedTasks;
+          else
+            ++m_nExecutedTasks;
+        }
+
+        if (shed) {
+          if (queuedTask.m_shed)
+            queuedTask.m_shed();
+        } else {
+          queuedTask.m_task();
+        }
+      }
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    bool Executor::expired(const std::chrono::steady_clock::time_point &queueTime,
+                           const std::chrono::steady_clock::time_point &now) const {
+      return (m_maxQueueLatency.count() > 0 && now - queueTime > m_maxQueueLatency);
+    }
+  }
+}
@@ -83,14 +83,53 @@ namespace dqm4hep {
     //-------------------------------------------------------------------------------------------------
     //-------------------------------------------------------------------------------------------------
 
+    namespace {
+
+      /**
+       *  @brief  Model on a receive buffer retained from dim, released with the model
+       */
+      class ReceivedBufferModel : public BufferModel {
+      public:
+        ReceivedBufferModel(void *pHandle, const char *buffer, size_t s) : m_pHandle(pHandle) {
+          this->handle(buffer, s);
+        }
+
+        ~ReceivedBufferModel() {
+          dim_release_data(m_pHandle);
+        }
+
+      private:
+        void *m_pHandle = {nullptr}; ///< The dim handle of the receive buffer
+      };
+    }
+
+    //-------------------------------------------------------------------------------------------------
+    //-------------------------------------------------------------------------------------------------
+
+    constexpr size_t Buffer::inlineSize;
+
+    //-------------------------------------------------------------------------------------------------
+
     Buffer::Buffer() {
-      this->adopt(NullBuffer::buffer, NullBuffer::size);
+      /* nop */
     }
 
     //-------------------------------------------------------------------------------------------------
 
-    Buffer::Buffer(Buffer &&buffer) {
-      m_model = std::move(buffer.m_model);
+    Buffer::Buffer(Buffer &&buffer)
+        : m_model(std::move(buffer.m_model)), m_pBuffer(buffer.m_pBuffer), m_size(buffer.m_size) {
+      if (buffer.m_pBuffer == buffer.m_inline) {
+        memcpy(m_inline, buffer.m_inline, m_size);
+        m_pBuffer = m_inline;
+      }
+
+      buffer.adopt(NullBuffer::buffer, NullBuffer::size);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    Buffer::Buffer(const std::string &value) {
+      this->copy(value.data(), value.size());
     }
 
     //-------------------------------------------------------------------------------------------------
@@ -109,34 +148,92 @@ namespace dqm4hep {
 
     //-------------------------------------------------------------------------------------------------
 
+    // a model may change its data after being set (see Server::handleServerInfoRequest)
+
     const char *Buffer::begin() const {
-      return m_model->raw().begin();
+      return m_model ? m_model->raw().begin() : m_pBuffer;
     }
 
     //-------------------------------------------------------------------------------------------------
 
     const char *Buffer::end() const {
-      return m_model->raw().end();
+      return m_model ? m_model->raw().end() : m_pBuffer + m_size;
     }
 
     //-------------------------------------------------------------------------------------------------
 
     size_t Buffer::size() const {
-      return m_model->raw().size();
+      return m_model ? m_model->raw().size() : m_size;
     }
 
     //-------------------------------------------------------------------------------------------------
 
     void Buffer::adopt(const char *buffer, size_t s) {
-      auto m = this->createModel();
-      m->handle(buffer, s);
+      m_model.reset();
+      m_pBuffer = buffer;
+      m_size = s;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void Buffer::copy(const char *buffer, size_t s) {
+      if (s <= inlineSize) {
+        this->copyInline(buffer, s);
+        return;
+      }
+
+      auto m = this->createModel<std::string>();
+      m->move(std::string(buffer, s));
       this->setModel(m);
     }
 
     //-------------------------------------------------------------------------------------------------
 
+    Buffer Buffer::retain() const {
+      Buffer buffer;
+
+      if (m_model) {
+        buffer.setModel(m_model);
+        return buffer;
+      }
+
+      // not worth holding a receive buffer
+      if (m_size <= inlineSize) {
+        buffer.copyInline(m_pBuffer, m_size);
+        return buffer;
+      }
+
+      void *pHandle = dim_retain_data((void *)m_pBuffer);
+
+      if (nullptr != pHandle)
+        buffer.setModel(std::make_shared<ReceivedBufferModel>(pHandle, m_pBuffer, m_size));
+      else
+        buffer.copy(m_pBuffer, m_size);
+
+      return buffer;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
     BufferModelPtr Buffer::model() const {
-      return m_model;
+      if (m_model)
+        return m_model;
+
+      auto m = this->createModel();
+      m->handle(m_pBuffer, m_size);
+      return m;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void Buffer::copyInline(const char *buffer, size_t s) {
+      m_model.reset();
+
+      if (0 != s)
+        memcpy(m_inline, buffer, s);
+
+      m_pBuffer = m_inline;
+      m_size = s;
     }
   }
 }
@@ -26,6 +26,13 @@
  */
 
 #include "dqm4hep/RequestHandler.h"
+#include "dqm4hep/Executor.h"
+#include "dqm4hep/Logging.h"
+#include "dqm4hep/RpcHeader.h"
+#include "dqm4hep/Server.h"
+
+// -- std headers
+#include <cstring>
 
 namespace dqm4hep {
 
@@ -51,7 +58,13 @@ namespace dqm4hep {
 
     void RequestHandler::startHandlingRequest() {
       if (!this->isHandlingRequest()) {
-        m_pRpc = new Rpc(this);
+        // the rpc handlers read the rpcs under the dim lock.
+        // The dim threads are started before, they take the lock on startup
+        dim_init();
+        dim_lock();
+        m_rpc = std::make_shared<Rpc>(this, false);
+        m_pipelinedRpc = std::make_shared<Rpc>(this, true);
+        dim_unlock();
       }
     }
 
@@ -59,15 +72,23 @@ namespace dqm4hep {
 
     void RequestHandler::stopHandlingRequest() {
       if (this->isHandlingRequest()) {
-        delete m_pRpc;
-        m_pRpc = nullptr;
+        std::shared_ptr<Rpc> rpc, pipelinedRpc;
+        dim_lock();
+        rpc.swap(m_rpc);
+        pipelinedRpc.swap(m_pipelinedRpc);
+        dim_unlock();
+
+        // deferred responses still holding the rpc are sent before it is deleted.
+        // Not under the dim lock, the deletion waits for a handler running in another dim thread
+        pipelinedRpc.reset();
+        rpc.reset();
       }
     }
 
     //-------------------------------------------------------------------------------------------------
 
     bool RequestHandler::isHandlingRequest() const {
-      return (m_pRpc != nullptr);
+      return (m_rpc != nullptr);
     }
 
     //-------------------------------------------------------------------------------------------------
@@ -78,31 +99,240 @@ namespace dqm4hep {
 
     //-------------------------------------------------------------------------------------------------
 
-    void RequestHandler::handleRequest(const Buffer &request, Buffer &response) {
-      m_requestSignal.process(request, response);
+    RequestHandler::DeferredRequestSignal &RequestHandler::onDeferredRequest() {
+      return m_deferredRequestSignal;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void RequestHandler::handleRequest(const Buffer &request, DeferredResponsePtr response) {
+      if (m_deferredRequestSignal.hasConnection()) {
+        m_deferredRequestSignal.process(request, response);
+        return;
+      }
+
+      Buffer buffer;
+      m_requestSignal.process(request, buffer);
+      response->send(buffer);
     }
 
     //-------------------------------------------------------------------------------------------------
     //-------------------------------------------------------------------------------------------------
 
-    RequestHandler::Rpc::Rpc(RequestHandler *pHandler)
-        : DimRpc((char *)pHandler->name().c_str(), "C", "C"), m_pHandler(pHandler) {
+    RequestHandler::Rpc::Rpc(RequestHandler *pHandler, bool pipelined)
+        : DimRpc((char *)(pipelined ? RpcHeader::pipelinedName(pHandler->name()) : pHandler->name()).c_str(), "C",
+                 "C"),
+          m_pHandler(pHandler),
+          m_pipelined(pipelined) {
       /* nop */
     }
 
     //-------------------------------------------------------------------------------------------------
 
+    RequestHandler::Rpc::~Rpc() {
+      // remove the rpc input first: this waits for a handler running in another dim thread,
+      // which uses the members
+      if (0 != this->itsIdIn) {
+        dis_remove_service(this->itsIdIn);
+        this->itsIdIn = 0;
+      }
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
     void RequestHandler::Rpc::rpcHandler() {
       char *data = (char *)this->getData();
       int size = this->getSize();
+
+      // requests on the pipelined rpc always start with the correlation header
+      uint32_t correlationId = 0;
+      const bool correlated = m_pipelined;
+
+      if (correlated) {
+        if (size < 0 || !RpcHeader::read(data, size, correlationId)) {
+          this->setFramedData(m_responseBuffer, 0, nullptr, 0, RpcHeader::OK);
+          return;
+        }
+
+        data += RpcHeader::size;
+        size -= RpcHeader::size;
+      }
+
+      // with several dim io threads the handler runs without the dim lock.
+      // The rpcs and the executor are replaced under it
+      dim_lock();
+      std::weak_ptr<Rpc> rpc = correlated ? m_pHandler->m_pipelinedRpc : m_pHandler->m_rpc;
+      Executor *pExecutor = (nullptr != m_pHandler->server()) ? m_pHandler->server()->executor() : nullptr;
+
+      // Run the handler in the server worker pool. Only correlated requests
+      // can be answered once this function has returned
+      if (correlated && nullptr != pExecutor) {
+        DeferredResponsePtr response(
+            new DeferredResponse(rpc, DimServer::getClientId(), correlationId, true, false));
+
+        // the request data are only valid during this call. Keep the receive buffer
+        Buffer requestView;
+
+        if (nullptr != data && size != 0)
+          requestView.adopt(data, size);
+
+        auto request = std::make_shared<Buffer>(requestView.retain());
+        RequestHandler *pHandler = m_pHandler;
+
+        pExecutor->submit([pHandler, request, response]() { pHandler->handleRequest(*request, response); },
+            [response]() { response->reject(); });
+
+        // dim sends the rpc output back in any case.
+        // Send only a header, the response is sent later
+        this->setFramedData(m_responseBuffer, 0, nullptr, 0, RpcHeader::OK);
+        dim_unlock();
+        return;
+      }
+
+      dim_unlock();
+
+      DeferredResponsePtr response(
+          new DeferredResponse(rpc, DimServer::getClientId(), correlationId, correlated, true));
       Buffer request;
 
       if (nullptr != data && size != 0)
         request.adopt(data, size);
 
-      Buffer response;
       m_pHandler->handleRequest(request, response);
-      this->setData((void *)response.begin(), response.size());
+
+      std::string inlineResponse;
+      RpcHeader::Status status(RpcHeader::OK);
+      const bool completed = response->endCallback(inlineResponse, status);
+
+      if (!correlated) {
+        if (completed && RpcHeader::OK == status)
+          this->setData((void *)inlineResponse.data(), inlineResponse.size());
+        else
+          this->setData((void *)NullBuffer::buffer, NullBuffer::size);
+
+        return;
+      }
+
+      // no response expected or deferred response: send only the header
+      if (!completed || 0 == correlationId)
+        this->setFramedData(m_responseBuffer, 0, nullptr, 0, RpcHeader::OK);
+      else
+        this->setFramedData(m_responseBuffer, correlationId, inlineResponse.data(), inlineResponse.size(), status);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void RequestHandler::Rpc::sendResponse(int clientId, uint32_t correlationId, const char *data, size_t size,
+                                           RpcHeader::Status status) {
+      if (0 == correlationId)
+        return;
+
+      int clientIds[2] = {clientId, 0};
+
+      // the rpc handler may run in another dim thread, the output it set is
+      // put back for the update sent on its return
+      dim_lock();
+      this->setFramedData(m_sendBuffer, correlationId, data, size, status);
+      dis_selective_update_service(this->itsIdOut, clientIds);
+
+      if (!m_responseBuffer.empty())
+        this->setData((void *)m_responseBuffer.data(), m_responseBuffer.size());
+
+      dim_unlock();
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void RequestHandler::Rpc::setFramedData(std::vector<char> &buffer, uint32_t correlationId, const char *data,
+                                            size_t size, RpcHeader::Status status) {
+      const size_t responseSize = (RpcHeader::OK == status) ? size : 0;
+
+      dim_lock();
+      buffer.resize(RpcHeader::size + responseSize);
+      RpcHeader::write(&buffer[0], correlationId, status);
+
+      if (0 != responseSize)
+        memcpy(&buffer[RpcHeader::size], data, responseSize);
+
+      this->setData((void *)buffer.data(), buffer.size());
+      dim_unlock();
+    }
+
+    //-------------------------------------------------------------------------------------------------
+    //-------------------------------------------------------------------------------------------------
+
+    DeferredResponse::DeferredResponse(std::weak_ptr<RequestHandler::Rpc> rpc, int clientId, uint32_t correlationId,
+                                       bool correlated, bool inCallback)
+        : m_rpc(rpc),
+          m_clientId(clientId),
+          m_correlationId(correlationId),
+          m_correlated(correlated),
+          m_inCallback(inCallback) {
+      /* nop */
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void DeferredResponse::send(const Buffer &response) {
+      this->complete(response.begin(), response.size(), RpcHeader::OK);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void DeferredResponse::reject() {
+      this->complete(nullptr, 0, RpcHeader::REJECTED);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    bool DeferredResponse::isCompleted() const {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return m_completed;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void DeferredResponse::complete(const char *data, size_t size, RpcHeader::Status status) {
+      std::shared_ptr<RequestHandler::Rpc> rpc;
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (m_completed)
+          return;
+
+        m_completed = true;
+
+        // still in the handler call: the rpc handler sends the response on return
+        if (m_inCallback) {
+          m_inlineResponse.assign(nullptr != data ? data : "", size);
+          m_inlineStatus = status;
+          return;
+        }
+
+        // plain requests can't be answered after the handler call
+        if (!m_correlated)
+          return;
+
+        rpc = m_rpc.lock();
+      }
+
+      // the request handler may have been stopped meanwhile
+      if (nullptr != rpc)
+        rpc->sendResponse(m_clientId, m_correlationId, data, size, status);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    bool DeferredResponse::endCallback(std::string &response, RpcHeader::Status &status) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_inCallback = false;
+
+      if (!m_completed)
+        return false;
+
+      response = std::move(m_inlineResponse);
+      status = m_inlineStatus;
+      return true;
     }
 
     //-------------------------------------------------------------------------------------------------
@@ -132,6 +362,12 @@ namespace dqm4hep {
 
     //-------------------------------------------------------------------------------------------------
 
+    unsigned long CommandHandler::numberOfDroppedCommands() const {
+      return m_droppedCommands.load();
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
     void CommandHandler::startHandlingCommands() {
       if (!this->isHandlingCommands()) {
         m_pCommand = new Command(this);
@@ -165,6 +401,17 @@ namespace dqm4hep {
       m_commandSignal.process(command);
     }
 
+    //-------------------------------------------------------------------------------------------------
+
+    void CommandHandler::dropCommand() {
+      const unsigned long nDropped = ++m_droppedCommands;
+
+      // don't flood the log while the server is overloaded
+      if (1 == nDropped || 0 == nDropped % 1000)
+        dqm_warning("CommandHandler::dropCommand: server overloaded, command '{0}' dropped ({1} so far)", m_name,
+                    nDropped);
+    }
+
     //------------------------------------------------------------------------------------------------
     //--------------------------------------------------------------------------------------------------
 
@@ -182,6 +429,29 @@ namespace dqm4hep {
       if (nullptr == data || size == 0)
         return;
 
+      // with several dim io threads the handler runs without the dim lock.
+      // The executor is replaced under it
+      dim_lock();
+      Executor *pExecutor = (nullptr != m_pHandler->server()) ? m_pHandler->server()->executor() : nullptr;
+
+      // Run the handler in the server worker pool.
+      // Shed commands are dropped, there is no reply to the sender
+      if (nullptr != pExecutor) {
+        // the command data are only valid during this call. Keep the receive buffer
+        Buffer commandView;
+        commandView.adopt(data, size);
+
+        auto command = std::make_shared<Buffer>(commandView.retain());
+        CommandHandler *pHandler = m_pHandler;
+
+        pExecutor->submit([pHandler, command]() { pHandler->handleCommand(*command); },
+            [pHandler]() { pHandler->dropCommand(); });
+
+        dim_unlock();
+        return;
+      }
+
+      dim_unlock();
       Buffer command;
       command.adopt(data, size);
       m_pHandler->handleCommand(command);
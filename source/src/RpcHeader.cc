@@ -0,0 +1,98 @@
+/// \file RpcHeader.cc
+/*
+ *
+ * RpcHeader.cc source template automatically generated by a class generator
+ * Creation date : sam. oct. 17 2026
+ *
+ * This file is part of DQM4HEP libraries.
+ *
+ * DQM4HEP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * DQM4HEP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DQM4HEP.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @author Remi Ete
+ * @copyright CNRS , IPNL
+ */
+
+// -- dqm4hep headers
+#include "dqm4hep/RpcHeader.h"
+
+// -- std headers
+#include <atomic>
+
+namespace dqm4hep {
+
+  namespace net {
+
+    const std::size_t RpcHeader::size;
+    const uint32_t RpcHeader::magic;
+    const uint32_t RpcHeader::rejectedMagic;
+
+    //-------------------------------------------------------------------------------------------------
+
+    void RpcHeader::write(char *pBuffer, uint32_t correlationId, Status status) {
+      const uint32_t headerMagic = (REJECTED == status) ? rejectedMagic : magic;
+
+      // fixed little endian layout, independent of the host byte order
+      for (unsigned int i = 0; i < 4; i++) {
+        pBuffer[i] = static_cast<char>((headerMagic >> (8 * i)) & 0xff);
+        pBuffer[4 + i] = static_cast<char>((correlationId >> (8 * i)) & 0xff);
+      }
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    bool RpcHeader::read(const char *pBuffer, std::size_t bufferSize, uint32_t &correlationId) {
+      Status status(OK);
+      return RpcHeader::read(pBuffer, bufferSize, correlationId, status);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    bool RpcHeader::read(const char *pBuffer, std::size_t bufferSize, uint32_t &correlationId, Status &status) {
+      if (nullptr == pBuffer || bufferSize < size)
+        return false;
+
+      uint32_t headerMagic = 0;
+      correlationId = 0;
+
+      for (unsigned int i = 0; i < 4; i++) {
+        headerMagic |= static_cast<uint32_t>(static_cast<unsigned char>(pBuffer[i])) << (8 * i);
+        correlationId |= static_cast<uint32_t>(static_cast<unsigned char>(pBuffer[4 + i])) << (8 * i);
+      }
+
+      status = (rejectedMagic == headerMagic) ? REJECTED : OK;
+      return (magic == headerMagic || rejectedMagic == headerMagic);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    std::string RpcHeader::pipelinedName(const std::string &name) {
+      return name + "/Pipelined";
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    uint32_t RpcHeader::nextCorrelationId() {
+      static std::atomic<uint32_t> correlationId(0);
+      uint32_t id = ++correlationId;
+
+      // 0 is reserved for requests without response
+      while (0 == id)
+        id = ++correlationId;
+
+      return id;
+    }
+  }
+}
@@ -26,6 +26,7 @@
  */
 
 // -- dqm4hep headers
+#include <dqm4hep/DirectoryCache.h>
 #include <dqm4hep/Internal.h>
 #include <dqm4hep/Server.h>
 #include <dqm4hep/Logging.h>
@@ -34,9 +35,6 @@
 #include <sys/utsname.h>
 #include <unistd.h>
 
-// -- dim headers
-#include <dic.hxx>
-
 namespace dqm4hep {
 
   namespace net {
@@ -51,6 +49,7 @@ namespace dqm4hep {
     //-------------------------------------------------------------------------------------------------
 
     Server::~Server() {
+      m_nWorkerThreads = 0;
       this->stop();
       this->clear();
       delete m_serverInfoHandler;
@@ -68,6 +67,8 @@ namespace dqm4hep {
       if (m_started)
         return;
 
+      DnsUpdateBatch batch;
+
       for (auto iter = m_serviceMap.begin(), endIter = m_serviceMap.end(); endIter != iter; ++iter) {
         if (!iter->second->isServiceConnected())
           iter->second->connectService();
@@ -97,23 +98,30 @@ namespace dqm4hep {
       if (!m_started)
         return;
 
-      for (auto iter = m_serviceMap.begin(), endIter = m_serviceMap.end(); endIter != iter; ++iter) {
-        if (iter->second->isServiceConnected())
-          iter->second->disconnectService();
-      }
+      // process the queued requests and commands while handlers are still running
+      this->resetExecutor();
 
-      for (auto iter = m_requestHandlerMap.begin(), endIter = m_requestHandlerMap.end(); endIter != iter; ++iter) {
-        if (iter->second->isHandlingRequest())
-          iter->second->stopHandlingRequest();
-      }
+      {
+        DnsUpdateBatch batch;
 
-      for (auto iter = m_commandHandlerMap.begin(), endIter = m_commandHandlerMap.end(); endIter != iter; ++iter) {
-        if (iter->second->isHandlingCommands())
-          iter->second->stopHandlingCommands();
-      }
+        for (auto iter = m_serviceMap.begin(), endIter = m_serviceMap.end(); endIter != iter; ++iter) {
+          if (iter->second->isServiceConnected())
+            iter->second->disconnectService();
+        }
 
-      if (m_serverInfoHandler->isHandlingRequest())
-        m_serverInfoHandler->stopHandlingRequest();
+        for (auto iter = m_requestHandlerMap.begin(), endIter = m_requestHandlerMap.end(); endIter != iter; ++iter) {
+          if (iter->second->isHandlingRequest())
+            iter->second->stopHandlingRequest();
+        }
+
+        for (auto iter = m_commandHandlerMap.begin(), endIter = m_commandHandlerMap.end(); endIter != iter; ++iter) {
+          if (iter->second->isHandlingCommands())
+            iter->second->stopHandlingCommands();
+        }
+
+        if (m_serverInfoHandler->isHandlingRequest())
+          m_serverInfoHandler->stopHandlingRequest();
+      }
 
       DimServer::stop();
       m_started = false;
@@ -128,6 +136,18 @@ namespace dqm4hep {
     //-------------------------------------------------------------------------------------------------
 
     void Server::clear() {
+      DnsUpdateBatch batch;
+
+      // no more request or command can be queued once the handlers are stopped.
+      // Drain the queue before deleting them
+      for (auto iter = m_requestHandlerMap.begin(), endIter = m_requestHandlerMap.end(); endIter != iter; ++iter)
+        iter->second->stopHandlingRequest();
+
+      for (auto iter = m_commandHandlerMap.begin(), endIter = m_commandHandlerMap.end(); endIter != iter; ++iter)
+        iter->second->stopHandlingCommands();
+
+      this->resetExecutor();
+
       for (auto iter = m_serviceMap.begin(), endIter = m_serviceMap.end(); endIter != iter; ++iter)
         delete iter->second;
 
@@ -175,6 +195,45 @@ namespace dqm4hep {
 
     //-------------------------------------------------------------------------------------------------
 
+    std::vector<Service *> Server::createServices(const core::StringVector &names) {
+      core::StringVector newNames;
+
+      for (auto &sname : names) {
+        if (sname.empty())
+          throw std::runtime_error("Server::createServices(): service name is invalid");
+
+        if (m_serviceMap.find(sname) == m_serviceMap.end())
+          newNames.push_back(sname);
+      }
+
+      core::StringVector runningNames(Server::servicesAlreadyRunning(newNames));
+
+      if (!runningNames.empty())
+        throw std::runtime_error("Server::createServices(): service '" + runningNames.front() +
+                                 "' already running on network");
+
+      std::vector<Service *> services;
+      services.reserve(names.size());
+      DnsUpdateBatch batch;
+
+      for (auto &sname : names) {
+        std::pair<ServiceMap::iterator, bool> inserted = m_serviceMap.insert(ServiceMap::value_type(sname, nullptr));
+
+        if (inserted.second) {
+          inserted.first->second = new Service(this, sname);
+
+          if (this->isRunning())
+            inserted.first->second->connectService();
+        }
+
+        services.push_back(inserted.first->second);
+      }
+
+      return services;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
     bool Server::isServiceRegistered(const std::string &sname) const {
       return (m_serviceMap.find(sname) != m_serviceMap.end());
     }
@@ -193,6 +252,13 @@ namespace dqm4hep {
 
     //-------------------------------------------------------------------------------------------------
 
+    unsigned long Server::numberOfDroppedCommands(const std::string &cname) const {
+      CommandHandler *pCommandHandler = this->commandHandler(cname);
+      return (nullptr != pCommandHandler) ? pCommandHandler->numberOfDroppedCommands() : 0;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
     void Server::startService(const std::string &sname) {
       Service *pService = this->service(sname);
 
@@ -268,6 +334,81 @@ namespace dqm4hep {
 
     //-------------------------------------------------------------------------------------------------
 
+    void Server::setWorkerThreads(unsigned int nThreads, unsigned int maxQueueSize, unsigned int maxQueueLatency) {
+      m_nWorkerThreads = nThreads;
+      m_maxQueueSize = maxQueueSize;
+      m_maxQueueLatency = maxQueueLatency;
+      this->resetExecutor();
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    Executor *Server::executor() const {
+      return m_executor.get();
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void Server::setCacheLimit(size_t limit) {
+      m_cacheLimit = limit;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    size_t Server::cacheLimit() const {
+      return m_cacheLimit;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    size_t Server::cacheSize() const {
+      return m_cacheSize;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    bool Server::setClientQueueLimit(int clientId, size_t maxBytes, OverflowPolicy policy) {
+      return (dim_set_conn_write_queue(clientId, static_cast<int>(maxBytes), policy) != 0);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    bool Server::clientQueueStats(int clientId, ClientQueueStats &stats) const {
+      DIM_WRITE_QUEUE_INFO info;
+
+      if (!dim_get_conn_write_queue_info(clientId, &info))
+        return false;
+
+      stats.bytes = info.bytes;
+      stats.entries = info.entries;
+      stats.peakBytes = info.peak_bytes;
+      stats.limit = info.limit;
+      stats.policy = static_cast<OverflowPolicy>(info.policy);
+      stats.drops = info.drops;
+      return true;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void Server::setDefaultClientQueueLimit(size_t maxBytes, OverflowPolicy policy) {
+      dim_set_write_queue_limit(static_cast<int>(maxBytes));
+      dim_set_write_queue_policy(policy);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    bool Server::setIOThreads(unsigned int nThreads) {
+      return dim_set_io_threads(static_cast<int>(nThreads)) != 0;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    unsigned int Server::ioThreads() {
+      return static_cast<unsigned int>(dim_get_io_threads());
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
     core::Signal<int> &Server::onClientExit() {
       return m_clientExitSignal;
     }
@@ -299,35 +440,17 @@ namespace dqm4hep {
     //-------------------------------------------------------------------------------------------------
 
     std::vector<std::string> Server::runningServers() {
-      std::vector<std::string> runningServers;
-
-      DimBrowser browser;
-      browser.getServers();
-      char *pServer, *pNode;
-
-      while (browser.getNextServer(pServer, pNode)) {
-        std::string server(pServer);
-        runningServers.push_back(server);
-      }
-
-      return runningServers;
+      DirectoryCache &directory(DirectoryCache::instance());
+      directory.waitReady();
+      return directory.servers();
     }
 
     //-------------------------------------------------------------------------------------------------
 
     bool Server::isServerRunning(const std::string &serverName) {
-      DimBrowser browser;
-      browser.getServers();
-      char *pServer, *pNode;
-
-      while (browser.getNextServer(pServer, pNode)) {
-        std::string server(pServer);
-
-        if (server == serverName)
-          return true;
-      }
-
-      return false;
+      DirectoryCache &directory(DirectoryCache::instance());
+      directory.waitReady();
+      return directory.hasServer(serverName);
     }
 
     //-------------------------------------------------------------------------------------------------
@@ -366,89 +489,75 @@ namespace dqm4hep {
 
     //-------------------------------------------------------------------------------------------------
 
-    bool Server::serviceAlreadyRunning(const std::string &sname) {
-      if(DimServer::inCallback()) {
-        dqm_warning( "Server::serviceAlreadyRunning: can't check for duplicated service on network !" );
-        return false;
-      }
-      DimBrowser browser;
-      int nServices = browser.getServices(sname.c_str());
-
-      if (nServices == 0)
-        return false;
-
-      int serviceType;
-      char *serviceName, *format;
+    bool Server::reserveCache(size_t size, size_t releasedSize) {
+      size_t current = m_cacheSize.load();
 
-      while (1) {
-        serviceType = browser.getNextService(serviceName, format);
+      while (true) {
+        size_t next = current - releasedSize + size;
 
-        if (serviceType == 0)
-          break;
+        if (next > m_cacheLimit)
+          return false;
 
-        if (serviceType == DimSERVICE)
+        if (m_cacheSize.compare_exchange_weak(current, next))
           return true;
       }
-
-      return false;
     }
 
     //-------------------------------------------------------------------------------------------------
 
-    bool Server::requestHandlerAlreadyRunning(const std::string &rname) {
-      if(DimServer::inCallback()) {
-        dqm_warning( "Server::requestHandlerAlreadyRunning: can't check for duplicated request handler on network !" );
-        return false;
-      }
-      DimBrowser browser;
-      int nServices = browser.getServices(rname.c_str());
-
-      if (nServices == 0)
-        return false;
+    void Server::releaseCache(size_t size) {
+      m_cacheSize -= size;
+    }
 
-      int serviceType;
-      char *serviceName, *format;
+    //-------------------------------------------------------------------------------------------------
 
-      while (1) {
-        serviceType = browser.getNextService(serviceName, format);
+    bool Server::serviceAlreadyRunning(const std::string &sname) {
+      DirectoryCache &directory(DirectoryCache::instance());
+      directory.waitReady();
+      return directory.hasService(sname, DimSERVICE);
+    }
 
-        if (serviceType == 0)
-          break;
+    //-------------------------------------------------------------------------------------------------
 
-        if (serviceType == DimRPC)
-          return true;
-      }
+    core::StringVector Server::servicesAlreadyRunning(const core::StringVector &names) {
+      if (names.empty())
+        return core::StringVector();
 
-      return false;
+      DirectoryCache &directory(DirectoryCache::instance());
+      directory.waitReady();
+      return directory.existingServices(names, DimSERVICE);
     }
 
     //-------------------------------------------------------------------------------------------------
 
-    bool Server::commandHandlerAlreadyRunning(const std::string &cname) {
-      if(DimServer::inCallback()) {
-        dqm_warning( "Server::commandHandlerAlreadyRunning: can't check for duplicated command on network !" );
-        return false;
-      }
-      DimBrowser browser;
-      int nServices = browser.getServices(cname.c_str());
+    bool Server::requestHandlerAlreadyRunning(const std::string &rname) {
+      DirectoryCache &directory(DirectoryCache::instance());
+      directory.waitReady();
+      return directory.hasService(rname, DimRPC);
+    }
 
-      if (nServices == 0)
-        return false;
+    //-------------------------------------------------------------------------------------------------
 
-      int serviceType;
-      char *serviceName, *format;
+    bool Server::commandHandlerAlreadyRunning(const std::string &cname) {
+      DirectoryCache &directory(DirectoryCache::instance());
+      directory.waitReady();
+      return directory.hasService(cname, DimCOMMAND);
+    }
 
-      while (1) {
-        serviceType = browser.getNextService(serviceName, format);
+    //-------------------------------------------------------------------------------------------------
 
-        if (serviceType == 0)
-          break;
+    void Server::resetExecutor() {
+      std::unique_ptr<Executor> executor(
+          m_nWorkerThreads > 0 ? new Executor(m_nWorkerThreads, m_maxQueueSize, m_maxQueueLatency) : nullptr);
 
-        if (serviceType == DimCOMMAND)
-          return true;
-      }
+      // the executor is read from the dim thread on request reception
+      dim_lock();
+      m_executor.swap(executor);
+      dim_unlock();
 
-      return false;
+      // The previous executor runs its queued tasks and stops here.
+      // The dim lock must not be held as the tasks send their response
+      executor.reset();
     }
 
     //-------------------------------------------------------------------------------------------------
@@ -27,14 +27,88 @@
 
 // -- dqm4hep headers
 #include "dqm4hep/Service.h"
+#include "dqm4hep/Server.h"
+
+// -- std headers
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
 
 namespace dqm4hep {
 
   namespace net {
 
+    namespace {
+
+      /**
+       *  @brief  The 0 terminated client id list expected by dim, null for all the clients.
+       *          Refers to the given list if already terminated, else copies it
+       */
+      class ClientIdList {
+      public:
+        ClientIdList(const int *clientIds, size_t nClientIds) {
+          if (0 == nClientIds)
+            return;
+
+          m_pIds = const_cast<int *>(clientIds);
+
+          if (clientIds[nClientIds - 1] == 0)
+            return;
+
+          if (nClientIds < 16) {
+            m_pIds = m_shortList;
+          } else {
+            m_longList.resize(nClientIds + 1);
+            m_pIds = m_longList.data();
+          }
+
+          std::copy(clientIds, clientIds + nClientIds, m_pIds);
+          m_pIds[nClientIds] = 0;
+        }
+
+        int *ids() const { return m_pIds; }
+
+      private:
+        int              m_shortList[16];
+        std::vector<int> m_longList = {};
+        int             *m_pIds = {nullptr};
+      };
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    /**
+     *  @brief  A buffer of a service pool. It keeps the pool alive while dim uses it
+     */
+    struct Service::PooledBuffer {
+      std::unique_ptr<char[]>  m_data = {nullptr};    ///< The buffer memory
+      size_t                   m_capacity = {0};      ///< The allocated size
+      size_t                   m_size = {0};          ///< The size acquired
+      BufferPoolPtr            m_pool = {nullptr};    ///< The pool the buffer belongs to
+    };
+
+    //-------------------------------------------------------------------------------------------------
+
+    /**
+     *  @brief  The buffers of a service to acquire. Buffers in use by dim are
+     *          released to the pool from the dim threads
+     */
+    struct Service::BufferPool {
+      std::mutex                    m_mutex = {};          ///< Guards the pool
+      std::condition_variable       m_condition = {};      ///< Notified when a buffer is released
+      std::vector<PooledBuffer *>   m_freeBuffers = {};    ///< The buffers ready to acquire
+      size_t                        m_nBuffers = {0};      ///< The number of buffers, free or in use
+      size_t                        m_maxBuffers = {4};    ///< The maximum number of buffers
+      bool                          m_closed = {false};    ///< Whether the service is gone
+    };
+
+    //-------------------------------------------------------------------------------------------------
+
     Service::Service(Server *pServer, const std::string &sname) : 
       m_name(sname), 
-      m_pServer(pServer) {
+      m_pServer(pServer),
+      m_pool(std::make_shared<BufferPool>()) {
       /* nop */
     }
 
@@ -42,6 +116,19 @@ namespace dqm4hep {
 
     Service::~Service() {
       this->disconnectService();
+
+      if (m_pAcquired)
+        Service::releaseBuffer(m_pAcquired);
+
+      // the buffers still queued for clients are deleted when released
+      std::lock_guard<std::mutex> lock(m_pool->m_mutex);
+      m_pool->m_closed = true;
+      m_pool->m_nBuffers -= m_pool->m_freeBuffers.size();
+
+      for (auto pBuffer : m_pool->m_freeBuffers)
+        delete pBuffer;
+
+      m_pool->m_freeBuffers.clear();
     }
 
     //-------------------------------------------------------------------------------------------------
@@ -67,6 +154,8 @@ namespace dqm4hep {
     //-------------------------------------------------------------------------------------------------
 
     void Service::disconnectService() {
+      this->releaseCache();
+
       if (this->isServiceConnected()) {
         delete m_pService;
         m_pService = nullptr;
@@ -84,7 +173,7 @@ namespace dqm4hep {
     void Service::sendBuffer(const void *ptr, size_t size) {
       Buffer buffer;
       buffer.adopt((const char *)ptr, size);
-      this->sendData(buffer, std::vector<int>());
+      this->sendData(buffer, nullptr, 0);
     }
 
     //-------------------------------------------------------------------------------------------------
@@ -92,7 +181,7 @@ namespace dqm4hep {
     void Service::sendBuffer(const void *ptr, size_t size, int clientId) {
       Buffer buffer;
       buffer.adopt((const char *)ptr, size);
-      this->sendData(buffer, std::vector<int>(1, clientId));
+      this->sendData(buffer, &clientId, 1);
     }
 
     //-------------------------------------------------------------------------------------------------
@@ -105,25 +194,268 @@ namespace dqm4hep {
 
     //-------------------------------------------------------------------------------------------------
 
+    void *Service::acquire(size_t size) {
+      return this->acquireBuffer(size, true);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void *Service::tryAcquire(size_t size) {
+      return this->acquireBuffer(size, false);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void Service::commit() {
+      this->commitBuffer(nullptr, 0);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void Service::commit(int clientId) {
+      this->commitBuffer(&clientId, 1);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void Service::commit(const std::vector<int> &clientIds) {
+      this->commitBuffer(clientIds.data(), clientIds.size());
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void Service::setPoolSize(size_t nBuffers) {
+      std::vector<PooledBuffer *> buffers;
+
+      {
+        std::lock_guard<std::mutex> lock(m_pool->m_mutex);
+        m_pool->m_maxBuffers = std::max<size_t>(nBuffers, 1);
+
+        // buffers in use are dropped when released
+        while (m_pool->m_nBuffers > m_pool->m_maxBuffers && !m_pool->m_freeBuffers.empty()) {
+          buffers.push_back(m_pool->m_freeBuffers.back());
+          m_pool->m_freeBuffers.pop_back();
+          m_pool->m_nBuffers--;
+        }
+      }
+
+      for (auto pBuffer : buffers)
+        delete pBuffer;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    size_t Service::poolSize() const {
+      std::lock_guard<std::mutex> lock(m_pool->m_mutex);
+      return m_pool->m_maxBuffers;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void Service::setCacheEnabled(bool enable) {
+      m_cacheEnabled = enable;
+
+      if (!m_cacheEnabled)
+        this->releaseCache();
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    bool Service::isCacheEnabled() const {
+      return m_cacheEnabled;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    size_t Service::cacheSize() const {
+      dim_lock();
+      size_t size = m_cache ? m_cache->size() : 0;
+      dim_unlock();
+      return size;
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
     void Service::sendData(const Buffer &buffer, const std::vector<int> &clientIds) {
+      this->sendData(buffer, clientIds.data(), clientIds.size());
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void Service::sendData(const Buffer &buffer, const int *clientIds, size_t nClientIds) {
       if (!this->isServiceConnected())
         throw; // TODO implement exceptions
 
-      if (clientIds.empty()) {
-        m_pService->updateService((void *)buffer.begin(), buffer.size());
-        m_pService->itsData = (void *)NullBuffer::buffer;
-        m_pService->itsSize = NullBuffer::size;
+      // keep the payload of a broadcast for new subscribers. They are served
+      // under the dim lock, it is only held to swap the cached payload
+      CachePtr oldCache;
+
+      if (0 == nClientIds && m_cacheEnabled) {
+        dim_lock();
+        oldCache = this->replaceCache(buffer);
+
+        if (m_cache) {
+          m_pService->itsData = (void *)m_cache->begin();
+          m_pService->itsSize = m_cache->size();
+        } else {
+          m_pService->itsData = (void *)NullBuffer::buffer;
+          m_pService->itsSize = NullBuffer::size;
+        }
+
+        dim_unlock();
+      }
+
+      // the update copies the payload for the clients, without the dim lock
+      // and without changing what new subscribers are served
+      ClientIdList clientIdList(clientIds, nClientIds);
+      m_pService->copyUpdateService((void *)buffer.begin(), buffer.size(), clientIdList.ids());
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void *Service::acquireBuffer(size_t size, bool wait) {
+      if (m_pAcquired)
+        throw std::runtime_error("Service::acquire(): service '" + m_name + "' has a buffer not committed");
+
+      PooledBuffer *pBuffer = nullptr;
+
+      {
+        std::unique_lock<std::mutex> lock(m_pool->m_mutex);
+
+        while (true) {
+          auto &freeBuffers(m_pool->m_freeBuffers);
+
+          if (!freeBuffers.empty()) {
+            // prefer a buffer large enough
+            auto iter = std::find_if(freeBuffers.begin(), freeBuffers.end(),
+                                     [size](PooledBuffer *pFree) { return pFree->m_capacity >= size; });
+
+            if (iter == freeBuffers.end())
+              iter = freeBuffers.end() - 1;
+
+            pBuffer = *iter;
+            freeBuffers.erase(iter);
+            break;
+          }
+
+          if (m_pool->m_nBuffers < m_pool->m_maxBuffers) {
+            pBuffer = new PooledBuffer();
+            pBuffer->m_pool = m_pool;
+            m_pool->m_nBuffers++;
+            break;
+          }
+
+          if (!wait)
+            return nullptr;
+
+          m_pool->m_condition.wait(lock);
+        }
+      }
+
+      if (pBuffer->m_capacity < size || !pBuffer->m_data) {
+        pBuffer->m_data.reset(new char[size ? size : 1]);
+        pBuffer->m_capacity = size;
+      }
+
+      pBuffer->m_size = size;
+      m_pAcquired = pBuffer;
+
+      return pBuffer->m_data.get();
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void Service::commitBuffer(const int *clientIds, size_t nClientIds) {
+      PooledBuffer *pBuffer = m_pAcquired;
+
+      if (!pBuffer)
+        throw std::runtime_error("Service::commit(): service '" + m_name + "' has no buffer acquired");
+
+      m_pAcquired = nullptr;
+
+      if (!this->isServiceConnected()) {
+        Service::releaseBuffer(pBuffer);
+        throw std::runtime_error("Service::commit(): service '" + m_name + "' not connected");
+      }
+
+      // the cache keeps a copy for new subscribers, the buffer goes back to the pool
+      CachePtr oldCache;
+
+      if (0 == nClientIds && m_cacheEnabled) {
+        Buffer pooledView;
+        pooledView.adopt(pBuffer->m_data.get(), pBuffer->m_size);
+        dim_lock();
+        oldCache = this->replaceCache(pooledView);
+
+        if (m_cache) {
+          m_pService->itsData = (void *)m_cache->begin();
+          m_pService->itsSize = m_cache->size();
+        } else {
+          m_pService->itsData = (void *)NullBuffer::buffer;
+          m_pService->itsSize = NullBuffer::size;
+        }
+
+        dim_unlock();
+      }
+
+      // not under the dim lock: the client writes are done after releasing it
+      ClientIdList clientIdList(clientIds, nClientIds);
+      m_pService->loanUpdateService(pBuffer->m_data.get(), pBuffer->m_size, clientIdList.ids(),
+                                    &Service::releaseBuffer, pBuffer);
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    void Service::releaseBuffer(void *pBuffer) {
+      PooledBuffer *pPooled = static_cast<PooledBuffer *>(pBuffer);
+      BufferPoolPtr pool = pPooled->m_pool;
+      std::lock_guard<std::mutex> lock(pool->m_mutex);
+
+      if (pool->m_closed || pool->m_nBuffers > pool->m_maxBuffers) {
+        pool->m_nBuffers--;
+        delete pPooled;
+        return;
+      }
+
+      pool->m_freeBuffers.push_back(pPooled);
+      pool->m_condition.notify_one();
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    Service::CachePtr Service::replaceCache(const Buffer &buffer) {
+      CachePtr cache;
+      size_t oldSize = m_cache ? m_cache->size() : 0;
+
+      // the buffers built by send() own their data: share it instead of copying
+      if (m_pServer->reserveCache(buffer.size(), oldSize)) {
+        cache = std::make_shared<const Buffer>(buffer.retain());
       } else {
-        std::vector<int> clientIdList(clientIds);
+        // does not fit in the server cache, drop the previous payload too
+        m_pServer->releaseCache(oldSize);
+      }
+
+      m_cache.swap(cache);
+      return cache;
+    }
 
-        if (clientIdList.back() != 0)
-          clientIdList.push_back(0);
+    //-------------------------------------------------------------------------------------------------
+
+    void Service::releaseCache() {
+      CachePtr cache;
+      dim_lock();
 
-        int *clientIdsArray = &clientIdList[0];
-        m_pService->selectiveUpdateService((void *)buffer.begin(), buffer.size(), clientIdsArray);
-        m_pService->itsData = (void *)NullBuffer::buffer;
-        m_pService->itsSize = NullBuffer::size;
+      if (m_cache) {
+        m_pServer->releaseCache(m_cache->size());
+        cache.swap(m_cache);
+
+        if (this->isServiceConnected()) {
+          m_pService->itsData = (void *)NullBuffer::buffer;
+          m_pService->itsSize = NullBuffer::size;
+        }
       }
+
+      dim_unlock();
     }
   }
 }
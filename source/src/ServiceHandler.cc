@@ -70,6 +70,17 @@ namespace dqm4hep {
 
     //-------------------------------------------------------------------------------------------------
 
+    ServiceHandler::ServiceInfo::~ServiceInfo() {
+      // as for the directory subscriptions, an update arriving once this
+      // destructor has run would reach DimInfo::infoHandler() instead
+      if (0 != this->itsId) {
+        dic_release_service(this->itsId);
+        this->itsId = 0;
+      }
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
     void ServiceHandler::ServiceInfo::infoHandler() {
       char *data = (char *)this->getData();
       int size = this->getSize();